@@ -10,18 +10,25 @@
  * (C)2020 Michael Stickel
  */
 
+#define _GNU_SOURCE
 #include <linux/dmx512/dmx512frame.h>
 #include <linux/dmx512/dmx512_ioctls.h>
 
 #include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
@@ -39,14 +46,57 @@
 
 
 
-enum { MAX_FD_WATCHERS = 256 };
-static struct dmx512_cuse_fdwatcher g_fdwatchers[MAX_FD_WATCHERS];
-static int g_num_fdwatchers = 0;
+/*
+ * An event loop with an epoll set of the fds it watches. Every card has
+ * a loop, served by a thread of its own, so the state of a card is only
+ * touched by that thread and a slow sendFrame does not hold up the other
+ * cards. The main thread serves g_main_loop, it waits for the signals
+ * and, if fuse runs single threaded, serves the loops of all cards.
+ */
+struct dmx512_cuse_loop
+{
+    int       epollfd;
+    int       wakefd;  // eventfd, written to make the loop check run
+    int       run;
+    int       cpu;     // the cpu the thread is pinned to, -1 if it is not
+    int       has_thread;
+    pthread_t thread;
+};
+
+/*
+ * The watchers of all loops, kept in a table indexed by the fd. A watcher
+ * without callback is unused. The loops look up their watchers while
+ * other threads add or remove theirs, so the table has a lock.
+ */
+struct dmx512_cuse_fdwatch
+{
+    struct dmx512_cuse_fdwatcher w;
+    struct dmx512_cuse_loop *    loop;
+};
+
+static pthread_mutex_t g_fdwatchers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dmx512_cuse_fdwatch * g_fdwatchers = 0;
+static int g_fdwatchers_size = 0;
+
+static struct dmx512_cuse_loop g_main_loop = { -1, -1, 0, -1, 0 };
+
+// the loop the thread serves right now, the fd watchers it adds are added to it.
+static __thread struct dmx512_cuse_loop * g_current_loop = 0;
 
 
 #ifdef CONFIG_RXFRAMEQUEUE
 #include <linux/dmx512/dmx512framequeue.h>
+#include <linux/dmx512/dmx512framepool.h>
+#include <linux/dmx512/dmx512txschedule.h>
+#include <linux/dmx512/dmx512rxfilter.h>
+#include <linux/dmx512/dmx512rdmroute.h>
+#include <linux/dmx512/dmx512merge.h>
 #endif
+#include <linux/dmx512/dmx512stats.h>
+#include <dmx512trace.h>
+
+// number of ports a card can have, a port filter can select.
+#define DMX512_CUSE_MAX_PORTS (1024)
 
 struct dmx512_cuse_context
 {
@@ -58,22 +108,52 @@ struct dmx512_cuse_context
     int nonblocking : 1;
 
     /*
-     * Mask of ports to monitor.
-     * Bit0 = port1, Bit1=port2,...
-     * Sums up to 64 ports. Should be enough for now.
+     * CLOCK_MONOTONIC or CLOCK_TAI, the clock of the timestamps this context sees.
+     */
+    int clock;
+
+    /*
+     * DMX512_RX_MODE_..., the generation of the last frame delivered
+     * per port for DMX512_RX_MODE_CHANGES.
      */
-    unsigned long long port_mask;
+    int rx_mode;
+    unsigned int rx_generation[DMX512_CUSE_MAX_PORTS];
 
     /*
-     * same but for transmitted frames to loop back.
+     * DMX512_FRAME_FORMAT_..., of the frames read and written.
      */
-    unsigned long long port_txmask;
+    int frame_format;
+
+    /*
+     * priority of the frames written to a merging port, see DMX512_IOCTL_SET_MERGE_PRIORITY.
+     */
+    unsigned int merge_priority;
+
+    /*
+     * wakeup moderation, see DMX512_IOCTL_SET_RX_MODERATION.
+     * rx_deadline is when the queued frames are released to the reader,
+     * 0 if they are already.
+     */
+    struct dmx512_rx_moderation moderation;
+    long long rx_deadline;
+
+    /*
+     * Match codes, frames that match none of them are not delivered.
+     */
+    struct dmx512_rxfilter rxfilter;
+
+    /*
+     * see DMX512_IOCTL_GET_STATS, the context is served by one thread,
+     * so the counters are plain.
+     */
+    struct dmx512_stats stats;
 
     /*
      * Every context (open filehandle) should have not more than
      * one active read at a time, otherwise things can go wrong.
      */
     fuse_req_t         read_req;
+    size_t             read_size;
 
     //-- !!!! we need a per context queue to store frames that come just like that.
     //-- We always write the new frame to the queue.
@@ -83,7 +163,7 @@ struct dmx512_cuse_context
     struct fuse_pollhandle *pollhandle;
 
 #ifdef CONFIG_RXFRAMEQUEUE
-    struct dmx512_framequeue  framequeue;
+    struct dmx512_framerefqueue  framequeue;
 #else
     int pollnotify;
     struct dmx512frame lastframe; // rather create a queue that holds received frames. But it should be limmited and old frames shall be thrown away.
@@ -93,10 +173,61 @@ struct dmx512_cuse_context
 // number of parallel opens possible for one device.
 #define DMX512_CUSE_CONTEXT_COUNT (32)
 
+// number of frames a context can queue before the oldest one is dropped.
+#define DMX512_CUSE_CONTEXT_QUEUE_SIZE (256)
+
+// max number of frames returned by a single read.
+#define DMX512_CUSE_READ_MAX_FRAMES (32)
+
+// frame pool of a card: frames kept unused, unused frames above which they are freed, max frames.
+#define DMX512_CUSE_FRAMEPOOL_LOW  (256)
+#define DMX512_CUSE_FRAMEPOOL_HIGH (2048)
+#define DMX512_CUSE_FRAMEPOOL_MAX  (32*32*2*4)
+
+// number of frames with a timestamp a card can hold until they are due.
+#define DMX512_CUSE_TXSCHEDULE_SIZE (1024)
+
+// number of frames other threads can hand to a card, until its thread takes them.
+#define DMX512_CUSE_RXINBOX_SIZE (256)
+
 struct dmx512_cuse_card
 {
     struct dmx512_cuse_card_config  config; // copy of the card parameter
     struct dmx512_cuse_context      contexts[DMX512_CUSE_CONTEXT_COUNT];
+
+    // the contexts that selected the received and transmitted frames of a port, bit n is context n.
+    unsigned int                    rx_subscribers[DMX512_CUSE_MAX_PORTS];
+    unsigned int                    tx_subscribers[DMX512_CUSE_MAX_PORTS];
+
+    // frames with the NULL start code forwarded between the ports of this card.
+    struct dmx512_route_info        routes[DMX512_ROUTES_MAX];
+    unsigned int                    route_count;
+
+    // the merge of the contexts and routes sending to a port, 0 if the port does not merge.
+    struct dmx512_merge *           merges[DMX512_CUSE_MAX_PORTS];
+
+    // see DMX512_IOCTL_GET_PORT_STATS.
+    struct dmx512_port_stats        port_stats[DMX512_CUSE_MAX_PORTS];
+
+    // the loop of the thread that serves the card.
+    struct dmx512_cuse_loop         loop;
+#ifdef CONFIG_RXFRAMEQUEUE
+    struct dmx512_framepool         framepool;
+    struct dmx512_txschedule        txschedule; // frames written with a timestamp
+    int                             txtimerfd;  // expires when the first frame of txschedule is due
+    struct dmx512_rdmroute          rdmroute;   // RDM requests of the contexts waiting for a response
+    int                             rdmtimerfd; // expires when the first request of rdmroute times out
+    int                             rxtimerfd;  // expires at the first rx_deadline of the contexts
+
+    // last frame with the NULL start code that differed from the one before per port and its generation.
+    struct dmx512_framequeue_entry * rx_last[DMX512_CUSE_MAX_PORTS];
+    unsigned int                     rx_generation[DMX512_CUSE_MAX_PORTS];
+
+    // frames received by other threads, e.g. looped back from another card.
+    struct dmx512_framequeue         rxinbox;
+    int                              rxinboxfd; // eventfd, written when frames are put into rxinbox
+    atomic_t                         rxinbox_dropped[DMX512_CUSE_MAX_PORTS];
+#endif
 };
 
 
@@ -107,258 +238,1135 @@ static struct dmx512_cuse_context * dmx512_cuse_context(struct dmx512_cuse_card
 
 static struct dmx512_cuse_card * dmx512_cuse_req_card(fuse_req_t);
 
+static void dmx512_cuse_context_deliver(struct dmx512_cuse_card *,
+                                        struct dmx512_cuse_context *,
+                                        const struct dmx512frame *,
+                                        struct dmx512_framequeue_entry **);
+
+static void dmx512_cuse_card_received_frame(struct dmx512_cuse_card *,
+                                            struct dmx512frame *);
+
 
 
 #ifdef CONFIG_RXFRAMEQUEUE
-struct dmx512_framequeue free_framequeue;
+// the arena all card pools allocate their frames from.
+static struct kmem_cache * dmx512_frame_cache;
 
-// get a new frame from the pool of this card.
-struct dmx512_framequeue_entry * dmx512_get_frame(struct dmx512_cuse_card * card)
+// get a new frame charged to port from the pool of this card, the caller holds the only reference.
+struct dmx512_framequeue_entry * dmx512_get_frame(struct dmx512_cuse_card * card, const int port)
 {
-    (void)card;
-    /* we may later use the port to control the per port usage of frames
-       or have some accounting. */
-    return dmx512_framequeue_get (&free_framequeue);
+    return dmx512_framepool_get(&card->framepool, port, GFP_KERNEL);
 }
 
-// return a frame to the pool of this card.
+// drop a reference to a frame and return it to the pool of this card, if it was the last one.
 void dmx512_put_frame(struct dmx512_cuse_card * card, struct dmx512_framequeue_entry * frame)
 {
     (void)card;
-    /* we may later use the port to control the per port usage of frames
-       or have some accounting. */
-    dmx512_framequeue_put(&free_framequeue, frame);
+    dmx512_framepool_put(frame);
 }
 #endif
 
+static long long dmx512_cuse_timespec_ns(const struct timespec * ts)
+{
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Timestamps are kept in CLOCK_MONOTONIC. This is the offset from
+ * CLOCK_MONOTONIC to the clock of a context.
+ */
+static long long dmx512_cuse_clock_offset(const int clock)
+{
+    struct timespec mono, other;
+    if (clock == CLOCK_MONOTONIC)
+        return 0;
+    clock_gettime(clock, &other);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return dmx512_cuse_timespec_ns(&other) - dmx512_cuse_timespec_ns(&mono);
+}
+
+// the frame is packed, so the timestamps are shifted in a copy.
+static void dmx512_cuse_shift_timestamps(struct dmx512frame * frame, const long long offset)
+{
+    struct timespec ts;
+    long long t;
+    if (frame->flags & DMX512_FLAG_TIMESTAMP)
+    {
+        ts = frame->timestamp;
+        t = dmx512_cuse_timespec_ns(&ts) + offset;
+        ts.tv_sec = t / 1000000000LL;
+        ts.tv_nsec = t % 1000000000LL;
+        frame->timestamp = ts;
+    }
+    if (frame->flags & DMX512_FLAG_BACK_TIMESTAMP)
+    {
+        ts = frame->back_timestamp;
+        t = dmx512_cuse_timespec_ns(&ts) + offset;
+        ts.tv_sec = t / 1000000000LL;
+        ts.tv_nsec = t % 1000000000LL;
+        frame->back_timestamp = ts;
+    }
+}
+
+/*
+ * Returns the frame as a context sees it. If its timestamps have to
+ * be moved to the clock of the context, they are moved in copy.
+ */
+static const struct dmx512frame * dmx512_cuse_context_frame(const long long offset,
+                                                            const struct dmx512frame * frame,
+                                                            struct dmx512frame * copy)
+{
+    if (!offset || !(frame->flags & (DMX512_FLAG_TIMESTAMP|DMX512_FLAG_BACK_TIMESTAMP)))
+        return frame;
+    memcpy(copy, frame, sizeof(*copy));
+    dmx512_cuse_shift_timestamps(copy, offset);
+    return copy;
+}
+
+void dmx512_cuse_frame_timestamp_front(struct dmx512frame *frame)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    frame->timestamp = ts;
+    frame->flags |= DMX512_FLAG_TIMESTAMP;
+    dmx512_trace_event(DMX512_TRACE_RX_BREAK, frame->port, dmx512_trace_frame_id(frame), 0);
+}
+
+void dmx512_cuse_frame_timestamp_back(struct dmx512frame *frame)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    frame->back_timestamp = ts;
+    frame->flags |= DMX512_FLAG_BACK_TIMESTAMP;
+}
+
+static long long dmx512_cuse_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
+/*
+ * The frames are handed to the card as they are written, there is no
+ * txqueue. The tx latency of a port is the time the card takes to take
+ * the frame, it is done with it when sendFrame returns.
+ */
 void dmx512_cuse_send_frame(struct dmx512_cuse_card *card,
                             struct dmx512frame *frame)
 {
     if (card && card->config.ops && card->config.ops->sendFrame)
+    {
+        const uint32_t id = dmx512_trace_frame_id(frame);
+        const long long start = dmx512_cuse_now_ns();
+        dmx512_trace_event(DMX512_TRACE_TX_SEND, frame->port, id, 0);
         card->config.ops->sendFrame(card, frame);
+        dmx512_trace_event(DMX512_TRACE_TX_COMPLETE, frame->port, id, 0);
+        if (frame->port < DMX512_CUSE_MAX_PORTS)
+        {
+            struct dmx512_port_stats * st = &card->port_stats[frame->port];
+            st->tx_frames++;
+            st->tx_bytes += frame->payload_size + 1;
+            st->tx_latency[dmx512_histogram_bucket(dmx512_cuse_now_ns() - start)]++;
+        }
+    }
 }
 
-void dmx512_cuse_handle_received_frame(struct dmx512_cuse_card *card,
-                                       struct dmx512frame *frame)
+// the index of the context, the file handle of its file.
+static unsigned int dmx512_cuse_context_index(struct dmx512_cuse_card * card,
+                                              const struct dmx512_cuse_context * ctx)
 {
-    int i;
-    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
+    return ctx - card->contexts;
+}
+
+// a frame the context reads, with the time since it has been received.
+static void dmx512_cuse_context_count_rx(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         const struct dmx512frame * frame,
+                                         const long long now)
+{
+    dmx512_trace_event(DMX512_TRACE_RX_READ, frame->port, dmx512_trace_frame_id(frame),
+                       dmx512_cuse_context_index(card, ctx));
+    ctx->stats.rx_frames++;
+    ctx->stats.rx_bytes += frame->payload_size + 1;
+    if ((frame->flags & (DMX512_FLAG_BACK_TIMESTAMP | DMX512_FLAGS_IS_TRANSMIT_FRAME)) == DMX512_FLAG_BACK_TIMESTAMP)
     {
-        struct dmx512_cuse_context * ctx = dmx512_cuse_context(card, i);
-        if (ctx->read_req && fuse_req_interrupted(ctx->read_req))
-        {
-            fuse_reply_err(ctx->read_req, EINTR);
-            ctx->read_req = 0;
-        }
+        const struct timespec ts = frame->back_timestamp;
+        ctx->stats.rx_latency[dmx512_histogram_bucket(now - dmx512_cuse_timespec_ns(&ts))]++;
+    }
+}
 
-	const unsigned long long port_mask =
-	    (frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME) ? ctx->port_txmask : ctx->port_mask;
+// a frame written to the context is accepted.
+static void dmx512_cuse_context_count_tx(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         const struct dmx512frame * frame)
+{
+    dmx512_trace_event(DMX512_TRACE_TX_WRITE, frame->port, dmx512_trace_frame_id(frame),
+                       dmx512_cuse_context_index(card, ctx));
+    ctx->stats.tx_frames++;
+    ctx->stats.tx_bytes += frame->payload_size + 1;
+}
 
-        if (ctx->in_use)
-	{
-	    if ((frame->port < 64) && (port_mask & (1<<frame->port)))
-	    {
-		// TODO: can we have a rewad_req as well as a pollhandle?
-		// if that is true, then we need to execute both paths.
-		if (ctx->read_req)
-		{
-		    fuse_reply_buf(ctx->read_req, (void*)frame, sizeof(*frame));
-		    ctx->read_req = 0;
-		}
-		else if (ctx->pollhandle)
-		{
 #ifdef CONFIG_RXFRAMEQUEUE
-		    struct dmx512_framequeue_entry * e = dmx512_get_frame(card);
-		    if (e)
-		    {
-			memcpy(&e->frame, frame, sizeof(*frame));
-			dmx512_framequeue_put(&ctx->framequeue, e);
-		    }
-#else
-		    //ctx->lastframe = *frame;
-		    memcpy(&ctx->lastframe, frame, sizeof(*frame));
-		    ctx->pollnotify++;
-#endif
-		    fuse_notify_poll(ctx->pollhandle);
-		}
-	    }
-	}
+
+// arm a timerfd for the CLOCK_MONOTONIC time next or disarm it, if next is not positive.
+static void dmx512_cuse_timer_arm(const int fd, const long long next)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (next > 0)
+    {
+        its.it_value.tv_sec = next / 1000000000LL;
+        its.it_value.tv_nsec = next % 1000000000LL;
     }
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, 0);
 }
 
-
-
-static int dmx512_cuse_free_context_index(struct dmx512_cuse_card * dmx512)
+// arm the timer for the first frame of the schedule or disarm it, if the schedule is empty.
+static void dmx512_cuse_txtimer_arm(struct dmx512_cuse_card * card)
 {
-    int i;
-    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
-        if (dmx512->contexts[i].in_use == 0)
-            return i;
-    return -1;
+    dmx512_cuse_timer_arm(card->txtimerfd, dmx512_txschedule_next(&card->txschedule));
 }
 
-static int dmx512_cuse_context_index_valid(const int index)
+// arm the timer for the first RDM request that times out or disarm it, if none waits.
+static void dmx512_cuse_rdmtimer_arm(struct dmx512_cuse_card * card)
 {
-    return index >= 0 && index < DMX512_CUSE_CONTEXT_COUNT;
+    dmx512_cuse_timer_arm(card->rdmtimerfd, dmx512_rdmroute_next(&card->rdmroute));
 }
 
-static struct dmx512_cuse_context * dmx512_cuse_context(struct dmx512_cuse_card * dmx512,
-                                                        const int index)
+static void dmx512_cuse_rdmroute_timeout(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         struct dmx512frame * timeout);
+
+// remember an RDM request of ctx, so the response is routed to it.
+// If the table is full, the request that expires first times out right away.
+static void dmx512_cuse_rdmroute_request(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         const struct dmx512frame * frame)
 {
-    if (dmx512 && dmx512_cuse_context_index_valid(index))
-        return &dmx512->contexts[index];
-    return 0;
+    const long long now = dmx512_cuse_now_ns();
+    const long long due = dmx512_frame_timestamp_ns(frame);
+    const long long expires = ((due > now) ? due : now) + DMX512_RDMROUTE_TIMEOUT_NS;
+    struct dmx512_cuse_context * evicted;
+    struct dmx512frame timeout;
+    if ((evicted = dmx512_rdmroute_evict(&card->rdmroute, &timeout)) != 0)
+        dmx512_cuse_rdmroute_timeout(card, evicted, &timeout);
+    if (dmx512_rdmroute_request(&card->rdmroute, frame, ctx, expires) &&
+        (dmx512_rdmroute_next(&card->rdmroute) == expires))
+        dmx512_cuse_rdmtimer_arm(card);
 }
 
-static struct dmx512_cuse_card * dmx512_cuse_req_card(fuse_req_t req)
+// the card took the RDM request, its response is waited for from now on.
+static void dmx512_cuse_rdmroute_sent(struct dmx512_cuse_card * card,
+                                      const struct dmx512frame * frame)
 {
-    return (struct dmx512_cuse_card *)fuse_req_userdata(req);
+    if (dmx512_rdmroute_sent(&card->rdmroute, frame, dmx512_cuse_now_ns() + DMX512_RDMROUTE_TIMEOUT_NS))
+        dmx512_cuse_rdmtimer_arm(card);
 }
 
-static void dmx512_cuse_open(fuse_req_t req,
-                             struct fuse_file_info *fi)
+// queue a frame with a timestamp, returns -1 if the schedule is full or no frame is left.
+static int dmx512_cuse_schedule_frame(struct dmx512_cuse_card * card,
+                                      const struct dmx512frame * frame)
 {
-    struct dmx512_cuse_card * dmx512 = dmx512_cuse_req_card(req);
-    const int index = dmx512 ? dmx512_cuse_free_context_index(dmx512) : -1;
-    if (index == -1)
+    const long long due = dmx512_frame_timestamp_ns(frame);
+    struct dmx512_framequeue_entry * e = dmx512_get_frame(card, frame->port);
+    int first;
+    if (!e)
+        return -1;
+    memcpy(&e->frame, frame, sizeof(*frame));
+    e->frame.flags &= ~DMX512_FLAG_TX_LATE;
+    first = dmx512_txschedule_put(&card->txschedule, e, due);
+    if (first < 0)
     {
-        fprintf(stderr, "no free context\n");
-        fuse_reply_err(req, ENOMEM);
-        return;
+        dmx512_put_frame(card, e);
+        return -1;
     }
-    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512, index);
-    bzero(ctx, sizeof (struct dmx512_cuse_context));
-    ctx->in_use = 1;
-    ctx->port_mask = 0; // no port selected // 0xffffffffffffffff; // -1
-    ctx->nonblocking = (fi->flags & O_NONBLOCK) ? 1 : 0;
-#ifdef CONFIG_RXFRAMEQUEUE
-    dmx512_framequeue_init(&ctx->framequeue);
-#endif
-    printf ("context%d activated %s\n",
-	    index, (ctx->nonblocking ? "nonblocking" : "blocking"));
-    fi->fh = index;
-    fuse_reply_open(req, fi);
+    if (first)
+        dmx512_cuse_txtimer_arm(card);
+    return 0;
 }
+#endif
 
-static void dmx512_cuse_release (fuse_req_t req,
-                                 struct fuse_file_info *fi)
+// send a frame to the card and loop it back to the contexts that monitor transmitted frames.
+static void dmx512_cuse_transmit_frame(struct dmx512_cuse_card * card,
+                                       struct dmx512frame * frame)
 {
-    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
-    if (!ctx)
-    {
-        fuse_reply_err(req, EINVAL);
-        return;
-    }
-    ctx->in_use = 0;
-    ctx->port_mask = 0;
+    frame->flags |= DMX512_FLAGS_IS_TRANSMIT_FRAME;
+    dmx512_cuse_send_frame(card, frame);
 #ifdef CONFIG_RXFRAMEQUEUE
-    dmx512_framequeue_cleanup(&ctx->framequeue);
+    if (dmx512_rdmroute_is_request(frame))
+        dmx512_cuse_rdmroute_sent(card, frame);
 #endif
-    printf ("context deactivated\n");
-    fuse_reply_err(req, 0);
+    dmx512_cuse_card_received_frame(card, frame);
 }
 
+/*
+ * Merge a frame with the NULL start code, written by owner, into the
+ * port it is send to and transmit the merged frame. Returns 0 if the port
+ * does not merge and the frame is to be send as is, 1 if the frame was
+ * merged and -1 if the port has no room for another source.
+ */
+static int dmx512_cuse_merge_frame(struct dmx512_cuse_card * card,
+                                   const unsigned long owner,
+                                   const unsigned int priority,
+                                   const struct dmx512frame * frame)
+{
+    struct dmx512_merge * m = (frame->port < DMX512_CUSE_MAX_PORTS) ? card->merges[frame->port] : 0;
+    struct dmx512frame merged;
+    if (!m || (frame->startcode != 0))
+        return 0;
+    if (dmx512_merge_put(m, owner, priority, frame, dmx512_cuse_now_ns()) < 0)
+        return -1;
+    // the card has no refresh, so the merged frame is send for every input.
+    memcpy(&merged, frame, sizeof(merged));
+    dmx512_merge_output(m, &merged);
+    dmx512_cuse_transmit_frame(card, &merged);
+    return 1;
+}
 
-static void dmx512_cuse_read(fuse_req_t req,
-                             size_t size,
-                             off_t  off,
-                             struct fuse_file_info *fi)
+// the context is closed, it is no longer a source of any merge.
+static void dmx512_cuse_merge_forget(struct dmx512_cuse_card * card,
+                                     struct dmx512_cuse_context * ctx)
 {
-    if (!fi)
+    unsigned int port;
+    for (port = 0; port < DMX512_CUSE_MAX_PORTS; ++port)
     {
-        printf("dmx512_cuse_read: fi=%p\n", fi);
-        fuse_reply_err(req, EINVAL);
-        return;
+        struct dmx512frame merged;
+        if (!card->merges[port] ||
+            !dmx512_merge_forget(card->merges[port], (unsigned long)ctx, dmx512_cuse_now_ns()))
+            continue;
+        memset(&merged, 0, sizeof(merged));
+        merged.port = port;
+        dmx512_merge_output(card->merges[port], &merged);
+        dmx512_cuse_transmit_frame(card, &merged);
     }
+}
 
-    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
-    if (!ctx)
+#ifdef CONFIG_RXFRAMEQUEUE
+// release all frames of the schedule that are due.
+static void dmx512_cuse_txtimer_callback(int fd, void * user)
+{
+    struct dmx512_cuse_card * card = (struct dmx512_cuse_card *)user;
+    struct dmx512_framequeue_entry * e;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("txtimer");
+    while ((e = dmx512_txschedule_get_due(&card->txschedule, dmx512_cuse_now_ns())) != 0)
     {
-        fprintf(stderr, "dmx512_cuse_read fi is NULL: size:%lu off:%lu\n", size, off);
-        fuse_reply_err(req, EINVAL);
-        return;
+        if ((e->frame.flags & DMX512_FLAG_TX_LATE) && (e->frame.port < DMX512_CUSE_MAX_PORTS))
+            card->port_stats[e->frame.port].tx_late++;
+        dmx512_cuse_transmit_frame(card, &e->frame);
+        dmx512_put_frame(card, e);
     }
+    dmx512_cuse_txtimer_arm(card);
+}
 
+// hand the timeout frame of a request to its context.
+static void dmx512_cuse_rdmroute_timeout(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         struct dmx512frame * timeout)
+{
+    struct dmx512_framequeue_entry * e = 0;
+    dmx512_cuse_frame_timestamp_back(timeout);
+    ctx->stats.rdm_timeouts++;
+    if (timeout->port < DMX512_CUSE_MAX_PORTS)
+        card->port_stats[timeout->port].rdm_timeouts++;
+    dmx512_cuse_context_deliver(card, ctx, timeout, &e);
+    if (e)
+        dmx512_put_frame(card, e);
+}
+
+// report the RDM requests that got no response in time to their contexts.
+static void dmx512_cuse_rdmtimer_callback(int fd, void * user)
+{
+    struct dmx512_cuse_card * card = (struct dmx512_cuse_card *)user;
+    struct dmx512_cuse_context * ctx;
+    struct dmx512frame timeout;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("rdmtimer");
+    while ((ctx = dmx512_rdmroute_expire(&card->rdmroute, dmx512_cuse_now_ns(), &timeout)) != 0)
+        dmx512_cuse_rdmroute_timeout(card, ctx, &timeout);
+    dmx512_cuse_rdmtimer_arm(card);
+}
+#endif
 
 #ifdef CONFIG_RXFRAMEQUEUE
-    if (!dmx512_framequeue_isempty(&ctx->framequeue))
+// reply to a read of size with the frames queued to the context.
+static void dmx512_cuse_reply_frames(struct dmx512_cuse_card * card,
+                                     struct dmx512_cuse_context * ctx,
+                                     fuse_req_t req,
+                                     const size_t size)
+{
+    const int compact = (ctx->frame_format == DMX512_FRAME_FORMAT_COMPACT);
+    if (compact)
     {
-	struct dmx512_framequeue_entry * e = dmx512_framequeue_get (&ctx->framequeue);
-	if (e)
+	/*
+	 * Compact records are a header, the slots referenced by the iov
+	 * and the padding. Records are packed while the rest of the read
+	 * can hold a record of any size.
+	 */
+	static const uint8_t padding[8];
+	struct dmx512_framequeue_entry * e[DMX512_CUSE_READ_MAX_FRAMES];
+	struct dmx512frame_compact headers[DMX512_CUSE_READ_MAX_FRAMES];
+	struct iovec iov[3 * DMX512_CUSE_READ_MAX_FRAMES];
+	const long long offset = dmx512_cuse_clock_offset(ctx->clock);
+	size_t used = 0;
+	long long now;
+	int count = 0;
+	int n = 0;
+	int i;
+	while ((count < DMX512_CUSE_READ_MAX_FRAMES) &&
+	       (size - used >= DMX512_FRAME_COMPACT_MAX_SIZE) &&
+	       ((e[count] = dmx512_framerefqueue_get (&ctx->framequeue)) != 0))
 	{
-	    fuse_reply_buf(req, (void*)(&e->frame), sizeof(e->frame));
-	    dmx512_put_frame(dmx512_cuse_req_card(req), e);
+	    const unsigned int data_size = dmx512_frame_to_compact(&e[count]->frame, &headers[count], offset);
+	    const size_t record = DMX512_FRAME_COMPACT_SIZE(e[count]->frame.payload_size);
+	    iov[n].iov_base = &headers[count];
+	    iov[n++].iov_len = sizeof(headers[count]);
+	    iov[n].iov_base = e[count]->frame.data;
+	    iov[n++].iov_len = data_size;
+	    if (record > sizeof(headers[count]) + data_size)
+	    {
+		iov[n].iov_base = (void*)padding;
+		iov[n++].iov_len = record - sizeof(headers[count]) - data_size;
+	    }
+	    used += record;
+	    ++count;
+	}
+	fuse_reply_iov(req, iov, n);
+	now = dmx512_cuse_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+	    dmx512_cuse_context_count_rx(card, ctx, &e[i]->frame, now);
+	    dmx512_put_frame(card, e[i]);
 	}
     }
-#else
-    const int data_available = ctx->lastframe.payload_size > 0;
-    if (data_available)
+    else
     {
-        fuse_reply_buf(req, (void*)(&ctx->lastframe), sizeof(ctx->lastframe));
-        bzero(&ctx->lastframe, sizeof(ctx->lastframe));
+	/*
+	 * Reply with as many whole frames as are queued and fit into
+	 * the read, the frames are not copied but referenced by the iov.
+	 */
+	struct dmx512_framequeue_entry * e[DMX512_CUSE_READ_MAX_FRAMES];
+	struct iovec iov[DMX512_CUSE_READ_MAX_FRAMES];
+	struct dmx512frame copies[ctx->clock != CLOCK_MONOTONIC ? DMX512_CUSE_READ_MAX_FRAMES : 1];
+	const long long offset = dmx512_cuse_clock_offset(ctx->clock);
+	long long now;
+	int count = 0;
+	int i;
+	while ((count < DMX512_CUSE_READ_MAX_FRAMES) &&
+	       (size >= (count + 1) * sizeof(struct dmx512frame)) &&
+	       ((e[count] = dmx512_framerefqueue_get (&ctx->framequeue)) != 0))
+	{
+	    iov[count].iov_base = (void*)dmx512_cuse_context_frame(offset, &e[count]->frame, &copies[offset ? count : 0]);
+	    iov[count].iov_len = sizeof(struct dmx512frame);
+	    ++count;
+	}
+	fuse_reply_iov(req, iov, count);
+	now = dmx512_cuse_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+	    dmx512_cuse_context_count_rx(card, ctx, &e[i]->frame, now);
+	    dmx512_put_frame(card, e[i]);
+	}
     }
-#endif
-    else // no data available
+}
+
+// release the queued frames to the reader of the context.
+static void dmx512_cuse_context_wakeup(struct dmx512_cuse_card * card,
+                                       struct dmx512_cuse_context * ctx)
+{
+    ctx->rx_deadline = 0;
+    if ((ctx->read_req || ctx->pollhandle) && !dmx512_framerefqueue_isempty(&ctx->framequeue))
+        dmx512_trace_event(DMX512_TRACE_RX_WAKEUP, DMX512_TRACE_NO_PORT, 0,
+                           dmx512_cuse_context_index(card, ctx));
+    if (ctx->read_req && !dmx512_framerefqueue_isempty(&ctx->framequeue))
     {
-        if (ctx->nonblocking)
-             fuse_reply_buf(req, 0, 0);
-        else
-        {
-            //-- the client context also holds the filters.
-            //-- only if a buffer mathing the filter is available, it is forwarded.
-            //queue_read_request(dmx512_client_context, req, size, off);
-            if (ctx->read_req)
-            {
-                // should not have two concurrent reads.
-                // ??? fuse_req_interrupted(ctx->read_req)
-                fuse_reply_err(ctx->read_req, EINTR);
-                ctx->read_req = 0; //TODO:this may be useless.
-            }
-            ctx->read_req = req;
-        }
+        dmx512_cuse_reply_frames(card, ctx, ctx->read_req, ctx->read_size);
+        ctx->read_req = 0;
     }
+    else if (ctx->pollhandle)
+        fuse_notify_poll(ctx->pollhandle);
 }
 
-static void dmx512_cuse_write(fuse_req_t req,
-                              const char *buf,
-                              size_t size,
-                              off_t off,
-                              struct fuse_file_info *fi)
+// arm the timer for the first deadline of the contexts or disarm it, if there is none.
+static void dmx512_cuse_rxtimer_arm(struct dmx512_cuse_card * card)
 {
-    if (!fi)
+    long long next = 0;
+    int i;
+    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
     {
-        fprintf(stderr, "dmx512_cuse_write fi is NULL: buf:%p size:%lu off:%lu\n", buf, size, off);
-        fuse_reply_err(req, EINVAL);
-        return;
+        const struct dmx512_cuse_context * ctx = &card->contexts[i];
+        if (ctx->in_use && ctx->rx_deadline && (!next || (ctx->rx_deadline < next)))
+            next = ctx->rx_deadline;
     }
+    dmx512_cuse_timer_arm(card->rxtimerfd, next);
+}
 
-    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
-    if (!ctx)
+// release the frames of the contexts whose deadline has passed.
+static void dmx512_cuse_rxtimer_callback(int fd, void * user)
+{
+    struct dmx512_cuse_card * card = (struct dmx512_cuse_card *)user;
+    uint64_t expirations;
+    long long now;
+    int i;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("rxtimer");
+    now = dmx512_cuse_now_ns();
+    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
     {
-        fprintf (stderr,"write: invalid context\n");
-        fuse_reply_err(req, EINVAL);
-        return;
+        struct dmx512_cuse_context * ctx = &card->contexts[i];
+        if (ctx->in_use && ctx->rx_deadline && (ctx->rx_deadline <= now))
+            dmx512_cuse_context_wakeup(card, ctx);
     }
+    dmx512_cuse_rxtimer_arm(card);
+}
 
-    struct dmx512frame * frame = (struct dmx512frame *)buf;
-    if (size < sizeof(struct dmx512frame))
+/*
+ * Queue a frame to the context, the copy *e is made if it does not exist.
+ * If the queue is full, the oldest frame is dropped.
+ */
+static void dmx512_cuse_context_queue(struct dmx512_cuse_card * card,
+                                      struct dmx512_cuse_context * ctx,
+                                      const struct dmx512frame * frame,
+                                      struct dmx512_framequeue_entry ** e)
+{
+    struct dmx512_framequeue_entry * dropped;
+    unsigned int count;
+    if (!*e)
     {
-        printf ("write: short dmx512 frame\n");
-        fuse_reply_err(req, EINVAL);
+        *e = dmx512_get_frame(card, frame->port);
+        if (*e)
+            memcpy(&(*e)->frame, frame, sizeof(*frame));
+    }
+    if (!*e)
         return;
+    dropped = dmx512_framerefqueue_put(&ctx->framequeue, *e);
+    dmx512_trace_event(DMX512_TRACE_RX_ENQUEUE, frame->port, dmx512_trace_frame_id(frame),
+                       dmx512_cuse_context_index(card, ctx));
+    if (dropped)
+    {
+        ctx->stats.rx_queue_full++;
+        dmx512_put_frame(card, dropped);
     }
-
-    frame->flags |= DMX512_FLAGS_IS_TRANSMIT_FRAME;
-
-    dmx512_cuse_send_frame(dmx512_cuse_req_card(req), frame);
-    dmx512_cuse_handle_received_frame(dmx512_cuse_req_card(req), frame);
-
-    fuse_reply_write(req, size);
+    count = dmx512_framerefqueue_count(&ctx->framequeue);
+    if (count > ctx->stats.rxqueue_high_water)
+        ctx->stats.rxqueue_high_water = count;
 }
 
-
-struct dmx512_cuse_card_config * dmx512_cuse_card_config(struct dmx512_cuse_card *card)
+/*
+ * Queue the frame to a context with a wakeup moderation. The reader is
+ * woken up once enough frames are queued, for an RDM frame, or by the
+ * rxtimer when the delay since the first frame has passed.
+ */
+static void dmx512_cuse_context_moderate(struct dmx512_cuse_card * card,
+                                         struct dmx512_cuse_context * ctx,
+                                         const struct dmx512frame * frame,
+                                         struct dmx512_framequeue_entry ** e)
+{
+    const int first = dmx512_framerefqueue_isempty(&ctx->framequeue);
+    dmx512_cuse_context_queue(card, ctx, frame, e);
+    if ((frame->flags & DMX512_FLAG_IS_RDM) || (frame->startcode == 0xCC) ||
+        (dmx512_framerefqueue_count(&ctx->framequeue) >= ctx->moderation.max_frames))
+    {
+        const int armed = (ctx->rx_deadline != 0);
+        dmx512_cuse_context_wakeup(card, ctx);
+        if (armed)
+            dmx512_cuse_rxtimer_arm(card);
+    }
+    else if (first && !dmx512_framerefqueue_isempty(&ctx->framequeue))
+    {
+        ctx->rx_deadline = dmx512_cuse_now_ns() + ctx->moderation.max_delay_us * 1000LL;
+        dmx512_cuse_rxtimer_arm(card);
+    }
+}
+#endif
+
+/*
+ * Complete the pending read of the context with the frame or queue it.
+ * *e is the copy of the frame shared by all contexts, it is made by the
+ * first context that queues the frame.
+ */
+static void dmx512_cuse_context_deliver(struct dmx512_cuse_card * card,
+                                        struct dmx512_cuse_context * ctx,
+                                        const struct dmx512frame * frame,
+                                        struct dmx512_framequeue_entry ** e)
+{
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (ctx->moderation.max_frames > 1)
+    {
+        dmx512_cuse_context_moderate(card, ctx, frame, e);
+        return;
+    }
+#endif
+    // TODO: can we have a rewad_req as well as a pollhandle?
+    // if that is true, then we need to execute both paths.
+    if (ctx->read_req && (ctx->frame_format == DMX512_FRAME_FORMAT_COMPACT))
+    {
+        static const uint8_t padding[8];
+        struct dmx512frame_compact h;
+        const unsigned int data_size =
+            dmx512_frame_to_compact(frame, &h, dmx512_cuse_clock_offset(ctx->clock));
+        const size_t record = DMX512_FRAME_COMPACT_SIZE(frame->payload_size);
+        struct iovec iov[3] = {
+            { &h, sizeof(h) },
+            { (void*)frame->data, data_size },
+            { (void*)padding, record - sizeof(h) - data_size }
+        };
+        fuse_reply_iov(ctx->read_req, iov, 3);
+        ctx->read_req = 0;
+        dmx512_cuse_context_count_rx(card, ctx, frame, dmx512_cuse_now_ns());
+    }
+    else if (ctx->read_req)
+    {
+        struct dmx512frame copy;
+        const struct dmx512frame * f =
+            dmx512_cuse_context_frame(dmx512_cuse_clock_offset(ctx->clock), frame, &copy);
+        fuse_reply_buf(ctx->read_req, (const void*)f, sizeof(*f));
+        ctx->read_req = 0;
+        dmx512_cuse_context_count_rx(card, ctx, frame, dmx512_cuse_now_ns());
+    }
+    else if (ctx->pollhandle)
+    {
+#ifdef CONFIG_RXFRAMEQUEUE
+        dmx512_cuse_context_queue(card, ctx, frame, e);
+        dmx512_trace_event(DMX512_TRACE_RX_WAKEUP, frame->port, dmx512_trace_frame_id(frame),
+                           dmx512_cuse_context_index(card, ctx));
+#else
+        //ctx->lastframe = *frame;
+        memcpy(&ctx->lastframe, frame, sizeof(*frame));
+        ctx->pollnotify++;
+#endif
+        fuse_notify_poll(ctx->pollhandle);
+    }
+    else
+        ctx->stats.rx_queue_full++; // no read is pending and nobody polls, the frame is lost.
+}
+
+/*
+ * Send a received frame with the NULL start code out on the ports
+ * the card routes its port to. Routes to other cards are not possible,
+ * as every card is served by a process of its own.
+ */
+static void dmx512_cuse_route_frame(struct dmx512_cuse_card * card,
+                                    const struct dmx512frame * frame)
+{
+    unsigned int i;
+    if ((frame->startcode != 0) || (frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME))
+        return;
+    for (i = 0; i < card->route_count; ++i)
+    {
+        const struct dmx512_route_info * r = &card->routes[i];
+        struct dmx512frame copy;
+        if (r->source_port != frame->port)
+            continue;
+        memcpy(&copy, frame, sizeof(copy));
+        if (r->slot_count)
+        {
+            unsigned int count;
+            if (frame->payload_size < r->source_slot)
+                continue;
+            count = frame->payload_size - r->source_slot + 1;
+            if (count > r->slot_count)
+                count = r->slot_count;
+            memset(copy.payload, 0, sizeof(copy.payload));
+            memcpy(&copy.data[r->dest_slot], &frame->data[r->source_slot], count);
+            copy.payload_size = r->dest_slot - 1 + count;
+        }
+        copy.port = r->dest_port;
+        // a route is a source of a merge, told apart from the contexts by the low bit.
+        if (!dmx512_cuse_merge_frame(card, ((unsigned long)r->source_port << 1) | 1,
+                                     r->priority ? r->priority : DMX512_MERGE_DEFAULT_PRIORITY, &copy))
+            dmx512_cuse_transmit_frame(card, &copy);
+    }
+}
+
+// a frame received by the card, called by the thread of the card.
+static void dmx512_cuse_card_received_frame(struct dmx512_cuse_card *card,
+                                            struct dmx512frame *frame)
+{
+    int i;
+#ifdef CONFIG_RXFRAMEQUEUE
+    /* The frame is copied once and then shared by all contexts that queue it. */
+    struct dmx512_framequeue_entry * e = 0;
+#endif
+    /* 0 for frames that are delivered to all contexts, see DMX512_RX_MODE_CHANGES. */
+    unsigned int generation = 0;
+    /* the contexts that selected the frame's port. */
+    unsigned int subscribers = 0;
+
+    if (!(frame->flags & (DMX512_FLAGS_IS_TRANSMIT_FRAME|DMX512_FLAG_BACK_TIMESTAMP)))
+        dmx512_cuse_frame_timestamp_back(frame);
+
+    if (!(frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME))
+        dmx512_trace_event(DMX512_TRACE_RX_COMPLETE, frame->port, dmx512_trace_frame_id(frame), 0);
+
+    if (!(frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME) && (frame->port < DMX512_CUSE_MAX_PORTS))
+    {
+        struct dmx512_port_stats * st = &card->port_stats[frame->port];
+        st->rx_frames++;
+        st->rx_bytes += frame->payload_size + 1;
+        if ((frame->flags & DMX512_FLAG_IS_RDM_DISC) &&
+            ((frame->flags & DMX512_FLAG_RDMCRC_INVALID) == DMX512_FLAG_RDMCRC_INVALID))
+            st->rdm_collisions++;
+    }
+
+    dmx512_cuse_route_frame(card, frame);
+
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (!(frame->flags & (DMX512_FLAGS_IS_TRANSMIT_FRAME|DMX512_FLAG_IS_RDM)) &&
+        (frame->startcode == 0) && (frame->port < DMX512_CUSE_MAX_PORTS))
+    {
+        struct dmx512_framequeue_entry * last = card->rx_last[frame->port];
+        if (!last || !dmx512_frame_data_equal(&last->frame, frame))
+        {
+            e = dmx512_get_frame(card, frame->port);
+            if (e)
+            {
+                memcpy(&e->frame, frame, sizeof(*frame));
+                card->rx_last[frame->port] = dmx512_frame_ref(e);
+                if (last)
+                    dmx512_put_frame(card, last);
+            }
+            if (++card->rx_generation[frame->port] == 0)
+                card->rx_generation[frame->port] = 1;
+        }
+        generation = card->rx_generation[frame->port];
+    }
+#endif
+
+    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
+    {
+        struct dmx512_cuse_context * ctx = dmx512_cuse_context(card, i);
+        if (ctx->read_req && fuse_req_interrupted(ctx->read_req))
+        {
+            fuse_reply_err(ctx->read_req, EINTR);
+            ctx->read_req = 0;
+        }
+    }
+
+#ifdef CONFIG_RXFRAMEQUEUE
+    /* a response to an RDM request goes only to the context that sent the request. */
+    if (!(frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME) && dmx512_rdmroute_is_response(frame))
+    {
+        struct dmx512_cuse_context * owner = dmx512_rdmroute_response(&card->rdmroute, frame);
+        if (owner)
+        {
+            dmx512_cuse_context_deliver(card, owner, frame, &e);
+            if (e)
+                dmx512_put_frame(card, e);
+            return;
+        }
+    }
+#endif
+
+    if (frame->port < DMX512_CUSE_MAX_PORTS)
+        subscribers = (frame->flags & DMX512_FLAGS_IS_TRANSMIT_FRAME) ?
+            card->tx_subscribers[frame->port] : card->rx_subscribers[frame->port];
+
+    while (subscribers)
+    {
+        struct dmx512_cuse_context * ctx = dmx512_cuse_context(card, __builtin_ctz(subscribers));
+        subscribers &= subscribers - 1;
+
+	if (dmx512_rxfilter_match(&ctx->rxfilter, frame) &&
+	    (!generation || (ctx->rx_mode != DMX512_RX_MODE_CHANGES) ||
+	     (ctx->rx_generation[frame->port] != generation)))
+	{
+	    if (generation)
+		ctx->rx_generation[frame->port] = generation;
+	    dmx512_cuse_context_deliver(card, ctx, frame, &e);
+	}
+    }
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (e)
+        dmx512_put_frame(card, e);
+#endif
+}
+
+// wake up a loop or the thread that waits on an eventfd.
+static void dmx512_cuse_eventfd_signal(const int fd)
+{
+    const uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && (errno != EAGAIN))
+        perror("dmx512_cuse_eventfd_signal");
+}
+
+static void dmx512_cuse_eventfd_clear(const int fd)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && (errno != EAGAIN))
+        perror("dmx512_cuse_eventfd_clear");
+}
+
+/*
+ * A frame is handled by the thread of its card. A driver may receive
+ * frames in another thread, e.g. the loop device loops a frame back from
+ * the card it is send on. Those are copied into the inbox of the card,
+ * a lock free queue, and its thread is woken up to take them.
+ */
+void dmx512_cuse_handle_received_frame(struct dmx512_cuse_card *card,
+                                       struct dmx512frame *frame)
+{
+#ifdef CONFIG_RXFRAMEQUEUE
+    struct dmx512_framequeue_entry * e;
+#endif
+    if (!card || !frame)
+        return;
+    if (!(frame->flags & (DMX512_FLAGS_IS_TRANSMIT_FRAME|DMX512_FLAG_BACK_TIMESTAMP)))
+        dmx512_cuse_frame_timestamp_back(frame);
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (g_current_loop != &card->loop)
+    {
+        e = dmx512_get_frame(card, frame->port);
+        if (e)
+        {
+            memcpy(&e->frame, frame, sizeof(*frame));
+            if (dmx512_framequeue_put(&card->rxinbox, e))
+            {
+                dmx512_put_frame(card, e);
+                e = 0;
+            }
+        }
+        if (!e && (frame->port < DMX512_CUSE_MAX_PORTS))
+            atomic_inc(&card->rxinbox_dropped[frame->port]);
+        dmx512_cuse_eventfd_signal(card->rxinboxfd);
+        return;
+    }
+#endif
+    dmx512_cuse_card_received_frame(card, frame);
+}
+
+#ifdef CONFIG_RXFRAMEQUEUE
+static void dmx512_cuse_rxinbox_callback(int fd, void * user)
+{
+    struct dmx512_cuse_card * card = (struct dmx512_cuse_card *)user;
+    struct dmx512_framequeue_entry * e;
+    int i;
+    dmx512_cuse_eventfd_clear(fd);
+    for (i = 0; i < DMX512_CUSE_MAX_PORTS; ++i)
+    {
+        const int dropped = atomic_read(&card->rxinbox_dropped[i]);
+        if (dropped)
+        {
+            atomic_sub(dropped, &card->rxinbox_dropped[i]);
+            card->port_stats[i].rx_no_frame += dropped;
+        }
+    }
+    while ((e = dmx512_framequeue_get(&card->rxinbox)) != 0)
+    {
+        dmx512_cuse_card_received_frame(card, &e->frame);
+        dmx512_put_frame(card, e);
+    }
+}
+#endif
+
+
+
+static int dmx512_cuse_free_context_index(struct dmx512_cuse_card * dmx512)
+{
+    int i;
+    for (i = 0; i < DMX512_CUSE_CONTEXT_COUNT; ++i)
+        if (dmx512->contexts[i].in_use == 0)
+            return i;
+    return -1;
+}
+
+static int dmx512_cuse_context_index_valid(const int index)
+{
+    return index >= 0 && index < DMX512_CUSE_CONTEXT_COUNT;
+}
+
+static struct dmx512_cuse_context * dmx512_cuse_context(struct dmx512_cuse_card * dmx512,
+                                                        const int index)
+{
+    if (dmx512 && dmx512_cuse_context_index_valid(index))
+        return &dmx512->contexts[index];
+    return 0;
+}
+
+static struct dmx512_cuse_card * dmx512_cuse_req_card(fuse_req_t req)
+{
+    return (struct dmx512_cuse_card *)fuse_req_userdata(req);
+}
+
+/*
+ * Replace the ports the context selected for a direction with the ports in bitmap.
+ * Returns EINVAL if a port is selected the card can not have.
+ */
+static int dmx512_cuse_set_ports(struct dmx512_cuse_card * card,
+                                 const int index,
+                                 const int direction,
+                                 const unsigned long long * bitmap,
+                                 const unsigned int port_count)
+{
+    unsigned int * subscribers = (direction == DMX512_PORT_BITMAP_TX) ? card->tx_subscribers : card->rx_subscribers;
+    const unsigned int bit = 1U << index;
+    unsigned int port;
+
+    for (port = DMX512_CUSE_MAX_PORTS; port < port_count; ++port)
+        if (bitmap[port / 64] & (1ULL << (port % 64)))
+            return EINVAL;
+    for (port = 0; port < DMX512_CUSE_MAX_PORTS; ++port)
+    {
+        if ((port < port_count) && (bitmap[port / 64] & (1ULL << (port % 64))))
+            subscribers[port] |= bit;
+        else
+            subscribers[port] &= ~bit;
+    }
+    return 0;
+}
+
+/*
+ * Fill the bitmap with the ports the context selected for a direction.
+ * Returns the number of ports needed to hold all of them.
+ */
+static unsigned int dmx512_cuse_get_ports(struct dmx512_cuse_card * card,
+                                          const int index,
+                                          const int direction,
+                                          unsigned long long * bitmap,
+                                          const unsigned int port_count)
+{
+    const unsigned int * subscribers = (direction == DMX512_PORT_BITMAP_TX) ? card->tx_subscribers : card->rx_subscribers;
+    const unsigned int bit = 1U << index;
+    unsigned int needed = 0;
+    unsigned int port;
+
+    if (bitmap)
+        memset(bitmap, 0, ((port_count + 63) / 64) * sizeof(*bitmap));
+    for (port = 0; port < DMX512_CUSE_MAX_PORTS; ++port)
+    {
+        if (!(subscribers[port] & bit))
+            continue;
+        if (bitmap && (port < port_count))
+            bitmap[port / 64] |= 1ULL << (port % 64);
+        needed = port + 1;
+    }
+    return needed;
+}
+
+static void dmx512_cuse_open(fuse_req_t req,
+                             struct fuse_file_info *fi)
+{
+    struct dmx512_cuse_card * dmx512 = dmx512_cuse_req_card(req);
+    const int index = dmx512 ? dmx512_cuse_free_context_index(dmx512) : -1;
+    if (index == -1)
+    {
+        fprintf(stderr, "no free context\n");
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512, index);
+    bzero(ctx, sizeof (struct dmx512_cuse_context));
+    ctx->in_use = 1; // no port selected
+    ctx->clock = CLOCK_MONOTONIC;
+    ctx->merge_priority = DMX512_MERGE_DEFAULT_PRIORITY;
+    ctx->nonblocking = (fi->flags & O_NONBLOCK) ? 1 : 0;
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (dmx512_framerefqueue_init(&ctx->framequeue, DMX512_CUSE_CONTEXT_QUEUE_SIZE))
+    {
+        ctx->in_use = 0;
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+#endif
+    printf ("context%d activated %s\n",
+	    index, (ctx->nonblocking ? "nonblocking" : "blocking"));
+    fi->fh = index;
+    fuse_reply_open(req, fi);
+}
+
+static void dmx512_cuse_release (fuse_req_t req,
+                                 struct fuse_file_info *fi)
+{
+    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
+    if (!ctx)
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    ctx->in_use = 0;
+    dmx512_cuse_set_ports(dmx512_cuse_req_card(req), fi->fh, DMX512_PORT_BITMAP_RX, 0, 0);
+    dmx512_cuse_set_ports(dmx512_cuse_req_card(req), fi->fh, DMX512_PORT_BITMAP_TX, 0, 0);
+    while (ctx->rxfilter.count)
+        dmx512_rxfilter_free(ctx->rxfilter.codes[--ctx->rxfilter.count]);
+    dmx512_cuse_merge_forget(dmx512_cuse_req_card(req), ctx);
+#ifdef CONFIG_RXFRAMEQUEUE
+    dmx512_rdmroute_forget(&dmx512_cuse_req_card(req)->rdmroute, ctx);
+    struct dmx512_framequeue_entry * e;
+    while ((e = dmx512_framerefqueue_get(&ctx->framequeue)) != 0)
+        dmx512_put_frame(dmx512_cuse_req_card(req), e);
+    dmx512_framerefqueue_cleanup(&ctx->framequeue);
+#endif
+    printf ("context deactivated\n");
+    fuse_reply_err(req, 0);
+}
+
+
+static void dmx512_cuse_read(fuse_req_t req,
+                             size_t size,
+                             off_t  off,
+                             struct fuse_file_info *fi)
+{
+    if (!fi)
+    {
+        printf("dmx512_cuse_read: fi=%p\n", fi);
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
+    if (!ctx)
+    {
+        fprintf(stderr, "dmx512_cuse_read fi is NULL: size:%lu off:%lu\n", size, off);
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    const int compact = (ctx->frame_format == DMX512_FRAME_FORMAT_COMPACT);
+    const size_t record_size = compact ? DMX512_FRAME_COMPACT_MAX_SIZE : sizeof(struct dmx512frame);
+    if (size < record_size)
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+#ifdef CONFIG_RXFRAMEQUEUE
+    /* a blocking read waits until the moderation releases the queued frames. */
+    if (!dmx512_framerefqueue_isempty(&ctx->framequeue) && (ctx->nonblocking || !ctx->rx_deadline))
+        dmx512_cuse_reply_frames(dmx512_cuse_req_card(req), ctx, req, size);
+#else
+    const int data_available = ctx->lastframe.payload_size > 0;
+    if (data_available)
+    {
+        fuse_reply_buf(req, (void*)(&ctx->lastframe), sizeof(ctx->lastframe));
+        bzero(&ctx->lastframe, sizeof(ctx->lastframe));
+    }
+#endif
+    else // no data available
+    {
+        if (ctx->nonblocking)
+             fuse_reply_buf(req, 0, 0);
+        else
+        {
+            //-- the client context also holds the filters.
+            //-- only if a buffer mathing the filter is available, it is forwarded.
+            //queue_read_request(dmx512_client_context, req, size, off);
+            if (ctx->read_req)
+            {
+                // should not have two concurrent reads.
+                // ??? fuse_req_interrupted(ctx->read_req)
+                fuse_reply_err(ctx->read_req, EINTR);
+                ctx->read_req = 0; //TODO:this may be useless.
+            }
+            ctx->read_req = req;
+            ctx->read_size = size;
+        }
+    }
+}
+
+static void dmx512_cuse_write(fuse_req_t req,
+                              const char *buf,
+                              size_t size,
+                              off_t off,
+                              struct fuse_file_info *fi)
+{
+    if (!fi)
+    {
+        fprintf(stderr, "dmx512_cuse_write fi is NULL: buf:%p size:%lu off:%lu\n", buf, size, off);
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    struct dmx512_cuse_context * ctx = dmx512_cuse_context(dmx512_cuse_req_card(req), fi->fh);
+    if (!ctx)
+    {
+        fprintf (stderr,"write: invalid context\n");
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    const int compact = (ctx->frame_format == DMX512_FRAME_FORMAT_COMPACT);
+    const size_t header_size = compact ? sizeof(struct dmx512frame_compact) : sizeof(struct dmx512frame);
+    if (size < header_size)
+    {
+        printf ("write: short dmx512 frame\n");
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    /*
+     * send all whole frames of the buffer, a trailing partial frame is not consumed.
+     * Frames with a timestamp are held back until they are due.
+     */
+    size_t count = 0;
+    size_t record_size = 0;
+    int err = EAGAIN;
+    for (; size - count >= header_size; count += record_size)
+    {
+        struct dmx512frame * frame = (struct dmx512frame *)(buf + count);
+        struct dmx512frame unpacked;
+        record_size = sizeof(struct dmx512frame);
+        if (compact)
+        {
+            const struct dmx512frame_compact * h = (const struct dmx512frame_compact *)(buf + count);
+            record_size = DMX512_FRAME_COMPACT_SIZE(h->payload_size);
+            if (size - count < record_size)
+                break;
+            memcpy(unpacked.data, h->data, dmx512_frame_from_compact(&unpacked, h));
+            frame = &unpacked;
+        }
+        /* a merging port sends the merged frame right away, the timestamp is ignored. */
+        const int merged = dmx512_cuse_merge_frame(dmx512_cuse_req_card(req),
+                                                   (unsigned long)ctx, ctx->merge_priority, frame);
+        if (merged < 0)
+        {
+            ctx->stats.tx_refused++;
+            err = ENOSPC;
+            break;
+        }
+        if (merged)
+        {
+            dmx512_cuse_context_count_tx(dmx512_cuse_req_card(req), ctx, frame);
+            continue;
+        }
+#ifdef CONFIG_RXFRAMEQUEUE
+        /* the timestamp is in the clock of the context. */
+        const long long offset = dmx512_frame_timestamp_ns(frame) ? dmx512_cuse_clock_offset(ctx->clock) : 0;
+        if (offset)
+        {
+            const unsigned short flags = frame->flags;
+            frame->flags = DMX512_FLAG_TIMESTAMP;
+            dmx512_cuse_shift_timestamps(frame, -offset);
+            frame->flags = flags;
+        }
+        /* recorded before it is send, a loop device responds right away. */
+        if (dmx512_rdmroute_is_request(frame))
+            dmx512_cuse_rdmroute_request(dmx512_cuse_req_card(req), ctx, frame);
+        if (dmx512_frame_timestamp_ns(frame))
+        {
+            if (dmx512_cuse_schedule_frame(dmx512_cuse_req_card(req), frame))
+            {
+                ctx->stats.tx_refused++;
+                break;
+            }
+            dmx512_cuse_context_count_tx(dmx512_cuse_req_card(req), ctx, frame);
+            continue;
+        }
+#endif
+        dmx512_cuse_context_count_tx(dmx512_cuse_req_card(req), ctx, frame);
+        dmx512_cuse_transmit_frame(dmx512_cuse_req_card(req), frame);
+    }
+
+    if (count == 0)
+        fuse_reply_err(req, err);
+    else
+        fuse_reply_write(req, count);
+}
+
+
+struct dmx512_cuse_card_config * dmx512_cuse_card_config(struct dmx512_cuse_card *card)
 {
     return &card->config;
 }
@@ -391,18 +1399,116 @@ static int dmx512_port_query_info(struct dmx512_cuse_card * card,
     return EINVAL;
 }
 
-static int dmx512_port_change_info(struct dmx512_cuse_card * card,
-                                   struct dmx512_cuse_context  * ctx,
-                                   struct dmx4linux2_port_info * portinfo,
-                                   int portIndex)
+static int dmx512_port_change_info(struct dmx512_cuse_card * card,
+                                   struct dmx512_cuse_context  * ctx,
+                                   struct dmx4linux2_port_info * portinfo,
+                                   int portIndex)
+{
+    if (card && card->config.ops && card->config.ops->changePortInfo)
+        return card->config.ops->changePortInfo(card, portinfo, portIndex);
+    return EINVAL;
+}
+
+
+static void dmx512_cuse_query_card_info(struct dmx512_cuse_context * ctx,
+                                        fuse_req_t req,
+                                        void *addr,
+                                        const void *in_buf,
+                                        size_t in_bufsz,
+                                        size_t out_bufsz)
+{
+    struct dmx512_cuse_card * dmx512 = dmx512_cuse_req_card(req);
+
+    const struct dmx4linux2_card_info * ci;
+    const struct dmx4linux2_key_value_tuple *tuples_in;
+    struct iovec in_iov[2], out_iov[2], iov[2];
+
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(*ci);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        return;
+    }
+    ci = in_buf;
+    in_buf += sizeof(*ci);
+    in_bufsz -= sizeof(*ci);
+    tuples_in = in_buf;
+    in_iov[1].iov_base = ci->tuples;
+    in_iov[1].iov_len = ci->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    out_iov[0].iov_base = addr;
+    out_iov[0].iov_len = sizeof(struct dmx4linux2_card_info) - sizeof(void*);
+    out_iov[1].iov_base = ci->tuples;
+    out_iov[1].iov_len = ci->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    if (!out_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, ci->tuples ? 2 : 1, out_iov, ci->tuples ? 2 : 1);
+        return;
+    }
+
+    struct dmx4linux2_key_value_tuple *tuples = ci->tuples ? malloc(out_iov[1].iov_len) : 0;
+    if (tuples)
+        memcpy (tuples, tuples_in, out_iov[1].iov_len);
+    struct dmx4linux2_card_info card_out = *ci;
+    card_out.tuples = tuples;
+
+    if (dmx512_card_query_info(dmx512, ctx, &card_out) != 0)
+        fuse_reply_err(req, EINVAL);
+    else
+    {
+        iov[0].iov_base = &card_out;
+        iov[0].iov_len = sizeof(*ci) - sizeof(void*);
+        iov[1].iov_base = tuples;
+        iov[1].iov_len = out_iov[1].iov_len;
+        fuse_reply_ioctl_iov(req, 0, iov, ci->tuples ? 2 : 1);
+    }
+    if (tuples)
+        free(tuples);
+}
+
+
+static void dmx512_cuse_change_card_info(struct dmx512_cuse_context * ctx,
+                                         fuse_req_t req,
+                                         void *addr,
+                                         const void *in_buf,
+                                         size_t in_bufsz,
+                                         size_t out_bufsz)
 {
-    if (card && card->config.ops && card->config.ops->changePortInfo)
-        return card->config.ops->changePortInfo(card, portinfo, portIndex);
-    return EINVAL;
-}
+    struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
+    struct dmx4linux2_card_info ci;
+    struct iovec in_iov[2];
+
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(ci);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        return;
+    }
+    ci = *((const struct dmx4linux2_card_info*)in_buf);
+    in_buf += sizeof(ci);
+    in_bufsz -= sizeof(ci);
+    in_iov[1].iov_base = ci.tuples;
+    in_iov[1].iov_len = ci.tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    if ((ci.tuple_count > 0) && !in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+        return;
+    }
+    ci.tuples = (struct dmx4linux2_key_value_tuple *)in_buf;
 
+    if (dmx512_card_change_info(card,
+                                ctx,
+                                &ci))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
 
-static void dmx512_cuse_query_card_info(struct dmx512_cuse_context * ctx,
+    fuse_reply_ioctl(req, 0, 0, 0);
+}
+
+static void dmx512_cuse_query_port_info(struct dmx512_cuse_context * ctx,
                                         fuse_req_t req,
                                         void *addr,
                                         const void *in_buf,
@@ -411,55 +1517,54 @@ static void dmx512_cuse_query_card_info(struct dmx512_cuse_context * ctx,
 {
     struct dmx512_cuse_card * dmx512 = dmx512_cuse_req_card(req);
 
-    const struct dmx4linux2_card_info * ci;
+    const struct dmx4linux2_port_info * pi;
     const struct dmx4linux2_key_value_tuple *tuples_in;
     struct iovec in_iov[2], out_iov[2], iov[2];
 
     in_iov[0].iov_base = addr;
-    in_iov[0].iov_len = sizeof(*ci);
+    in_iov[0].iov_len = sizeof(*pi);
     if (!in_bufsz)
     {
         fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
         return;
     }
-    ci = in_buf;
-    in_buf += sizeof(*ci);
-    in_bufsz -= sizeof(*ci);
+    pi = in_buf;
+    in_buf += sizeof(*pi);
+    in_bufsz -= sizeof(*pi);
     tuples_in = in_buf;
-    in_iov[1].iov_base = ci->tuples;
-    in_iov[1].iov_len = ci->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    in_iov[1].iov_base = pi->tuples;
+    in_iov[1].iov_len = pi->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
     out_iov[0].iov_base = addr;
     out_iov[0].iov_len = sizeof(struct dmx4linux2_card_info) - sizeof(void*);
-    out_iov[1].iov_base = ci->tuples;
-    out_iov[1].iov_len = ci->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    out_iov[1].iov_base = pi->tuples;
+    out_iov[1].iov_len = pi->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
     if (!out_bufsz)
     {
-        fuse_reply_ioctl_retry(req, in_iov, ci->tuples ? 2 : 1, out_iov, ci->tuples ? 2 : 1);
+        fuse_reply_ioctl_retry(req, in_iov, pi->tuples ? 2 : 1, out_iov, pi->tuples ? 2 : 1);
         return;
     }
 
-    struct dmx4linux2_key_value_tuple *tuples = ci->tuples ? malloc(out_iov[1].iov_len) : 0;
+    struct dmx4linux2_key_value_tuple *tuples = pi->tuples ? malloc(out_iov[1].iov_len) : 0;
     if (tuples)
         memcpy (tuples, tuples_in, out_iov[1].iov_len);
-    struct dmx4linux2_card_info card_out = *ci;
-    card_out.tuples = tuples;
+    struct dmx4linux2_port_info port_out = *pi;
+    port_out.tuples = tuples;
 
-    if (dmx512_card_query_info(dmx512, ctx, &card_out) != 0)
+    if (dmx512_port_query_info(dmx512, ctx, &port_out, pi->port_index) != 0)
         fuse_reply_err(req, EINVAL);
     else
     {
-        iov[0].iov_base = &card_out;
-        iov[0].iov_len = sizeof(*ci) - sizeof(void*);
+        iov[0].iov_base = &port_out;
+        iov[0].iov_len = sizeof(*pi) - sizeof(void*);
         iov[1].iov_base = tuples;
         iov[1].iov_len = out_iov[1].iov_len;
-        fuse_reply_ioctl_iov(req, 0, iov, ci->tuples ? 2 : 1);
+        fuse_reply_ioctl_iov(req, 0, iov, pi->tuples ? 2 : 1);
     }
     if (tuples)
         free(tuples);
 }
 
-
-static void dmx512_cuse_change_card_info(struct dmx512_cuse_context * ctx,
+static void dmx512_cuse_change_port_info(struct dmx512_cuse_context * ctx,
                                          fuse_req_t req,
                                          void *addr,
                                          const void *in_buf,
@@ -467,135 +1572,487 @@ static void dmx512_cuse_change_card_info(struct dmx512_cuse_context * ctx,
                                          size_t out_bufsz)
 {
     struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
-    struct dmx4linux2_card_info ci;
+    struct dmx4linux2_port_info pi;
+    struct iovec in_iov[2];
+
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(pi);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        return;
+    }
+    pi = *((const struct dmx4linux2_port_info*)in_buf);
+    in_buf += sizeof(pi);
+    in_bufsz -= sizeof(pi);
+    in_iov[1].iov_base = pi.tuples;
+    in_iov[1].iov_len = pi.tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
+    if ((pi.tuple_count > 0) && !in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+        return;
+    }
+    pi.tuples = (struct dmx4linux2_key_value_tuple *)in_buf;
+
+    if (dmx512_port_change_info(card,
+                                ctx,
+                                &pi,
+                                pi.port_index))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    fuse_reply_ioctl(req, 0, 0, 0);
+}
+
+static void dmx512_cuse_set_port_bitmap(struct dmx512_cuse_context * ctx,
+                                        fuse_req_t req,
+                                        void *addr,
+                                        const void *in_buf,
+                                        size_t in_bufsz,
+                                        size_t out_bufsz,
+                                        const int index)
+{
+    struct dmx512_port_bitmap pb;
+    struct iovec in_iov[2];
+
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(pb);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        return;
+    }
+    pb = *((const struct dmx512_port_bitmap*)in_buf);
+    in_buf += sizeof(pb);
+    in_bufsz -= sizeof(pb);
+    if (((pb.direction != DMX512_PORT_BITMAP_RX) && (pb.direction != DMX512_PORT_BITMAP_TX)) ||
+        (pb.port_count > DMX512_PORT_BITMAP_MAX_PORTS))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    in_iov[1].iov_base = (void *)(uintptr_t)pb.bitmap;
+    in_iov[1].iov_len = ((pb.port_count + 63) / 64) * sizeof(unsigned long long);
+    if (in_bufsz < in_iov[1].iov_len)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+        return;
+    }
+
+    const int err = dmx512_cuse_set_ports(dmx512_cuse_req_card(req), index, pb.direction,
+                                          (const unsigned long long *)in_buf, pb.port_count);
+    if (err)
+        fuse_reply_err(req, err);
+    else
+        fuse_reply_ioctl(req, 0, 0, 0);
+}
+
+static void dmx512_cuse_get_port_bitmap(struct dmx512_cuse_context * ctx,
+                                        fuse_req_t req,
+                                        void *addr,
+                                        const void *in_buf,
+                                        size_t in_bufsz,
+                                        size_t out_bufsz,
+                                        const int index)
+{
+    struct dmx512_port_bitmap pb;
+    struct iovec in_iov[1], out_iov[2], iov[2];
+
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(pb);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, in_iov, 1);
+        return;
+    }
+    pb = *((const struct dmx512_port_bitmap*)in_buf);
+    if ((pb.direction != DMX512_PORT_BITMAP_RX) && (pb.direction != DMX512_PORT_BITMAP_TX))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    if (pb.port_count > DMX512_PORT_BITMAP_MAX_PORTS)
+        pb.port_count = DMX512_PORT_BITMAP_MAX_PORTS;
+
+    out_iov[0].iov_base = addr;
+    out_iov[0].iov_len = sizeof(pb);
+    out_iov[1].iov_base = (void *)(uintptr_t)pb.bitmap;
+    out_iov[1].iov_len = pb.bitmap ? ((pb.port_count + 63) / 64) * sizeof(unsigned long long) : 0;
+    if (out_bufsz < out_iov[0].iov_len + out_iov[1].iov_len)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, out_iov, out_iov[1].iov_len ? 2 : 1);
+        return;
+    }
+
+    unsigned long long * bitmap = out_iov[1].iov_len ? malloc(out_iov[1].iov_len) : 0;
+    if (out_iov[1].iov_len && !bitmap)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    pb.port_count = dmx512_cuse_get_ports(dmx512_cuse_req_card(req), index, pb.direction, bitmap, pb.port_count);
+    iov[0].iov_base = &pb;
+    iov[0].iov_len = sizeof(pb);
+    iov[1].iov_base = bitmap;
+    iov[1].iov_len = out_iov[1].iov_len;
+    fuse_reply_ioctl_iov(req, 0, iov, bitmap ? 2 : 1);
+    free(bitmap);
+}
+
+static void dmx512_cuse_set_rx_match_filter(struct dmx512_cuse_context * ctx,
+                                             fuse_req_t req,
+                                             void *addr,
+                                             const void *in_buf,
+                                             size_t in_bufsz,
+                                             size_t out_bufsz)
+{
+    struct dmx512_rxfilter_info info;
+    struct dmx512_rxfilter_code * code;
+    struct dmx512_rxfilter_code * old;
     struct iovec in_iov[2];
 
-    in_iov[0].iov_base = addr;
-    in_iov[0].iov_len = sizeof(ci);
-    if (!in_bufsz)
+    in_iov[0].iov_base = addr;
+    in_iov[0].iov_len = sizeof(info);
+    if (!in_bufsz)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        return;
+    }
+    info = *((const struct dmx512_rxfilter_info*)in_buf);
+    in_buf += sizeof(info);
+    in_bufsz -= sizeof(info);
+    if ((info.matchcode_size % sizeof(struct dmx512_matchcode_term)) ||
+        (info.matchcode_size == 0) ||
+        (info.matchcode_size > DMX512_RXFILTER_MAX_TERMS * sizeof(struct dmx512_matchcode_term)))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    in_iov[1].iov_base = (void *)(uintptr_t)info.matchcode;
+    in_iov[1].iov_len = info.matchcode_size;
+    if (in_bufsz < info.matchcode_size)
+    {
+        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+        return;
+    }
+
+    code = dmx512_rxfilter_compile((const struct dmx512_matchcode_term *)in_buf,
+                                   info.matchcode_size / sizeof(struct dmx512_matchcode_term));
+    if (!code)
+        fuse_reply_err(req, EINVAL);
+    else if (dmx512_rxfilter_set(&ctx->rxfilter, info.matchcodes_index, code, &old))
+    {
+        dmx512_rxfilter_free(code);
+        fuse_reply_err(req, (info.matchcodes_index == -1) ? ENOSPC : EINVAL);
+    }
+    else
+    {
+        dmx512_rxfilter_free(old);
+        fuse_reply_ioctl(req, 0, 0, 0);
+    }
+}
+
+static void dmx512_cuse_change_route(struct dmx512_cuse_card * card,
+                                     fuse_req_t req,
+                                     void *addr,
+                                     const void *in_buf,
+                                     size_t in_bufsz,
+                                     const int remove)
+{
+    const struct dmx512_route_info * info = in_buf;
+    const int index = in_bufsz ? info->route_index : 0;
+
+    if (!in_bufsz)
+    {
+        struct iovec iov = { addr, sizeof(*info) };
+        fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        return;
+    }
+    if (remove && (index == -1))
+        card->route_count = 0;
+    else if ((index < -1) || (index >= (int)card->route_count) || (!remove && (index == -1) && (card->route_count >= DMX512_ROUTES_MAX)))
+    {
+        fuse_reply_err(req, (index == -1) ? ENOSPC : EINVAL);
+        return;
+    }
+    else if (remove)
+    {
+        memmove(&card->routes[index], &card->routes[index+1],
+                (card->route_count - index - 1) * sizeof(card->routes[0]));
+        --card->route_count;
+    }
+    else if (info->dest_device[0])
+    {
+        fuse_reply_err(req, ENODEV);
+        return;
+    }
+    else if ((info->priority > DMX512_MERGE_MAX_PRIORITY) ||
+             (info->slot_count &&
+             (!info->source_slot || !info->dest_slot ||
+              (info->source_slot + info->slot_count > 513) ||
+              (info->dest_slot + info->slot_count > 513))))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    else
+    {
+        struct dmx512_route_info * r = &card->routes[(index == -1) ? card->route_count++ : index];
+        *r = *info;
+        if (!r->slot_count)
+            r->source_slot = r->dest_slot = 0;
+    }
+    fuse_reply_ioctl(req, 0, 0, 0);
+}
+
+static void dmx512_cuse_get_route(struct dmx512_cuse_card * card,
+                                  fuse_req_t req,
+                                  void *addr,
+                                  const void *in_buf,
+                                  size_t in_bufsz,
+                                  size_t out_bufsz)
+{
+    struct dmx512_route_info info;
+
+    if (!in_bufsz || !out_bufsz)
+    {
+        struct iovec iov = { addr, sizeof(info) };
+        fuse_reply_ioctl_retry(req, &iov, 1, &iov, 1);
+        return;
+    }
+    const int index = ((const struct dmx512_route_info *)in_buf)->route_index;
+    if ((index >= 0) && (index < (int)card->route_count))
+        info = card->routes[index];
+    else if (index == -1)
+        memset(&info, 0, sizeof(info));
+    else
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    info.route_index = index;
+    info.routes_size = card->route_count;
+    fuse_reply_ioctl(req, 0, &info, sizeof(info));
+}
+
+/*
+ * A mode of DMX512_MERGE_OFF stops the merge and forgets all sources.
+ * Changing the mode or timeout starts with no sources.
+ */
+static void dmx512_cuse_set_port_merge(struct dmx512_cuse_card * card,
+                                       fuse_req_t req,
+                                       void *addr,
+                                       const void *in_buf,
+                                       size_t in_bufsz)
+{
+    const struct dmx512_port_merge_info * info = in_buf;
+    struct dmx512_merge * merge = 0;
+
+    if (!in_bufsz)
+    {
+        struct iovec iov = { addr, sizeof(*info) };
+        fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        return;
+    }
+    if ((info->port >= DMX512_CUSE_MAX_PORTS) ||
+        ((info->mode != DMX512_MERGE_OFF) && (info->mode != DMX512_MERGE_HTP) &&
+         (info->mode != DMX512_MERGE_LTP) && (info->mode != DMX512_MERGE_PRIORITY)))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    if (info->mode != DMX512_MERGE_OFF)
+    {
+        merge = malloc(sizeof(*merge));
+        if (!merge)
+        {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        dmx512_merge_init(merge, info->mode, (long long)info->source_timeout_ms * 1000000LL);
+    }
+    free(card->merges[info->port]);
+    card->merges[info->port] = merge;
+    fuse_reply_ioctl(req, 0, 0, 0);
+}
+
+static void dmx512_cuse_get_port_merge(struct dmx512_cuse_card * card,
+                                       fuse_req_t req,
+                                       void *addr,
+                                       const void *in_buf,
+                                       size_t in_bufsz,
+                                       size_t out_bufsz)
+{
+    struct dmx512_port_merge_info info;
+
+    if (!in_bufsz || !out_bufsz)
     {
-        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        struct iovec iov = { addr, sizeof(info) };
+        fuse_reply_ioctl_retry(req, &iov, 1, &iov, 1);
         return;
     }
-    ci = *((const struct dmx4linux2_card_info*)in_buf);
-    in_buf += sizeof(ci);
-    in_bufsz -= sizeof(ci);
-    in_iov[1].iov_base = ci.tuples;
-    in_iov[1].iov_len = ci.tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
-    if ((ci.tuple_count > 0) && !in_bufsz)
+    info = *((const struct dmx512_port_merge_info *)in_buf);
+    if (info.port >= DMX512_CUSE_MAX_PORTS)
     {
-        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+        fuse_reply_err(req, EINVAL);
         return;
     }
-    ci.tuples = (struct dmx4linux2_key_value_tuple *)in_buf;
+    const struct dmx512_merge * m = card->merges[info.port];
+    info.mode = m ? m->mode : DMX512_MERGE_OFF;
+    info.source_timeout_ms = m ? m->source_timeout / 1000000LL : 0;
+    info.sources = m ? dmx512_merge_sources(m, dmx512_cuse_now_ns()) : 0;
+    fuse_reply_ioctl(req, 0, &info, sizeof(info));
+}
 
-    if (dmx512_card_change_info(card,
-                                ctx,
-                                &ci))
+/*
+ * The frames are handed to the card as they are written, so
+ * a port has no txqueue and coalesce is accepted but unused.
+ * get is 1 for DMX512_IOCTL_GET_PORT_TXQUEUE.
+ */
+static void dmx512_cuse_port_txqueue(fuse_req_t req,
+                                     const int get,
+                                     void *addr,
+                                     const void *in_buf,
+                                     size_t in_bufsz,
+                                     size_t out_bufsz)
+{
+    struct dmx512_port_txqueue_info info;
+
+    if (!in_bufsz || (!out_bufsz && get))
+    {
+        struct iovec iov = { addr, sizeof(info) };
+        if (get)
+            fuse_reply_ioctl_retry(req, &iov, 1, &iov, 1);
+        else
+            fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        return;
+    }
+    info = *((const struct dmx512_port_txqueue_info *)in_buf);
+    if (info.port >= DMX512_CUSE_MAX_PORTS)
     {
         fuse_reply_err(req, EINVAL);
         return;
     }
-
-    fuse_reply_ioctl(req, 0, 0, 0);
+    if (!get)
+    {
+        fuse_reply_ioctl(req, 0, NULL, 0);
+        return;
+    }
+    info.coalesce = 0;
+    info.size = 0;
+    info.queued = 0;
+    info.dropped = 0;
+    info.coalesced = 0;
+    fuse_reply_ioctl(req, 0, &info, sizeof(info));
 }
 
-static void dmx512_cuse_query_port_info(struct dmx512_cuse_context * ctx,
-                                        fuse_req_t req,
-                                        void *addr,
-                                        const void *in_buf,
-                                        size_t in_bufsz,
-                                        size_t out_bufsz)
+static void dmx512_cuse_get_port_stats(fuse_req_t req,
+                                       void *addr,
+                                       const void *in_buf,
+                                       size_t in_bufsz,
+                                       size_t out_bufsz)
 {
-    struct dmx512_cuse_card * dmx512 = dmx512_cuse_req_card(req);
-
-    const struct dmx4linux2_port_info * pi;
-    const struct dmx4linux2_key_value_tuple *tuples_in;
-    struct iovec in_iov[2], out_iov[2], iov[2];
+    struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
+    struct dmx512_port_stats st;
 
-    in_iov[0].iov_base = addr;
-    in_iov[0].iov_len = sizeof(*pi);
-    if (!in_bufsz)
+    if (!in_bufsz || !out_bufsz)
     {
-        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        struct iovec iov = { addr, sizeof(st) };
+        fuse_reply_ioctl_retry(req, &iov, 1, &iov, 1);
         return;
     }
-    pi = in_buf;
-    in_buf += sizeof(*pi);
-    in_bufsz -= sizeof(*pi);
-    tuples_in = in_buf;
-    in_iov[1].iov_base = pi->tuples;
-    in_iov[1].iov_len = pi->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
-    out_iov[0].iov_base = addr;
-    out_iov[0].iov_len = sizeof(struct dmx4linux2_card_info) - sizeof(void*);
-    out_iov[1].iov_base = pi->tuples;
-    out_iov[1].iov_len = pi->tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
-    if (!out_bufsz)
+    st.port = ((const struct dmx512_port_stats *)in_buf)->port;
+    if (st.port >= DMX512_CUSE_MAX_PORTS)
     {
-        fuse_reply_ioctl_retry(req, in_iov, pi->tuples ? 2 : 1, out_iov, pi->tuples ? 2 : 1);
+        fuse_reply_err(req, EINVAL);
         return;
     }
+    st = card->port_stats[st.port];
+    fuse_reply_ioctl(req, 0, &st, sizeof(st));
+}
 
-    struct dmx4linux2_key_value_tuple *tuples = pi->tuples ? malloc(out_iov[1].iov_len) : 0;
-    if (tuples)
-        memcpy (tuples, tuples_in, out_iov[1].iov_len);
-    struct dmx4linux2_port_info port_out = *pi;
-    port_out.tuples = tuples;
+static void dmx512_cuse_rem_rx_match_filter(struct dmx512_cuse_context * ctx,
+                                             fuse_req_t req,
+                                             void *addr,
+                                             const void *in_buf,
+                                             size_t in_bufsz,
+                                             size_t out_bufsz)
+{
+    const struct dmx512_rxfilter_info * info = in_buf;
+    struct dmx512_rxfilter_code * old;
 
-    if (dmx512_port_query_info(dmx512, ctx, &port_out, pi->port_index) != 0)
-        fuse_reply_err(req, EINVAL);
-    else
+    if (!in_bufsz)
     {
-        iov[0].iov_base = &port_out;
-        iov[0].iov_len = sizeof(*pi) - sizeof(void*);
-        iov[1].iov_base = tuples;
-        iov[1].iov_len = out_iov[1].iov_len;
-        fuse_reply_ioctl_iov(req, 0, iov, pi->tuples ? 2 : 1);
+        struct iovec iov = { addr, sizeof(*info) };
+        fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        return;
     }
-    if (tuples)
-        free(tuples);
+    if (info->matchcodes_index == -1)
+    {
+        while (ctx->rxfilter.count)
+            dmx512_rxfilter_free(ctx->rxfilter.codes[--ctx->rxfilter.count]);
+    }
+    else if (dmx512_rxfilter_remove(&ctx->rxfilter, info->matchcodes_index, &old))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    else
+        dmx512_rxfilter_free(old);
+    fuse_reply_ioctl(req, 0, 0, 0);
 }
 
-static void dmx512_cuse_change_port_info(struct dmx512_cuse_context * ctx,
-                                         fuse_req_t req,
-                                         void *addr,
-                                         const void *in_buf,
-                                         size_t in_bufsz,
-                                         size_t out_bufsz)
+static void dmx512_cuse_get_rx_match_filter(struct dmx512_cuse_context * ctx,
+                                             fuse_req_t req,
+                                             void *addr,
+                                             const void *in_buf,
+                                             size_t in_bufsz,
+                                             size_t out_bufsz)
 {
-    struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
-    struct dmx4linux2_port_info pi;
-    struct iovec in_iov[2];
+    struct dmx512_rxfilter_info info;
+    const struct dmx512_rxfilter_code * code = 0;
+    struct iovec in_iov[1], out_iov[2], iov[2];
+    int copy;
 
     in_iov[0].iov_base = addr;
-    in_iov[0].iov_len = sizeof(pi);
+    in_iov[0].iov_len = sizeof(info);
     if (!in_bufsz)
     {
-        fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+        fuse_reply_ioctl_retry(req, in_iov, 1, in_iov, 1);
         return;
     }
-    pi = *((const struct dmx4linux2_port_info*)in_buf);
-    in_buf += sizeof(pi);
-    in_bufsz -= sizeof(pi);
-    in_iov[1].iov_base = pi.tuples;
-    in_iov[1].iov_len = pi.tuple_count * sizeof(struct dmx4linux2_key_value_tuple);
-    if ((pi.tuple_count > 0) && !in_bufsz)
+    info = *((const struct dmx512_rxfilter_info*)in_buf);
+    if (info.matchcodes_index != -1)
     {
-        fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
-        return;
+        if ((info.matchcodes_index < 0) || (info.matchcodes_index >= (int)ctx->rxfilter.count))
+        {
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+        code = ctx->rxfilter.codes[info.matchcodes_index];
     }
-    pi.tuples = (struct dmx4linux2_key_value_tuple *)in_buf;
+    copy = code && info.matchcode &&
+        (info.matchcode_size >= code->term_count * sizeof(struct dmx512_matchcode_term));
 
-    if (dmx512_port_change_info(card,
-                                ctx,
-                                &pi,
-                                pi.port_index))
+    out_iov[0].iov_base = addr;
+    out_iov[0].iov_len = sizeof(info);
+    out_iov[1].iov_base = (void *)(uintptr_t)info.matchcode;
+    out_iov[1].iov_len = copy ? code->term_count * sizeof(struct dmx512_matchcode_term) : 0;
+    if (out_bufsz < out_iov[0].iov_len + out_iov[1].iov_len)
     {
-        fuse_reply_err(req, EINVAL);
+        fuse_reply_ioctl_retry(req, in_iov, 1, out_iov, copy ? 2 : 1);
         return;
     }
 
-    fuse_reply_ioctl(req, 0, 0, 0);
+    info.matchcodes_size = ctx->rxfilter.count;
+    info.matchcode_size = code ? code->term_count * sizeof(struct dmx512_matchcode_term) : 0;
+    iov[0].iov_base = &info;
+    iov[0].iov_len = sizeof(info);
+    iov[1].iov_base = code ? (void*)code->terms : 0;
+    iov[1].iov_len = out_iov[1].iov_len;
+    fuse_reply_ioctl_iov(req, 0, iov, copy ? 2 : 1);
 }
 
 static void dmx512_cuse_ioctl(fuse_req_t req,
@@ -630,6 +2087,7 @@ static void dmx512_cuse_ioctl(fuse_req_t req,
         break;
 
     case DMX512_IOCTL_SET_PORT_FILTER:
+    case DMX512_IOCTL_SET_PORT_TXFILTER:
         if (in_bufsz == 0)
         {
             struct iovec iov = { arg, sizeof(unsigned long long) };
@@ -638,13 +2096,16 @@ static void dmx512_cuse_ioctl(fuse_req_t req,
         else
         {
             unsigned long long value = *((unsigned long long*)in_buf);
-            printf("DMX512_IOCTL_SET_PORT_FILTER=%08llX\n", value);
-            ctx->port_mask = value;
+            printf("%s=%08llX\n", (cmd == DMX512_IOCTL_SET_PORT_FILTER) ? "DMX512_IOCTL_SET_PORT_FILTER" : "DMX512_IOCTL_SET_PORT_TXFILTER", value);
+            dmx512_cuse_set_ports(dmx512_cuse_req_card(req), fi->fh,
+                                  (cmd == DMX512_IOCTL_SET_PORT_FILTER) ? DMX512_PORT_BITMAP_RX : DMX512_PORT_BITMAP_TX,
+                                  &value, 64);
             fuse_reply_ioctl(req, 0, NULL, 0);
         }
         break;
 
     case DMX512_IOCTL_GET_PORT_FILTER:
+    case DMX512_IOCTL_GET_PORT_TXFILTER:
         if (out_bufsz == 0)
         {
             struct iovec iov = { arg, sizeof(unsigned long long) };
@@ -653,40 +2114,162 @@ static void dmx512_cuse_ioctl(fuse_req_t req,
         else
         {
             unsigned long long value = 0;
-            value = ctx->port_mask;
+            /* cmd is an int, the _IOR number has bit 31 set. */
+            dmx512_cuse_get_ports(dmx512_cuse_req_card(req), fi->fh,
+                                  ((unsigned int)cmd == DMX512_IOCTL_GET_PORT_FILTER) ? DMX512_PORT_BITMAP_RX : DMX512_PORT_BITMAP_TX,
+                                  &value, 64);
             fuse_reply_ioctl(req, 0, &value, sizeof(unsigned long long));
         }
         break;
 
-    case DMX512_IOCTL_SET_PORT_TXFILTER:
+    case DMX512_IOCTL_SET_PORT_BITMAP:
+        dmx512_cuse_set_port_bitmap(ctx, req, arg, in_buf, in_bufsz, out_bufsz, fi->fh);
+        break;
+
+    case DMX512_IOCTL_GET_PORT_BITMAP:
+        dmx512_cuse_get_port_bitmap(ctx, req, arg, in_buf, in_bufsz, out_bufsz, fi->fh);
+        break;
+
+    case DMX512_IOCTL_SET_TIMESTAMP_CLOCK:
         if (in_bufsz == 0)
         {
-            struct iovec iov = { arg, sizeof(unsigned long long) };
+            struct iovec iov = { arg, sizeof(int) };
             fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
         }
         else
         {
-            unsigned long long value = *((unsigned long long*)in_buf);
-            printf("DMX512_IOCTL_SET_PORT_TXFILTER=%08llX\n", value);
-            ctx->port_txmask = value;
-            fuse_reply_ioctl(req, 0, NULL, 0);
+            const int clock = *((const int*)in_buf);
+            if ((clock != CLOCK_MONOTONIC) && (clock != CLOCK_TAI))
+                fuse_reply_err(req, EINVAL);
+            else
+            {
+                ctx->clock = clock;
+                fuse_reply_ioctl(req, 0, NULL, 0);
+            }
         }
         break;
 
-    case DMX512_IOCTL_GET_PORT_TXFILTER:
+    case DMX512_IOCTL_GET_TIMESTAMP_CLOCK:
         if (out_bufsz == 0)
         {
-            struct iovec iov = { arg, sizeof(unsigned long long) };
+            struct iovec iov = { arg, sizeof(int) };
             fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
         }
         else
+            fuse_reply_ioctl(req, 0, &ctx->clock, sizeof(int));
+        break;
+
+    case DMX512_IOCTL_SET_RX_MODE:
+        if (in_bufsz == 0)
         {
-            unsigned long long value = 0;
-            value = ctx->port_txmask;
-            fuse_reply_ioctl(req, 0, &value, sizeof(unsigned long long));
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        }
+        else
+        {
+            const int mode = *((const int*)in_buf);
+            if ((mode != DMX512_RX_MODE_ALL) && (mode != DMX512_RX_MODE_CHANGES))
+                fuse_reply_err(req, EINVAL);
+            else
+            {
+                ctx->rx_mode = mode;
+                memset(ctx->rx_generation, 0, sizeof(ctx->rx_generation));
+                fuse_reply_ioctl(req, 0, NULL, 0);
+            }
+        }
+        break;
+
+    case DMX512_IOCTL_GET_RX_MODE:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+            fuse_reply_ioctl(req, 0, &ctx->rx_mode, sizeof(int));
+        break;
+
+    case DMX512_IOCTL_SET_FRAME_FORMAT:
+        if (in_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        }
+        else
+        {
+            const int format = *((const int*)in_buf);
+            if ((format != DMX512_FRAME_FORMAT_FULL) && (format != DMX512_FRAME_FORMAT_COMPACT))
+                fuse_reply_err(req, EINVAL);
+            else
+            {
+                ctx->frame_format = format;
+                fuse_reply_ioctl(req, 0, NULL, 0);
+            }
         }
         break;
 
+    case DMX512_IOCTL_GET_FRAME_FORMAT:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+            fuse_reply_ioctl(req, 0, &ctx->frame_format, sizeof(int));
+        break;
+
+    case DMX512_IOCTL_SET_MERGE_PRIORITY:
+        if (in_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        }
+        else
+        {
+            const int priority = *((const int*)in_buf);
+            if ((priority < 0) || (priority > DMX512_MERGE_MAX_PRIORITY))
+                fuse_reply_err(req, EINVAL);
+            else
+            {
+                ctx->merge_priority = priority;
+                fuse_reply_ioctl(req, 0, NULL, 0);
+            }
+        }
+        break;
+
+    case DMX512_IOCTL_GET_MERGE_PRIORITY:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(int) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+        {
+            const int priority = ctx->merge_priority;
+            fuse_reply_ioctl(req, 0, &priority, sizeof(int));
+        }
+        break;
+
+    case DMX512_IOCTL_SET_PORT_MERGE:
+        dmx512_cuse_set_port_merge(dmx512_cuse_req_card(req), req, arg, in_buf, in_bufsz);
+        break;
+
+    case DMX512_IOCTL_GET_PORT_MERGE:
+        dmx512_cuse_get_port_merge(dmx512_cuse_req_card(req), req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_SET_PORT_TXQUEUE:
+        dmx512_cuse_port_txqueue(req, 0, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_GET_PORT_TXQUEUE:
+        dmx512_cuse_port_txqueue(req, 1, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_GET_PORT_STATS:
+        dmx512_cuse_get_port_stats(req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
     case DMX512_IOCTL_QUERY_CARD_INFO:
         dmx512_cuse_query_card_info(ctx,
                                     req,
@@ -705,23 +2288,138 @@ static void dmx512_cuse_ioctl(fuse_req_t req,
                                      out_bufsz);
       break;
 
-    case DMX512_IOCTL_QUERY_PORT_INFO:
-        dmx512_cuse_query_port_info(ctx,
-                                    req,
-                                    arg,
-                                    in_buf,
-                                    in_bufsz,
-                                    out_bufsz);
+    case DMX512_IOCTL_QUERY_PORT_INFO:
+        dmx512_cuse_query_port_info(ctx,
+                                    req,
+                                    arg,
+                                    in_buf,
+                                    in_bufsz,
+                                    out_bufsz);
+        break;
+
+    case DMX512_IOCTL_CHANGE_PORT_INFO:
+        dmx512_cuse_change_port_info(ctx,
+                                     req,
+                                     arg,
+                                     in_buf,
+                                     in_bufsz,
+                                     out_bufsz);
+      break;
+
+    case DMX512_IOCTL_SET_RX_MATCH_FILTER:
+        dmx512_cuse_set_rx_match_filter(ctx, req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_REM_RX_MATCH_FILTER:
+        dmx512_cuse_rem_rx_match_filter(ctx, req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_GET_RX_MATCH_FILTER:
+        dmx512_cuse_get_rx_match_filter(ctx, req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+#ifdef CONFIG_RXFRAMEQUEUE
+    case DMX512_IOCTL_SET_ROUTE:
+    case DMX512_IOCTL_REM_ROUTE:
+        dmx512_cuse_change_route(dmx512_cuse_req_card(req), req, arg, in_buf, in_bufsz,
+                                 cmd == DMX512_IOCTL_REM_ROUTE);
+        break;
+
+    case DMX512_IOCTL_GET_ROUTE:
+        dmx512_cuse_get_route(dmx512_cuse_req_card(req), req, arg, in_buf, in_bufsz, out_bufsz);
+        break;
+
+    case DMX512_IOCTL_GET_FRAMEPOOL_INFO:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(struct dmx512_framepool_info) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+        {
+            struct dmx512_framepool_info info;
+            dmx512_framepool_get_info(&dmx512_cuse_req_card(req)->framepool, &info);
+            fuse_reply_ioctl(req, 0, &info, sizeof(info));
+        }
+        break;
+
+    case DMX512_IOCTL_SET_RX_MODERATION:
+        if (in_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(struct dmx512_rx_moderation) };
+            fuse_reply_ioctl_retry(req, &iov, 1, NULL, 0);
+        }
+        else
+        {
+            /* frames already queued are released to the reader. */
+            struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
+            struct dmx512_rx_moderation info = *((const struct dmx512_rx_moderation*)in_buf);
+            const unsigned int capacity = dmx512_framerefqueue_capacity(&ctx->framequeue);
+            if ((info.max_frames > 1) &&
+                ((info.max_delay_us == 0) || (info.max_delay_us > DMX512_RX_MODERATION_MAX_DELAY_US)))
+                fuse_reply_err(req, EINVAL);
+            else
+            {
+                if (info.max_frames > capacity)
+                    info.max_frames = capacity;
+                if (info.max_frames <= 1)
+                    info.max_delay_us = 0;
+                ctx->moderation = info;
+                fuse_reply_ioctl(req, 0, NULL, 0);
+                if (ctx->rx_deadline)
+                {
+                    dmx512_cuse_context_wakeup(card, ctx);
+                    dmx512_cuse_rxtimer_arm(card);
+                }
+            }
+        }
+        break;
+
+    case DMX512_IOCTL_GET_RX_MODERATION:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(struct dmx512_rx_moderation) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+            fuse_reply_ioctl(req, 0, &ctx->moderation, sizeof(ctx->moderation));
+        break;
+
+    case DMX512_IOCTL_GET_STATS:
+        if (out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(struct dmx512_stats) };
+            fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+        }
+        else
+            fuse_reply_ioctl(req, 0, &ctx->stats, sizeof(ctx->stats));
+        break;
+
+    case DMX512_IOCTL_GET_PORT_TXSCHEDULE_INFO:
+        if (in_bufsz == 0 || out_bufsz == 0)
+        {
+            struct iovec iov = { arg, sizeof(struct dmx512_port_txschedule_info) };
+            fuse_reply_ioctl_retry(req, &iov, 1, &iov, 1);
+        }
+        else
+        {
+            /* the frames of all ports of a card share one schedule. */
+            struct dmx512_cuse_card * card = dmx512_cuse_req_card(req);
+            struct dmx512_port_txschedule_info info = *((const struct dmx512_port_txschedule_info*)in_buf);
+            info.queued = card->txschedule.count;
+            info.late = atomic_read(&card->txschedule.late);
+            info.dropped = atomic_read(&card->txschedule.dropped);
+            fuse_reply_ioctl(req, 0, &info, sizeof(info));
+        }
         break;
+#endif
 
-    case DMX512_IOCTL_CHANGE_PORT_INFO:
-        dmx512_cuse_change_port_info(ctx,
-                                     req,
-                                     arg,
-                                     in_buf,
-                                     in_bufsz,
-                                     out_bufsz);
-      break;
+    case DMX512_IOCTL_ALLOCATE_DMX_BUFFERS:
+    case DMX512_IOCTL_ENQUEUE_DMX_BUFFER:
+    case DMX512_IOCTL_DEQUEUE_DMX_BUFFER:
+        // cuse does not support mmap, so there is no way to share buffers.
+        fuse_reply_err(req, ENOTTY);
+        break;
 
     default:
         fuse_reply_err(req, EINVAL);
@@ -752,7 +2450,7 @@ void dmx512_cuse_poll (fuse_req_t req,
 
     unsigned revents = 0;
 #ifdef CONFIG_RXFRAMEQUEUE
-    if (!dmx512_framequeue_isempty(&ctx->framequeue))
+    if (!dmx512_framerefqueue_isempty(&ctx->framequeue) && !ctx->rx_deadline)
 #else
     if (ctx->pollnotify > 0)
 #endif
@@ -762,9 +2460,330 @@ void dmx512_cuse_poll (fuse_req_t req,
 	--ctx->pollnotify;
 #endif
     }
+    /* a write is send to the card right away, it never blocks. */
+    revents |= POLLOUT;
     fuse_reply_poll(req, revents);
 }
 
+// a session of a card with its receive buffer, the user of its fdwatcher.
+struct dmx512_cuse_session
+{
+    struct fuse_session *session;
+    struct fuse_chan *ch;
+    size_t bufsize;
+    char *buf;
+    struct dmx512_cuse_card *card;
+};
+
+static struct dmx512_cuse_session * g_sessions = 0;
+static int g_num_sessions = 0;
+
+static int dmx512_cuse_loop_watch(struct dmx512_cuse_loop *, struct dmx512_cuse_fdwatcher *);
+
+static void dmx512_cuse_loop_stop(struct dmx512_cuse_loop * loop)
+{
+    __atomic_store_n(&loop->run, 0, __ATOMIC_RELEASE);
+    dmx512_cuse_eventfd_signal(loop->wakefd);
+}
+
+// stop the loops of all cards and the main loop.
+static void dmx512_cuse_stop(void)
+{
+    int i;
+    for (i = 0; i < g_num_sessions; ++i)
+        dmx512_cuse_loop_stop(&g_sessions[i].card->loop);
+    dmx512_cuse_loop_stop(&g_main_loop);
+}
+
+// a signal may have ended a session, then all loops stop.
+static void dmx512_cuse_check_sessions(void)
+{
+    int i;
+    for (i = 0; i < g_num_sessions; ++i)
+        if (fuse_session_exited(g_sessions[i].session))
+            dmx512_cuse_stop();
+}
+
+static void dmx512_cuse_loop_wake_callback(int fd, void * user)
+{
+    (void)user;
+    dmx512_cuse_eventfd_clear(fd);
+}
+
+static int dmx512_cuse_loop_init(struct dmx512_cuse_loop * loop, const int cpu)
+{
+    struct dmx512_cuse_fdwatcher wake;
+    loop->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->run = 1;
+    loop->cpu = cpu;
+    loop->has_thread = 0;
+    wake.fd = loop->wakefd;
+    wake.callback = dmx512_cuse_loop_wake_callback;
+    wake.user = loop;
+    if ((loop->epollfd < 0) || (loop->wakefd < 0) || dmx512_cuse_loop_watch(loop, &wake))
+    {
+        if (loop->wakefd >= 0)
+            close(loop->wakefd);
+        if (loop->epollfd >= 0)
+            close(loop->epollfd);
+        loop->wakefd = loop->epollfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void dmx512_cuse_loop_cleanup(struct dmx512_cuse_loop * loop)
+{
+    struct dmx512_cuse_fdwatcher wake = { loop->wakefd, 0, 0 };
+    if (loop->epollfd < 0)
+        return;
+    dmx512_cuse_fdwatcher_remove(&wake);
+    close(loop->wakefd);
+    close(loop->epollfd);
+    loop->wakefd = loop->epollfd = -1;
+}
+
+/*
+ * Call the watchers of the fds that are ready, waits up to timeout ms
+ * for the first one. Returns the number of ready fds or -errno.
+ */
+static int dmx512_cuse_loop_dispatch(struct dmx512_cuse_loop * loop, const int timeout)
+{
+    struct dmx512_cuse_loop * const previous = g_current_loop;
+    struct epoll_event events[64];
+    int n, i;
+
+    n = epoll_wait(loop->epollfd, events, sizeof(events) / sizeof(events[0]), timeout);
+    if (n < 0)
+        return -errno;
+    g_current_loop = loop;
+    for (i = 0; i < n; ++i)
+    {
+        /* a callback may remove the watcher of an fd that is ready as well. */
+        const int fd = events[i].data.fd;
+        struct dmx512_cuse_fdwatcher w = { -1, 0, 0 };
+        pthread_mutex_lock(&g_fdwatchers_lock);
+        if ((fd < g_fdwatchers_size) && (g_fdwatchers[fd].loop == loop))
+            w = g_fdwatchers[fd].w;
+        pthread_mutex_unlock(&g_fdwatchers_lock);
+        if (w.callback)
+            w.callback(fd, w.user);
+    }
+    g_current_loop = previous;
+    return n;
+}
+
+/*
+ * Nothing is done while no fd is ready. The sessions are checked for
+ * their end after each of their requests and when a signal, that may
+ * have ended them, interrupts the wait.
+ */
+static void dmx512_cuse_loop_run(struct dmx512_cuse_loop * loop)
+{
+    while (__atomic_load_n(&loop->run, __ATOMIC_ACQUIRE))
+    {
+        const int res = dmx512_cuse_loop_dispatch(loop, -1);
+        if (res == -EINTR)
+            dmx512_cuse_check_sessions();
+        else if (res < 0)
+        {
+            fprintf(stderr, "epoll_wait: %s\n", strerror(-res));
+            dmx512_cuse_stop();
+        }
+    }
+}
+
+// the loop of a card, watched by the main loop if fuse runs single threaded.
+static void dmx512_cuse_loop_callback(int fd, void * user)
+{
+    (void)fd;
+    dmx512_cuse_loop_dispatch((struct dmx512_cuse_loop *)user, 0);
+}
+
+static void * dmx512_cuse_loop_thread(void * arg)
+{
+    struct dmx512_cuse_loop * loop = (struct dmx512_cuse_loop *)arg;
+    if (loop->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        int err;
+        CPU_ZERO(&cpus);
+        CPU_SET(loop->cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err)
+            fprintf(stderr, "dmx512_cuse: can not pin a card to cpu %d: %s\n", loop->cpu, strerror(err));
+    }
+    dmx512_cuse_loop_run(loop);
+    return 0;
+}
+
+/*
+ * The cpu the thread of the card with the index is pinned to, taken from
+ * the comma separated list in DMX512_CUSE_CPUS. -1 if it is not pinned.
+ */
+static int dmx512_cuse_card_cpu(const int index)
+{
+    const char * s = getenv("DMX512_CUSE_CPUS");
+    int i;
+    for (i = 0; s && *s; ++i)
+    {
+        char * end;
+        const long cpu = strtol(s, &end, 0);
+        if (end == s)
+            break;
+        if (i == index)
+            return ((cpu >= 0) && (cpu < CPU_SETSIZE)) ? cpu : -1;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return -1;
+}
+
+// process one request of the session, all loops stop if the session has ended.
+static void dmx512_cuse_session_callback(int fd, void * user)
+{
+    struct dmx512_cuse_session * sd = (struct dmx512_cuse_session *)user;
+    struct fuse_chan *tmpch = sd->ch;
+    struct fuse_buf fbuf = {
+        .mem = sd->buf,
+        .size = sd->bufsize,
+    };
+    const int res = fuse_session_receive_buf(sd->session, &fbuf, &tmpch);
+    (void)fd;
+    if (res == -EINTR || res == -EAGAIN)
+        return;
+    if (res <= 0)
+    {
+        dmx512_cuse_stop();
+        return;
+    }
+    fuse_session_process_buf(sd->session, &fbuf, tmpch);
+    if (fuse_session_exited(sd->session))
+        dmx512_cuse_stop();
+}
+
+// HUP, INT or TERM stop the loops, in whatever thread they are taken.
+static void dmx512_cuse_signal(int sig)
+{
+    (void)sig;
+    dmx512_cuse_stop();
+}
+
+// start the threads of the cards, the signals are taken by the main thread.
+static int dmx512_cuse_start_threads(void)
+{
+    sigset_t all, old;
+    int res = 0;
+    int i;
+
+    /* the threads inherit the blocked signals. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < g_num_sessions; ++i)
+    {
+        struct dmx512_cuse_loop * loop = &g_sessions[i].card->loop;
+        const int err = pthread_create(&loop->thread, 0, dmx512_cuse_loop_thread, loop);
+        if (err)
+        {
+            fprintf(stderr, "dmx512_cuse: can not start the thread of card %d: %s\n",
+                    g_sessions[i].card->config.cardno, strerror(err));
+            dmx512_cuse_stop();
+            res = -1;
+            break;
+        }
+        loop->has_thread = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+    return res;
+}
+
+/*
+ * Serve the loops until a session ends. If fuse runs multi threaded,
+ * every card is served by a thread of its own and the main thread only
+ * waits for the end. Otherwise the main thread serves all cards.
+ *
+ * The signal handlers of fuse end only one session and do not wake up
+ * the loop, if a thread of a driver takes the signal, so they are
+ * replaced while the loops run.
+ */
+static int dmx512_cuse_run(const int multithreaded)
+{
+    static const int signals[] = { SIGHUP, SIGINT, SIGTERM };
+    struct sigaction sa, old_sa[sizeof(signals) / sizeof(signals[0])];
+    int res = 0;
+    int i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dmx512_cuse_signal;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < (int)(sizeof(signals) / sizeof(signals[0])); ++i)
+        sigaction(signals[i], &sa, &old_sa[i]);
+
+    g_main_loop.run = 1;
+    if (multithreaded)
+        res = dmx512_cuse_start_threads();
+    else
+    {
+        for (i = 0; !res && (i < g_num_sessions); ++i)
+        {
+            struct dmx512_cuse_loop * loop = &g_sessions[i].card->loop;
+            struct dmx512_cuse_fdwatcher w = { loop->epollfd, dmx512_cuse_loop_callback, loop };
+            res = dmx512_cuse_loop_watch(&g_main_loop, &w);
+        }
+    }
+    if (!res)
+        dmx512_cuse_loop_run(&g_main_loop);
+
+    for (i = 0; i < g_num_sessions; ++i)
+    {
+        struct dmx512_cuse_loop * loop = &g_sessions[i].card->loop;
+        struct dmx512_cuse_fdwatcher w = { loop->epollfd, 0, 0 };
+        if (loop->has_thread)
+            pthread_join(loop->thread, 0);
+        loop->has_thread = 0;
+        dmx512_cuse_fdwatcher_remove(&w);
+    }
+    for (i = 0; i < (int)(sizeof(signals) / sizeof(signals[0])); ++i)
+        sigaction(signals[i], &old_sa[i], 0);
+    return res ? -1 : 0;
+}
+
+// the loop of the card and the inbox, other threads hand frames to the card with.
+static int dmx512_cuse_card_loop_init(struct dmx512_cuse_card * card, const int cpu)
+{
+    if (dmx512_cuse_loop_init(&card->loop, cpu))
+        return -1;
+#ifdef CONFIG_RXFRAMEQUEUE
+    card->rxinboxfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct dmx512_cuse_fdwatcher rxinbox = { card->rxinboxfd, dmx512_cuse_rxinbox_callback, card };
+    if ((card->rxinboxfd < 0) ||
+        dmx512_framequeue_init(&card->rxinbox, DMX512_CUSE_RXINBOX_SIZE) ||
+        dmx512_cuse_loop_watch(&card->loop, &rxinbox))
+    {
+        if (card->rxinboxfd >= 0)
+            close(card->rxinboxfd);
+        dmx512_framequeue_cleanup(&card->rxinbox);
+        dmx512_cuse_loop_cleanup(&card->loop);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+static void dmx512_cuse_card_loop_cleanup(struct dmx512_cuse_card * card)
+{
+#ifdef CONFIG_RXFRAMEQUEUE
+    struct dmx512_cuse_fdwatcher rxinbox = { card->rxinboxfd, 0, 0 };
+    struct dmx512_framequeue_entry * e;
+    dmx512_cuse_fdwatcher_remove(&rxinbox);
+    close(card->rxinboxfd);
+    while ((e = dmx512_framequeue_get(&card->rxinbox)) != 0)
+        dmx512_put_frame(card, e);
+    dmx512_framequeue_cleanup(&card->rxinbox);
+#endif
+    dmx512_cuse_loop_cleanup(&card->loop);
+}
+
 static void dmx512_cuse_init (void *userdata,
                        struct fuse_conn_info *conn)
 {
@@ -806,6 +2825,29 @@ static void dmx512_cuse_destroy (void *userdata)
     if (card->config.ops && card->config.ops->cleanup)
         card->config.ops->cleanup (card);
 
+    for (i = 0; i < DMX512_CUSE_MAX_PORTS; ++i)
+        free(card->merges[i]);
+
+#ifdef CONFIG_RXFRAMEQUEUE
+    struct dmx512_cuse_fdwatcher txtimer = { card->txtimerfd, 0, 0 };
+    struct dmx512_framequeue_entry * e;
+    struct dmx512_cuse_fdwatcher rdmtimer = { card->rdmtimerfd, 0, 0 };
+    struct dmx512_cuse_fdwatcher rxtimer = { card->rxtimerfd, 0, 0 };
+    dmx512_cuse_fdwatcher_remove(&txtimer);
+    close(card->txtimerfd);
+    dmx512_cuse_fdwatcher_remove(&rdmtimer);
+    close(card->rdmtimerfd);
+    dmx512_cuse_fdwatcher_remove(&rxtimer);
+    close(card->rxtimerfd);
+    while ((e = dmx512_txschedule_get(&card->txschedule)) != 0)
+        dmx512_put_frame(card, e);
+    dmx512_txschedule_cleanup(&card->txschedule);
+    for (i = 0; i < DMX512_CUSE_MAX_PORTS; ++i)
+        if (card->rx_last[i])
+            dmx512_put_frame(card, card->rx_last[i]);
+#endif
+    dmx512_cuse_card_loop_cleanup(card);
+
     free(userdata);
 }
 
@@ -824,142 +2866,15 @@ static const struct cuse_lowlevel_ops cusetest_clop =
 };
 
 
-static int fuse_multisession_loop(struct fuse_session **sessions,
-                                  const int num_sessions,
-                                  struct dmx512_cuse_fdwatcher * fdwatchers,
-                                  int num_fdwatchers)
-{
-    struct fuse_session_data
-    {
-        struct fuse_session *session;
-        struct fuse_chan *ch;
-        size_t bufsize;
-        char *buf;
-    };
-
-    struct fuse_session_data sd[10];
-    {
-        int i;
-        for (i = 0; i < num_sessions; ++i)
-        {
-            struct fuse_session *se = sessions[i];
-            struct fuse_chan *ch = fuse_session_next_chan(se, NULL);
-            size_t bufsize = fuse_chan_bufsize(ch);
-            char *buf = (char *) malloc(bufsize);
-            if (!buf)
-            {
-                fprintf(stderr, "fuse: failed to allocate read buffer\n");
-                return -1;
-            }
-            sd[i].session = se;
-            sd[i].ch = ch;
-            sd[i].bufsize = bufsize;
-            sd[i].buf = buf;
-        }
-    }
-
-    {
-	int i;
-	for (i = 0; i < num_fdwatchers && g_num_fdwatchers < MAX_FD_WATCHERS; ++i)
-	    g_fdwatchers[g_num_fdwatchers++] = fdwatchers[i];
-	//for (i = 0; i < num_fdwatchers; ++i)
-	//   dmx512_cuse_add_fdwatcher(fdwatchers[i]);
-    }
-
-    unsigned int timout_counter = 0;
-    int res = 0;
-    int run = 1;
-    while (run)
-    {
-        int i;
-        for (i = 0; i < num_sessions; ++i)
-            if (fuse_session_exited(sd[i].session))
-                run = 0;
-        if (run == 0)
-            break;
-
-        int n = -1;
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        
-        for (i = 0; i < num_sessions; ++i)
-        {
-            const int fd = fuse_chan_fd(sd[i].ch);
-            FD_SET(fd, &readfds);
-            if (fd+1 > n)
-                n = fd+1;
-        }
-
-        for (i=0; i < g_num_fdwatchers; ++i)
-	{
-	    const int fd = g_fdwatchers[i].fd;
-	    if (fd != -1)
-	    {
-		FD_SET(fd, &readfds);
-		if (fd+1 > n)
-		    n = fd+1;
-	    }
-	}
-
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        const int ret = select(n, &readfds, 0, 0, &timeout);
-        if (ret == 0)
-        {
-	    printf ("timeout %d\r", timout_counter++);
-	    fflush(stdout);
-        }
-        if (ret <= 0)
-            continue;
-
-        for (i = 0; i < num_sessions; ++i)
-        {
-            struct fuse_chan *ch = sd[i].ch;
-            const int fd = fuse_chan_fd(ch);
-
-            if (FD_ISSET(fd, &readfds))
-            {
-                struct fuse_chan *tmpch = ch;
-                struct fuse_buf fbuf = {
-                    .mem = sd[i].buf,
-                    .size = sd[i].bufsize,
-                };
-                res = fuse_session_receive_buf(sd[i].session, &fbuf, &tmpch);
-                if (res == -EINTR)
-                    continue;
-                if (res <= 0)
-                {
-                    run = 0;
-                    break;
-                }
-                fuse_session_process_buf(sd[i].session, &fbuf, tmpch);
-            }
-        }
-
-        for (i=0; i < g_num_fdwatchers; ++i)
-	{
-	    const int fd = g_fdwatchers[i].fd;
-            if (FD_ISSET(fd, &readfds))
-            {
-		g_fdwatchers[i].callback(fd, g_fdwatchers[i].user);
-            }
-	}
-    }
-
-    {
-        int i;
-        for (i = 0; i < num_sessions; ++i)
-        {
-            free(sd[i].buf);
-            fuse_session_reset(sd[i].session);
-        }
-    }
-    return res < 0 ? -1 : 0;
-}
-
+/*
+ * Create the card and its session. The fds of the card are watched by
+ * the loop of the card, whose thread is pinned to cpu, if it is not -1.
+ */
 struct fuse_session *dmx512_cuse_create_session(int argc, char *argv[],
-                                                struct dmx512_cuse_card_config *card_config)
+                                                struct dmx512_cuse_card_config *card_config,
+                                                const int cpu,
+                                                struct dmx512_cuse_card **card,
+                                                int *multithreaded)
 {
     char devarg0[1024];
     const char *devarg[1] = { devarg0 };
@@ -974,13 +2889,83 @@ struct fuse_session *dmx512_cuse_create_session(int argc, char *argv[],
     struct dmx512_cuse_card * userdata = malloc(sizeof(struct dmx512_cuse_card));
     bzero(userdata, sizeof(*userdata));
     userdata->config = *card_config;
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (dmx512_framepool_init(&userdata->framepool, dmx512_frame_cache,
+                              DMX512_CUSE_FRAMEPOOL_LOW,
+                              DMX512_CUSE_FRAMEPOOL_HIGH,
+                              DMX512_CUSE_FRAMEPOOL_MAX))
+    {
+        free(userdata);
+        return NULL;
+    }
+#endif
+    if (dmx512_cuse_card_loop_init(userdata, cpu))
+    {
+#ifdef CONFIG_RXFRAMEQUEUE
+        dmx512_framepool_cleanup(&userdata->framepool);
+#endif
+        free(userdata);
+        return NULL;
+    }
+#ifdef CONFIG_RXFRAMEQUEUE
+    if (dmx512_txschedule_init(&userdata->txschedule, DMX512_CUSE_TXSCHEDULE_SIZE))
+    {
+        dmx512_cuse_card_loop_cleanup(userdata);
+        dmx512_framepool_cleanup(&userdata->framepool);
+        free(userdata);
+        return NULL;
+    }
+    userdata->txtimerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct dmx512_cuse_fdwatcher txtimer = { userdata->txtimerfd, dmx512_cuse_txtimer_callback, userdata };
+    if ((userdata->txtimerfd < 0) || dmx512_cuse_loop_watch(&userdata->loop, &txtimer))
+    {
+        if (userdata->txtimerfd >= 0)
+            close(userdata->txtimerfd);
+        dmx512_txschedule_cleanup(&userdata->txschedule);
+        dmx512_cuse_card_loop_cleanup(userdata);
+        dmx512_framepool_cleanup(&userdata->framepool);
+        free(userdata);
+        return NULL;
+    }
+    dmx512_rdmroute_init(&userdata->rdmroute);
+    userdata->rdmtimerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct dmx512_cuse_fdwatcher rdmtimer = { userdata->rdmtimerfd, dmx512_cuse_rdmtimer_callback, userdata };
+    if ((userdata->rdmtimerfd < 0) || dmx512_cuse_loop_watch(&userdata->loop, &rdmtimer))
+    {
+        if (userdata->rdmtimerfd >= 0)
+            close(userdata->rdmtimerfd);
+        dmx512_cuse_fdwatcher_remove(&txtimer);
+        close(userdata->txtimerfd);
+        dmx512_txschedule_cleanup(&userdata->txschedule);
+        dmx512_cuse_card_loop_cleanup(userdata);
+        dmx512_framepool_cleanup(&userdata->framepool);
+        free(userdata);
+        return NULL;
+    }
+    userdata->rxtimerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct dmx512_cuse_fdwatcher rxtimer = { userdata->rxtimerfd, dmx512_cuse_rxtimer_callback, userdata };
+    if ((userdata->rxtimerfd < 0) || dmx512_cuse_loop_watch(&userdata->loop, &rxtimer))
+    {
+        if (userdata->rxtimerfd >= 0)
+            close(userdata->rxtimerfd);
+        dmx512_cuse_fdwatcher_remove(&rdmtimer);
+        close(userdata->rdmtimerfd);
+        dmx512_cuse_fdwatcher_remove(&txtimer);
+        close(userdata->txtimerfd);
+        dmx512_txschedule_cleanup(&userdata->txschedule);
+        dmx512_cuse_card_loop_cleanup(userdata);
+        dmx512_framepool_cleanup(&userdata->framepool);
+        free(userdata);
+        return NULL;
+    }
+#endif
 
-    int multithreaded;
     struct fuse_session *se;
     const struct cuse_lowlevel_ops *clop = &cusetest_clop;
-    se = cuse_lowlevel_setup(argc, argv, &ci, clop, &multithreaded,
+    se = cuse_lowlevel_setup(argc, argv, &ci, clop, multithreaded,
                              userdata);
-    printf ("multithreaded=%d\n", multithreaded);
+    printf ("multithreaded=%d\n", *multithreaded);
+    *card = userdata;
     return se;
 }
 
@@ -990,69 +2975,141 @@ int dmx512_cuse_lowlevel_main(int argc, char *argv[],
                               struct dmx512_cuse_fdwatcher * fdwatchers,
                               int num_fd_watchers)
 {
+        struct dmx512_cuse_loop * first = &g_main_loop;
+        int multithreaded = 1;
+        int res = 0;
         int i;
-        struct fuse_session *sessions[num_cards];
-        int num_sessions = 0;
+
+        g_sessions = calloc(num_cards ? num_cards : 1, sizeof(*g_sessions));
+        if (!g_sessions)
+            return 1;
 
         for (i = 0; i < num_cards; ++i)
         {
-            struct fuse_session *se;
-            se = dmx512_cuse_create_session(argc, argv,
-                                            &cards[i]);
-            if (se == NULL)
-                return 1;
-            sessions[i] = se;
-            num_sessions++;
+            struct dmx512_cuse_session * sd = &g_sessions[i];
+            int session_multithreaded = 0;
+            sd->session = dmx512_cuse_create_session(argc, argv,
+                                                     &cards[i],
+                                                     dmx512_cuse_card_cpu(i),
+                                                     &sd->card,
+                                                     &session_multithreaded);
+            if (sd->session == NULL)
+            {
+                res = -1;
+                break;
+            }
+            g_num_sessions++;
+            multithreaded = multithreaded && session_multithreaded;
+
+            sd->ch = fuse_session_next_chan(sd->session, NULL);
+            sd->bufsize = fuse_chan_bufsize(sd->ch);
+            sd->buf = (char *) malloc(sd->bufsize);
+            struct dmx512_cuse_fdwatcher w = { fuse_chan_fd(sd->ch), dmx512_cuse_session_callback, sd };
+            if (!sd->buf || dmx512_cuse_loop_watch(&sd->card->loop, &w))
+            {
+                fprintf(stderr, "fuse: failed to set up session %d\n", i);
+                res = -1;
+                break;
+            }
         }
 
-        int res = fuse_multisession_loop(sessions,
-                                         num_sessions,
-                                         fdwatchers,
-                                         num_fd_watchers
-                                         );
-        for (i = 0; i < num_sessions; ++i)
+        /* the fds of the driver are watched by the loop of its first card. */
+        if (g_num_sessions)
+            first = &g_sessions[0].card->loop;
+        for (i = 0; !res && (i < num_fd_watchers); ++i)
+            if (dmx512_cuse_loop_watch(first, &fdwatchers[i]))
+                fprintf(stderr, "fuse: failed to watch fd %d\n", fdwatchers[i].fd);
+
+        if (!res)
+            res = dmx512_cuse_run(multithreaded);
+
+        for (i = 0; i < num_fd_watchers; ++i)
+            dmx512_cuse_fdwatcher_remove(&fdwatchers[i]);
+        for (i = 0; i < g_num_sessions; ++i)
         {
-            cuse_lowlevel_teardown(sessions[i]);
+            struct dmx512_cuse_session * sd = &g_sessions[i];
+            struct dmx512_cuse_fdwatcher w = { fuse_chan_fd(sd->ch), 0, 0 };
+            dmx512_cuse_fdwatcher_remove(&w);
+            free(sd->buf);
+            fuse_session_reset(sd->session);
+            cuse_lowlevel_teardown(sd->session);
         }
+        free(g_sessions);
+        g_sessions = 0;
+        g_num_sessions = 0;
 
         return (res == -1) ? 1 : 0;
 }
 
-static int dmx512_cuse_fdwatcher_find_fd(const int fd)
+// make room for the watcher of fd in the table, called with g_fdwatchers_lock held.
+static int dmx512_cuse_fdwatchers_reserve(const int fd)
 {
-    int i;
-    for (i = 0; g_num_fdwatchers < MAX_FD_WATCHERS; ++i)
-	if (g_fdwatchers[i].fd == fd)
-	    return i;
-    return -1;
+    struct dmx512_cuse_fdwatch * table;
+    int size = g_fdwatchers_size ? g_fdwatchers_size : 64;
+    if (fd < g_fdwatchers_size)
+	return 0;
+    while (size <= fd)
+	size *= 2;
+    table = realloc(g_fdwatchers, size * sizeof(*table));
+    if (!table)
+	return -ENOMEM;
+    memset(&table[g_fdwatchers_size], 0, (size - g_fdwatchers_size) * sizeof(*table));
+    g_fdwatchers = table;
+    g_fdwatchers_size = size;
+    return 0;
 }
 
-
-int dmx512_cuse_fdwatcher_add(struct dmx512_cuse_fdwatcher * w)
+static int dmx512_cuse_loop_watch(struct dmx512_cuse_loop * loop, struct dmx512_cuse_fdwatcher * w)
 {
-    if (dmx512_cuse_fdwatcher_find_fd(w->fd)!=-1)
+    struct epoll_event ev;
+    int res;
+    if (!loop || (loop->epollfd < 0) || !w || (w->fd < 0) || !w->callback)
 	return -EINVAL;
 
-    const int first_free_entry = dmx512_cuse_fdwatcher_find_fd(-1);
-    if (first_free_entry < 0)
-	return -ENOMEM;
-
-    g_fdwatchers[first_free_entry] = *w;
-    if (first_free_entry+1 > g_num_fdwatchers)
-	g_num_fdwatchers = first_free_entry+1;
+    pthread_mutex_lock(&g_fdwatchers_lock);
+    res = dmx512_cuse_fdwatchers_reserve(w->fd);
+    if (!res && g_fdwatchers[w->fd].w.callback)
+	res = -EINVAL;
+    if (!res)
+    {
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = w->fd;
+	if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, w->fd, &ev) < 0)
+	    res = -errno;
+	else
+	{
+	    g_fdwatchers[w->fd].w = *w;
+	    g_fdwatchers[w->fd].loop = loop;
+	}
+    }
+    pthread_mutex_unlock(&g_fdwatchers_lock);
+    return res;
+}
 
-    return 0;
+int dmx512_cuse_fdwatcher_add(struct dmx512_cuse_fdwatcher * w)
+{
+    return dmx512_cuse_loop_watch(g_current_loop ? g_current_loop : &g_main_loop, w);
 }
 
 int dmx512_cuse_fdwatcher_remove(struct dmx512_cuse_fdwatcher * w)
 {
-    const int i = dmx512_cuse_fdwatcher_find_fd(w->fd);
-    if (i < 0)
+    int res = 0;
+    if (!w || (w->fd < 0))
 	return -EINVAL;
-    g_fdwatchers[i].fd = -1;
-    g_fdwatchers[i].callback = 0;
-    g_fdwatchers[i].user = 0;
-    return 0;
+    pthread_mutex_lock(&g_fdwatchers_lock);
+    if ((w->fd >= g_fdwatchers_size) || !g_fdwatchers[w->fd].w.callback)
+	res = -EINVAL;
+    else
+    {
+	epoll_ctl(g_fdwatchers[w->fd].loop->epollfd, EPOLL_CTL_DEL, w->fd, 0);
+	g_fdwatchers[w->fd].w.fd = -1;
+	g_fdwatchers[w->fd].w.callback = 0;
+	g_fdwatchers[w->fd].w.user = 0;
+	g_fdwatchers[w->fd].loop = 0;
+    }
+    pthread_mutex_unlock(&g_fdwatchers_lock);
+    return res;
 }
 
 
@@ -1060,12 +3117,14 @@ int dmx512_cuse_fdwatcher_remove(struct dmx512_cuse_fdwatcher * w)
 int dmx512_core_init(void)
 {
         printf("loading dmx512 core\n");
+        if (dmx512_trace_open_env())
+                return -1;
+        if (dmx512_cuse_loop_init(&g_main_loop, -1))
+                return -1;
 #ifdef CONFIG_RXFRAMEQUEUE
-        dmx512_framequeue_init(&free_framequeue);
-        /* put some frame in the freequeue: 32 ports with 32 contexts w directions with 4 frames each. */
-        int i;
-        for (i = 0; i < 32*32*2*4; ++i)
-                dmx512_framequeue_put(&free_framequeue, dmx512_framequeue_entry_alloc());
+        dmx512_frame_cache = dmx512_framepool_create_cache();
+        if (!dmx512_frame_cache)
+                return -1;
 #endif
         return 0;
 }
@@ -1074,6 +3133,8 @@ void dmx512_core_exit(void)
 {
     printf("unloading dmx512 core\n");
 #ifdef CONFIG_RXFRAMEQUEUE
-    dmx512_framequeue_cleanup(&free_framequeue);
+    kmem_cache_destroy(dmx512_frame_cache);
 #endif
+    dmx512_cuse_loop_cleanup(&g_main_loop);
+    dmx512_trace_close();
 }
@@ -43,9 +43,29 @@ struct dmx512_cuse_card_config
 void dmx512_cuse_send_frame(struct dmx512_cuse_card *card,
                             struct dmx512frame *frame);
 
+/*
+ * Every card is served by a thread of its own. A frame received in
+ * another thread, e.g. of another card, is queued to the card and
+ * handled by its thread.
+ */
 void dmx512_cuse_handle_received_frame(struct dmx512_cuse_card *card,
                                        struct dmx512frame *frame);
 
+/*
+ * Software timestamps of received frames in CLOCK_MONOTONIC.
+ * Drivers take the front timestamp when they detect the break.
+ * The back timestamp is taken by dmx512_cuse_handle_received_frame,
+ * if the driver has not taken it after the last slot.
+ */
+void dmx512_cuse_frame_timestamp_front(struct dmx512frame *frame);
+void dmx512_cuse_frame_timestamp_back(struct dmx512frame *frame);
+
+/*
+ * Runs one thread per card, unless fuse is told to run single threaded
+ * with -s. DMX512_CUSE_CPUS pins the threads to cpus, e.g. "2,3" pins
+ * the first card to cpu 2 and the second one to cpu 3, -1 leaves a card
+ * unpinned. The fdwatchers are served by the thread of the first card.
+ */
 int dmx512_cuse_lowlevel_main(int cuseargc, char ** cuseargv,
                               struct dmx512_cuse_card_config *cards,
                               int num_cards,
@@ -56,6 +76,10 @@ int dmx512_cuse_lowlevel_main(int cuseargc, char ** cuseargv,
 struct dmx512_cuse_card_config * dmx512_cuse_card_config(struct dmx512_cuse_card *dmx512);
 
 
+/*
+ * A watcher is served by the thread that adds it, e.g. the one of the
+ * card in its init. Remove it in that thread or after the loop ended.
+ */
 int dmx512_cuse_fdwatcher_add(struct dmx512_cuse_fdwatcher * w);
 int dmx512_cuse_fdwatcher_remove(struct dmx512_cuse_fdwatcher * w);
 
@@ -372,6 +372,7 @@ static void  llgdmx_check_rx_port ( struct dmxllgip_card * card, const int portn
             port->state = 1;
             frame->port = portno;
             frame->flags = 0;
+            dmx512_cuse_frame_timestamp_front(frame);
 	    /* size of break in 4us units, can be up to 4*254us */
             frame->breaksize = DMX_RXFIFO_DATA(x) >> 2;
             frame->payload_size = 0;
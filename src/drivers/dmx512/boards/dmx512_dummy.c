@@ -22,8 +22,15 @@ MODULE_PARM_DESC(ports_count, "number of ports to create for both dummy devices"
 static int dmx512_dummy_send_frame (struct dmx512_port * port, struct dmx512_framequeue_entry * frame)
 {
         struct dmx512_port *dst_port = (struct dmx512_port *)dmx512_port_userptr(port);
-        if (dst_port)
+        if (dst_port) {
+	    /*
+	     * The frame arrives as it is send, so the break is now. The
+	     * timestamps of the writer are not the ones of the reception.
+	     */
+	    frame->frame.flags &= ~DMX512_FLAG_BACK_TIMESTAMP;
+	    dmx512_frame_timestamp_front(frame);
 	    dmx512_received_frame(dst_port, frame);
+        }
 	return 0;
 }
 
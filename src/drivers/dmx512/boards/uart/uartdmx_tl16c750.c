@@ -32,12 +32,15 @@ static int dmxuart_tl16c750_send_frame (struct dmx512_port * port, struct dmx512
 {
 	/*
 	 * Send the frame to the same port of the receive queue of the other device.
-	 * No need to change the frame, as the data is valid on the recive path.
-	 * The timestamp difference is not worth it.
+	 * No need to change the data, as it is valid on the recive path.
 	 */
 	struct dmx512_port * dst_port = dmx512_port_by_index(port->device, dmx512_port_index(port) ^ 1);
-	if (dst_port)
+	if (dst_port) {
+	    /* the break of the looped back frame is now. */
+	    frame->frame.flags &= ~DMX512_FLAG_BACK_TIMESTAMP;
+	    dmx512_frame_timestamp_front(frame);
 	    dmx512_received_frame(dst_port, frame);
+	}
 	return 0;
 }
 
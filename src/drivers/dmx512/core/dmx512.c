@@ -11,6 +11,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/string.h>
 #include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/miscdevice.h>
@@ -21,11 +22,23 @@
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/uio.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/capability.h>
 
 
 
 #include <linux/dmx512/dmx512_priv.h>
 #include <linux/dmx512/dmx512.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+#define CREATE_TRACE_POINTS
+#include "dmx512trace.h"
 
 DEFINE_SPINLOCK(dmx512_lock);
 #define DMX512_LOCK spin_lock_irqsave(&dmx512_lock, flags)
@@ -36,11 +49,125 @@ DEFINE_SPINLOCK(dmx512_lock);
 LIST_HEAD(dmx512_devices);
 LIST_HEAD(dmx512_ports);
 
-struct dmx512_framequeue free_framequeue;
+/* the cache the frame pools of all devices allocate from. */
+static struct kmem_cache * dmx512_frame_cache;
+
+/* /sys/kernel/debug/dmx512, holds the statistics of each device. */
+static struct dentry * dmx512_debugfs_root;
+
+static unsigned int framepool_low = 64;
+module_param(framepool_low, uint, 0444);
+MODULE_PARM_DESC(framepool_low, "number of unused frames each device keeps allocated");
+
+static unsigned int framepool_high = 512;
+module_param(framepool_high, uint, 0444);
+MODULE_PARM_DESC(framepool_high, "number of unused frames above which a device frees frames");
+
+static unsigned int framepool_max = 4096;
+module_param(framepool_max, uint, 0444);
+MODULE_PARM_DESC(framepool_max, "maximum number of frames per device");
+
+/* take a frame from the pool of the device, the caller holds the only reference. */
+static struct dmx512_framequeue_entry * _dmx512_alloc_frame(struct dmx512_device * dmx, const int port, gfp_t gfp)
+{
+    return dmx512_framepool_get(dmx->framepool, port, gfp);
+}
+
+/* drop a reference to the frame and return it to its pool if it was the last one. */
+static void _dmx512_release_frame(struct dmx512_framequeue_entry * e)
+{
+    dmx512_framepool_put(e);
+}
+
+/*
+ * Timestamps are kept in CLOCK_MONOTONIC and moved to the clock
+ * of a client, when the client reads the frame.
+ */
+static ktime_t dmx512_client_clock_offset(struct dmx512_client * client)
+{
+    return (client->clock == CLOCK_TAI) ? ktime_mono_to_any(0, TK_OFFS_TAI) : 0;
+}
+
+static void dmx512_timespec_shift(struct timespec * ts, const ktime_t offset)
+{
+    const struct timespec64 t = ktime_to_timespec64(ktime_add(ktime_set(ts->tv_sec, ts->tv_nsec), offset));
+    ts->tv_sec = t.tv_sec;
+    ts->tv_nsec = t.tv_nsec;
+}
+
+/* the frame is packed, so its timestamps are shifted in a copy. */
+static void dmx512_frame_shift_timestamps(struct dmx512frame * frame, const ktime_t offset)
+{
+    struct timespec ts;
+    if (!offset)
+	return;
+    if (frame->flags & DMX512_FLAG_TIMESTAMP)
+    {
+	ts = frame->timestamp;
+	dmx512_timespec_shift(&ts, offset);
+	frame->timestamp = ts;
+    }
+    if (frame->flags & DMX512_FLAG_BACK_TIMESTAMP)
+    {
+	ts = frame->back_timestamp;
+	dmx512_timespec_shift(&ts, offset);
+	frame->back_timestamp = ts;
+    }
+}
+
+static void dmx512_timespec_now(struct timespec * ts)
+{
+    struct timespec64 t;
+    ktime_get_ts64(&t);
+    ts->tv_sec = t.tv_sec;
+    ts->tv_nsec = t.tv_nsec;
+}
+
+static long long dmx512_timespec_ns(const struct timespec ts)
+{
+    return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* a frame the client reads, with the time since it has been received. */
+static void dmx512_client_count_rx(struct dmx512_client * client, const struct dmx512frame * frame, const long long now)
+{
+    atomic64_inc(&client->stats.rx_frames);
+    atomic64_add(frame->payload_size + 1, &client->stats.rx_bytes);
+    if ((frame->flags & (DMX512_FLAG_BACK_TIMESTAMP | DMX512_FLAGS_IS_TRANSMIT_FRAME)) == DMX512_FLAG_BACK_TIMESTAMP)
+	dmx512_histogram_add(&client->stats.rx_latency, now - dmx512_timespec_ns(frame->back_timestamp));
+}
+
+static void dmx512_client_free_buffers(struct dmx512_client_buffers * b);
+static void dmx512_client_merge_forget(struct dmx512_client * client);
+static void dmx512_client_moderation_init(struct dmx512_client * client);
+static int  dmx512_client_rx_ready(struct dmx512_client * client);
+static int  dmx512_port_txschedule_init(struct dmx512_port * port);
+static void dmx512_port_txschedule_stop(struct dmx512_port * port);
+static void dmx512_port_txschedule_cleanup(struct dmx512_port * port);
+static int  dmx512_port_txqueue_init(struct dmx512_port * port);
+static void dmx512_port_txqueue_cleanup(struct dmx512_port * port);
+static void dmx512_port_merge_cleanup(struct dmx512_port * port);
+static void dmx512_device_state_update(struct dmx512_device * dmx, const unsigned int port,
+				       const struct dmx512frame * frame, const int tx);
 
+/*
+ * The port gets the lowest free index of the device, which it keeps
+ * until it is removed. Indices of other ports do not change.
+ */
 static int _dmx512_add_port(struct dmx512_device * dev, struct dmx512_port * port)
 {
+    u32 index;
+    int err = xa_alloc(&dev->ports_xa, &index, port, XA_LIMIT(0, 0xffff), GFP_ATOMIC);
+    if (err)
+	return err;
+    port->index = index;
     port->device = dev;
+    port->rx_last = 0;
+    port->rx_generation = 0;
+    memset(&port->stats, 0, sizeof(port->stats));
+    dmx512_port_refresh_init(port);
+    spin_lock_init(&port->merge.lock);
+    port->merge.merge = 0;
     list_add_tail(&port->device_item, &dev->ports);
     list_add_tail(&port->portlist_item, &dmx512_ports);
 
@@ -49,148 +176,2432 @@ static int _dmx512_add_port(struct dmx512_device * dev, struct dmx512_port * por
     return 0;
 }
 
-static int _dmx512_remove_port(struct dmx512_port * port)
+/* hrtimer_cancel waits for the callback, so the timers are stopped before dmx512_lock is taken. */
+static void dmx512_port_stop_timers(struct dmx512_port * port)
+{
+    dmx512_port_refresh_stop(port);
+    dmx512_port_txschedule_stop(port);
+}
+
+/* The port must not be freed before a grace period, use kfree_rcu. */
+static int _dmx512_remove_port(struct dmx512_port * port)
+{
+    printk("dmx512: remove port %s\n", port->name);
+
+    if (port->device) {
+	dmx512_port_txschedule_cleanup(port);
+	dmx512_port_merge_cleanup(port);
+	dmx512_port_txqueue_cleanup(port);
+	xa_erase(&port->device->ports_xa, port->index);
+	if (port->rx_last)
+	    _dmx512_release_frame(port->rx_last);
+	port->rx_last = 0;
+    }
+    list_del(&port->device_item);
+    list_del(&port->portlist_item);
+    port->device = 0;
+    port->index = -1;
+    return 0;
+}
+
+#define miscdev_to_dmx512device(d) container_of(d, struct dmx512_device, miscdev)
+
+
+static int dmx512_device_open (struct inode *inode, struct file * filp)
+{
+    struct dmx512_device *dmx = miscdev_to_dmx512device(filp->private_data);
+    struct dmx512_client *client;
+    unsigned long flags;
+    if (!dmx)
+	return -ENODEV;
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client)
+	return -ENOMEM;
+
+    if (!try_module_get(dmx->owner)) {
+	kfree(client);
+	return -ENODEV;
+    }
+
+    if (dmx512_framerefqueue_init(&client->rxframequeue, DMX512_CLIENT_RXQUEUE_SIZE)) {
+	module_put(dmx->owner);
+	kfree(client);
+	return -ENOMEM;
+    }
+
+    client->device = dmx;
+    INIT_LIST_HEAD(&client->subscriptions); /* no port selected */
+    client->clock = CLOCK_MONOTONIC;
+    client->merge_priority = DMX512_MERGE_DEFAULT_PRIORITY;
+    init_waitqueue_head(&client->rxwait_queue);
+    client->tx_blocked_port = -1;
+    dmx512_client_moderation_init(client);
+    mutex_init(&client->buffers.lock);
+    atomic_set(&client->buffers.mapped, 0);
+
+    spin_lock_irqsave(&dmx->clients_lock, flags);
+    list_add_tail(&client->deviceclient_item, &dmx->clients);
+    spin_unlock_irqrestore(&dmx->clients_lock, flags);
+
+    filp->private_data = client;
+    /* read_iter and write_iter honor IOCB_NOWAIT. */
+    filp->f_mode |= FMODE_NOWAIT;
+
+    printk("open dmx512 device %s\n", dmx->name);
+
+    return 0;
+}
+
+static int dmx512_device_release (struct inode * inode, struct file * filp)
+{
+    struct dmx512_client *client = (struct dmx512_client *)filp->private_data;
+    struct dmx512_device *dmx = client ? client->device : 0;
+    struct dmx512_framequeue_entry * e;
+    struct dmx512_subscription * sub, * tmp;
+    unsigned long flags;
+    if (!dmx)
+	return -ENODEV;
+
+    printk("close dmx512 device %s\n", dmx->name);
+
+    spin_lock_irqsave(&dmx->clients_lock, flags);
+    list_del(&client->deviceclient_item);
+    list_for_each_entry(sub, &client->subscriptions, client_item)
+	list_del(&sub->port_item);
+    dmx512_rdmroute_forget(&dmx->rdmroute, client);
+    spin_unlock_irqrestore(&dmx->clients_lock, flags);
+    list_for_each_entry_safe(sub, tmp, &client->subscriptions, client_item)
+	kfree(sub);
+
+    dmx512_client_merge_forget(client);
+    hrtimer_cancel(&client->moderation.timer);
+
+    while ((e = dmx512_framerefqueue_get(&client->rxframequeue)) != 0)
+	_dmx512_release_frame(e);
+    dmx512_framerefqueue_cleanup(&client->rxframequeue);
+    while (client->rxfilter.count)
+	dmx512_rxfilter_free(client->rxfilter.codes[--client->rxfilter.count]);
+    dmx512_client_free_buffers(&client->buffers);
+    kfree(client);
+
+    module_put(dmx->owner);
+
+    return 0;
+}
+
+/*
+ * Copy a frame as struct dmx512frame with its timestamps in the clock
+ * of the client. Returns the size copied or -EFAULT.
+ */
+static ssize_t dmx512_copy_frame_to_iter(struct iov_iter * to, const struct dmx512frame * frame, const ktime_t offset)
+{
+    /* only the timestamps at the end of the frame differ in the clock of the client. */
+    const size_t head = offsetof(struct dmx512frame, timestamp);
+    struct timespec ts[2] = { frame->timestamp, frame->back_timestamp };
+    if (offset && (frame->flags & DMX512_FLAG_TIMESTAMP))
+        dmx512_timespec_shift(&ts[0], offset);
+    if (offset && (frame->flags & DMX512_FLAG_BACK_TIMESTAMP))
+        dmx512_timespec_shift(&ts[1], offset);
+    if ((copy_to_iter(frame, head, to) != head) ||
+        (copy_to_iter(ts, sizeof(ts), to) != sizeof(ts)))
+        return -EFAULT;
+    return sizeof(struct dmx512frame);
+}
+
+/*
+ * Copy a frame as struct dmx512frame_compact, only the slots of the
+ * frame are copied. Returns the size of the record or -EFAULT.
+ */
+static ssize_t dmx512_copy_compact_to_iter(struct iov_iter * to, const struct dmx512frame * frame, const ktime_t offset)
+{
+    struct dmx512frame_compact h;
+    const unsigned int data_size = dmx512_frame_to_compact(frame, &h, offset);
+    const size_t size = DMX512_FRAME_COMPACT_SIZE(frame->payload_size);
+    const size_t padding = size - sizeof(h) - data_size;
+    if ((copy_to_iter(&h, sizeof(h), to) != sizeof(h)) ||
+        (copy_to_iter(frame->data, data_size, to) != data_size) ||
+        (iov_iter_zero(padding, to) != padding))
+        return -EFAULT;
+    return size;
+}
+
+/*
+ * Reads as many whole frames as there are queued and fit into the iov,
+ * which may be split into any number of segments.
+ * Only blocks if there is not a single frame available, or with a
+ * wakeup moderation, until the moderation releases the queued frames.
+ * With O_NONBLOCK or IOCB_NOWAIT -EAGAIN is returned instead.
+ * Compact records are only packed while the rest of the iov can
+ * hold a record of any size.
+ */
+static ssize_t dmx512_device_read_iter (struct kiocb * iocb, struct iov_iter * to)
+{
+    struct dmx512_client *client = (struct dmx512_client *)iocb->ki_filp->private_data;
+    const ktime_t offset = dmx512_client_clock_offset(client);
+    const int compact = (client->frame_format == DMX512_FRAME_FORMAT_COMPACT);
+    const size_t record_size = compact ? DMX512_FRAME_COMPACT_MAX_SIZE : sizeof(struct dmx512frame);
+    const int nonblocking = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+    struct dmx512_framequeue_entry * e;
+    ssize_t count = 0;
+    long long now;
+
+    if (iov_iter_count(to) < record_size)
+        return -EINVAL;
+
+    /* a non blocking read does not wait for the moderation. */
+    if (!dmx512_client_rx_ready(client))
+    {
+	    if (nonblocking)
+	    {
+		    if (dmx512_framerefqueue_isempty(&client->rxframequeue))
+			    return -EAGAIN;
+	    }
+	    else if (wait_event_interruptible (client->rxwait_queue, dmx512_client_rx_ready(client)))
+		    return -ERESTARTSYS;
+    }
+    now = ktime_get_ns();
+    while ((iov_iter_count(to) >= record_size) &&
+	   ((e = dmx512_framerefqueue_get (&client->rxframequeue)) != 0))
+    {
+        const ssize_t n = compact ?
+            dmx512_copy_compact_to_iter(to, &e->frame, offset) :
+            dmx512_copy_frame_to_iter(to, &e->frame, offset);
+        if (n >= 0)
+        {
+          trace_dmx512_rx_read(client, e->frame.port, e->id);
+          dmx512_client_count_rx(client, &e->frame, now);
+        }
+        _dmx512_release_frame(e);
+        if (n < 0)
+          return count ? count : n;
+        count += n;
+    }
+    return count;
+}
+
+static void dmx512_client_wake_reader(struct dmx512_client * client)
+{
+	trace_dmx512_rx_wakeup(client, dmx512_framerefqueue_count(&client->rxframequeue));
+	wake_up (&client->rxwait_queue);
+}
+
+/*
+ * Queue a reference to the frame to the client. If the clients queue
+ * is full the oldest frame is dropped to make room for the new one.
+ * The reader is woken up as the moderation of the client allows.
+ * Called with the clients_lock held.
+ */
+static void dmx512_client_queue_frame(struct dmx512_client * client, struct dmx512_framequeue_entry * e)
+{
+	struct dmx512_client_moderation * m = &client->moderation;
+	const int first = dmx512_framerefqueue_isempty(&client->rxframequeue);
+	struct dmx512_framequeue_entry * dropped = dmx512_framerefqueue_put(&client->rxframequeue, e);
+
+	trace_dmx512_rx_enqueue(client, e->frame.port, e->id);
+	if (dropped)
+	{
+		atomic64_inc(&client->stats.rx_queue_full);
+		_dmx512_release_frame(dropped);
+	}
+	dmx512_stats_high_water(&client->stats.rxqueue_high_water,
+				dmx512_framerefqueue_count(&client->rxframequeue));
+	if (m->frames <= 1)
+		dmx512_client_wake_reader(client);
+	else if (dmx512_frame_is_rdm(e) ||
+		 (dmx512_framerefqueue_count(&client->rxframequeue) >= m->frames))
+	{
+		m->expired = 1;
+		hrtimer_try_to_cancel(&m->timer);
+		dmx512_client_wake_reader(client);
+	}
+	else if (first)
+	{
+		m->expired = 0;
+		hrtimer_start(&m->timer, m->delay, HRTIMER_MODE_REL_SOFT);
+	}
+}
+
+/* frames are queued and the moderation lets the reader see them. */
+static int dmx512_client_rx_ready(struct dmx512_client * client)
+{
+	if (dmx512_framerefqueue_isempty(&client->rxframequeue))
+		return 0;
+	return (READ_ONCE(client->moderation.frames) <= 1) || READ_ONCE(client->moderation.expired);
+}
+
+static enum hrtimer_restart dmx512_client_moderation_timer(struct hrtimer * timer)
+{
+	struct dmx512_client * client = container_of(timer, struct dmx512_client, moderation.timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	client->moderation.expired = 1;
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+	dmx512_client_wake_reader(client);
+	return HRTIMER_NORESTART;
+}
+
+static void dmx512_client_moderation_init(struct dmx512_client * client)
+{
+	hrtimer_init(&client->moderation.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	client->moderation.timer.function = dmx512_client_moderation_timer;
+	client->moderation.frames = 0;
+	client->moderation.delay = 0;
+	client->moderation.expired = 0;
+}
+
+/* frames already queued are released to the reader. */
+static int dmx512_client_set_moderation(struct dmx512_client * client, const struct dmx512_rx_moderation * info)
+{
+	struct dmx512_client_moderation * m = &client->moderation;
+	const unsigned int capacity = dmx512_framerefqueue_capacity(&client->rxframequeue);
+	unsigned long flags;
+
+	if ((info->max_frames > 1) &&
+	    ((info->max_delay_us == 0) || (info->max_delay_us > DMX512_RX_MODERATION_MAX_DELAY_US)))
+		return -EINVAL;
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	m->frames = (info->max_frames > capacity) ? capacity : info->max_frames;
+	m->delay = (m->frames > 1) ? (ktime_t)info->max_delay_us * NSEC_PER_USEC : 0;
+	m->expired = 1;
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+	hrtimer_try_to_cancel(&m->timer);
+	dmx512_client_wake_reader(client);
+	return 0;
+}
+
+static void dmx512_client_get_moderation(struct dmx512_client * client, struct dmx512_rx_moderation * info)
+{
+	struct dmx512_client_moderation * m = &client->moderation;
+	unsigned long flags;
+
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	info->max_frames = m->frames;
+	info->max_delay_us = div_s64(m->delay, NSEC_PER_USEC);
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+}
+
+/*
+ * The subscriber lists of a port, created if create is set.
+ * Returns 0 if the port has none or they could not be created.
+ * They are freed with kfree_rcu on unregister, so a caller that does
+ * not create them holds rcu_read_lock while it uses them.
+ */
+static struct dmx512_port_subscribers * dmx512_device_subscribers(struct dmx512_device * dmx,
+								  const unsigned int port,
+								  const int create)
+{
+	struct dmx512_port_subscribers * subs = xa_load(&dmx->subscribers_xa, port);
+	if (subs || !create)
+		return subs;
+	subs = kzalloc(sizeof(*subs), GFP_KERNEL);
+	if (!subs)
+		return 0;
+	INIT_LIST_HEAD(&subs->rx);
+	INIT_LIST_HEAD(&subs->tx);
+	if (xa_insert(&dmx->subscribers_xa, port, subs, GFP_KERNEL))
+	{
+		/* lost the race with another client or out of memory. */
+		kfree(subs);
+		subs = xa_load(&dmx->subscribers_xa, port);
+	}
+	return subs;
+}
+
+static struct list_head * dmx512_subscriber_list(struct dmx512_port_subscribers * subs, const int direction)
+{
+	return (direction == DMX512_PORT_BITMAP_TX) ? &subs->tx : &subs->rx;
+}
+
+/*
+ * Deliver the frame to all clients of the device, that subscribed to the
+ * received or transmitted frames of the frame's port. The frame is not
+ * copied, every client gets a reference to it instead. The callers
+ * reference to the frame is consumed.
+ * Clients skip frames that do not match their match codes. Clients in
+ * DMX512_RX_MODE_CHANGES skip the frame, if they already got a frame of
+ * that generation. A generation of 0 is delivered to all.
+ */
+static void dmx512_device_deliver_frame(struct dmx512_device * dmx, struct dmx512_framequeue_entry * frame,
+					const unsigned int generation)
+{
+	const int direction = (frame->frame.flags & DMX512_FLAGS_IS_TRANSMIT_FRAME) ? DMX512_PORT_BITMAP_TX : DMX512_PORT_BITMAP_RX;
+	struct dmx512_port_subscribers * subs;
+	struct dmx512_subscription * sub;
+	unsigned long flags;
+
+	rcu_read_lock();
+	subs = dmx512_device_subscribers(dmx, frame->frame.port, 0);
+	if (subs)
+	{
+		spin_lock_irqsave(&dmx->clients_lock, flags);
+		list_for_each_entry(sub, dmx512_subscriber_list(subs, direction), port_item)
+		{
+			struct dmx512_client * client = sub->client;
+			if (!dmx512_rxfilter_match(&client->rxfilter, &frame->frame))
+				continue;
+			if (generation && (client->rx_mode == DMX512_RX_MODE_CHANGES))
+			{
+				if (sub->rx_generation == generation)
+					continue;
+				sub->rx_generation = generation;
+			}
+			dmx512_client_queue_frame(client, frame);
+		}
+		spin_unlock_irqrestore(&dmx->clients_lock, flags);
+	}
+	rcu_read_unlock();
+	_dmx512_release_frame(frame);
+}
+
+/*
+ * Replace the ports the client selected for a direction with the ports
+ * set in bitmap. The subscriptions are allocated before the clients_lock
+ * is taken and the old ones are freed after it is released.
+ */
+static int dmx512_client_set_ports(struct dmx512_client * client, const int direction,
+				   const u64 * bitmap, const unsigned int port_count)
+{
+	struct dmx512_device * dmx = client->device;
+	struct dmx512_subscription * sub, * tmp;
+	LIST_HEAD(added);
+	LIST_HEAD(removed);
+	unsigned long flags;
+	unsigned int w;
+	int err = 0;
+
+	for (w = 0; (w < (port_count + 63) / 64) && !err; ++w)
+	{
+		u64 bits = bitmap[w];
+		if ((port_count - w * 64) < 64)
+			bits &= (1ULL << (port_count - w * 64)) - 1;
+		while (bits && !err)
+		{
+			const unsigned int port = w * 64 + __ffs64(bits);
+			bits &= bits - 1;
+			/* only ports of the device get a subscriber list, it is kept until unregister. */
+			if (!xa_load(&dmx->ports_xa, port))
+				continue;
+			sub = kzalloc(sizeof(*sub), GFP_KERNEL);
+			if (!sub || !dmx512_device_subscribers(dmx, port, 1))
+			{
+				kfree(sub);
+				err = -ENOMEM;
+				break;
+			}
+			sub->client = client;
+			sub->port = port;
+			sub->direction = direction;
+			list_add_tail(&sub->client_item, &added);
+		}
+	}
+
+	if (!err)
+	{
+		rcu_read_lock();
+		spin_lock_irqsave(&dmx->clients_lock, flags);
+		list_for_each_entry_safe(sub, tmp, &client->subscriptions, client_item)
+		{
+			if (sub->direction != direction)
+				continue;
+			list_del(&sub->port_item);
+			list_move_tail(&sub->client_item, &removed);
+		}
+		list_for_each_entry(sub, &added, client_item)
+			list_add_tail(&sub->port_item,
+				      dmx512_subscriber_list(dmx512_device_subscribers(dmx, sub->port, 0), direction));
+		list_splice_tail_init(&added, &client->subscriptions);
+		spin_unlock_irqrestore(&dmx->clients_lock, flags);
+		rcu_read_unlock();
+	}
+
+	list_splice_tail(&added, &removed);
+	list_for_each_entry_safe(sub, tmp, &removed, client_item)
+		kfree(sub);
+	return err;
+}
+
+/*
+ * Fill the bitmap with the ports the client selected for a direction.
+ * Returns the number of ports needed to hold all of them.
+ */
+static unsigned int dmx512_client_get_ports(struct dmx512_client * client, const int direction,
+					    u64 * bitmap, const unsigned int port_count)
+{
+	struct dmx512_subscription * sub;
+	unsigned int needed = 0;
+	unsigned long flags;
+
+	if (bitmap)
+		memset(bitmap, 0, ((port_count + 63) / 64) * sizeof(*bitmap));
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	list_for_each_entry(sub, &client->subscriptions, client_item)
+	{
+		if (sub->direction != direction)
+			continue;
+		if (bitmap && (sub->port < port_count))
+			bitmap[sub->port / 64] |= 1ULL << (sub->port % 64);
+		if (sub->port >= needed)
+			needed = sub->port + 1;
+	}
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+	return needed;
+}
+
+/*
+ * Hand out a copy of the frame to all clients that
+ * monitor transmitted frames of the frame's port.
+ */
+static void dmx512_device_loopback_txframe(struct dmx512_device * dmx, struct dmx512_framequeue_entry * frame)
+{
+	struct dmx512_port_subscribers * subs;
+	struct dmx512_framequeue_entry * e;
+	int monitored;
+	rcu_read_lock();
+	subs = dmx512_device_subscribers(dmx, frame->frame.port, 0);
+	monitored = subs && !list_empty(&subs->tx);
+	rcu_read_unlock();
+	if (!monitored)
+		return;
+	e = _dmx512_alloc_frame(dmx, frame->frame.port, GFP_ATOMIC);
+	if (e)
+	{
+		memcpy(&e->frame, &frame->frame, sizeof(e->frame));
+		e->frame.flags |= DMX512_FLAGS_IS_TRANSMIT_FRAME;
+		dmx512_device_deliver_frame(dmx, e, 0);
+	}
+}
+
+/* hand the timeout frame of a request to its client, called with clients_lock held. */
+static void dmx512_device_rdmroute_timeout(struct dmx512_device * dmx, struct dmx512_client * client,
+					   struct dmx512_framequeue_entry * e)
+{
+	struct dmx512_port * p;
+	dmx512_frame_timestamp_back(e);
+	dmx512_client_queue_frame(client, e);
+	atomic64_inc(&client->stats.rdm_timeouts);
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, e->frame.port);
+	if (p)
+		atomic64_inc(&p->stats.rdm_timeouts);
+	rcu_read_unlock();
+}
+
+/*
+ * Remember an RDM request of the client, so the response is routed to it.
+ * A request scheduled for later waits for its response from its due time.
+ * If the table is full, the request that expires first times out right away.
+ */
+static void dmx512_device_rdmroute_request(struct dmx512_device * dmx, struct dmx512_client * client,
+					   const struct dmx512frame * frame, const long long due)
+{
+	const long long now = ktime_get_ns();
+	const long long expires = ((due > now) ? due : now) + DMX512_RDMROUTE_TIMEOUT_NS;
+	struct dmx512_framequeue_entry * e;
+	struct dmx512_client * evicted;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	if (!dmx->rdmroute_stopped && (dmx->rdmroute.count >= DMX512_RDMROUTE_SIZE))
+	{
+		e = _dmx512_alloc_frame(dmx, -1, GFP_ATOMIC);
+		evicted = dmx512_rdmroute_evict(&dmx->rdmroute, e ? &e->frame : 0);
+		if (evicted && e)
+			dmx512_device_rdmroute_timeout(dmx, evicted, e);
+		if (e)
+			_dmx512_release_frame(e);
+	}
+	if (!dmx->rdmroute_stopped &&
+	    dmx512_rdmroute_request(&dmx->rdmroute, frame, client, expires) &&
+	    (dmx512_rdmroute_next(&dmx->rdmroute) == expires))
+		hrtimer_start(&dmx->rdmroute_timer, ns_to_ktime(expires), HRTIMER_MODE_ABS_SOFT);
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+}
+
+/*
+ * The RDM request is handed to the transmitter now. It may have waited
+ * in the txqueue, so its response is waited for from now on.
+ */
+static void dmx512_device_rdmroute_sent(struct dmx512_device * dmx, const struct dmx512frame * frame)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	if (!dmx->rdmroute_stopped)
+		dmx512_rdmroute_sent(&dmx->rdmroute, frame, ktime_get_ns() + DMX512_RDMROUTE_TIMEOUT_NS);
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+}
+
+/*
+ * Hand a received RDM response only to the client that sent the request.
+ * Returns 1 if the frame was routed, the callers reference is consumed then.
+ */
+static int dmx512_device_rdmroute_response(struct dmx512_device * dmx, struct dmx512_framequeue_entry * frame)
+{
+	struct dmx512_client * client;
+	unsigned long flags;
+
+	if (!dmx512_rdmroute_is_response(&frame->frame))
+		return 0;
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	client = dmx512_rdmroute_response(&dmx->rdmroute, &frame->frame);
+	if (client)
+		dmx512_client_queue_frame(client, frame);
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+	if (client)
+		_dmx512_release_frame(frame);
+	return client ? 1 : 0;
+}
+
+/*
+ * Reports the requests that got no response in time to their clients,
+ * with a frame that has DMX512_FLAG_RDM_TIMEOUT set. If no frame can be
+ * allocated, the request is dropped silently.
+ */
+static enum hrtimer_restart dmx512_device_rdmroute_timer(struct hrtimer * timer)
+{
+	struct dmx512_device * dmx = container_of(timer, struct dmx512_device, rdmroute_timer);
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	const long long now = ktime_get_ns();
+	struct dmx512_framequeue_entry * e;
+	struct dmx512_client * client;
+	unsigned long flags;
+	long long next;
+
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	do
+	{
+		e = _dmx512_alloc_frame(dmx, -1, GFP_ATOMIC);
+		client = dmx512_rdmroute_expire(&dmx->rdmroute, now, e ? &e->frame : 0);
+		if (client && e)
+			dmx512_device_rdmroute_timeout(dmx, client, e);
+		if (e)
+			_dmx512_release_frame(e);
+	} while (client);
+	next = dmx512_rdmroute_next(&dmx->rdmroute);
+	/* a request on another cpu may have restarted the timer meanwhile. */
+	if ((next >= 0) && !dmx->rdmroute_stopped && !hrtimer_is_queued(timer))
+	{
+		hrtimer_set_expires(timer, ns_to_ktime(next));
+		restart = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+	return restart;
+}
+
+/* no request is routed after it. Waits for the timer, so not under dmx512_lock. */
+static void dmx512_device_rdmroute_stop(struct dmx512_device * dmx)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	dmx->rdmroute_stopped = 1;
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+	hrtimer_cancel(&dmx->rdmroute_timer);
+}
+
+/*
+ * Hand the queued frames to the transmitter as long as it has space.
+ * The context that finds the queue not busy sends for all others,
+ * so the frames of a port keep their order. The lock is dropped
+ * while a frame is send, as send_frame may loop back into the core.
+ * Called in an rcu read side critical section.
+ */
+static void dmx512_port_txqueue_run(struct dmx512_port * p)
+{
+	struct dmx512_port_txqueue * q = &p->txqueue;
+	struct dmx512_framequeue_entry * e;
+	unsigned long flags;
+	int sent = 0;
+
+	spin_lock_irqsave(&q->lock, flags);
+	if (q->busy)
+	{
+		spin_unlock_irqrestore(&q->lock, flags);
+		return;
+	}
+	q->busy = 1;
+	while (!q->stopped && (!p->transmitter_has_space || p->transmitter_has_space(p)) &&
+	       ((e = dmx512_txqueue_get(&q->frames)) != 0))
+	{
+		spin_unlock_irqrestore(&q->lock, flags);
+		atomic64_inc(&p->stats.tx_frames);
+		atomic64_add(e->frame.payload_size + 1, &p->stats.tx_bytes);
+		dmx512_histogram_add(&p->stats.tx_latency, ktime_get_ns() - e->queued_ns);
+		dmx512_device_state_update(p->device, p->index, &e->frame, 1);
+		trace_dmx512_tx_send(p->index, e->id);
+		if (dmx512_rdmroute_is_request(&e->frame))
+			dmx512_device_rdmroute_sent(p->device, &e->frame);
+		p->send_frame(p, e);
+		sent = 1;
+		spin_lock_irqsave(&q->lock, flags);
+	}
+	q->busy = 0;
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (sent && wq_has_sleeper(&p->device->txwait_queue))
+		wake_up_interruptible(&p->device->txwait_queue);
+}
+
+int dmx512_port_txqueue_transmit(struct dmx512_port * p, struct dmx512_framequeue_entry * e)
+{
+	struct dmx512_port_txqueue * q = &p->txqueue;
+	struct dmx512_framequeue_entry * replaced = 0;
+	unsigned long flags;
+	int err = -ENOSPC;
+	unsigned int queued = 0;
+
+	e->queued_ns = ktime_get_ns();
+	spin_lock_irqsave(&q->lock, flags);
+	if (!q->stopped && !dmx512_txqueue_put(&q->frames, e, &replaced))
+		err = 0;
+	queued = q->frames.count;
+	spin_unlock_irqrestore(&q->lock, flags);
+	dmx512_stats_high_water(&p->stats.txqueue_high_water, queued);
+
+	if (err)
+	{
+		atomic_inc(&q->dropped);
+		_dmx512_release_frame(e);
+		return err;
+	}
+	if (replaced)
+	{
+		atomic_inc(&q->coalesced);
+		_dmx512_release_frame(replaced);
+	}
+	dmx512_port_txqueue_run(p);
+	return 0;
+}
+
+void dmx512_port_transmitter_ready(struct dmx512_port * port)
+{
+	rcu_read_lock();
+	dmx512_port_txqueue_run(port);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(dmx512_port_transmitter_ready);
+
+/* can sleep, so it is called before the port is added under the lock. */
+static int dmx512_port_txqueue_init(struct dmx512_port * port)
+{
+	struct dmx512_port_txqueue * q = &port->txqueue;
+	spin_lock_init(&q->lock);
+	q->busy = 0;
+	q->stopped = 0;
+	atomic_set(&q->dropped, 0);
+	atomic_set(&q->coalesced, 0);
+	return dmx512_txqueue_init(&q->frames, DMX512_PORT_TXQUEUE_SIZE) ? -ENOMEM : 0;
+}
+
+/* drops all frames still waiting for the transmitter. */
+static void dmx512_port_txqueue_cleanup(struct dmx512_port * port)
+{
+	struct dmx512_port_txqueue * q = &port->txqueue;
+	struct dmx512_framequeue_entry * e;
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->lock, flags);
+	q->stopped = 1;
+	while ((e = dmx512_txqueue_get(&q->frames)) != 0)
+	{
+		spin_unlock_irqrestore(&q->lock, flags);
+		_dmx512_release_frame(e);
+		spin_lock_irqsave(&q->lock, flags);
+	}
+	/* everyone else checks stopped, before the frames are touched. */
+	dmx512_txqueue_cleanup(&q->frames);
+	spin_unlock_irqrestore(&q->lock, flags);
+	if (port->device)
+		wake_up_interruptible(&port->device->txwait_queue);
+}
+
+/* 1 if the frame, or any frame if 0, can be queued on the port without a drop. */
+static int dmx512_port_txqueue_accepts(struct dmx512_port * p, const struct dmx512frame * frame)
+{
+	struct dmx512_port_txqueue * q = &p->txqueue;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&q->lock, flags);
+	ret = q->stopped || dmx512_txqueue_accepts(&q->frames, frame);
+	spin_unlock_irqrestore(&q->lock, flags);
+	return ret;
+}
+
+static int dmx512_port_txqueue_configure(struct dmx512_device * dmx, const struct dmx512_port_txqueue_info * info)
+{
+	struct dmx512_port * p;
+	unsigned long flags;
+
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, info->port);
+	if (p)
+	{
+		spin_lock_irqsave(&p->txqueue.lock, flags);
+		dmx512_txqueue_set_coalesce(&p->txqueue.frames, info->coalesce);
+		spin_unlock_irqrestore(&p->txqueue.lock, flags);
+	}
+	rcu_read_unlock();
+	return p ? 0 : -EINVAL;
+}
+
+static int dmx512_port_txqueue_get(struct dmx512_device * dmx, struct dmx512_port_txqueue_info * info)
+{
+	struct dmx512_port * p;
+	unsigned long flags;
+
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, info->port);
+	if (p)
+	{
+		spin_lock_irqsave(&p->txqueue.lock, flags);
+		info->coalesce = p->txqueue.frames.coalesce;
+		info->size = p->txqueue.frames.size;
+		info->queued = p->txqueue.frames.count;
+		spin_unlock_irqrestore(&p->txqueue.lock, flags);
+		info->dropped = atomic_read(&p->txqueue.dropped);
+		info->coalesced = atomic_read(&p->txqueue.coalesced);
+	}
+	rcu_read_unlock();
+	return p ? 0 : -EINVAL;
+}
+
+/*---- statistics ----*/
+
+static void dmx512_port_get_stats(struct dmx512_port * p, struct dmx512_port_stats * st)
+{
+	const unsigned int port = st->port;
+	memset(st, 0, sizeof(*st));
+	st->port = port;
+	st->txqueue_high_water = atomic_read(&p->stats.txqueue_high_water);
+	st->rx_frames = atomic64_read(&p->stats.rx_frames);
+	st->rx_bytes = atomic64_read(&p->stats.rx_bytes);
+	st->rx_no_frame = atomic64_read(&p->stats.rx_no_frame);
+	st->rx_overruns = atomic64_read(&p->stats.rx_overruns);
+	st->tx_frames = atomic64_read(&p->stats.tx_frames);
+	st->tx_bytes = atomic64_read(&p->stats.tx_bytes);
+	st->tx_queue_full = (unsigned int)atomic_read(&p->txqueue.dropped);
+	st->tx_coalesced = (unsigned int)atomic_read(&p->txqueue.coalesced);
+	st->tx_late = (unsigned int)atomic_read(&p->txschedule.frames.late);
+	st->rdm_timeouts = atomic64_read(&p->stats.rdm_timeouts);
+	st->rdm_collisions = atomic64_read(&p->stats.rdm_collisions);
+	dmx512_histogram_get(&p->stats.tx_latency, st->tx_latency);
+}
+
+static void dmx512_client_get_stats(struct dmx512_client * client, struct dmx512_stats * st)
+{
+	memset(st, 0, sizeof(*st));
+	st->rxqueue_high_water = atomic_read(&client->stats.rxqueue_high_water);
+	st->rx_frames = atomic64_read(&client->stats.rx_frames);
+	st->rx_bytes = atomic64_read(&client->stats.rx_bytes);
+	st->rx_queue_full = atomic64_read(&client->stats.rx_queue_full);
+	st->tx_frames = atomic64_read(&client->stats.tx_frames);
+	st->tx_bytes = atomic64_read(&client->stats.tx_bytes);
+	st->tx_refused = atomic64_read(&client->stats.tx_refused);
+	st->rdm_timeouts = atomic64_read(&client->stats.rdm_timeouts);
+	dmx512_histogram_get(&client->stats.rx_latency, st->rx_latency);
+}
+
+static void dmx512_stats_show_histogram(struct seq_file * m, const char * name, const unsigned int * buckets)
+{
+	unsigned int i;
+	seq_printf(m, "  %s_us:", name);
+	for (i = 0; i < DMX512_STATS_HISTOGRAM_BUCKETS; ++i)
+		seq_printf(m, " %u", buckets[i]);
+	seq_puts(m, "\n");
+}
+
+/* /sys/kernel/debug/dmx512/<device>, the statistics of all ports and open files. */
+static int dmx512_stats_show(struct seq_file * m, void * unused)
+{
+	struct dmx512_device * dmx = m->private;
+	struct dmx512_framepool_info * pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	struct dmx512_client * client;
+	struct dmx512_port * p;
+	unsigned long index, flags;
+
+	if (pool)
+	{
+		dmx512_framepool_get_info(dmx->framepool, pool);
+		seq_printf(m, "framepool: in_use %u peak %u exhausted %u\n",
+			   pool->in_use, pool->peak_in_use, pool->exhausted);
+		kfree(pool);
+	}
+
+	rcu_read_lock();
+	xa_for_each(&dmx->ports_xa, index, p)
+	{
+		struct dmx512_port_stats st;
+		dmx512_port_get_stats(p, &st);
+		seq_printf(m, "port %lu %s:\n", index, p->name);
+		seq_printf(m, "  rx: frames %llu bytes %llu no_frame %llu overruns %llu\n",
+			   st.rx_frames, st.rx_bytes, st.rx_no_frame, st.rx_overruns);
+		seq_printf(m, "  tx: frames %llu bytes %llu queue_full %llu coalesced %llu late %llu high_water %u\n",
+			   st.tx_frames, st.tx_bytes, st.tx_queue_full, st.tx_coalesced, st.tx_late,
+			   st.txqueue_high_water);
+		seq_printf(m, "  rdm: timeouts %llu collisions %llu\n", st.rdm_timeouts, st.rdm_collisions);
+		dmx512_stats_show_histogram(m, "tx_latency", st.tx_latency);
+	}
+	rcu_read_unlock();
+
+	spin_lock_irqsave(&dmx->clients_lock, flags);
+	list_for_each_entry(client, &dmx->clients, deviceclient_item)
+	{
+		struct dmx512_stats st;
+		dmx512_client_get_stats(client, &st);
+		seq_printf(m, "file %p:\n", client);
+		seq_printf(m, "  rx: frames %llu bytes %llu queue_full %llu high_water %u\n",
+			   st.rx_frames, st.rx_bytes, st.rx_queue_full, st.rxqueue_high_water);
+		seq_printf(m, "  tx: frames %llu bytes %llu refused %llu\n", st.tx_frames, st.tx_bytes, st.tx_refused);
+		seq_printf(m, "  rdm: timeouts %llu\n", st.rdm_timeouts);
+		dmx512_stats_show_histogram(m, "rx_latency", st.rx_latency);
+	}
+	spin_unlock_irqrestore(&dmx->clients_lock, flags);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(dmx512_stats);
+
+/*
+ * Send a frame out to the port, the callers reference is consumed.
+ * Returns -ENOSPC if the txqueue was full and the frame was dropped.
+ * Called in an rcu read side critical section.
+ */
+static int dmx512_port_transmit(struct dmx512_device * dmx, struct dmx512_port * p, struct dmx512_framequeue_entry * e)
+{
+	e->frame.flags &= ~DMX512_FLAGS_IS_TRANSMIT_FRAME;
+	dmx512_device_loopback_txframe(dmx, e);
+	if (!dmx512_port_refresh_transmit(p, e))
+		return dmx512_port_txqueue_transmit(p, e);
+	_dmx512_release_frame(e); /* the refresh engine sends a copy later */
+	return 0;
+}
+
+/*
+ * Releases all frames that are due. The lock is dropped while a
+ * frame is send, so frames can be scheduled meanwhile.
+ */
+static enum hrtimer_restart dmx512_port_txschedule_timer(struct hrtimer * timer)
+{
+	struct dmx512_port_txschedule * s = container_of(timer, struct dmx512_port_txschedule, timer);
+	struct dmx512_port * port = container_of(s, struct dmx512_port, txschedule);
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	struct dmx512_framequeue_entry * e;
+	unsigned long flags;
+	long long next;
+
+	rcu_read_lock();
+	spin_lock_irqsave(&s->lock, flags);
+	while ((e = dmx512_txschedule_get_due(&s->frames, ktime_get_ns())) != 0)
+	{
+		spin_unlock_irqrestore(&s->lock, flags);
+		/* counted as dropped in the txqueue and in the schedule. */
+		if (dmx512_port_transmit(port->device, port, e))
+			atomic_inc(&s->frames.dropped);
+		spin_lock_irqsave(&s->lock, flags);
+	}
+	next = dmx512_txschedule_next(&s->frames);
+	/* a frame scheduled on another cpu may have restarted the timer meanwhile. */
+	if ((next >= 0) && !s->stopped && !hrtimer_is_queued(timer))
+	{
+		hrtimer_set_expires(timer, ns_to_ktime(next));
+		restart = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	rcu_read_unlock();
+	return restart;
+}
+
+/* can sleep, so it is called before the port is added under the lock. */
+static int dmx512_port_txschedule_init(struct dmx512_port * port)
+{
+	struct dmx512_port_txschedule * s = &port->txschedule;
+	spin_lock_init(&s->lock);
+	hrtimer_init(&s->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+	s->timer.function = dmx512_port_txschedule_timer;
+	s->stopped = 0;
+	return dmx512_txschedule_init(&s->frames, DMX512_PORT_TXSCHEDULE_SIZE) ? -ENOMEM : 0;
+}
+
+/* stops the timer, no frame is scheduled after it. Waits for the timer, so not under dmx512_lock. */
+static void dmx512_port_txschedule_stop(struct dmx512_port * port)
+{
+	struct dmx512_port_txschedule * s = &port->txschedule;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	s->stopped = 1;
+	spin_unlock_irqrestore(&s->lock, flags);
+	hrtimer_cancel(&s->timer);
+}
+
+/* drops all frames still waiting, the timer has been stopped before. */
+static void dmx512_port_txschedule_cleanup(struct dmx512_port * port)
+{
+	struct dmx512_port_txschedule * s = &port->txschedule;
+	struct dmx512_framequeue_entry * e;
+
+	while ((e = dmx512_txschedule_get(&s->frames)) != 0)
+		_dmx512_release_frame(e);
+	dmx512_txschedule_cleanup(&s->frames);
+}
+
+/* returns -EAGAIN if the schedule is full, the caller still owns the frame then. */
+static int dmx512_port_txschedule_put(struct dmx512_port * port, struct dmx512_framequeue_entry * e, const long long due)
+{
+	struct dmx512_port_txschedule * s = &port->txschedule;
+	unsigned long flags;
+	int first = -1;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (!s->stopped)
+		first = dmx512_txschedule_put(&s->frames, e, due);
+	if (first > 0)
+		hrtimer_start(&s->timer, ns_to_ktime(due), HRTIMER_MODE_ABS_SOFT);
+	spin_unlock_irqrestore(&s->lock, flags);
+	return (first < 0) ? -EAGAIN : 0;
+}
+
+static void dmx512_port_txschedule_get_info(struct dmx512_port * port, struct dmx512_port_txschedule_info * info)
+{
+	struct dmx512_port_txschedule * s = &port->txschedule;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	info->queued = s->frames.count;
+	spin_unlock_irqrestore(&s->lock, flags);
+	info->late = atomic_read(&s->frames.late);
+	info->dropped = atomic_read(&s->frames.dropped);
+}
+
+/*
+ * Merge a frame written to a port, if the port merges. The merged frame
+ * is send in the callers frame, which must not be shared therefore.
+ * Returns 0 if the port does not merge and the caller still owns the
+ * frame. Else the callers reference is consumed and 1 is returned, or
+ * -ENOSPC if the port has no room for another source.
+ * Called in an rcu read side critical section.
+ */
+static int dmx512_port_merge_transmit(struct dmx512_port * p, const unsigned long owner,
+				      const unsigned int priority, struct dmx512_framequeue_entry * e)
+{
+	struct dmx512_port_merge * pm = &p->merge;
+	unsigned long flags;
+	int changed;
+
+	if (!READ_ONCE(pm->merge) || (e->frame.startcode != 0) || dmx512_frame_is_rdm(e))
+		return 0;
+	spin_lock_irqsave(&pm->lock, flags);
+	if (!pm->merge)
+	{
+		spin_unlock_irqrestore(&pm->lock, flags);
+		return 0;
+	}
+	changed = dmx512_merge_put(pm->merge, owner, priority, &e->frame, ktime_get_ns());
+	/* without a refresh, the port sends as often as its sources. */
+	if ((changed > 0) || ((changed == 0) && !READ_ONCE(p->refresh.period)))
+		dmx512_merge_output(pm->merge, &e->frame);
+	else
+		changed = (changed < 0) ? -ENOSPC : -1;
+	spin_unlock_irqrestore(&pm->lock, flags);
+
+	if (changed < 0)
+	{
+		_dmx512_release_frame(e);
+		return (changed == -ENOSPC) ? -ENOSPC : 1;
+	}
+	dmx512_port_transmit(p->device, p, e);
+	return 1;
+}
+
+/* remove a source of the merge of a port and send the output, if it changed. */
+static void dmx512_port_merge_forget(struct dmx512_port * p, const unsigned long owner)
+{
+	struct dmx512_port_merge * pm = &p->merge;
+	struct dmx512_framequeue_entry * e = 0;
+	unsigned long flags;
+
+	if (!READ_ONCE(pm->merge))
+		return;
+	spin_lock_irqsave(&pm->lock, flags);
+	if (pm->merge && dmx512_merge_forget(pm->merge, owner, ktime_get_ns()))
+	{
+		e = _dmx512_alloc_frame(p->device, p->index, GFP_ATOMIC);
+		if (e)
+		{
+			memset(&e->frame, 0, sizeof(e->frame));
+			e->frame.port = p->index;
+			dmx512_merge_output(pm->merge, &e->frame);
+		}
+	}
+	spin_unlock_irqrestore(&pm->lock, flags);
+	if (e)
+		dmx512_port_transmit(p->device, p, e);
+}
+
+/* the file is closed, it is no longer a source of any merge. */
+static void dmx512_client_merge_forget(struct dmx512_client * client)
+{
+	struct dmx512_port * p;
+	unsigned long index;
+
+	rcu_read_lock();
+	xa_for_each(&client->device->ports_xa, index, p)
+		dmx512_port_merge_forget(p, (unsigned long)client);
+	rcu_read_unlock();
+}
+
+/*
+ * A mode of DMX512_MERGE_OFF stops the merge and forgets all sources.
+ * Changing the mode or timeout starts with no sources.
+ */
+static int dmx512_port_merge_configure(struct dmx512_device * dmx, const struct dmx512_port_merge_info * info)
+{
+	struct dmx512_merge * merge = 0;
+	struct dmx512_port * p;
+	unsigned long flags;
+
+	if ((info->mode != DMX512_MERGE_OFF) && (info->mode != DMX512_MERGE_HTP) &&
+	    (info->mode != DMX512_MERGE_LTP) && (info->mode != DMX512_MERGE_PRIORITY))
+		return -EINVAL;
+	if (info->mode != DMX512_MERGE_OFF)
+	{
+		merge = kmalloc(sizeof(*merge), GFP_KERNEL);
+		if (!merge)
+			return -ENOMEM;
+		dmx512_merge_init(merge, info->mode, (long long)info->source_timeout_ms * NSEC_PER_MSEC);
+	}
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, info->port);
+	if (p)
+	{
+		spin_lock_irqsave(&p->merge.lock, flags);
+		swap(p->merge.merge, merge);
+		spin_unlock_irqrestore(&p->merge.lock, flags);
+	}
+	rcu_read_unlock();
+	kfree(merge);
+	return p ? 0 : -EINVAL;
+}
+
+static int dmx512_port_merge_get(struct dmx512_device * dmx, struct dmx512_port_merge_info * info)
+{
+	struct dmx512_port * p;
+	unsigned long flags;
+
+	info->mode = DMX512_MERGE_OFF;
+	info->source_timeout_ms = 0;
+	info->sources = 0;
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, info->port);
+	if (p)
+	{
+		spin_lock_irqsave(&p->merge.lock, flags);
+		if (p->merge.merge)
+		{
+			info->mode = p->merge.merge->mode;
+			info->source_timeout_ms = div_s64(p->merge.merge->source_timeout, NSEC_PER_MSEC);
+			info->sources = dmx512_merge_sources(p->merge.merge, ktime_get_ns());
+		}
+		spin_unlock_irqrestore(&p->merge.lock, flags);
+	}
+	rcu_read_unlock();
+	return p ? 0 : -EINVAL;
+}
+
+/* called with the dmx512_lock held, when the port is removed. */
+static void dmx512_port_merge_cleanup(struct dmx512_port * port)
+{
+	struct dmx512_merge * merge;
+	unsigned long flags;
+
+	spin_lock_irqsave(&port->merge.lock, flags);
+	merge = port->merge.merge;
+	port->merge.merge = 0;
+	spin_unlock_irqrestore(&port->merge.lock, flags);
+	kfree(merge);
+}
+
+/* 1 if the frame can be queued on its port without a drop, or the port is gone. */
+static int dmx512_device_tx_room(struct dmx512_device * dmx, const int port, const struct dmx512frame * frame)
+{
+	struct dmx512_port * p;
+	int ret;
+
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, port);
+	ret = !p || dmx512_port_txqueue_accepts(p, frame);
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * Send a frame, that has been handed in by a client, out to its port.
+ * Frames with a timestamp are scheduled for that time. Other frames
+ * wait for room in the txqueue of the port, or -EAGAIN is returned
+ * if nonblocking is set.
+ * The callers reference to the frame is consumed.
+ */
+static int dmx512_client_send(struct dmx512_client * client, struct dmx512_framequeue_entry * e,
+			      const int nonblocking)
+{
+	struct dmx512_device *dmx = client->device;
+	int err = -EINVAL;
+	struct dmx512_port * p;
+	long long due;
+
+	/* the timestamp is in the clock of the client. */
+	if (dmx512_frame_timestamp_ns(&e->frame))
+	{
+		struct timespec ts = e->frame.timestamp;
+		dmx512_timespec_shift(&ts, -dmx512_client_clock_offset(client));
+		e->frame.timestamp = ts;
+	}
+	due = dmx512_frame_timestamp_ns(&e->frame);
+
+	rcu_read_lock();
+	p = dmx512_port_by_index(dmx, e->frame.port);
+	while (p && !due && !dmx512_port_txqueue_accepts(p, &e->frame))
+	{
+		rcu_read_unlock();
+		if (nonblocking)
+		{
+			WRITE_ONCE(client->tx_blocked_port, e->frame.port);
+			_dmx512_release_frame(e);
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(dmx->txwait_queue,
+					     dmx512_device_tx_room(dmx, e->frame.port, &e->frame)))
+		{
+			_dmx512_release_frame(e);
+			return -ERESTARTSYS;
+		}
+		rcu_read_lock();
+		p = dmx512_port_by_index(dmx, e->frame.port);
+	}
+	WRITE_ONCE(client->tx_blocked_port, -1);
+	if (p)
+	{
+		err = dmx512_port_merge_transmit(p, (unsigned long)client, client->merge_priority, e);
+		if (err)
+		{
+			rcu_read_unlock();
+			return (err < 0) ? err : 0;
+		}
+		/* recorded before it is send, the response may be faster than we are. */
+		if (dmx512_rdmroute_is_request(&e->frame))
+			dmx512_device_rdmroute_request(dmx, client, &e->frame, due);
+		if (due)
+		{
+			e->frame.flags &= ~DMX512_FLAG_TX_LATE;
+			err = dmx512_port_txschedule_put(p, e, due);
+			rcu_read_unlock();
+			if (err)
+				_dmx512_release_frame(e);
+			return err;
+		}
+		dmx512_port_transmit(dmx, p, e);
+		rcu_read_unlock();
+		return 0;
+	}
+	rcu_read_unlock();
+	_dmx512_release_frame(e);
+	return err;
+}
+
+/* dmx512_client_send, counted in the statistics of the client. */
+static int dmx512_client_transmit(struct dmx512_client * client, struct dmx512_framequeue_entry * e,
+				  const int nonblocking)
+{
+	const unsigned int bytes = e->frame.payload_size + 1;
+	const int port = e->frame.port;
+	const unsigned int id = e->id;
+	const int err = dmx512_client_send(client, e, nonblocking);
+	if (err)
+		atomic64_inc(&client->stats.tx_refused);
+	else
+	{
+		trace_dmx512_tx_write(client, port, id);
+		atomic64_inc(&client->stats.tx_frames);
+		atomic64_add(bytes, &client->stats.tx_bytes);
+	}
+	return err;
+}
+
+/*
+ * Copy the next compact record of the iov into frame. Returns the size
+ * of the record, 0 if the rest of the iov does not hold the whole record
+ * or -EFAULT.
+ */
+static ssize_t dmx512_copy_compact_from_iter(struct dmx512frame * frame, struct iov_iter * from)
+{
+	struct dmx512frame_compact h;
+	unsigned int data_size;
+	size_t record_size;
+
+	if (!copy_from_iter_full(&h, sizeof(h), from))
+		return -EFAULT;
+	record_size = DMX512_FRAME_COMPACT_SIZE(h.payload_size);
+	if (iov_iter_count(from) < record_size - sizeof(h))
+	{
+		/* a trailing partial record is not consumed. */
+		iov_iter_revert(from, sizeof(h));
+		return 0;
+	}
+	data_size = dmx512_frame_from_compact(frame, &h);
+	if (!copy_from_iter_full(frame->data, data_size, from))
+		return -EFAULT;
+	iov_iter_advance(from, record_size - sizeof(h) - data_size);
+	return record_size;
+}
+
+/*
+ * Writes all whole frames or compact records of the iov, which may be
+ * split into any number of segments. If a frame can not be send, the
+ * number of bytes written so far is returned or the error if it was the
+ * first frame. With IOCB_NOWAIT the frames are taken from the pool
+ * without waiting for memory, -EAGAIN is returned if there is none.
+ */
+static ssize_t dmx512_device_write_iter (struct kiocb * iocb, struct iov_iter * from)
+{
+	struct dmx512_client *client = (struct dmx512_client *)iocb->ki_filp->private_data;
+	const gfp_t gfp = (iocb->ki_flags & IOCB_NOWAIT) ? GFP_NOWAIT : GFP_KERNEL;
+	const int nonblocking = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+	size_t header_size;
+	ssize_t count = 0;
+	if (!client || !client->device)
+		return -ENODEV;
+
+	header_size = (client->frame_format == DMX512_FRAME_FORMAT_COMPACT) ?
+		sizeof(struct dmx512frame_compact) : sizeof(struct dmx512frame);
+	while (iov_iter_count(from) >= header_size)
+	{
+		struct dmx512_framequeue_entry * e = _dmx512_alloc_frame(client->device, -1, gfp);
+		ssize_t n;
+		int err;
+		if (!e)
+			return count ? count : ((iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM);
+
+		if (client->frame_format == DMX512_FRAME_FORMAT_COMPACT)
+			n = dmx512_copy_compact_from_iter(&e->frame, from);
+		else
+			n = copy_from_iter_full(&e->frame, sizeof(struct dmx512frame), from) ?
+				sizeof(struct dmx512frame) : -EFAULT;
+		if (n <= 0)
+		{
+			_dmx512_release_frame(e);
+			if (n < 0)
+				return count ? count : n;
+			break;
+		}
+		dmx512_framepool_charge(e, e->frame.port);
+		err = dmx512_client_transmit(client, e, nonblocking);
+		if (err)
+			return count ? count : err;
+		count += n;
+	}
+	return count ? count : -EINVAL;
+}
+
+/*---- buffers shared with userspace ----*/
+
+enum {
+	DMX512_BUFFER_STATE_DEQUEUED = 0, /* owned by userspace */
+	DMX512_BUFFER_STATE_QUEUED,       /* enqueued rx buffer, waiting for a frame */
+	DMX512_BUFFER_STATE_DONE          /* ready to be dequeued */
+};
+
+static void dmx512_client_free_buffers(struct dmx512_client_buffers * b)
+{
+	vfree(b->frames);
+	kfree(b->state);
+	kfree(b->rx);
+	kfree(b->done);
+	b->frames = 0;
+	b->state = 0;
+	b->rx = 0;
+	b->done = 0;
+	b->count = 0;
+	b->size = 0;
+	b->rx_head = b->rx_tail = 0;
+	b->done_head = b->done_tail = 0;
+}
+
+static int dmx512_client_allocate_buffers(struct dmx512_client * client, struct dmx512_buffer_request * req)
+{
+	struct dmx512_client_buffers * b = &client->buffers;
+	int err = 0;
+
+	mutex_lock(&b->lock);
+	if (atomic_read(&b->mapped))
+	{
+		err = -EBUSY;
+		goto out;
+	}
+	dmx512_client_free_buffers(b);
+	if (req->count > DMX512_CLIENT_MAX_BUFFERS)
+		req->count = DMX512_CLIENT_MAX_BUFFERS;
+	if (req->count > 0)
+	{
+		b->size = PAGE_ALIGN(req->count * sizeof(struct dmx512frame));
+		b->frames = vmalloc_user(b->size);
+		b->state = kcalloc(req->count, sizeof(*b->state), GFP_KERNEL);
+		b->rx = kcalloc(req->count, sizeof(*b->rx), GFP_KERNEL);
+		b->done = kcalloc(req->count, sizeof(*b->done), GFP_KERNEL);
+		if (!b->frames || !b->state || !b->rx || !b->done)
+		{
+			dmx512_client_free_buffers(b);
+			err = -ENOMEM;
+			goto out;
+		}
+		b->count = req->count;
+	}
+	req->size = sizeof(struct dmx512frame);
+	req->mmap_size = b->size;
+out:
+	mutex_unlock(&b->lock);
+	return err;
+}
+
+static void dmx512_client_buffer_done(struct dmx512_client_buffers * b,
+				      const unsigned int index,
+				      const unsigned int type,
+				      const unsigned int flags)
+{
+	struct dmx512_buffer * d = &b->done[b->done_head++ % b->count];
+	d->index = index;
+	d->type = type;
+	d->flags = flags;
+	b->state[index] = DMX512_BUFFER_STATE_DONE;
+}
+
+static int dmx512_client_enqueue_buffer(struct dmx512_client * client, const struct dmx512_buffer * buf)
+{
+	struct dmx512_client_buffers * b = &client->buffers;
+	int err = 0;
+
+	mutex_lock(&b->lock);
+	if ((buf->index >= b->count) || (b->state[buf->index] != DMX512_BUFFER_STATE_DEQUEUED))
+		err = -EINVAL;
+	else if (buf->type == DMX512_BUFFER_TYPE_RX)
+	{
+		b->state[buf->index] = DMX512_BUFFER_STATE_QUEUED;
+		b->rx[b->rx_head++ % b->count] = buf->index;
+	}
+	else if (buf->type == DMX512_BUFFER_TYPE_TX)
+	{
+		/* The frame is copied within the kernel, the buffer is done right away. */
+		const int port = b->frames[buf->index].port;
+		struct dmx512_framequeue_entry * e = _dmx512_alloc_frame(client->device, port, GFP_KERNEL);
+		if (!e)
+			err = -ENOMEM;
+		else
+		{
+			memcpy(&e->frame, &b->frames[buf->index], sizeof(e->frame));
+			/* the buffers lock is held, so it does not wait for the port. */
+			err = dmx512_client_transmit(client, e, 1);
+			if (err == 0)
+				dmx512_client_buffer_done(b, buf->index, DMX512_BUFFER_TYPE_TX, 0);
+		}
+	}
+	else
+		err = -EINVAL;
+	mutex_unlock(&b->lock);
+	if (err == 0)
+		wake_up(&client->rxwait_queue);
+	return err;
+}
+
+/*
+ * Fill enqueued receive buffers with received frames.
+ * Must be called with the buffers lock held.
+ */
+static void dmx512_client_fill_rxbuffers(struct dmx512_client * client)
+{
+	struct dmx512_client_buffers * b = &client->buffers;
+	while (b->rx_tail != b->rx_head)
+	{
+		const unsigned int index = b->rx[b->rx_tail % b->count];
+		struct dmx512_framequeue_entry * e = dmx512_framerefqueue_get(&client->rxframequeue);
+		if (!e)
+			break;
+		b->rx_tail++;
+		memcpy(&b->frames[index], &e->frame, sizeof(e->frame));
+		dmx512_frame_shift_timestamps(&b->frames[index], dmx512_client_clock_offset(client));
+		trace_dmx512_rx_read(client, e->frame.port, e->id);
+		dmx512_client_count_rx(client, &e->frame, ktime_get_ns());
+		_dmx512_release_frame(e);
+		dmx512_client_buffer_done(b, index, DMX512_BUFFER_TYPE_RX, 0);
+	}
+}
+
+static int dmx512_client_dequeue_ready(struct dmx512_client * client)
+{
+	struct dmx512_client_buffers * b = &client->buffers;
+	return (b->done_tail != b->done_head) ||
+		((b->rx_tail != b->rx_head) && dmx512_client_rx_ready(client));
+}
+
+static int dmx512_client_dequeue_buffer(struct dmx512_client * client, struct dmx512_buffer * buf, const int nonblocking)
+{
+	struct dmx512_client_buffers * b = &client->buffers;
+	while (1)
+	{
+		mutex_lock(&b->lock);
+		if (b->count == 0)
+		{
+			mutex_unlock(&b->lock);
+			return -EINVAL;
+		}
+		dmx512_client_fill_rxbuffers(client);
+		if (b->done_tail != b->done_head)
+		{
+			*buf = b->done[b->done_tail++ % b->count];
+			b->state[buf->index] = DMX512_BUFFER_STATE_DEQUEUED;
+			mutex_unlock(&b->lock);
+			return 0;
+		}
+		mutex_unlock(&b->lock);
+
+		if (nonblocking)
+			return -EAGAIN;
+		if (wait_event_interruptible (client->rxwait_queue, dmx512_client_dequeue_ready(client)))
+			return -ERESTARTSYS;
+	}
+}
+
+static void dmx512_buffers_vm_open(struct vm_area_struct *vma)
+{
+	struct dmx512_client *client = vma->vm_private_data;
+	atomic_inc(&client->buffers.mapped);
+}
+
+static void dmx512_buffers_vm_close(struct vm_area_struct *vma)
+{
+	struct dmx512_client *client = vma->vm_private_data;
+	atomic_dec(&client->buffers.mapped);
+}
+
+static const struct vm_operations_struct dmx512_buffers_vm_ops = {
+	.open  = dmx512_buffers_vm_open,
+	.close = dmx512_buffers_vm_close,
+};
+
+/*---- universe state table ----*/
+
+/* can sleep, so it is called before the device is registered under the lock. */
+static struct dmx512_device_state * dmx512_device_state_alloc(void)
+{
+	struct dmx512_device_state * st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return 0;
+	st->size = PAGE_ALIGN(sizeof(struct dmx512_state_table));
+	st->table = vmalloc_user(st->size);
+	if (!st->table)
+	{
+		kfree(st);
+		return 0;
+	}
+	spin_lock_init(&st->lock);
+	return st;
+}
+
+static void dmx512_device_state_free(struct dmx512_device_state * st)
+{
+	vfree(st->table);
+	kfree(st);
+}
+
+/* the device is gone, the table is freed now or by the last unmap. */
+static void dmx512_device_state_remove(struct dmx512_device * dmx)
+{
+	struct dmx512_device_state * st = rcu_dereference_protected(dmx->state, 1);
+	unsigned long flags;
+	int unused;
+
+	if (!st)
+		return;
+	RCU_INIT_POINTER(dmx->state, 0);
+	synchronize_rcu();
+	spin_lock_irqsave(&st->lock, flags);
+	st->removed = 1;
+	unused = !st->mapped;
+	spin_unlock_irqrestore(&st->lock, flags);
+	if (unused)
+		dmx512_device_state_free(st);
+}
+
+/*
+ * Keep the frame as the latest one of the port. Only frames with the
+ * NULL start code are kept, frames transmitted only with DMX512_STATE_FLAG_TX.
+ */
+static void dmx512_device_state_update(struct dmx512_device * dmx, const unsigned int port,
+				       const struct dmx512frame * frame, const int tx)
+{
+	struct dmx512_device_state * st;
+	struct timespec now;
+	unsigned long flags;
+
+	if ((frame->startcode != 0) || (port >= DMX512_STATE_MAX_PORTS))
+		return;
+	rcu_read_lock();
+	st = rcu_dereference(dmx->state);
+	if (st && (!tx || (READ_ONCE(st->flags) & DMX512_STATE_FLAG_TX)))
+	{
+		dmx512_timespec_now(&now);
+		spin_lock_irqsave(&st->lock, flags);
+		dmx512_port_state_write(tx ? &st->table->tx[port] : &st->table->rx[port], frame, &now);
+		spin_unlock_irqrestore(&st->lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+static int dmx512_device_state_info(struct dmx512_device * dmx, struct dmx512_state_info * info, const int set)
+{
+	struct dmx512_device_state * st;
+	unsigned long flags;
+
+	if (set && (info->flags & ~DMX512_STATE_FLAG_TX))
+		return -EINVAL;
+	rcu_read_lock();
+	st = rcu_dereference(dmx->state);
+	if (st)
+	{
+		spin_lock_irqsave(&st->lock, flags);
+		if (set)
+			st->flags = info->flags;
+		info->flags = st->flags;
+		spin_unlock_irqrestore(&st->lock, flags);
+		info->mmap_size = st->size;
+		info->port_count = DMX512_STATE_MAX_PORTS;
+		info->reserved = 0;
+	}
+	rcu_read_unlock();
+	return st ? 0 : -ENODEV;
+}
+
+static void dmx512_state_vm_open(struct vm_area_struct *vma)
+{
+	struct dmx512_device_state * st = vma->vm_private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&st->lock, flags);
+	++st->mapped;
+	spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void dmx512_state_vm_close(struct vm_area_struct *vma)
+{
+	struct dmx512_device_state * st = vma->vm_private_data;
+	unsigned long flags;
+	int unused;
+
+	spin_lock_irqsave(&st->lock, flags);
+	unused = !--st->mapped && st->removed;
+	spin_unlock_irqrestore(&st->lock, flags);
+	if (unused)
+		dmx512_device_state_free(st);
+}
+
+static const struct vm_operations_struct dmx512_state_vm_ops = {
+	.open  = dmx512_state_vm_open,
+	.close = dmx512_state_vm_close,
+};
+
+/* the table is only mapped read only. */
+static int dmx512_device_state_mmap(struct dmx512_device * dmx, struct vm_area_struct *vma)
+{
+	struct dmx512_device_state * st;
+	unsigned long flags;
+	int err = -ENODEV;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	rcu_read_lock();
+	st = rcu_dereference(dmx->state);
+	if (st)
+	{
+		/* counted before the lock is dropped, so the table stays. */
+		spin_lock_irqsave(&st->lock, flags);
+		err = st->removed ? -ENODEV : 0;
+		if (!err)
+			++st->mapped;
+		spin_unlock_irqrestore(&st->lock, flags);
+	}
+	rcu_read_unlock();
+	if (err)
+		return err;
+
+	err = -EINVAL;
+	if (vma->vm_end - vma->vm_start <= st->size)
+		err = remap_vmalloc_range(vma, st->table, 0);
+	if (err)
+	{
+		vma->vm_private_data = st;
+		dmx512_state_vm_close(vma);
+		return err;
+	}
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_private_data = st;
+	vma->vm_ops = &dmx512_state_vm_ops;
+	return 0;
+}
+
+static int dmx512_device_mmap(struct file * filp, struct vm_area_struct *vma)
+{
+	struct dmx512_client *client = (struct dmx512_client *)filp->private_data;
+	struct dmx512_client_buffers * b;
+	int err;
+	if (!client)
+		return -ENODEV;
+	if (vma->vm_pgoff == (DMX512_STATE_MMAP_OFFSET >> PAGE_SHIFT))
+		return dmx512_device_state_mmap(client->device, vma);
+	b = &client->buffers;
+
+	mutex_lock(&b->lock);
+	err = -EINVAL;
+	if (b->frames && (vma->vm_pgoff == 0) && (vma->vm_end - vma->vm_start <= b->size))
+		err = remap_vmalloc_range(vma, b->frames, 0);
+	if (err == 0)
+	{
+		vma->vm_private_data = client;
+		vma->vm_ops = &dmx512_buffers_vm_ops;
+		dmx512_buffers_vm_open(vma);
+	}
+	mutex_unlock(&b->lock);
+	return err;
+}
+
+static unsigned int dmx512_device_poll (struct file *file, poll_table *wait)
 {
-    printk("dmx512: remove port %s\n", port->name);
+	struct dmx512_client *client = (struct dmx512_client *)file->private_data;
+	if (client)
+	{
+		unsigned int ret;
+		int port;
+		ret = 0;
+		poll_wait(file, &client->rxwait_queue, wait);
+		poll_wait(file, &client->device->txwait_queue, wait);
 
-    list_del(&port->device_item);
-    list_del(&port->portlist_item);
-    port->device = 0;
-    return 0;
+		if (dmx512_client_rx_ready(client))
+			ret |= POLLIN | POLLRDNORM;
+		/* writable, unless the port of the last write that would have blocked is still full. */
+		port = READ_ONCE(client->tx_blocked_port);
+		if ((port < 0) || dmx512_device_tx_room(client->device, port, 0))
+			ret |= POLLOUT | POLLWRNORM;
+		return ret;
+	}
+	return 0;
 }
 
-#define miscdev_to_dmx512device(d) container_of(d, struct dmx512_device, miscdev)
-
-
-static int dmx512_device_open (struct inode *inode, struct file * filp)
+/*
+ * The match code is compiled before the clients_lock is taken,
+ * replaced codes are freed after it is released.
+ */
+static int dmx512_client_set_rxfilter(struct dmx512_client * client, const struct dmx512_rxfilter_info * info)
 {
-    struct dmx512_device *dmx = miscdev_to_dmx512device(filp->private_data);
-    if (!dmx)
-	return -ENODEV;
-    filp->private_data = dmx;
-
-    if (!try_module_get(dmx->owner))
-	return -ENODEV;
+	struct dmx512_rxfilter_code * code;
+	struct dmx512_rxfilter_code * old;
+	struct dmx512_matchcode_term * terms;
+	const unsigned int count = info->matchcode_size / sizeof(*terms);
+	unsigned long flags;
+	int err;
+
+	if ((info->matchcode_size % sizeof(*terms)) || !count || (count > DMX512_RXFILTER_MAX_TERMS))
+		return -EINVAL;
+	terms = memdup_user(u64_to_user_ptr(info->matchcode), info->matchcode_size);
+	if (IS_ERR(terms))
+		return PTR_ERR(terms);
+	code = dmx512_rxfilter_compile(terms, count);
+	kfree(terms);
+	if (!code)
+		return -EINVAL;
+
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	err = dmx512_rxfilter_set(&client->rxfilter, info->matchcodes_index, code, &old);
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+	if (err)
+	{
+		dmx512_rxfilter_free(code);
+		return (info->matchcodes_index == -1) ? -ENOSPC : -EINVAL;
+	}
+	dmx512_rxfilter_free(old);
+	return 0;
+}
 
-    printk("open dmx512 device %s\n", dmx->name);
+static int dmx512_client_remove_rxfilter(struct dmx512_client * client, const int index)
+{
+	struct dmx512_rxfilter_code * old[DMX512_RXFILTER_MAX_MATCHCODES];
+	unsigned int count = 0;
+	unsigned long flags;
+	int err = 0;
 
-    return 0;
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	if (index == -1)
+	{
+		while (client->rxfilter.count)
+			dmx512_rxfilter_remove(&client->rxfilter, client->rxfilter.count - 1, &old[count++]);
+	}
+	else if (dmx512_rxfilter_remove(&client->rxfilter, index, &old[count]))
+		err = -EINVAL;
+	else
+		++count;
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
+	while (count)
+		dmx512_rxfilter_free(old[--count]);
+	return err;
 }
 
-static int dmx512_device_release (struct inode * inode, struct file * filp)
+static int dmx512_client_get_rxfilter(struct dmx512_client * client, struct dmx512_rxfilter_info * info)
 {
-    struct dmx512_device *dmx = (struct dmx512_device *)filp->private_data;
-    if (!dmx)
-	return -ENODEV;
+	struct dmx512_matchcode_term * terms = 0;
+	const unsigned int size = info->matchcode_size;
+	unsigned long flags;
+	int err = 0;
+
+	spin_lock_irqsave(&client->device->clients_lock, flags);
+	info->matchcodes_size = client->rxfilter.count;
+	info->matchcode_size = 0;
+	if (info->matchcodes_index == -1)
+		; /* only the number of match codes is requested. */
+	else if ((info->matchcodes_index < 0) || (info->matchcodes_index >= (int)client->rxfilter.count))
+		err = -EINVAL;
+	else
+	{
+		const struct dmx512_rxfilter_code * code = client->rxfilter.codes[info->matchcodes_index];
+		info->matchcode_size = code->term_count * sizeof(*terms);
+		if (info->matchcode && (size >= info->matchcode_size))
+		{
+			terms = kmemdup(code->terms, info->matchcode_size, GFP_ATOMIC);
+			if (!terms)
+				err = -ENOMEM;
+		}
+	}
+	spin_unlock_irqrestore(&client->device->clients_lock, flags);
 
-    printk("close dmx512 device %s\n", dmx->name);
+	if (terms && copy_to_user(u64_to_user_ptr(info->matchcode), terms, info->matchcode_size))
+		err = -EFAULT;
+	kfree(terms);
+	return err;
+}
 
-    module_put(dmx->owner);
+/*
+ * Send a frame received on source out on the destination of a route.
+ * Called in an rcu read side critical section.
+ */
+static void dmx512_route_transmit(const struct dmx512_route * r, struct dmx512_port * source,
+				  const struct dmx512frame * frame)
+{
+	struct dmx512_port * p = dmx512_port_by_index(r->dest_device, r->dest_port);
+	struct dmx512_framequeue_entry * e;
+	unsigned int count = 0;
 
-    return 0;
+	if (r->slot_count)
+	{
+		if (frame->payload_size < r->source_slot)
+			return;
+		count = min_t(unsigned int, r->slot_count, frame->payload_size - r->source_slot + 1);
+	}
+	if (!p)
+		return;
+	e = _dmx512_alloc_frame(r->dest_device, r->dest_port, GFP_ATOMIC);
+	if (!e)
+		return;
+	memcpy(&e->frame, frame, sizeof(e->frame));
+	if (r->slot_count)
+	{
+		memset(e->frame.payload, 0, sizeof(e->frame.payload));
+		memcpy(&e->frame.data[r->dest_slot], &frame->data[r->source_slot], count);
+		e->frame.payload_size = r->dest_slot - 1 + count;
+	}
+	e->frame.port = r->dest_port;
+	e->routed = 1;
+	if (!dmx512_port_merge_transmit(p, (unsigned long)source, r->priority, e))
+		dmx512_port_transmit(r->dest_device, p, e);
 }
 
-static ssize_t dmx512_device_read (struct file * filp, char __user * buf, size_t size, loff_t * off)
+/*
+ * Forward a frame with the NULL start code received on
+ * port along all routes of the port. A frame that was send by a
+ * route and is received again, e.g. on a loopback, is not forwarded,
+ * so a cycle of routes does not send it forever.
+ */
+static void dmx512_port_route_frame(struct dmx512_port * port, const struct dmx512_framequeue_entry * e)
 {
-    struct dmx512_device *dmx = (struct dmx512_device *)filp->private_data;
-    struct dmx512_framequeue_entry * e;
+	const struct dmx512frame * frame = &e->frame;
+	struct dmx512_device * dmx = port->device;
+	const struct dmx512_routes * routes;
+	unsigned int i;
+
+	if ((frame->startcode != 0) || e->routed)
+		return;
+	rcu_read_lock();
+	routes = rcu_dereference(dmx->routes);
+	for (i = 0; routes && (i < routes->count); ++i)
+		if (routes->routes[i].source_port == frame->port)
+			dmx512_route_transmit(&routes->routes[i], port, frame);
+	rcu_read_unlock();
+}
 
-    if (size < sizeof(struct dmx512frame))
-        return -EINVAL;
+/* the registered device with that name, called with the dmx512_lock held. */
+static struct dmx512_device * _dmx512_device_by_name(const char * name)
+{
+	struct dmx512_device * dev;
+	list_for_each_entry(dev, &dmx512_devices, devicelist_item)
+		if (dev->name && !strcmp(dev->name, name))
+			return dev;
+	return 0;
+}
 
-    if (dmx512_framequeue_isempty(&dmx->rxframequeue))
-    {
-	    if (filp->f_flags & O_NONBLOCK)
-		    return -EAGAIN;
-	    wait_event_interruptible (dmx->rxwait_queue, 0==dmx512_framequeue_isempty(&dmx->rxframequeue));
-    }
-    e = dmx512_framequeue_get (&dmx->rxframequeue);
-    if (e)
-    {
-        const int stat = copy_to_user (buf, &(e->frame), sizeof(struct dmx512frame));
-        dmx512_framequeue_put(&free_framequeue, e);
-        if (stat==0)
-          return sizeof(struct dmx512frame);
-    }
-    return 0;
+/*
+ * Replace the route at index or append it if index is -1, or remove
+ * the route at index, or all if index is -1, if route is 0.
+ * The new table is filled in by the caller with the routes in use.
+ * Called with the dmx512_lock held.
+ */
+static int _dmx512_routes_change(struct dmx512_routes * routes, const int index,
+				 const struct dmx512_route * route)
+{
+	if (route && (index == -1))
+	{
+		if (routes->count >= DMX512_ROUTES_MAX)
+			return -ENOSPC;
+		routes->routes[routes->count++] = *route;
+		return 0;
+	}
+	if (!route && (index == -1))
+	{
+		routes->count = 0;
+		return 0;
+	}
+	if ((index < 0) || (index >= (int)routes->count))
+		return -EINVAL;
+	if (route)
+		routes->routes[index] = *route;
+	else
+	{
+		memmove(&routes->routes[index], &routes->routes[index+1],
+			(routes->count - index - 1) * sizeof(routes->routes[0]));
+		--routes->count;
+	}
+	return 0;
 }
 
-static ssize_t dmx512_device_write (struct file * filp, const char __user * buf, size_t size, loff_t * off)
+/*
+ * Set the route of info at index, or remove the route at index if info
+ * is 0, see _dmx512_routes_change. The table is allocated before the
+ * dmx512_lock is taken and the old one is freed after all readers left it.
+ */
+static int dmx512_device_change_routes(struct dmx512_device * dmx, const int index,
+				       const struct dmx512_route_info * info)
 {
-	ssize_t err = -ENODEV;
-	struct dmx512_device *dmx = (struct dmx512_device *)filp->private_data;
-	if (dmx)
+	struct dmx512_routes * routes = kzalloc(sizeof(*routes), GFP_KERNEL);
+	struct dmx512_routes * old = 0;
+	struct dmx512_route route;
+	const int remove = !info;
+	int err = 0;
+
+	if (!routes)
+		return -ENOMEM;
+	if (!remove)
 	{
-		// do not remove the entry from the queue, just get the port-number from the top entry.
-		// then find the port for that entry and if the port is not ready then:
-		// either return -EAGAIN or -EBUSY if the device is opened with O_NONBLOCK
-		// or wait until the port becomes ready again.
-		// then fetch the entry from the queue and send it to the port.
-		struct dmx512_framequeue_entry * e = dmx512_framequeue_get (&free_framequeue);
-		if (!e)
-			return -ENOMEM;
+		if (info->slot_count &&
+		    (!info->source_slot || !info->dest_slot ||
+		     (info->source_slot + info->slot_count > 513) ||
+		     (info->dest_slot + info->slot_count > 513)))
+		{
+			kfree(routes);
+			return -EINVAL;
+		}
+		route.source_port = info->source_port;
+		route.dest_port = info->dest_port;
+		route.source_slot = info->slot_count ? info->source_slot : 0;
+		route.dest_slot = info->slot_count ? info->dest_slot : 0;
+		route.slot_count = info->slot_count;
+		route.priority = info->priority ? info->priority : DMX512_MERGE_DEFAULT_PRIORITY;
+		if (route.priority > DMX512_MERGE_MAX_PRIORITY)
+		{
+			kfree(routes);
+			return -EINVAL;
+		}
+	}
 
-		err = -EINVAL;
-		if ((size >= sizeof(struct dmx512frame)) && !copy_from_user (&e->frame, buf, sizeof(struct dmx512frame)))
+	DMX512_LOCKED(
+		old = rcu_dereference_protected(dmx->routes, lockdep_is_held(&dmx512_lock));
+		if (old)
+		{
+			routes->count = old->count;
+			memcpy(routes->routes, old->routes, old->count * sizeof(old->routes[0]));
+		}
+		if (!remove)
 		{
-			struct dmx512_port * p = dmx512_port_by_index(dmx, e->frame.port);
-			if (p)
+			route.dest_device = info->dest_device[0] ? _dmx512_device_by_name(info->dest_device) : dmx;
+			if (!route.dest_device)
 			{
-#if 0
-				if (!(filp->f_flags & O_NONBLOCK) && p->transmitter_has_space && !p->transmitter_has_space(p))
-				{
-					wait_event_interruptible (p->txwait_queue, p->transmitter_has_space(p));
-				}
-#endif
-				if ((p->transmitter_has_space==0) || p->transmitter_has_space(p))
-				{
-					// dmx512_framequeue_put(&dmx->txframequeue, e);
-					p->send_frame(p, e);
-					return sizeof(struct dmx512frame);
-				}
-				err = -EAGAIN; // or -EBUSY
+				err = -ENODEV;
+				break;
 			}
 		}
-		dmx512_framequeue_put(&free_framequeue, e);
-	}
+		err = _dmx512_routes_change(routes, index, remove ? 0 : &route);
+		if (err)
+			break;
+		rcu_assign_pointer(dmx->routes, routes);
+		routes = 0;
+	);
+	if (routes)
+		kfree(routes);
+	else if (old)
+		kfree_rcu(old, rcu);
 	return err;
 }
 
-
-static unsigned int dmx512_device_poll (struct file *file, poll_table *wait)
+static int dmx512_device_get_route(struct dmx512_device * dmx, struct dmx512_route_info * info)
 {
-	struct dmx512_device *dmx = (struct dmx512_device *)file->private_data;
-	if (dmx)
+	const struct dmx512_routes * routes;
+	const int index = info->route_index;
+	int err = 0;
+
+	memset(info, 0, sizeof(*info));
+	info->route_index = index;
+	rcu_read_lock();
+	routes = rcu_dereference(dmx->routes);
+	info->routes_size = routes ? routes->count : 0;
+	if ((index >= 0) && (index < (int)info->routes_size))
 	{
-		unsigned int ret;
-		ret = 0;
-		poll_wait(file, &dmx->rxwait_queue, wait);
+		const struct dmx512_route * r = &routes->routes[index];
+		info->source_port = r->source_port;
+		info->dest_port = r->dest_port;
+		info->source_slot = r->source_slot;
+		info->dest_slot = r->dest_slot;
+		info->slot_count = r->slot_count;
+		info->priority = r->priority;
+		if (r->dest_device != dmx)
+			strscpy(info->dest_device, r->dest_device->name, sizeof(info->dest_device));
+	}
+	else if (index != -1)
+		err = -EINVAL;
+	rcu_read_unlock();
+	return err;
+}
 
-		if (!dmx512_framequeue_isempty(&dmx->rxframequeue))
-			ret |= POLLIN | POLLRDNORM;
-#if 0
-		if(dmx512_framequeue_isempty(&dmx->txframequeue)) // buffer not full. write wont block
-			ret |= POLLOUT | POLLWRNORM;
-#endif
-		return ret;
+/*
+ * Drop the routes from and to a device that goes away.
+ * Called with the dmx512_lock held, so a table that can not be
+ * allocated drops all routes of a device.
+ */
+static void _dmx512_remove_routes(struct dmx512_device * gone)
+{
+	struct dmx512_device * dev;
+	list_for_each_entry(dev, &dmx512_devices, devicelist_item)
+	{
+		struct dmx512_routes * old = rcu_dereference_protected(dev->routes, lockdep_is_held(&dmx512_lock));
+		struct dmx512_routes * routes = 0;
+		unsigned int i;
+		if (!old)
+			continue;
+		if (dev != gone)
+		{
+			for (i = 0; i < old->count; ++i)
+				if (old->routes[i].dest_device == gone)
+					break;
+			if (i == old->count)
+				continue;
+			routes = kzalloc(sizeof(*routes), GFP_ATOMIC);
+			for (i = 0; routes && (i < old->count); ++i)
+				if (old->routes[i].dest_device != gone)
+					routes->routes[routes->count++] = old->routes[i];
+		}
+		rcu_assign_pointer(dev->routes, routes);
+		kfree_rcu(old, rcu);
 	}
-	return 0;
 }
 
 static long dmx512_device_ioctl (struct file * filp,
 				 unsigned int command,
 				 unsigned long arg)
 {
-	return 0;
+	struct dmx512_client *client = (struct dmx512_client *)filp->private_data;
+	void __user * argp = (void __user *)arg;
+	u64 mask;
+
+	if (!client)
+		return -ENODEV;
+
+	switch (command)
+	{
+	case DMX512_IOCTL_ALLOCATE_DMX_BUFFERS:
+	{
+		struct dmx512_buffer_request req;
+		int err;
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		err = dmx512_client_allocate_buffers(client, &req);
+		if (err)
+			return err;
+		return copy_to_user(argp, &req, sizeof(req)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_ENQUEUE_DMX_BUFFER:
+	{
+		struct dmx512_buffer buf;
+		if (copy_from_user(&buf, argp, sizeof(buf)))
+			return -EFAULT;
+		return dmx512_client_enqueue_buffer(client, &buf);
+	}
+
+	case DMX512_IOCTL_DEQUEUE_DMX_BUFFER:
+	{
+		struct dmx512_buffer buf;
+		const int err = dmx512_client_dequeue_buffer(client, &buf, filp->f_flags & O_NONBLOCK);
+		if (err)
+			return err;
+		return copy_to_user(argp, &buf, sizeof(buf)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_GET_FRAMEPOOL_INFO:
+	{
+		struct dmx512_framepool_info * info = kmalloc(sizeof(*info), GFP_KERNEL);
+		int err;
+		if (!info)
+			return -ENOMEM;
+		dmx512_framepool_get_info(client->device->framepool, info);
+		err = copy_to_user(argp, info, sizeof(*info)) ? -EFAULT : 0;
+		kfree(info);
+		return err;
+	}
+
+	case DMX512_IOCTL_SET_ROUTE:
+	case DMX512_IOCTL_REM_ROUTE:
+	{
+		struct dmx512_route_info info;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		info.dest_device[sizeof(info.dest_device)-1] = 0;
+		/* a route to another device sends on ports the opener may not have access to. */
+		if ((command == DMX512_IOCTL_SET_ROUTE) && info.dest_device[0] &&
+		    strcmp(info.dest_device, client->device->name) && !capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return dmx512_device_change_routes(client->device, info.route_index,
+						   (command == DMX512_IOCTL_SET_ROUTE) ? &info : 0);
+	}
+
+	case DMX512_IOCTL_GET_ROUTE:
+	{
+		struct dmx512_route_info info;
+		int err;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		err = dmx512_device_get_route(client->device, &info);
+		if (err)
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_SET_STATE_INFO:
+	{
+		struct dmx512_state_info info;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		return dmx512_device_state_info(client->device, &info, 1);
+	}
+
+	case DMX512_IOCTL_GET_STATE_INFO:
+	{
+		struct dmx512_state_info info;
+		int err = dmx512_device_state_info(client->device, &info, 0);
+		if (err)
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_SET_PORT_REFRESH:
+	case DMX512_IOCTL_GET_PORT_REFRESH:
+	{
+		struct dmx512_port_refresh_info info;
+		struct dmx512_port * port;
+		int err = 0;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		rcu_read_lock();
+		port = dmx512_port_by_index(client->device, info.port);
+		if (!port)
+			err = -EINVAL;
+		else if (command == DMX512_IOCTL_SET_PORT_REFRESH)
+			err = dmx512_port_refresh_configure(port, info.period_us, info.min_gap_us);
+		else
+			dmx512_port_refresh_get(port, &info.period_us, &info.min_gap_us);
+		rcu_read_unlock();
+		if (err || (command == DMX512_IOCTL_SET_PORT_REFRESH))
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_SET_PORT_MERGE:
+	case DMX512_IOCTL_GET_PORT_MERGE:
+	{
+		struct dmx512_port_merge_info info;
+		int err;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		if (command == DMX512_IOCTL_SET_PORT_MERGE)
+			return dmx512_port_merge_configure(client->device, &info);
+		err = dmx512_port_merge_get(client->device, &info);
+		if (err)
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_GET_PORT_STATS:
+	{
+		struct dmx512_port_stats * st = kmalloc(sizeof(*st), GFP_KERNEL);
+		struct dmx512_port * port;
+		int err = 0;
+		if (!st)
+			return -ENOMEM;
+		if (copy_from_user(&st->port, argp, sizeof(st->port)))
+			err = -EFAULT;
+		else
+		{
+			rcu_read_lock();
+			port = dmx512_port_by_index(client->device, st->port);
+			if (port)
+				dmx512_port_get_stats(port, st);
+			else
+				err = -EINVAL;
+			rcu_read_unlock();
+		}
+		if (!err && copy_to_user(argp, st, sizeof(*st)))
+			err = -EFAULT;
+		kfree(st);
+		return err;
+	}
+
+	case DMX512_IOCTL_GET_STATS:
+	{
+		struct dmx512_stats * st = kmalloc(sizeof(*st), GFP_KERNEL);
+		int err;
+		if (!st)
+			return -ENOMEM;
+		dmx512_client_get_stats(client, st);
+		err = copy_to_user(argp, st, sizeof(*st)) ? -EFAULT : 0;
+		kfree(st);
+		return err;
+	}
+
+	case DMX512_IOCTL_SET_PORT_TXQUEUE:
+	case DMX512_IOCTL_GET_PORT_TXQUEUE:
+	{
+		struct dmx512_port_txqueue_info info;
+		int err;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		if (command == DMX512_IOCTL_SET_PORT_TXQUEUE)
+			return dmx512_port_txqueue_configure(client->device, &info);
+		err = dmx512_port_txqueue_get(client->device, &info);
+		if (err)
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_GET_PORT_TXSCHEDULE_INFO:
+	{
+		struct dmx512_port_txschedule_info info;
+		struct dmx512_port * port;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		rcu_read_lock();
+		port = dmx512_port_by_index(client->device, info.port);
+		if (port)
+			dmx512_port_txschedule_get_info(port, &info);
+		rcu_read_unlock();
+		if (!port)
+			return -EINVAL;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_SET_RX_MATCH_FILTER:
+	case DMX512_IOCTL_REM_RX_MATCH_FILTER:
+	{
+		struct dmx512_rxfilter_info info;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		if (command == DMX512_IOCTL_SET_RX_MATCH_FILTER)
+			return dmx512_client_set_rxfilter(client, &info);
+		return dmx512_client_remove_rxfilter(client, info.matchcodes_index);
+	}
+
+	case DMX512_IOCTL_GET_RX_MATCH_FILTER:
+	{
+		struct dmx512_rxfilter_info info;
+		int err;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		err = dmx512_client_get_rxfilter(client, &info);
+		if (err)
+			return err;
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	case DMX512_IOCTL_VERSION:
+		return put_user((unsigned long)DMX4LINUX2_VERSION, (unsigned long __user *)argp);
+
+	case DMX512_IOCTL_SET_PORT_FILTER:
+	case DMX512_IOCTL_SET_PORT_TXFILTER:
+		if (copy_from_user(&mask, argp, sizeof(mask)))
+			return -EFAULT;
+		return dmx512_client_set_ports(client,
+					       (command == DMX512_IOCTL_SET_PORT_TXFILTER) ? DMX512_PORT_BITMAP_TX : DMX512_PORT_BITMAP_RX,
+					       &mask, 64);
+
+	case DMX512_IOCTL_GET_PORT_FILTER:
+	case DMX512_IOCTL_GET_PORT_TXFILTER:
+		dmx512_client_get_ports(client,
+					(command == DMX512_IOCTL_GET_PORT_TXFILTER) ? DMX512_PORT_BITMAP_TX : DMX512_PORT_BITMAP_RX,
+					&mask, 64);
+		return copy_to_user(argp, &mask, sizeof(mask)) ? -EFAULT : 0;
+
+	case DMX512_IOCTL_SET_PORT_BITMAP:
+	{
+		struct dmx512_port_bitmap pb;
+		u64 * bitmap = 0;
+		int err;
+		if (copy_from_user(&pb, argp, sizeof(pb)))
+			return -EFAULT;
+		if ((pb.direction != DMX512_PORT_BITMAP_RX) && (pb.direction != DMX512_PORT_BITMAP_TX))
+			return -EINVAL;
+		if (pb.port_count > DMX512_PORT_BITMAP_MAX_PORTS)
+			return -EINVAL;
+		if (pb.port_count)
+		{
+			bitmap = memdup_user(u64_to_user_ptr(pb.bitmap), ((pb.port_count + 63) / 64) * sizeof(*bitmap));
+			if (IS_ERR(bitmap))
+				return PTR_ERR(bitmap);
+		}
+		err = dmx512_client_set_ports(client, pb.direction, bitmap, pb.port_count);
+		kfree(bitmap);
+		return err;
+	}
+
+	case DMX512_IOCTL_GET_PORT_BITMAP:
+	{
+		struct dmx512_port_bitmap pb;
+		u64 * bitmap = 0;
+		size_t size;
+		int err = 0;
+		if (copy_from_user(&pb, argp, sizeof(pb)))
+			return -EFAULT;
+		if ((pb.direction != DMX512_PORT_BITMAP_RX) && (pb.direction != DMX512_PORT_BITMAP_TX))
+			return -EINVAL;
+		if (pb.port_count > DMX512_PORT_BITMAP_MAX_PORTS)
+			pb.port_count = DMX512_PORT_BITMAP_MAX_PORTS;
+		size = ((pb.port_count + 63) / 64) * sizeof(*bitmap);
+		if (pb.bitmap && size)
+		{
+			bitmap = kmalloc(size, GFP_KERNEL);
+			if (!bitmap)
+				return -ENOMEM;
+		}
+		pb.port_count = dmx512_client_get_ports(client, pb.direction, bitmap, pb.port_count);
+		if (bitmap && copy_to_user(u64_to_user_ptr(pb.bitmap), bitmap, size))
+			err = -EFAULT;
+		kfree(bitmap);
+		if (!err && copy_to_user(argp, &pb, sizeof(pb)))
+			err = -EFAULT;
+		return err;
+	}
+
+	case DMX512_IOCTL_SET_TIMESTAMP_CLOCK:
+	{
+		int clock;
+		if (get_user(clock, (int __user *)argp))
+			return -EFAULT;
+		if ((clock != CLOCK_MONOTONIC) && (clock != CLOCK_TAI))
+			return -EINVAL;
+		client->clock = clock;
+		return 0;
+	}
+
+	case DMX512_IOCTL_GET_TIMESTAMP_CLOCK:
+		return put_user(client->clock, (int __user *)argp);
+
+	case DMX512_IOCTL_SET_RX_MODE:
+	{
+		struct dmx512_subscription * sub;
+		unsigned long flags;
+		int mode;
+		if (get_user(mode, (int __user *)argp))
+			return -EFAULT;
+		if ((mode != DMX512_RX_MODE_ALL) && (mode != DMX512_RX_MODE_CHANGES))
+			return -EINVAL;
+		spin_lock_irqsave(&client->device->clients_lock, flags);
+		client->rx_mode = mode;
+		list_for_each_entry(sub, &client->subscriptions, client_item)
+			sub->rx_generation = 0;
+		spin_unlock_irqrestore(&client->device->clients_lock, flags);
+		return 0;
+	}
+
+	case DMX512_IOCTL_GET_RX_MODE:
+		return put_user(client->rx_mode, (int __user *)argp);
+
+	case DMX512_IOCTL_SET_FRAME_FORMAT:
+	{
+		int format;
+		if (get_user(format, (int __user *)argp))
+			return -EFAULT;
+		if ((format != DMX512_FRAME_FORMAT_FULL) && (format != DMX512_FRAME_FORMAT_COMPACT))
+			return -EINVAL;
+		client->frame_format = format;
+		return 0;
+	}
+
+	case DMX512_IOCTL_GET_FRAME_FORMAT:
+		return put_user(client->frame_format, (int __user *)argp);
+
+	case DMX512_IOCTL_SET_MERGE_PRIORITY:
+	{
+		int priority;
+		if (get_user(priority, (int __user *)argp))
+			return -EFAULT;
+		if ((priority < 0) || (priority > DMX512_MERGE_MAX_PRIORITY))
+			return -EINVAL;
+		client->merge_priority = priority;
+		return 0;
+	}
+
+	case DMX512_IOCTL_GET_MERGE_PRIORITY:
+		return put_user((int)client->merge_priority, (int __user *)argp);
+
+	case DMX512_IOCTL_SET_RX_MODERATION:
+	{
+		struct dmx512_rx_moderation info;
+		if (copy_from_user(&info, argp, sizeof(info)))
+			return -EFAULT;
+		return dmx512_client_set_moderation(client, &info);
+	}
+
+	case DMX512_IOCTL_GET_RX_MODERATION:
+	{
+		struct dmx512_rx_moderation info;
+		dmx512_client_get_moderation(client, &info);
+		return copy_to_user(argp, &info, sizeof(info)) ? -EFAULT : 0;
+	}
+
+	default:
+		break;
+	}
+	return -ENOTTY;
 }
 
 static const struct file_operations dmx512_device_fops = {
     .open    = dmx512_device_open,
     .release = dmx512_device_release,
 
-    .read  = dmx512_device_read,
-    .write = dmx512_device_write,
+    .read_iter  = dmx512_device_read_iter,
+    .write_iter = dmx512_device_write_iter,
     .poll  = dmx512_device_poll,
+    .mmap  = dmx512_device_mmap,
 
     .unlocked_ioctl = dmx512_device_ioctl,
     // long (*unlocked_ioctl) (struct file *, unsigned int, unsigned long);
@@ -206,15 +2617,25 @@ static int _register_dmx512_device(struct dmx512_device * dev, void * data)
     dev->data = data;
 
     INIT_LIST_HEAD(&dev->ports);
-    init_waitqueue_head(&dev->rxwait_queue);
-    dmx512_framequeue_init(&dev->rxframequeue);
-
+    xa_init_flags(&dev->ports_xa, XA_FLAGS_ALLOC);
+    xa_init(&dev->subscribers_xa);
+    INIT_LIST_HEAD(&dev->clients);
+    spin_lock_init(&dev->clients_lock);
+    init_waitqueue_head(&dev->txwait_queue);
+    dmx512_rdmroute_init(&dev->rdmroute);
+    hrtimer_init(&dev->rdmroute_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+    dev->rdmroute_timer.function = dmx512_device_rdmroute_timer;
+    dev->rdmroute_stopped = 0;
+
+    RCU_INIT_POINTER(dev->routes, 0);
     list_add(&dev->devicelist_item, &dmx512_devices);
 
     dev->miscdev.minor = MISC_DYNAMIC_MINOR;
     dev->miscdev.name = kasprintf(GFP_KERNEL, "dmx-%s", dev->name);
     dev->miscdev.fops = &dmx512_device_fops;
     err = misc_register(&dev->miscdev);
+    if (err)
+	list_del(&dev->devicelist_item);
     return err;
 }
 
@@ -222,14 +2643,37 @@ static int _unregister_dmx512_device(struct dmx512_device * dev)
 {
     /* remove all ports */
     struct dmx512_port *port, *tmp;
-    wake_up(&dev->rxwait_queue);
+    struct dmx512_client *client;
+    struct dmx512_port_subscribers *subs;
+    unsigned long index, flags;
+    spin_lock_irqsave(&dev->clients_lock, flags);
+    list_for_each_entry(client, &dev->clients, deviceclient_item)
+	wake_up(&client->rxwait_queue);
+    dmx512_rdmroute_init(&dev->rdmroute);
+    spin_unlock_irqrestore(&dev->clients_lock, flags);
     misc_deregister(&dev->miscdev);
     list_for_each_entry_safe(port, tmp, &dev->ports, device_item) {
 	_dmx512_remove_port(port);
-	kfree(port);
+	kfree_rcu(port, rcu);
+    }
+    xa_destroy(&dev->ports_xa);
+
+    /* clients still open keep their subscriptions until they are released. */
+    xa_for_each(&dev->subscribers_xa, index, subs) {
+	struct dmx512_subscription *sub, *stmp;
+	spin_lock_irqsave(&dev->clients_lock, flags);
+	list_for_each_entry_safe(sub, stmp, &subs->rx, port_item)
+	    list_del_init(&sub->port_item);
+	list_for_each_entry_safe(sub, stmp, &subs->tx, port_item)
+	    list_del_init(&sub->port_item);
+	spin_unlock_irqrestore(&dev->clients_lock, flags);
+	/* a reader that loads it after the erase finds none. */
+	xa_erase(&dev->subscribers_xa, index);
+	kfree_rcu(subs, rcu);
     }
+    xa_destroy(&dev->subscribers_xa);
+    _dmx512_remove_routes(dev);
     list_del(&dev->devicelist_item);
-    dmx512_framequeue_cleanup(&dev->rxframequeue);
     return 0;
 }
 
@@ -242,38 +2686,6 @@ static int _devm_register_dmx512_device(struct device * dev, struct dmx512_devic
 }
 
 
-static int _dmx512_port_index(struct dmx512_port * port)
-{
-    int index = 0;
-    struct dmx512_port *p, *tmp;
-    if (port == 0)
-	return -1;
-    list_for_each_entry_safe(p, tmp, &port->device->ports, device_item) {
-	if (port == p)
-	    return index;
-	index++;
-    }
-    return -1;
-}
-
-/*
- * _dmx512_port_by_index(device, 1) returns the second port.
- */
-static struct dmx512_port * _dmx512_port_by_index(struct dmx512_device * device, const int index)
-{
-    int i = 0;
-    struct dmx512_port *port, *tmp;
-    if (device == 0)
-	return 0;
-    list_for_each_entry_safe(port, tmp, &device->ports, device_item) {
-	if (index == i)
-	    return port;
-	i++;
-    }
-    return 0;
-}
-
-
 /*---- public functions ----*/
 
 struct dmx512_device * dmx512_create_device(const char * name)
@@ -304,17 +2716,49 @@ EXPORT_SYMBOL(dmx512_delete_device);
 
 int register_dmx512_device(struct dmx512_device * dev, void * data)
 {
+    struct dmx512_device_state * st = dmx512_device_state_alloc();
     int ret;
+    if (!st)
+	return -ENOMEM;
+    RCU_INIT_POINTER(dev->state, st);
+    /*
+     * frames of the device may still be queued to open files or other
+     * devices after it is unregistered, so the pool is allocated and
+     * goes away with the last frame. It allocates, so not under the lock.
+     */
+    dev->framepool = dmx512_framepool_create(dmx512_frame_cache,
+					     framepool_low, framepool_high, framepool_max);
+    if (!dev->framepool) {
+	dmx512_device_state_remove(dev);
+	return -ENOMEM;
+    }
     DMX512_LOCKED(ret = _register_dmx512_device(dev, data));
+    if (ret) {
+	dmx512_framepool_cleanup(dev->framepool);
+	dev->framepool = 0;
+	dmx512_device_state_remove(dev);
+    } else
+	dev->debugfs = debugfs_create_file(dev->miscdev.name, 0444, dmx512_debugfs_root,
+					   dev, &dmx512_stats_fops);
     return ret;
 }
 EXPORT_SYMBOL(register_dmx512_device);
 
 int unregister_dmx512_device(struct dmx512_device * dev)
 {
+    struct dmx512_port * port;
     int ret = 0;
     if (dev) {
+            debugfs_remove(dev->debugfs);
+            dev->debugfs = 0;
+            dmx512_device_rdmroute_stop(dev);
+            /* the driver does not add or remove ports while it unregisters the device. */
+            list_for_each_entry(port, &dev->ports, device_item)
+                    dmx512_port_stop_timers(port);
             DMX512_LOCKED(ret = _unregister_dmx512_device(dev));
+            dmx512_framepool_cleanup(dev->framepool);
+            dev->framepool = 0;
+            dmx512_device_state_remove(dev);
     }
     return ret;
 }
@@ -353,6 +2797,7 @@ struct dmx512_port * dmx512_create_port(struct dmx512_device *dmx,
 		return ERR_PTR(-ENOMEM);
 
         port->device = dmx;
+        port->index = -1;
         strcpy(port->name, portname);
         port->capabilities = capabilities;
         port->send_frame = 0;
@@ -364,7 +2809,7 @@ void dmx512_delete_port(struct dmx512_port * port)
 {
         if (port) {
                 dmx512_remove_port(port);
-                kfree(port);
+                kfree_rcu(port, rcu);
         }
 }
 EXPORT_SYMBOL(dmx512_delete_port);
@@ -380,13 +2825,36 @@ void dmx512_port_set_sendframe(struct dmx512_port *port,
 }
 EXPORT_SYMBOL(dmx512_port_set_sendframe);
 
+void dmx512_port_set_rx_timestamp(struct dmx512_port *port,
+                                  void (*callback_fn) (struct dmx512_port *,
+                                                       struct dmx512_framequeue_entry *)
+        )
+{
+        if (port)
+                port->rx_timestamp = callback_fn;
+}
+EXPORT_SYMBOL(dmx512_port_set_rx_timestamp);
+
                                         
                                         
 
 int dmx512_add_port(struct dmx512_device * dev, struct dmx512_port *port)
 {
-    int ret;
+    int ret = dmx512_port_txschedule_init(port);
+    if (ret)
+	return ret;
+    ret = dmx512_port_txqueue_init(port);
+    if (ret)
+    {
+	dmx512_txschedule_cleanup(&port->txschedule.frames);
+	return ret;
+    }
     DMX512_LOCKED(ret=_dmx512_add_port(dev, port));
+    if (ret)
+    {
+	dmx512_txschedule_cleanup(&port->txschedule.frames);
+	dmx512_txqueue_cleanup(&port->txqueue.frames);
+    }
     return ret;
 }
 EXPORT_SYMBOL(dmx512_add_port);
@@ -394,24 +2862,33 @@ EXPORT_SYMBOL(dmx512_add_port);
 int dmx512_remove_port(struct dmx512_port *port)
 {
     int ret;
+    if (port->device)
+        dmx512_port_stop_timers(port);
     DMX512_LOCKED(ret=_dmx512_remove_port(port));
     return ret;
 }
 EXPORT_SYMBOL(dmx512_remove_port);
 
+/*
+ * Lock free lookup of a port. The caller has to be in an rcu read side
+ * critical section or otherwise make sure the port is not removed
+ * while it is used.
+ */
 struct dmx512_port * dmx512_port_by_index(struct dmx512_device * device, const int index)
 {
     struct dmx512_port * port;
-    DMX512_LOCKED(port = _dmx512_port_by_index(device,index));
+    if (!device || (index < 0))
+	return 0;
+    rcu_read_lock();
+    port = xa_load(&device->ports_xa, index);
+    rcu_read_unlock();
     return port;
 }
 EXPORT_SYMBOL(dmx512_port_by_index);
 
 int dmx512_port_index(struct dmx512_port * port)
 {
-    int ret;
-    DMX512_LOCKED(ret = _dmx512_port_index(port));
-    return ret;
+    return port ? port->index : -1;
 }
 EXPORT_SYMBOL(dmx512_port_index);
 
@@ -435,13 +2912,47 @@ const char * dmx512_port_name(struct dmx512_port * port)
 EXPORT_SYMBOL(dmx512_port_name);
 
 
+/*
+ * Returns the generation of a received frame with the NULL start code,
+ * 0 for other frames.
+ * The generation only changes, if the slots differ from the last frame.
+ */
+static unsigned int dmx512_port_rx_generation(struct dmx512_port * port, struct dmx512_framequeue_entry * frame)
+{
+	struct dmx512_framequeue_entry * last = port->rx_last;
+	if ((frame->frame.startcode != 0) || dmx512_frame_is_rdm(frame))
+		return 0;
+	if (last && dmx512_frame_data_equal(&last->frame, &frame->frame))
+		return port->rx_generation;
+	port->rx_last = dmx512_frame_ref(frame);
+	if (last)
+		_dmx512_release_frame(last);
+	if (++port->rx_generation == 0)
+		port->rx_generation = 1;
+	return port->rx_generation;
+}
+
 int dmx512_received_frame(struct dmx512_port *port, struct dmx512_framequeue_entry * frame)
 {
 	if (!port || !port->device)
 		return -1;
 	frame->frame.port = dmx512_port_index(port);
-	dmx512_framequeue_put(&port->device->rxframequeue, frame);
-	wake_up (&port->device->rxwait_queue);
+	frame->frame.flags &= ~DMX512_FLAGS_IS_TRANSMIT_FRAME;
+	if (port->rx_timestamp)
+		port->rx_timestamp(port, frame);
+	if (!(frame->frame.flags & DMX512_FLAG_BACK_TIMESTAMP))
+		dmx512_frame_timestamp_back(frame);
+	trace_dmx512_rx_complete(frame->frame.port, frame->id);
+	atomic64_inc(&port->stats.rx_frames);
+	atomic64_add(frame->frame.payload_size + 1, &port->stats.rx_bytes);
+	if ((frame->frame.flags & DMX512_FLAG_IS_RDM_DISC) &&
+	    ((frame->frame.flags & DMX512_FLAG_RDMCRC_INVALID) == DMX512_FLAG_RDMCRC_INVALID))
+		atomic64_inc(&port->stats.rdm_collisions);
+	dmx512_device_state_update(port->device, frame->frame.port, &frame->frame, 0);
+	if (dmx512_device_rdmroute_response(port->device, frame))
+		return 0;
+	dmx512_port_route_frame(port, frame);
+	dmx512_device_deliver_frame(port->device, frame, dmx512_port_rx_generation(port, frame));
 
 	return 0;
 }
@@ -449,41 +2960,79 @@ EXPORT_SYMBOL(dmx512_received_frame);
 
 void dmx512_put_frame(struct dmx512_port *port, struct dmx512_framequeue_entry * frame)
 {
-	(void)port;
-	/* we may later use the port to control the per port usage of frames
-	   or have some accounting. */
-	dmx512_framequeue_put(&free_framequeue, frame);
+	if (port && frame)
+		trace_dmx512_tx_complete(dmx512_port_index(port), frame->id);
+	_dmx512_release_frame(frame);
 }
 EXPORT_SYMBOL(dmx512_put_frame);
 
+/*
+ * Drivers call this from their interrupt handlers, so the pool
+ * only grows with GFP_ATOMIC here. The frame is charged to the port.
+ */
 struct dmx512_framequeue_entry * dmx512_get_frame(struct dmx512_port *port)
 {
-	(void)port;
-	/* we may later use the port to control the per port usage of frames
-	   or have some accounting. */
-	return dmx512_framequeue_get (&free_framequeue);
+	struct dmx512_framequeue_entry * e;
+	if (!port || !port->device)
+		return 0;
+	e = _dmx512_alloc_frame(port->device, dmx512_port_index(port), GFP_ATOMIC);
+	if (e)
+	{
+		/* frames are reused, a driver only sets the flags it knows about. */
+		e->frame.flags = 0;
+		memset(&e->frame.timestamp, 0, sizeof(e->frame.timestamp));
+		memset(&e->frame.back_timestamp, 0, sizeof(e->frame.back_timestamp));
+	}
+	else
+		atomic64_inc(&port->stats.rx_no_frame);
+	return e;
 }
 EXPORT_SYMBOL(dmx512_get_frame);
 
+void dmx512_port_rx_overrun(struct dmx512_port *port)
+{
+	if (port)
+		atomic64_inc(&port->stats.rx_overruns);
+}
+EXPORT_SYMBOL(dmx512_port_rx_overrun);
+
+void dmx512_frame_timestamp_front(struct dmx512_framequeue_entry * frame)
+{
+	struct timespec ts;
+	dmx512_timespec_now(&ts);
+	frame->frame.timestamp = ts;
+	frame->frame.flags |= DMX512_FLAG_TIMESTAMP;
+	trace_dmx512_rx_break(frame->charged_port, frame->id);
+}
+EXPORT_SYMBOL(dmx512_frame_timestamp_front);
+
+void dmx512_frame_timestamp_back(struct dmx512_framequeue_entry * frame)
+{
+	struct timespec ts;
+	dmx512_timespec_now(&ts);
+	frame->frame.back_timestamp = ts;
+	frame->frame.flags |= DMX512_FLAG_BACK_TIMESTAMP;
+}
+EXPORT_SYMBOL(dmx512_frame_timestamp_back);
+
 
 
 static int __init dmx512_core_init(void)
 {
-	int i;
 	printk(KERN_INFO "loading dmx512 core\n");
 
-	dmx512_framequeue_init(&free_framequeue);
-	/* put some frame in the freequeue */
-	for (i = 0; i < 16; ++i)
-		dmx512_framequeue_put(&free_framequeue, dmx512_framequeue_entry_alloc());
-
+	dmx512_frame_cache = dmx512_framepool_create_cache();
+	if (!dmx512_frame_cache)
+		return -ENOMEM;
+	dmx512_debugfs_root = debugfs_create_dir("dmx512", 0);
         return 0;
 }
 
 static void __exit dmx512_core_exit(void)
 {
     printk(KERN_INFO "unloading dmx512 core\n");
-    dmx512_framequeue_cleanup(&free_framequeue);
+    debugfs_remove_recursive(dmx512_debugfs_root);
+    kmem_cache_destroy(dmx512_frame_cache);
 }
 
 module_init(dmx512_core_init);
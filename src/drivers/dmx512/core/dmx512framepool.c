@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512framepool.h>
+
+#include <linux/atomic.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+struct kmem_cache * dmx512_framepool_create_cache(void)
+{
+    return kmem_cache_create("dmx512_frame",
+			     sizeof(struct dmx512_framequeue_entry),
+			     0, SLAB_HWCACHE_ALIGN, NULL);
+}
+
+static void dmx512_framepool_account(struct dmx512_framepool * pool, const int port, const int n)
+{
+    if ((port >= 0) && (port < DMX512_FRAMEPOOL_PORTS))
+	atomic_add(n, &pool->port_in_use[port]);
+}
+
+/* allocate a new frame from the cache, if the pool is allowed to grow. */
+static struct dmx512_framequeue_entry * dmx512_framepool_grow(struct dmx512_framepool * pool, gfp_t gfp)
+{
+    struct dmx512_framequeue_entry * e = 0;
+    if (atomic_inc_return(&pool->allocated) <= (int)pool->max_frames)
+	e = kmem_cache_alloc(pool->cache, gfp);
+    if (!e)
+	atomic_dec(&pool->allocated);
+    return e;
+}
+
+static void dmx512_framepool_shrink(struct dmx512_framepool * pool, struct dmx512_framequeue_entry * e)
+{
+    kmem_cache_free(pool->cache, e);
+    atomic_dec(&pool->allocated);
+}
+
+int dmx512_framepool_init(struct dmx512_framepool * pool, struct kmem_cache * cache,
+			  const unsigned int low_watermark,
+			  const unsigned int high_watermark,
+			  const unsigned int max_frames)
+{
+    unsigned int size = 1;
+    unsigned int i;
+    if (!pool || !cache || (low_watermark > high_watermark) || (high_watermark > max_frames))
+	return -1;
+    memset(pool, 0, sizeof(*pool));
+    pool->cache = cache;
+    pool->low_watermark = low_watermark;
+    pool->high_watermark = high_watermark;
+    pool->max_frames = max_frames;
+
+    /* the free queue never holds more than high_watermark frames. */
+    while (size < high_watermark)
+	size <<= 1;
+    if (dmx512_framequeue_init(&pool->free, size))
+	return -1;
+    atomic_set(&pool->users, 1);
+
+    for (i = 0; i < low_watermark; ++i)
+    {
+	struct dmx512_framequeue_entry * e = dmx512_framepool_grow(pool, GFP_KERNEL);
+	if (!e)
+	    break;
+	dmx512_framequeue_put(&pool->free, e);
+    }
+    return 0;
+}
+
+struct dmx512_framepool * dmx512_framepool_create(struct kmem_cache * cache,
+						  const unsigned int low_watermark,
+						  const unsigned int high_watermark,
+						  const unsigned int max_frames)
+{
+    struct dmx512_framepool * pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+    if (!pool)
+	return 0;
+    if (dmx512_framepool_init(pool, cache, low_watermark, high_watermark, max_frames))
+    {
+	kfree(pool);
+	return 0;
+    }
+    pool->dynamic = 1;
+    return pool;
+}
+
+static void dmx512_framepool_drain(struct dmx512_framepool * pool)
+{
+    struct dmx512_framequeue_entry * e;
+    while ((e = dmx512_framequeue_get(&pool->free)) != 0)
+	dmx512_framepool_shrink(pool, e);
+}
+
+/* the last frame in use was put after the owner let go of the pool. */
+static void dmx512_framepool_unuse(struct dmx512_framepool * pool)
+{
+    if (!atomic_dec_and_test(&pool->users))
+	return;
+    dmx512_framepool_drain(pool);
+    dmx512_framequeue_cleanup(&pool->free);
+    if (pool->dynamic)
+	kfree(pool);
+}
+
+/*
+ * Frees all unused frames. Frames still in use, e.g. queued to a file
+ * that is still open, keep the pool until they are put.
+ */
+void dmx512_framepool_cleanup(struct dmx512_framepool * pool)
+{
+    if (!pool || !pool->cache)
+	return;
+    dmx512_framepool_drain(pool);
+    dmx512_framepool_unuse(pool);
+}
+
+struct dmx512_framequeue_entry * dmx512_framepool_get(struct dmx512_framepool * pool, const int port, gfp_t gfp)
+{
+    struct dmx512_framequeue_entry * e;
+    int in_use, peak;
+    if (!pool)
+	return 0;
+    e = dmx512_framequeue_get(&pool->free);
+    if (!e)
+    {
+	e = dmx512_framepool_grow(pool, gfp);
+	if (!e)
+	{
+	    atomic_inc(&pool->exhausted);
+	    return 0;
+	}
+	atomic_inc(&pool->grown);
+    }
+    atomic_inc(&pool->users);
+    atomic_set(&e->refcount, 1);
+    e->pool = pool;
+    e->id = (unsigned int)atomic_inc_return(&pool->next_id);
+    e->charged_port = port;
+    e->routed = 0;
+    dmx512_framepool_account(pool, port, 1);
+
+    in_use = atomic_inc_return(&pool->in_use);
+    peak = atomic_read(&pool->peak_in_use);
+    while (in_use > peak)
+    {
+	const int prev = atomic_cmpxchg(&pool->peak_in_use, peak, in_use);
+	if (prev == peak)
+	    break;
+	peak = prev;
+    }
+    return e;
+}
+
+void dmx512_framepool_put(struct dmx512_framequeue_entry * e)
+{
+    struct dmx512_framepool * pool;
+    if (!e || !dmx512_frame_unref(e))
+	return;
+    pool = e->pool;
+    dmx512_framepool_account(pool, e->charged_port, -1);
+    atomic_dec(&pool->in_use);
+    if ((atomic_read(&pool->allocated) - atomic_read(&pool->in_use) > (int)pool->high_watermark) ||
+	dmx512_framequeue_put(&pool->free, e))
+    {
+	dmx512_framepool_shrink(pool, e);
+	atomic_inc(&pool->shrunk);
+    }
+    dmx512_framepool_unuse(pool);
+}
+
+void dmx512_framepool_charge(struct dmx512_framequeue_entry * e, const int port)
+{
+    if (!e || !e->pool || (e->charged_port == port))
+	return;
+    dmx512_framepool_account(e->pool, e->charged_port, -1);
+    dmx512_framepool_account(e->pool, port, 1);
+    e->charged_port = port;
+}
+
+void dmx512_framepool_get_info(struct dmx512_framepool * pool, struct dmx512_framepool_info * info)
+{
+    int i;
+    memset(info, 0, sizeof(*info));
+    if (!pool)
+	return;
+    info->allocated = atomic_read(&pool->allocated);
+    info->in_use = atomic_read(&pool->in_use);
+    info->peak_in_use = atomic_read(&pool->peak_in_use);
+    info->low_watermark = pool->low_watermark;
+    info->high_watermark = pool->high_watermark;
+    info->max_frames = pool->max_frames;
+    info->grown = atomic_read(&pool->grown);
+    info->shrunk = atomic_read(&pool->shrunk);
+    info->exhausted = atomic_read(&pool->exhausted);
+    for (i = 0; i < DMX512_FRAMEPOOL_PORTS; ++i)
+	info->port_in_use[i] = atomic_read(&pool->port_in_use[i]);
+}
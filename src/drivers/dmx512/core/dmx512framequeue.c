@@ -4,105 +4,245 @@
  */
 #include <linux/dmx512/dmx512framequeue.h>
 
-#include <linux/list.h>
-#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/compiler.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/time.h>
 
-static struct dmx512_framequeue_entry * _dmx512_framequeue_get (struct dmx512_framequeue * q);
+static int dmx512_framequeue_size_valid(const unsigned int size)
+{
+    return size && ((size & (size - 1)) == 0);
+}
 
-void dmx512_framequeue_init(struct dmx512_framequeue *q)
+/*
+ * The free queue is a bounded mpmc queue as described by Dmitry Vyukov.
+ * Each cell carries a sequence number. A cell can be written at position
+ * pos if its sequence is pos and read if its sequence is pos+1.
+ * A producer or consumer first claims the position with a cmpxchg and
+ * then publishes the cell by advancing its sequence.
+ *
+ * If a put is interrupted between claim and publish, a get from the
+ * interrupt sees the queue as empty at that cell. The receiver then
+ * has to drop the frame, which is what happens if the pool is empty anyway.
+ */
+int dmx512_framequeue_init(struct dmx512_framequeue *q, const unsigned int size)
 {
-    if (!q)
-	return;
-    INIT_LIST_HEAD(&q->head);
-    spin_lock_init(&q->queue_lock);
+    unsigned int i;
+    if (!q || !dmx512_framequeue_size_valid(size))
+	return -1;
+    q->cells = kzalloc(size * sizeof(*q->cells), GFP_KERNEL);
+    if (!q->cells)
+	return -1;
+    for (i = 0; i < size; ++i)
+	atomic_set(&q->cells[i].sequence, i);
+    q->mask = size - 1;
+    atomic_set(&q->enqueue_pos, 0);
+    atomic_set(&q->dequeue_pos, 0);
+    return 0;
 }
 
+/* frees all entries still queued. */
 void dmx512_framequeue_cleanup(struct dmx512_framequeue * q)
 {
     struct dmx512_framequeue_entry *e;
-    if (!q)
+    if (!q || !q->cells)
 	return;
-    spin_lock (&q->queue_lock);
-    while ((e=_dmx512_framequeue_get (q)) != 0)
+    while ((e=dmx512_framequeue_get (q)) != 0)
 	dmx512_framequeue_entry_free(e);
-    spin_unlock (&q->queue_lock);
+    kfree(q->cells);
+    q->cells = 0;
 }
 
 int  dmx512_framequeue_isempty(struct dmx512_framequeue * q)
 {
-    int ret = 1;
-    spin_lock (&q->queue_lock);
-    ret = list_empty(&q->head);
-    spin_unlock (&q->queue_lock);
-    return ret;
+    if (!q->cells)
+	return 1;
+    return atomic_read(&q->dequeue_pos) == atomic_read(&q->enqueue_pos);
 }
 
-static struct dmx512_framequeue_entry * _dmx512_framequeue_get (struct dmx512_framequeue * q)
+struct dmx512_framequeue_entry * dmx512_framequeue_get (struct dmx512_framequeue * q)
 {
-    struct dmx512_framequeue_entry * e = NULL;
-    if (!q)
+    struct dmx512_framequeue_cell * cell;
+    struct dmx512_framequeue_entry * e;
+    unsigned int pos;
+    if (!q || !q->cells)
 	return 0;
-    if (!list_empty(&q->head))
+    pos = atomic_read(&q->dequeue_pos);
+    for (;;)
     {
-        e = (struct dmx512_framequeue_entry *)(q->head.next);
-        if (e)
-            list_del(&e->head);
+	int diff;
+	cell = &q->cells[pos & q->mask];
+	diff = (int)((unsigned int)atomic_read_acquire(&cell->sequence) - (pos + 1));
+	if (diff == 0)
+	{
+	    const unsigned int prev = atomic_cmpxchg(&q->dequeue_pos, pos, pos + 1);
+	    if (prev == pos)
+		break;
+	    pos = prev;
+	}
+	else if (diff < 0)
+	    return 0; /* empty */
+	else
+	    pos = atomic_read(&q->dequeue_pos);
     }
+    e = cell->entry;
+    cell->entry = 0;
+    atomic_set_release(&cell->sequence, pos + q->mask + 1);
     return e;
 }
 
-struct dmx512_framequeue_entry * dmx512_framequeue_get (struct dmx512_framequeue * q)
+/* returns -1 if the queue is full, the caller still owns the entry then. */
+int  dmx512_framequeue_put(struct dmx512_framequeue * q, struct dmx512_framequeue_entry * e)
 {
-    struct dmx512_framequeue_entry * e = NULL;
-    if (!q)
-	return 0;
-    spin_lock (&q->queue_lock);
-    e = _dmx512_framequeue_get (q);
-    spin_unlock (&q->queue_lock);
-    return e;
+    struct dmx512_framequeue_cell * cell;
+    unsigned int pos;
+    if (!q || !q->cells || !e)
+	return -1;
+    pos = atomic_read(&q->enqueue_pos);
+    for (;;)
+    {
+	int diff;
+	cell = &q->cells[pos & q->mask];
+	diff = (int)((unsigned int)atomic_read_acquire(&cell->sequence) - pos);
+	if (diff == 0)
+	{
+	    const unsigned int prev = atomic_cmpxchg(&q->enqueue_pos, pos, pos + 1);
+	    if (prev == pos)
+		break;
+	    pos = prev;
+	}
+	else if (diff < 0)
+	    return -1; /* full */
+	else
+	    pos = atomic_read(&q->enqueue_pos);
+    }
+    cell->entry = e;
+    atomic_set_release(&cell->sequence, pos + 1);
+    return 0;
 }
 
-static struct dmx512_framequeue_entry * _dmx512_framequeue_front (struct dmx512_framequeue * q)
+/*
+ * The refqueue holds references to frames. A frame can be queued to many
+ * refqueues at the same time, each holding one reference to it.
+ * The size must be a power of two.
+ */
+int dmx512_framerefqueue_init(struct dmx512_framerefqueue *q, const unsigned int size)
+{
+    if (!q || !dmx512_framequeue_size_valid(size))
+	return -1;
+    q->ring = kzalloc(size * sizeof(*q->ring), GFP_KERNEL);
+    if (!q->ring)
+	return -1;
+    q->mask = size - 1;
+    q->rdm_reserve = size / 8;
+    atomic_set(&q->head, 0);
+    atomic_set(&q->tail, 0);
+    atomic_set(&q->dropped, 0);
+    return 0;
+}
+
+/*
+ * The queue must be drained with dmx512_framerefqueue_get before,
+ * as the refqueue does not know where the frames are returned to.
+ */
+void dmx512_framerefqueue_cleanup(struct dmx512_framerefqueue * q)
 {
-    struct dmx512_framequeue_entry * e = NULL;
     if (!q)
-	return 0;
-    if (!list_empty(&q->head))
-        e = (struct dmx512_framequeue_entry *)(q->head.next);
-    return e;
+	return;
+    kfree(q->ring);
+    q->ring = 0;
+}
+
+int  dmx512_framerefqueue_isempty(struct dmx512_framerefqueue * q)
+{
+    return atomic_read(&q->tail) == atomic_read_acquire(&q->head);
+}
+
+unsigned int dmx512_framerefqueue_count(struct dmx512_framerefqueue * q)
+{
+    /* the tail is read first, it never passes the head read after it. */
+    const unsigned int tail = atomic_read(&q->tail);
+    return (unsigned int)atomic_read_acquire(&q->head) - tail;
+}
+
+unsigned int dmx512_framerefqueue_capacity(struct dmx512_framerefqueue * q)
+{
+    return q->mask + 1 - q->rdm_reserve;
 }
 
 /*
- * Do not get(remove) the entry, just return a reference to the front entry.
+ * Remove the oldest frame from the queue. The reference the queue
+ * held on the frame is handed over to the caller.
  */
-struct dmx512_framequeue_entry * dmx512_framequeue_front (struct dmx512_framequeue * q)
+struct dmx512_framequeue_entry * dmx512_framerefqueue_get (struct dmx512_framerefqueue * q)
 {
-    struct dmx512_framequeue_entry * e = NULL;
+    unsigned int tail;
     if (!q)
 	return 0;
-    spin_lock (&q->queue_lock);
-    e = _dmx512_framequeue_front (q);
-    spin_unlock (&q->queue_lock);
-    return e;
+    tail = atomic_read(&q->tail);
+    for (;;)
+    {
+	struct dmx512_framequeue_entry * e;
+	unsigned int prev;
+	if (tail == (unsigned int)atomic_read_acquire(&q->head))
+	    return 0;
+	e = READ_ONCE(q->ring[tail & q->mask]);
+	/* the producer may have dropped this frame meanwhile. */
+	prev = atomic_cmpxchg(&q->tail, tail, tail + 1);
+	if (prev == tail)
+	    return e;
+	tail = prev;
+    }
 }
 
-int  dmx512_framequeue_put(struct dmx512_framequeue * q, struct dmx512_framequeue_entry * e)
+/*
+ * Queue a new reference to the frame. If the frame does not fit, either
+ * the oldest frame or the new one is dropped (see the overflow policy)
+ * and returned, so the caller can drop the reference the queue held
+ * on it. Else 0 is returned.
+ * Only one producer may call this at a time.
+ */
+struct dmx512_framequeue_entry * dmx512_framerefqueue_put(struct dmx512_framerefqueue * q, struct dmx512_framequeue_entry * e)
 {
+    const unsigned int size = q ? q->mask + 1 : 0;
+    struct dmx512_framequeue_entry * dropped = 0;
+    unsigned int head, tail, limit;
     if (!q || !e)
-	return -1;
-    spin_lock (&q->queue_lock);
-    list_add_tail(&e->head, &q->head);
-    spin_unlock (&q->queue_lock);
-    return 0;
+	return 0;
+    dmx512_frame_ref(e);
+    limit = dmx512_frame_is_rdm(e) ? size : size - q->rdm_reserve;
+    head = atomic_read(&q->head);
+    tail = atomic_read(&q->tail);
+    while (head - tail >= limit)
+    {
+	struct dmx512_framequeue_entry * oldest = READ_ONCE(q->ring[tail & q->mask]);
+	unsigned int prev;
+	if (dmx512_frame_is_rdm(oldest))
+	{
+	    atomic_inc(&q->dropped);
+	    return e;
+	}
+	prev = atomic_cmpxchg(&q->tail, tail, tail + 1);
+	if (prev == tail)
+	{
+	    atomic_inc(&q->dropped);
+	    dropped = oldest;
+	    break;
+	}
+	tail = prev; /* a reader was faster, check again */
+    }
+    WRITE_ONCE(q->ring[head & q->mask], e);
+    atomic_set_release(&q->head, head + 1);
+    return dropped;
 }
 
 struct dmx512_framequeue_entry * dmx512_framequeue_entry_alloc()
 {
     struct dmx512_framequeue_entry * e = kzalloc(sizeof(*e), GFP_KERNEL);
-    if (e) {
-	INIT_LIST_HEAD(&e->head);
-    }
+    if (e)
+	atomic_set(&e->refcount, 0);
     return e;
 }
 
@@ -110,6 +250,91 @@ void dmx512_framequeue_entry_free(struct dmx512_framequeue_entry * e)
 {
     if (!e)
 	return;
-    // list_del(&e->head); /* remove from list, if not allready done. */
     kfree(e);
 }
+
+/*
+ * The slots are compared in blocks of 64 octets. Within a block the
+ * differences of the words are or'ed without a branch, so the compiler
+ * can vectorize it. The check is cheaper than copying the frame to a
+ * client that does not need it.
+ */
+int dmx512_frame_data_equal(const struct dmx512frame * a, const struct dmx512frame * b)
+{
+    const uint8_t * pa = a->data;
+    const uint8_t * pb = b->data;
+    unsigned int size = a->payload_size + 1; /* some drivers count the start code, some do not. */
+    unsigned int i = 0;
+    if (a->payload_size != b->payload_size)
+	return 0;
+    if (size > sizeof(a->data))
+	size = sizeof(a->data);
+    for (; i + 64 <= size; i += 64)
+    {
+	uint64_t diff = 0;
+	unsigned int j;
+	for (j = 0; j < 64; j += 8)
+	{
+	    uint64_t x, y;
+	    memcpy(&x, pa + i + j, sizeof(x));
+	    memcpy(&y, pb + i + j, sizeof(y));
+	    diff |= x ^ y;
+	}
+	if (diff)
+	    return 0;
+    }
+    for (; i < size; ++i)
+	if (pa[i] != pb[i])
+	    return 0;
+    return 1;
+}
+
+static long long dmx512_timespec_to_ns(const struct timespec ts)
+{
+    return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct timespec dmx512_ns_to_timespec(const long long ns)
+{
+    struct timespec ts;
+    s32 rem;
+    ts.tv_sec = div_s64_rem(ns, NSEC_PER_SEC, &rem);
+    ts.tv_nsec = rem;
+    if (rem < 0)
+    {
+	--ts.tv_sec;
+	ts.tv_nsec += NSEC_PER_SEC;
+    }
+    return ts;
+}
+
+unsigned int dmx512_frame_to_compact(const struct dmx512frame * frame,
+				     struct dmx512frame_compact * h,
+				     const long long offset)
+{
+    h->port = frame->port;
+    h->flags = frame->flags;
+    h->breaksize = frame->breaksize;
+    h->unused = 0;
+    h->payload_size = frame->payload_size;
+    h->timestamp = dmx512_timespec_to_ns(frame->timestamp);
+    h->back_timestamp = dmx512_timespec_to_ns(frame->back_timestamp);
+    if (frame->flags & DMX512_FLAG_TIMESTAMP)
+	h->timestamp += offset;
+    if (frame->flags & DMX512_FLAG_BACK_TIMESTAMP)
+	h->back_timestamp += offset;
+    return DMX512_FRAME_COMPACT_DATA_SIZE(frame->payload_size);
+}
+
+unsigned int dmx512_frame_from_compact(struct dmx512frame * frame,
+				       const struct dmx512frame_compact * h)
+{
+    frame->port = h->port;
+    frame->flags = h->flags;
+    frame->breaksize = h->breaksize;
+    memset(frame->unused, 0, sizeof(frame->unused));
+    frame->payload_size = h->payload_size;
+    frame->timestamp = dmx512_ns_to_timespec(h->timestamp);
+    frame->back_timestamp = dmx512_ns_to_timespec(h->back_timestamp);
+    return DMX512_FRAME_COMPACT_DATA_SIZE(h->payload_size);
+}
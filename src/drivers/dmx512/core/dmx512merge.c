@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512merge.h>
+
+#include <linux/string.h>
+
+#define DMX512_MERGE_WORDS (512 / 8)
+#define DMX512_MERGE_HIGH  (0x8080808080808080ULL)
+
+/*
+ * Per octet 0xff where a >= b and 0x00 where not. The low 7 bits are
+ * compared with a subtraction, that can not borrow from the next octet,
+ * because the minuend has the high bit set.
+ */
+static inline uint64_t dmx512_merge_ge(const uint64_t a, const uint64_t b)
+{
+    const uint64_t low = (a | DMX512_MERGE_HIGH) - (b & ~DMX512_MERGE_HIGH);
+    const uint64_t ge = ((a & ~b) | (~(a ^ b) & low)) & DMX512_MERGE_HIGH;
+    return (ge >> 7) * 0xff;
+}
+
+/* per octet 0xff where x is not 0. */
+static inline uint64_t dmx512_merge_nonzero(const uint64_t x)
+{
+    const uint64_t nz = (((x & ~DMX512_MERGE_HIGH) + ~DMX512_MERGE_HIGH) | x) & DMX512_MERGE_HIGH;
+    return (nz >> 7) * 0xff;
+}
+
+static inline uint64_t dmx512_merge_select(const uint64_t mask, const uint64_t a, const uint64_t b)
+{
+    return (a & mask) | (b & ~mask);
+}
+
+static int dmx512_merge_active(const struct dmx512_merge * m, const struct dmx512_merge_source * s,
+                               const long long now)
+{
+    return s->owner && (!m->source_timeout || (now - s->updated <= m->source_timeout));
+}
+
+void dmx512_merge_init(struct dmx512_merge * m, const int mode, const long long source_timeout)
+{
+    memset(m, 0, sizeof(*m));
+    m->mode = mode;
+    m->source_timeout = source_timeout;
+}
+
+/* HTP of the active sources, for DMX512_MERGE_PRIORITY only of those with the highest priority. */
+static void dmx512_merge_htp(struct dmx512_merge * m, const long long now)
+{
+    unsigned int priority = 0;
+    unsigned int i, w;
+
+    if (m->mode == DMX512_MERGE_PRIORITY)
+        for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+            if (dmx512_merge_active(m, &m->sources[i], now) && (m->sources[i].priority > priority))
+                priority = m->sources[i].priority;
+
+    memset(m->output, 0, sizeof(m->output));
+    m->payload_size = 0;
+    for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+    {
+        const struct dmx512_merge_source * s = &m->sources[i];
+        if (!dmx512_merge_active(m, s, now) || (s->priority < priority))
+            continue;
+        for (w = 0; w < DMX512_MERGE_WORDS; ++w)
+            m->output[w] = dmx512_merge_select(dmx512_merge_ge(s->slots[w], m->output[w]), s->slots[w], m->output[w]);
+        if (s->payload_size > m->payload_size)
+            m->payload_size = s->payload_size;
+    }
+}
+
+/*
+ * The slots of the source that differ from its last frame are taken over,
+ * all slots of its payload with the first frame of a source.
+ */
+static void dmx512_merge_ltp(struct dmx512_merge * m, const struct dmx512_merge_source * s,
+                             const uint64_t * slots, const unsigned int size, const int first)
+{
+    unsigned int w;
+    for (w = 0; w < DMX512_MERGE_WORDS; ++w)
+    {
+        uint64_t changed = 0;
+        if (!first)
+            changed = dmx512_merge_nonzero(s->slots[w] ^ slots[w]);
+        else if (8 * w + 8 <= size)
+            changed = ~0ULL;
+        else if (8 * w < size)
+            memset(&changed, 0xff, size - 8 * w);
+        m->output[w] = dmx512_merge_select(changed, slots[w], m->output[w]);
+    }
+    if (size > m->payload_size)
+        m->payload_size = size;
+}
+
+int dmx512_merge_put(struct dmx512_merge * m, const unsigned long owner, const unsigned int priority,
+                     const struct dmx512frame * frame, const long long now)
+{
+    struct dmx512_merge_source * s = 0;
+    const unsigned int payload_size = m->payload_size;
+    const unsigned int size = (frame->payload_size < 512) ? frame->payload_size : 512;
+    int first = 0;
+    unsigned int i;
+
+    for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+    {
+        struct dmx512_merge_source * x = &m->sources[i];
+        if (x->owner == owner)
+        {
+            s = x;
+            break;
+        }
+        if (x->owner && !dmx512_merge_active(m, x, now))
+            x->owner = 0;
+        if (!x->owner && !s)
+            s = x;
+    }
+    if (!s)
+        return -1;
+    if (s->owner != owner)
+    {
+        first = 1;
+        s->owner = owner;
+    }
+
+    memset(m->slots, 0, sizeof(m->slots));
+    memcpy(m->slots, frame->payload, size);
+    memcpy(m->previous, m->output, sizeof(m->previous));
+    if (m->mode == DMX512_MERGE_LTP)
+        dmx512_merge_ltp(m, s, m->slots, size, first);
+    s->updated = now;
+    s->priority = priority;
+    s->payload_size = size;
+    memcpy(s->slots, m->slots, sizeof(m->slots));
+    if (m->mode != DMX512_MERGE_LTP)
+        dmx512_merge_htp(m, now);
+    return (payload_size != m->payload_size) || memcmp(m->previous, m->output, sizeof(m->previous));
+}
+
+int dmx512_merge_forget(struct dmx512_merge * m, const unsigned long owner, const long long now)
+{
+    const unsigned int payload_size = m->payload_size;
+    unsigned int i;
+
+    for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+        if (m->sources[i].owner == owner)
+            break;
+    if (!owner || (i == DMX512_MERGE_MAX_SOURCES))
+        return 0;
+    m->sources[i].owner = 0;
+    /* LTP keeps the slots a source that went away set last. */
+    if (m->mode == DMX512_MERGE_LTP)
+        return 0;
+    memcpy(m->previous, m->output, sizeof(m->previous));
+    dmx512_merge_htp(m, now);
+    return (payload_size != m->payload_size) || memcmp(m->previous, m->output, sizeof(m->previous));
+}
+
+unsigned int dmx512_merge_sources(const struct dmx512_merge * m, const long long now)
+{
+    unsigned int i, n = 0;
+    for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+        if (dmx512_merge_active(m, &m->sources[i], now))
+            ++n;
+    return n;
+}
+
+void dmx512_merge_output(const struct dmx512_merge * m, struct dmx512frame * frame)
+{
+    frame->startcode = 0;
+    frame->payload_size = m->payload_size;
+    memcpy(frame->payload, m->output, sizeof(frame->payload));
+}
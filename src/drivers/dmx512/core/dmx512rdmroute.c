@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512rdmroute.h>
+
+#include <linux/string.h>
+
+/* RDM message layout, offsets into dmx512frame.data. */
+#define RDM_SC_RDM               (0xCC)
+#define RDM_SC_SUB_MESSAGE       (0x01)
+#define RDM_DUB_PREAMBLE         (0xFE)
+#define RDM_DUB_SEPARATOR        (0xAA)
+
+#define RDM_OFFSET_SUB_START     (1)
+#define RDM_OFFSET_DEST_UID      (3)
+#define RDM_OFFSET_SOURCE_UID    (9)
+#define RDM_OFFSET_TN            (15)
+#define RDM_OFFSET_CC            (20)
+#define RDM_OFFSET_PID           (21)
+
+#define RDM_CC_DISCOVERY_COMMAND (0x10)
+#define RDM_CC_GET_COMMAND       (0x20)
+#define RDM_CC_SET_COMMAND       (0x30)
+#define RDM_CC_RESPONSE          (0x01) /* or'ed to the command class of the request */
+
+#define RDM_PID_DISC_UNIQUE_BRANCH (0x0001)
+
+static int dmx512_rdm_has_header(const struct dmx512frame * frame)
+{
+    return (frame->startcode == RDM_SC_RDM) &&
+	(frame->data[RDM_OFFSET_SUB_START] == RDM_SC_SUB_MESSAGE) &&
+	(frame->payload_size >= DMX512_RDM_HEADER_SIZE - 1);
+}
+
+static int dmx512_rdm_is_dub(const struct dmx512frame * frame)
+{
+    return (frame->data[RDM_OFFSET_CC] == RDM_CC_DISCOVERY_COMMAND) &&
+	(frame->data[RDM_OFFSET_PID] == (RDM_PID_DISC_UNIQUE_BRANCH >> 8)) &&
+	(frame->data[RDM_OFFSET_PID+1] == (RDM_PID_DISC_UNIQUE_BRANCH & 0xff));
+}
+
+/* all devices or all devices of a manufacturer. */
+static int dmx512_rdm_is_broadcast(const struct dmx512frame * frame)
+{
+    static const uint8_t all[4] = { 0xff, 0xff, 0xff, 0xff };
+    return memcmp(&frame->data[RDM_OFFSET_DEST_UID + 2], all, sizeof(all)) == 0;
+}
+
+void dmx512_rdmroute_init(struct dmx512_rdmroute * r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+int dmx512_rdmroute_is_request(const struct dmx512frame * frame)
+{
+    uint8_t cc;
+    if (!dmx512_rdm_has_header(frame))
+	return 0;
+    cc = frame->data[RDM_OFFSET_CC];
+    if ((cc != RDM_CC_DISCOVERY_COMMAND) && (cc != RDM_CC_GET_COMMAND) && (cc != RDM_CC_SET_COMMAND))
+	return 0;
+    /* broadcasts are not answered, except for the discovery. */
+    return dmx512_rdm_is_dub(frame) || !dmx512_rdm_is_broadcast(frame);
+}
+
+static int dmx512_rdm_is_disc_response(const struct dmx512frame * frame)
+{
+    return (frame->flags & DMX512_FLAG_IS_RDM_DISC) ||
+	(frame->startcode == RDM_DUB_PREAMBLE) || (frame->startcode == RDM_DUB_SEPARATOR);
+}
+
+int dmx512_rdmroute_is_response(const struct dmx512frame * frame)
+{
+    return dmx512_rdm_has_header(frame) || dmx512_rdm_is_disc_response(frame);
+}
+
+int dmx512_rdmroute_request(struct dmx512_rdmroute * r, const struct dmx512frame * frame,
+			    void * owner, const long long expires)
+{
+    struct dmx512_rdmroute_entry * e = 0;
+    unsigned int i;
+
+    if (!owner || !dmx512_rdmroute_is_request(frame))
+	return 0;
+    for (i = 0; (i < DMX512_RDMROUTE_SIZE) && !e; ++i)
+	if (!r->entries[i].owner)
+	    e = &r->entries[i];
+    if (!e)
+	return 0;
+    ++r->count;
+    e->owner = owner;
+    e->expires = expires;
+    e->port = frame->port;
+    e->disc = dmx512_rdm_is_dub(frame);
+    memcpy(e->header, frame->data, sizeof(e->header));
+    return 1;
+}
+
+int dmx512_rdmroute_sent(struct dmx512_rdmroute * r, const struct dmx512frame * frame, const long long expires)
+{
+    unsigned int i;
+    for (i = 0; (i < DMX512_RDMROUTE_SIZE) && r->count; ++i)
+    {
+	struct dmx512_rdmroute_entry * e = &r->entries[i];
+	if (!e->owner || (e->port != frame->port) || memcmp(e->header, frame->data, sizeof(e->header)))
+	    continue;
+	if (e->expires < expires)
+	    e->expires = expires;
+	return 1;
+    }
+    return 0;
+}
+
+static int dmx512_rdmroute_matches(const struct dmx512_rdmroute_entry * e, const struct dmx512frame * frame)
+{
+    if (!e->owner || (e->port != frame->port) || e->disc)
+	return 0;
+    return (frame->data[RDM_OFFSET_CC] == (e->header[RDM_OFFSET_CC] | RDM_CC_RESPONSE)) &&
+	(frame->data[RDM_OFFSET_TN] == e->header[RDM_OFFSET_TN]) &&
+	(memcmp(&frame->data[RDM_OFFSET_DEST_UID], &e->header[RDM_OFFSET_SOURCE_UID], 6) == 0);
+}
+
+static void * dmx512_rdmroute_remove(struct dmx512_rdmroute * r, struct dmx512_rdmroute_entry * e)
+{
+    void * owner = e->owner;
+    e->owner = 0;
+    --r->count;
+    return owner;
+}
+
+void * dmx512_rdmroute_response(struct dmx512_rdmroute * r, const struct dmx512frame * frame)
+{
+    struct dmx512_rdmroute_entry * dub = 0;
+    unsigned int i;
+
+    if (!r->count)
+	return 0;
+    if (dmx512_rdm_has_header(frame))
+    {
+	for (i = 0; i < DMX512_RDMROUTE_SIZE; ++i)
+	    if (dmx512_rdmroute_matches(&r->entries[i], frame))
+		return dmx512_rdmroute_remove(r, &r->entries[i]);
+	return 0;
+    }
+
+    /* a discovery response, possibly garbled by a collision. */
+    if (!dmx512_rdm_is_disc_response(frame))
+	return 0;
+    for (i = 0; i < DMX512_RDMROUTE_SIZE; ++i)
+    {
+	struct dmx512_rdmroute_entry * e = &r->entries[i];
+	if (e->owner && e->disc && (e->port == frame->port) && (!dub || (e->expires < dub->expires)))
+	    dub = e;
+    }
+    return dub ? dmx512_rdmroute_remove(r, dub) : 0;
+}
+
+static void dmx512_rdmroute_timeout(const struct dmx512_rdmroute_entry * e, struct dmx512frame * timeout)
+{
+    timeout->port = e->port;
+    timeout->flags = DMX512_FLAG_IS_RDM | DMX512_FLAG_RDM_TIMEOUT;
+    if (e->disc)
+	timeout->flags |= DMX512_FLAG_IS_RDM_DISC;
+    timeout->breaksize = 0;
+    timeout->payload_size = DMX512_RDM_HEADER_SIZE - 1;
+    memcpy(timeout->data, e->header, sizeof(e->header));
+    memset(&timeout->timestamp, 0, sizeof(timeout->timestamp));
+    memset(&timeout->back_timestamp, 0, sizeof(timeout->back_timestamp));
+}
+
+void * dmx512_rdmroute_expire(struct dmx512_rdmroute * r, const long long now, struct dmx512frame * timeout)
+{
+    unsigned int i;
+    for (i = 0; (i < DMX512_RDMROUTE_SIZE) && r->count; ++i)
+    {
+	struct dmx512_rdmroute_entry * e = &r->entries[i];
+	if (!e->owner || (e->expires > now))
+	    continue;
+	if (timeout)
+	    dmx512_rdmroute_timeout(e, timeout);
+	return dmx512_rdmroute_remove(r, e);
+    }
+    return 0;
+}
+
+void * dmx512_rdmroute_evict(struct dmx512_rdmroute * r, struct dmx512frame * timeout)
+{
+    struct dmx512_rdmroute_entry * e = 0;
+    unsigned int i;
+    if (r->count < DMX512_RDMROUTE_SIZE)
+	return 0;
+    for (i = 0; i < DMX512_RDMROUTE_SIZE; ++i)
+	if (!e || (r->entries[i].expires < e->expires))
+	    e = &r->entries[i];
+    if (timeout)
+	dmx512_rdmroute_timeout(e, timeout);
+    return dmx512_rdmroute_remove(r, e);
+}
+
+long long dmx512_rdmroute_next(const struct dmx512_rdmroute * r)
+{
+    long long next = -1;
+    unsigned int i;
+    for (i = 0; (i < DMX512_RDMROUTE_SIZE) && r->count; ++i)
+    {
+	const struct dmx512_rdmroute_entry * e = &r->entries[i];
+	if (e->owner && ((next < 0) || (e->expires < next)))
+	    next = e->expires;
+    }
+    return next;
+}
+
+void dmx512_rdmroute_forget(struct dmx512_rdmroute * r, void * owner)
+{
+    unsigned int i;
+    for (i = 0; (i < DMX512_RDMROUTE_SIZE) && r->count; ++i)
+	if (r->entries[i].owner == owner)
+	    dmx512_rdmroute_remove(r, &r->entries[i]);
+}
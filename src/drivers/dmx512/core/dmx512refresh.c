@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/rcupdate.h>
+#include <linux/compiler.h>
+
+#include <linux/dmx512/dmx512_priv.h>
+
+/*
+ * The refresh engine of a port keeps a copy of the last frame with the
+ * NULL start code written to the port and sends it again from an hrtimer,
+ * if no other frame has been written for one period. Frames written
+ * less than min_gap after the last frame are held back and send by the
+ * timer once the gap has passed. A newer frame replaces a held back one.
+ */
+
+static int dmx512_refresh_frame(const struct dmx512frame * frame)
+{
+	return (frame->startcode == 0) && !(frame->flags & DMX512_FLAG_IS_RDM);
+}
+
+static enum hrtimer_restart dmx512_port_refresh_timer(struct hrtimer * timer)
+{
+	struct dmx512_port_refresh * r = container_of(timer, struct dmx512_port_refresh, timer);
+	struct dmx512_port * port = container_of(r, struct dmx512_port, refresh);
+	struct dmx512_framequeue_entry * e = 0;
+	enum hrtimer_restart restart = HRTIMER_RESTART;
+	unsigned long flags;
+	ktime_t now = ktime_get();
+	ktime_t next;
+
+	spin_lock_irqsave(&r->lock, flags);
+	if (!r->period || !r->valid || !port->device) {
+		spin_unlock_irqrestore(&r->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	if (r->pending || !ktime_before(now, ktime_add(r->last_tx, r->period))) {
+		e = dmx512_framepool_get(port->device->framepool, port->index, GFP_ATOMIC);
+		if (e) {
+			memcpy(&e->frame, &r->frame, sizeof(e->frame));
+			r->pending = 0;
+			r->last_tx = now;
+		}
+	}
+	next = r->pending ? ktime_add(r->last_tx, r->min_gap) : ktime_add(r->last_tx, r->period);
+	if (!ktime_after(next, now))
+		next = ktime_add(now, r->period);
+	/* a write on another cpu may have restarted the timer meanwhile. */
+	if (hrtimer_is_queued(timer))
+		restart = HRTIMER_NORESTART;
+	else
+		hrtimer_set_expires(timer, next);
+	spin_unlock_irqrestore(&r->lock, flags);
+
+	if (e) {
+		rcu_read_lock();
+		dmx512_port_txqueue_transmit(port, e);
+		rcu_read_unlock();
+	}
+	return restart;
+}
+
+void dmx512_port_refresh_init(struct dmx512_port * port)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	spin_lock_init(&r->lock);
+	hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+	r->timer.function = dmx512_port_refresh_timer;
+	r->period = 0;
+	r->min_gap = 0;
+	r->last_tx = 0;
+	r->valid = 0;
+	r->pending = 0;
+	r->stopped = 0;
+}
+
+void dmx512_port_refresh_cleanup(struct dmx512_port * port)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	unsigned long flags;
+	spin_lock_irqsave(&r->lock, flags);
+	r->period = 0;
+	spin_unlock_irqrestore(&r->lock, flags);
+	hrtimer_cancel(&r->timer);
+}
+
+/*
+ * Stops the refresh for good before the port is removed. It waits for
+ * the timer, so it must not be called under dmx512_lock.
+ */
+void dmx512_port_refresh_stop(struct dmx512_port * port)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	unsigned long flags;
+	spin_lock_irqsave(&r->lock, flags);
+	r->stopped = 1;
+	r->period = 0;
+	spin_unlock_irqrestore(&r->lock, flags);
+	hrtimer_cancel(&r->timer);
+}
+
+/*
+ * A period of 0 stops the refresh and forgets the last frame.
+ */
+int dmx512_port_refresh_configure(struct dmx512_port * port, const u32 period_us, const u32 min_gap_us)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	unsigned long flags;
+
+	if (period_us && ((period_us < DMX512_REFRESH_MIN_PERIOD_US) || (min_gap_us > period_us)))
+		return -EINVAL;
+
+	if (!period_us) {
+		dmx512_port_refresh_cleanup(port);
+		spin_lock_irqsave(&r->lock, flags);
+		r->valid = 0;
+		r->pending = 0;
+		spin_unlock_irqrestore(&r->lock, flags);
+		return 0;
+	}
+
+	spin_lock_irqsave(&r->lock, flags);
+	if (r->stopped) {
+		spin_unlock_irqrestore(&r->lock, flags);
+		return -ENODEV;
+	}
+	r->period = us_to_ktime(period_us);
+	r->min_gap = us_to_ktime(min_gap_us);
+	if (r->valid)
+		hrtimer_start(&r->timer, ktime_add(r->last_tx, r->period), HRTIMER_MODE_ABS_SOFT);
+	spin_unlock_irqrestore(&r->lock, flags);
+	return 0;
+}
+
+void dmx512_port_refresh_get(struct dmx512_port * port, u32 * period_us, u32 * min_gap_us)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	unsigned long flags;
+	spin_lock_irqsave(&r->lock, flags);
+	*period_us = ktime_to_us(r->period);
+	*min_gap_us = ktime_to_us(r->min_gap);
+	spin_unlock_irqrestore(&r->lock, flags);
+}
+
+/*
+ * Called for every frame that is about to be send to the port.
+ * Returns 1 if the frame is held back, because the min_gap has not
+ * passed yet. The timer sends it later and the caller drops the frame.
+ * Returns 0 if the caller shall send the frame now.
+ */
+int dmx512_port_refresh_transmit(struct dmx512_port * port, struct dmx512_framequeue_entry * e)
+{
+	struct dmx512_port_refresh * r = &port->refresh;
+	unsigned long flags;
+	ktime_t now;
+	int held = 0;
+
+	if (!READ_ONCE(r->period))
+		return 0;
+
+	now = ktime_get();
+	spin_lock_irqsave(&r->lock, flags);
+	if (!r->period || !dmx512_refresh_frame(&e->frame)) {
+		/* other frames are send right away, but count as traffic on the port. */
+		if (r->period)
+			r->last_tx = now;
+		spin_unlock_irqrestore(&r->lock, flags);
+		return 0;
+	}
+	memcpy(&r->frame, &e->frame, sizeof(r->frame));
+	r->valid = 1;
+	if (r->pending || ktime_before(now, ktime_add(r->last_tx, r->min_gap))) {
+		r->pending = 1;
+		held = 1;
+		hrtimer_start(&r->timer, ktime_add(r->last_tx, r->min_gap), HRTIMER_MODE_ABS_SOFT);
+	} else {
+		r->last_tx = now;
+		hrtimer_start(&r->timer, ktime_add(now, r->period), HRTIMER_MODE_ABS_SOFT);
+	}
+	spin_unlock_irqrestore(&r->lock, flags);
+	return held;
+}
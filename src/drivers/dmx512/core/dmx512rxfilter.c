@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512rxfilter.h>
+
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#define DMX512_RXFILTER_DATA_SIZE (sizeof(((struct dmx512frame *)0)->data))
+
+/*
+ * Sort the terms by offset and merge terms on the same octet.
+ * Returns the number of terms left or -1 if two terms contradict.
+ */
+static int dmx512_rxfilter_sort_terms(struct dmx512_matchcode_term * t, const unsigned int count)
+{
+    unsigned int i, n = 0;
+    for (i = 1; i < count; ++i)
+    {
+	const struct dmx512_matchcode_term x = t[i];
+	unsigned int j = i;
+	while ((j > 0) && (t[j-1].offset > x.offset))
+	{
+	    t[j] = t[j-1];
+	    --j;
+	}
+	t[j] = x;
+    }
+    for (i = 0; i < count; ++i)
+    {
+	if (n && (t[n-1].offset == t[i].offset))
+	{
+	    const unsigned char common = t[n-1].mask & t[i].mask;
+	    if ((t[n-1].value & common) != (t[i].value & common))
+		return -1;
+	    t[n-1].value = (t[n-1].value & t[n-1].mask) | (t[i].value & t[i].mask);
+	    t[n-1].mask |= t[i].mask;
+	}
+	else
+	{
+	    t[n] = t[i];
+	    t[n].value &= t[n].mask;
+	    ++n;
+	}
+    }
+    return n;
+}
+
+/*
+ * Terms within 8 octets are combined into one word. A word never
+ * reaches behind the end of the data, so it is moved to the front
+ * for terms on the last slots.
+ */
+struct dmx512_rxfilter_code * dmx512_rxfilter_compile(const struct dmx512_matchcode_term * terms,
+						      const unsigned int count)
+{
+    struct dmx512_matchcode_term sorted[DMX512_RXFILTER_MAX_TERMS];
+    struct dmx512_rxfilter_code * code;
+    unsigned int i;
+    int n;
+
+    if (!terms || (count == 0) || (count > DMX512_RXFILTER_MAX_TERMS))
+	return 0;
+    for (i = 0; i < count; ++i)
+	if (terms[i].offset >= DMX512_RXFILTER_DATA_SIZE)
+	    return 0;
+    memcpy(sorted, terms, count * sizeof(*terms));
+    n = dmx512_rxfilter_sort_terms(sorted, count);
+    if (n < 0)
+	return 0;
+
+    code = kzalloc(sizeof(*code), GFP_KERNEL);
+    if (!code)
+	return 0;
+    memcpy(code->terms, terms, count * sizeof(*terms));
+    code->term_count = count;
+    code->min_payload_size = sorted[n-1].offset;
+
+    for (i = 0; i < (unsigned int)n; )
+    {
+	struct dmx512_rxfilter_word * w = &code->words[code->word_count++];
+	uint8_t mask[8], value[8];
+	unsigned int offset = sorted[i].offset;
+	if (offset > DMX512_RXFILTER_DATA_SIZE - 8)
+	    offset = DMX512_RXFILTER_DATA_SIZE - 8;
+	memset(mask, 0, sizeof(mask));
+	memset(value, 0, sizeof(value));
+	for (; (i < (unsigned int)n) && (sorted[i].offset < offset + 8); ++i)
+	{
+	    mask[sorted[i].offset - offset] = sorted[i].mask;
+	    value[sorted[i].offset - offset] = sorted[i].value;
+	}
+	memcpy(&w->mask, mask, sizeof(w->mask));
+	memcpy(&w->value, value, sizeof(w->value));
+	w->offset = offset;
+    }
+    return code;
+}
+
+void dmx512_rxfilter_free(struct dmx512_rxfilter_code * code)
+{
+    kfree(code);
+}
+
+int dmx512_rxfilter_set(struct dmx512_rxfilter * f, const int index,
+			struct dmx512_rxfilter_code * code,
+			struct dmx512_rxfilter_code ** old)
+{
+    *old = 0;
+    if (index == -1)
+    {
+	if (f->count >= DMX512_RXFILTER_MAX_MATCHCODES)
+	    return -1;
+	f->codes[f->count++] = code;
+	return 0;
+    }
+    if ((index < 0) || (index >= (int)f->count))
+	return -1;
+    *old = f->codes[index];
+    f->codes[index] = code;
+    return 0;
+}
+
+int dmx512_rxfilter_remove(struct dmx512_rxfilter * f, const int index,
+			   struct dmx512_rxfilter_code ** old)
+{
+    *old = 0;
+    if ((index < 0) || (index >= (int)f->count))
+	return -1;
+    *old = f->codes[index];
+    memmove(&f->codes[index], &f->codes[index+1], (f->count - index - 1) * sizeof(f->codes[0]));
+    f->codes[--f->count] = 0;
+    return 0;
+}
+
+static int dmx512_rxfilter_code_match(const struct dmx512_rxfilter_code * code, const struct dmx512frame * frame)
+{
+    unsigned int i;
+    if (code->min_payload_size > frame->payload_size)
+	return 0;
+    for (i = 0; i < code->word_count; ++i)
+    {
+	const struct dmx512_rxfilter_word * w = &code->words[i];
+	uint64_t x;
+	memcpy(&x, &frame->data[w->offset], sizeof(x));
+	if ((x & w->mask) != w->value)
+	    return 0;
+    }
+    return 1;
+}
+
+int dmx512_rxfilter_match(const struct dmx512_rxfilter * f, const struct dmx512frame * frame)
+{
+    unsigned int i;
+    if (!f->count)
+	return 1;
+    for (i = 0; i < f->count; ++i)
+	if (dmx512_rxfilter_code_match(f->codes[i], frame))
+	    return 1;
+    return 0;
+}
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512state.h>
+
+#include <linux/compiler.h>
+#include <linux/string.h>
+#include <asm/barrier.h>
+
+/* the sequence is odd while the frame is written. */
+void dmx512_port_state_write(struct dmx512_port_state * s, const struct dmx512frame * frame,
+			     const struct timespec * updated)
+{
+    const unsigned int sequence = READ_ONCE(s->sequence);
+    WRITE_ONCE(s->sequence, sequence + 1);
+    smp_wmb();
+    memcpy(&s->frame, frame, sizeof(s->frame));
+    s->frame.back_timestamp = *updated;
+    smp_wmb();
+    WRITE_ONCE(s->sequence, sequence + 2);
+}
+
+unsigned int dmx512_port_state_read(const struct dmx512_port_state * s, struct dmx512frame * frame)
+{
+    unsigned int sequence;
+    do
+    {
+	while ((sequence = READ_ONCE(s->sequence)) & 1)
+	    ;
+	smp_rmb();
+	memcpy(frame, &s->frame, sizeof(*frame));
+	smp_rmb();
+    } while (READ_ONCE(s->sequence) != sequence);
+    return sequence;
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512stats.h>
+
+#include <linux/math64.h>
+
+void dmx512_histogram_init(struct dmx512_histogram * h)
+{
+    unsigned int i;
+    for (i = 0; i < DMX512_STATS_HISTOGRAM_BUCKETS; ++i)
+	atomic_set(&h->buckets[i], 0);
+}
+
+unsigned int dmx512_histogram_bucket(const long long ns)
+{
+    unsigned int b = 0;
+    s32 rem;
+    s64 us;
+    if (ns <= 0)
+	return 0;
+    us = div_s64_rem(ns, 1000, &rem);
+    while (us && (b < DMX512_STATS_HISTOGRAM_BUCKETS - 1))
+    {
+	us >>= 1;
+	++b;
+    }
+    return b;
+}
+
+void dmx512_histogram_add(struct dmx512_histogram * h, const long long ns)
+{
+    atomic_inc(&h->buckets[dmx512_histogram_bucket(ns)]);
+}
+
+void dmx512_histogram_get(const struct dmx512_histogram * h, unsigned int * buckets)
+{
+    unsigned int i;
+    for (i = 0; i < DMX512_STATS_HISTOGRAM_BUCKETS; ++i)
+	buckets[i] = atomic_read(&h->buckets[i]);
+}
+
+void dmx512_stats_high_water(atomic_t * mark, const int value)
+{
+    int old = atomic_read(mark);
+    while (old < value)
+    {
+	const int seen = atomic_cmpxchg(mark, old, value);
+	if (seen == old)
+	    break;
+	old = seen;
+    }
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+/*
+ * Tracepoints along the path of a frame through the core, enabled in
+ * /sys/kernel/tracing/events/dmx512. A frame is identified by its port
+ * and the id its entry got from the frame pool, the time is the one of
+ * the trace record. A frame copied to another entry, e.g. by a route,
+ * gets a new id.
+ *
+ * Received frames: rx_break, rx_complete, rx_enqueue per file, rx_wakeup
+ * of the reader and rx_read when the frame is copied out.
+ * Transmitted frames: tx_write, tx_send and tx_complete, when the driver
+ * gives the frame back.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dmx512
+
+#if !defined(DEFINED_DMX512_TRACE) || defined(TRACE_HEADER_MULTI_READ)
+#define DEFINED_DMX512_TRACE
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(dmx512_frame,
+	TP_PROTO(const int port, const unsigned int id),
+	TP_ARGS(port, id),
+	TP_STRUCT__entry(
+		__field(int, port)
+		__field(unsigned int, id)
+	),
+	TP_fast_assign(
+		__entry->port = port;
+		__entry->id = id;
+	),
+	TP_printk("port=%d id=%u", __entry->port, __entry->id)
+);
+
+/* the break of a frame is detected, the driver takes the front timestamp. */
+DEFINE_EVENT(dmx512_frame, dmx512_rx_break,
+	TP_PROTO(const int port, const unsigned int id),
+	TP_ARGS(port, id));
+
+/* the driver received all slots and hands the frame to the core. */
+DEFINE_EVENT(dmx512_frame, dmx512_rx_complete,
+	TP_PROTO(const int port, const unsigned int id),
+	TP_ARGS(port, id));
+
+/* the frame is handed to the driver. */
+DEFINE_EVENT(dmx512_frame, dmx512_tx_send,
+	TP_PROTO(const int port, const unsigned int id),
+	TP_ARGS(port, id));
+
+/* the driver gives the frame back, after a transmit it is on the wire. */
+DEFINE_EVENT(dmx512_frame, dmx512_tx_complete,
+	TP_PROTO(const int port, const unsigned int id),
+	TP_ARGS(port, id));
+
+DECLARE_EVENT_CLASS(dmx512_client_frame,
+	TP_PROTO(const void * client, const int port, const unsigned int id),
+	TP_ARGS(client, port, id),
+	TP_STRUCT__entry(
+		__field(const void *, client)
+		__field(int, port)
+		__field(unsigned int, id)
+	),
+	TP_fast_assign(
+		__entry->client = client;
+		__entry->port = port;
+		__entry->id = id;
+	),
+	TP_printk("client=%p port=%d id=%u", __entry->client, __entry->port, __entry->id)
+);
+
+/* the frame is queued to the receive queue of an open file. */
+DEFINE_EVENT(dmx512_client_frame, dmx512_rx_enqueue,
+	TP_PROTO(const void * client, const int port, const unsigned int id),
+	TP_ARGS(client, port, id));
+
+/* the frame is copied to the reader. */
+DEFINE_EVENT(dmx512_client_frame, dmx512_rx_read,
+	TP_PROTO(const void * client, const int port, const unsigned int id),
+	TP_ARGS(client, port, id));
+
+/* a written frame is accepted. */
+DEFINE_EVENT(dmx512_client_frame, dmx512_tx_write,
+	TP_PROTO(const void * client, const int port, const unsigned int id),
+	TP_ARGS(client, port, id));
+
+/* the reader of an open file is woken up with queued frames. */
+TRACE_EVENT(dmx512_rx_wakeup,
+	TP_PROTO(const void * client, const unsigned int queued),
+	TP_ARGS(client, queued),
+	TP_STRUCT__entry(
+		__field(const void *, client)
+		__field(unsigned int, queued)
+	),
+	TP_fast_assign(
+		__entry->client = client;
+		__entry->queued = queued;
+	),
+	TP_printk("client=%p queued=%u", __entry->client, __entry->queued)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dmx512trace
+#include <trace/define_trace.h>
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512txqueue.h>
+
+#include <linux/slab.h>
+
+int dmx512_txqueue_init(struct dmx512_txqueue * q, const unsigned int size)
+{
+    if (!q || !size)
+	return -1;
+    q->frames = kzalloc(size * sizeof(*q->frames), GFP_KERNEL);
+    if (!q->frames)
+	return -1;
+    q->size = size;
+    q->head = 0;
+    q->count = 0;
+    q->coalesce = 0;
+    q->latest = -1;
+    return 0;
+}
+
+void dmx512_txqueue_cleanup(struct dmx512_txqueue * q)
+{
+    if (!q)
+	return;
+    kfree(q->frames);
+    q->frames = 0;
+    q->size = 0;
+    q->count = 0;
+    q->latest = -1;
+}
+
+void dmx512_txqueue_set_coalesce(struct dmx512_txqueue * q, const int coalesce)
+{
+    q->coalesce = coalesce ? 1 : 0;
+    if (!q->coalesce)
+	q->latest = -1;
+}
+
+/* RDM and other alternate start codes are never replaced. */
+static int dmx512_txqueue_coalescing(const struct dmx512_txqueue * q, const struct dmx512frame * frame)
+{
+    return q->coalesce && (frame->startcode == 0) && !(frame->flags & DMX512_FLAG_IS_RDM);
+}
+
+int dmx512_txqueue_accepts(const struct dmx512_txqueue * q, const struct dmx512frame * frame)
+{
+    if (q->count < q->size)
+	return 1;
+    return frame && dmx512_txqueue_coalescing(q, frame) && (q->latest >= 0);
+}
+
+int dmx512_txqueue_put(struct dmx512_txqueue * q, struct dmx512_framequeue_entry * e,
+		       struct dmx512_framequeue_entry ** replaced)
+{
+    const int coalescing = dmx512_txqueue_coalescing(q, &e->frame);
+    unsigned int slot;
+    *replaced = 0;
+    if (coalescing && (q->latest >= 0))
+    {
+	*replaced = q->frames[q->latest];
+	q->frames[q->latest] = e;
+	return 0;
+    }
+    if (q->count >= q->size)
+	return -1;
+    slot = (q->head + q->count++) % q->size;
+    q->frames[slot] = e;
+    if (coalescing)
+	q->latest = slot;
+    return 0;
+}
+
+struct dmx512_framequeue_entry * dmx512_txqueue_get(struct dmx512_txqueue * q)
+{
+    struct dmx512_framequeue_entry * e;
+    if (!q->count)
+	return 0;
+    e = q->frames[q->head];
+    q->frames[q->head] = 0;
+    if (q->latest == (int)q->head)
+	q->latest = -1;
+    q->head = (q->head + 1) % q->size;
+    --q->count;
+    return e;
+}
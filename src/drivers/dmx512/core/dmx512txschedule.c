@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512txschedule.h>
+
+#include <linux/atomic.h>
+#include <linux/slab.h>
+
+int dmx512_txschedule_init(struct dmx512_txschedule * s, const unsigned int size)
+{
+    if (!s || !size)
+	return -1;
+    s->heap = kzalloc(size * sizeof(*s->heap), GFP_KERNEL);
+    if (!s->heap)
+	return -1;
+    s->size = size;
+    s->count = 0;
+    s->seq = 0;
+    atomic_set(&s->late, 0);
+    atomic_set(&s->dropped, 0);
+    return 0;
+}
+
+void dmx512_txschedule_cleanup(struct dmx512_txschedule * s)
+{
+    if (!s)
+	return;
+    kfree(s->heap);
+    s->heap = 0;
+    s->size = 0;
+    s->count = 0;
+}
+
+/* a is released before b */
+static int dmx512_txschedule_before(const struct dmx512_txschedule_slot * a,
+				    const struct dmx512_txschedule_slot * b)
+{
+    if (a->due != b->due)
+	return a->due < b->due;
+    return (int)(a->seq - b->seq) < 0;
+}
+
+static void dmx512_txschedule_swap(struct dmx512_txschedule * s, const unsigned int a, const unsigned int b)
+{
+    const struct dmx512_txschedule_slot t = s->heap[a];
+    s->heap[a] = s->heap[b];
+    s->heap[b] = t;
+}
+
+int dmx512_txschedule_put(struct dmx512_txschedule * s, struct dmx512_framequeue_entry * e, const long long due)
+{
+    unsigned int i;
+    if (!s || !e || (s->count >= s->size))
+	return -1;
+    i = s->count++;
+    s->heap[i].due = due;
+    s->heap[i].seq = s->seq++;
+    s->heap[i].entry = e;
+    while (i > 0)
+    {
+	const unsigned int parent = (i - 1) / 2;
+	if (!dmx512_txschedule_before(&s->heap[i], &s->heap[parent]))
+	    break;
+	dmx512_txschedule_swap(s, i, parent);
+	i = parent;
+    }
+    return (i == 0) ? 1 : 0;
+}
+
+struct dmx512_framequeue_entry * dmx512_txschedule_get(struct dmx512_txschedule * s)
+{
+    struct dmx512_framequeue_entry * e;
+    unsigned int i = 0;
+    if (!s || !s->count)
+	return 0;
+    e = s->heap[0].entry;
+    s->heap[0] = s->heap[--s->count];
+    for (;;)
+    {
+	const unsigned int l = 2 * i + 1;
+	const unsigned int r = l + 1;
+	unsigned int first = i;
+	if ((l < s->count) && dmx512_txschedule_before(&s->heap[l], &s->heap[first]))
+	    first = l;
+	if ((r < s->count) && dmx512_txschedule_before(&s->heap[r], &s->heap[first]))
+	    first = r;
+	if (first == i)
+	    break;
+	dmx512_txschedule_swap(s, i, first);
+	i = first;
+    }
+    return e;
+}
+
+struct dmx512_framequeue_entry * dmx512_txschedule_get_due(struct dmx512_txschedule * s, const long long now)
+{
+    struct dmx512_framequeue_entry * e;
+    long long due;
+    if (!s || !s->count || (s->heap[0].due > now))
+	return 0;
+    due = s->heap[0].due;
+    e = dmx512_txschedule_get(s);
+    if (now - due > DMX512_TXSCHEDULE_LATE_NS)
+    {
+	e->frame.flags |= DMX512_FLAG_TX_LATE;
+	atomic_inc(&s->late);
+    }
+    return e;
+}
+
+long long dmx512_txschedule_next(struct dmx512_txschedule * s)
+{
+    return (s && s->count) ? s->heap[0].due : -1;
+}
+
+long long dmx512_frame_timestamp_ns(const struct dmx512frame * frame)
+{
+    return (long long)frame->timestamp.tv_sec * 1000000000LL + frame->timestamp.tv_nsec;
+}
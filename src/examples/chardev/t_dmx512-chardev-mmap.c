@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+/*
+ * Receive frames into buffers that are shared with the driver via mmap.
+ */
+#include <linux/dmx512/dmx512frame.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+int main (int argc , char **argv)
+{
+    const char * card_name = (argc > 1) ? argv[1] : "/dev/dmx-card0";
+    unsigned long long portmask = (argc > 2) ? atoi(argv[2]) : 1;
+    int dmxfd = open(card_name, O_RDWR);
+    if (dmxfd < 0)
+	return 1;
+
+    if (ioctl(dmxfd, DMX512_IOCTL_SET_PORT_FILTER, &portmask))
+    {
+	perror("DMX512_IOCTL_SET_PORT_FILTER");
+	return 1;
+    }
+
+    struct dmx512_buffer_request request;
+    bzero(&request, sizeof(request));
+    request.count = 8;
+    if (ioctl(dmxfd, DMX512_IOCTL_ALLOCATE_DMX_BUFFERS, &request))
+    {
+	perror("DMX512_IOCTL_ALLOCATE_DMX_BUFFERS");
+	return 1;
+    }
+    printf ("allocated %u buffers of %u bytes\n", request.count, request.size);
+
+    struct dmx512frame * frames = mmap(0, request.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, dmxfd, 0);
+    if (frames == MAP_FAILED)
+    {
+	perror("mmap");
+	return 1;
+    }
+
+    unsigned int i;
+    for (i = 0; i < request.count; ++i)
+    {
+	struct dmx512_buffer buffer = { .index = i, .type = DMX512_BUFFER_TYPE_RX };
+	if (ioctl(dmxfd, DMX512_IOCTL_ENQUEUE_DMX_BUFFER, &buffer))
+	    perror("DMX512_IOCTL_ENQUEUE_DMX_BUFFER");
+    }
+
+    int count = 0;
+    while (1)
+    {
+	struct dmx512_buffer buffer;
+	if (ioctl(dmxfd, DMX512_IOCTL_DEQUEUE_DMX_BUFFER, &buffer))
+	{
+	    perror("DMX512_IOCTL_DEQUEUE_DMX_BUFFER");
+	    break;
+	}
+	const struct dmx512frame * frame = &frames[buffer.index];
+	printf ("[%d] buffer:%u port:%d startcode:%d #slots:%d\n",
+		count++, buffer.index, frame->port, frame->startcode, frame->payload_size);
+
+	/* give the buffer back to the driver. */
+	buffer.type = DMX512_BUFFER_TYPE_RX;
+	if (ioctl(dmxfd, DMX512_IOCTL_ENQUEUE_DMX_BUFFER, &buffer))
+	{
+	    perror("DMX512_IOCTL_ENQUEUE_DMX_BUFFER");
+	    break;
+	}
+    }
+    munmap(frames, request.mmap_size);
+    close(dmxfd);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <linux/dmx512/dmx512frame.h>
+
+#include <sys/ioctl.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Let the core forward frames from one port to another, the same
+ * that t_dmx512-chardev-copy does in userspace.
+ */
+int main (int argc , char **argv)
+{
+    if ((argc != 2) && (argc != 5) && (argc != 8))
+    {
+        printf ("Route frames from a dmx-cards port to a cards port.\n");
+        printf ("The destination card is given by its name, - for the source card.\n");
+        printf ("%s <source-card>                    list the routes\n", argv[0]);
+        printf ("%s <source-card> <source-port> <target-name> <target-port> [<source-slot> <target-slot> <slot-count>]\n", argv[0]);
+        return 1;
+    }
+
+    int dmxfd = open(argv[1], O_RDWR);
+    if (dmxfd < 0)
+	return 1;
+
+    struct dmx512_route_info info;
+    memset(&info, 0, sizeof(info));
+
+    if (argc == 2)
+    {
+        int i;
+        info.route_index = -1;
+        if (ioctl(dmxfd, DMX512_IOCTL_GET_ROUTE, &info))
+        {
+            printf("failed to get the routes\n");
+            return 1;
+        }
+        const int count = info.routes_size;
+        for (i = 0; i < count; ++i)
+        {
+            info.route_index = i;
+            if (ioctl(dmxfd, DMX512_IOCTL_GET_ROUTE, &info))
+                break;
+            printf("%d: port %u -> %s:%u", i, info.source_port,
+                   info.dest_device[0] ? info.dest_device : "-", info.dest_port);
+            if (info.slot_count)
+                printf(" slots %u..%u -> %u..%u", info.source_slot, info.source_slot + info.slot_count - 1,
+                       info.dest_slot, info.dest_slot + info.slot_count - 1);
+            printf("\n");
+        }
+        close(dmxfd);
+        return 0;
+    }
+
+    info.route_index = -1;
+    info.source_port = atoi(argv[2]);
+    if (strcmp(argv[3], "-"))
+        strncpy(info.dest_device, argv[3], sizeof(info.dest_device)-1);
+    info.dest_port = atoi(argv[4]);
+    if (argc == 8)
+    {
+        info.source_slot = atoi(argv[5]);
+        info.dest_slot = atoi(argv[6]);
+        info.slot_count = atoi(argv[7]);
+    }
+    if (ioctl(dmxfd, DMX512_IOCTL_SET_ROUTE, &info))
+    {
+        printf("failed to set the route\n");
+        return 1;
+    }
+    close(dmxfd);
+    return 0;
+}
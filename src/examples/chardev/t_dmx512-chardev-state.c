@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+/*
+ * Sample the latest frame of a port from the universe state table,
+ * without reading frames from the device.
+ */
+#include <linux/dmx512/dmx512frame.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* returns the sequence of the copy, 0 if the port has no frame yet. */
+static unsigned int read_port_state(const struct dmx512_port_state * e, struct dmx512frame * frame)
+{
+    unsigned int seq;
+    do {
+	seq = __atomic_load_n(&e->sequence, __ATOMIC_ACQUIRE);
+	memcpy(frame, &e->frame, sizeof(*frame));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&e->sequence, __ATOMIC_RELAXED)));
+    return seq;
+}
+
+int main (int argc , char **argv)
+{
+    const char * card_name = (argc > 1) ? argv[1] : "/dev/dmx-card0";
+    const unsigned int port = (argc > 2) ? atoi(argv[2]) : 0;
+    int dmxfd = open(card_name, O_RDONLY);
+    if (dmxfd < 0)
+	return 1;
+
+    struct dmx512_state_info info;
+    if (ioctl(dmxfd, DMX512_IOCTL_GET_STATE_INFO, &info))
+    {
+	perror("DMX512_IOCTL_GET_STATE_INFO");
+	return 1;
+    }
+    if (port >= info.port_count)
+    {
+	fprintf(stderr, "port %u is not in the state table\n", port);
+	return 1;
+    }
+
+    const struct dmx512_state_table * table = mmap(0, info.mmap_size, PROT_READ, MAP_SHARED,
+                                                   dmxfd, DMX512_STATE_MMAP_OFFSET);
+    if (table == MAP_FAILED)
+    {
+	perror("mmap");
+	return 1;
+    }
+
+    unsigned int last = 0;
+    while (1)
+    {
+	struct dmx512frame frame;
+	const unsigned int seq = read_port_state(&table->rx[port], &frame);
+	if (seq != last)
+	{
+	    printf ("port:%u update:%u at %ld.%09ld #slots:%d slot1:%d\n",
+		    port, seq / 2,
+		    (long)frame.back_timestamp.tv_sec, (long)frame.back_timestamp.tv_nsec,
+		    frame.payload_size, frame.payload[0]);
+	    last = seq;
+	}
+	usleep(100000);
+    }
+    munmap((void *)table, info.mmap_size);
+    close(dmxfd);
+    return 0;
+}
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#include <linux/dmx512/dmx512frame.h>
+
+#include <sys/ioctl.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Set the coalesce mode of a ports txqueue, read it back and show the
+ * queue. The kernel drivers and the cuse-drivers both take the two
+ * ioctls, the cuse-drivers have no txqueue and report it empty.
+ */
+int main (int argc , char **argv)
+{
+    if (argc < 3)
+    {
+        printf ("%s <card> <port> [<coalesce>]\n", argv[0]);
+        return 1;
+    }
+
+    int dmxfd = open(argv[1], O_RDWR);
+    if (dmxfd < 0)
+	return 1;
+
+    struct dmx512_port_txqueue_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = atoi(argv[2]);
+
+    if (argc > 3)
+    {
+        info.coalesce = atoi(argv[3]);
+        int ret = ioctl(dmxfd, DMX512_IOCTL_SET_PORT_TXQUEUE, &info);
+        printf ("DMX512_IOCTL_SET_PORT_TXQUEUE -> %d\n", ret);
+        if (ret)
+            return 1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.port = atoi(argv[2]);
+    info.coalesce = -1;
+    int ret = ioctl(dmxfd, DMX512_IOCTL_GET_PORT_TXQUEUE, &info);
+    printf ("DMX512_IOCTL_GET_PORT_TXQUEUE -> %d\n", ret);
+    if (ret)
+        return 1;
+    printf ("port %u: coalesce %d, size %u, queued %u, dropped %u, coalesced %u\n",
+            info.port, info.coalesce, info.size, info.queued, info.dropped, info.coalesced);
+
+    close(dmxfd);
+
+    return 0;
+}
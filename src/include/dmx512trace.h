@@ -0,0 +1,124 @@
+#ifndef DEFINED_DMX512TRACE_H
+#define DEFINED_DMX512TRACE_H
+
+/*
+ * Binary event trace of the frame path for the userspace drivers,
+ * the counterpart of the dmx512 tracepoints of the kernel core.
+ *
+ * The trace is a file, mapped shared, with one ring of records per cpu.
+ * A record is claimed with an atomic add on the head of the ring of
+ * the cpu the thread runs on, so writers never wait for each other and
+ * rarely share a cache line. Old records are overwritten. The file can
+ * be decoded while the driver runs or after it has exited with
+ * dmx512trace_decode.
+ *
+ * Tracing is enabled by setting DMX512_TRACE to the path of the file.
+ * If it is not set dmx512_trace is 0 and a trace point costs a load
+ * and a branch.
+ */
+
+#include <stdint.h>
+
+#include <linux/dmx512/dmx512frame.h>
+
+enum dmx512_trace_event
+{
+    DMX512_TRACE_RX_BREAK = 1, /* the break of a frame is detected. */
+    DMX512_TRACE_RX_COMPLETE,  /* the driver received all slots. */
+    DMX512_TRACE_RX_ENQUEUE,   /* queued to an open file, arg is the file. */
+    DMX512_TRACE_RX_WAKEUP,    /* the reader of a file is woken up, arg is the file. */
+    DMX512_TRACE_RX_READ,      /* copied to the reader, arg is the file. */
+    DMX512_TRACE_TX_WRITE,     /* a write is accepted, arg is the file. */
+    DMX512_TRACE_TX_SEND,      /* handed to the driver. */
+    DMX512_TRACE_TX_COMPLETE,  /* the driver is done with the frame. */
+    DMX512_TRACE_EVENT_COUNT
+};
+
+/*
+ * port of the events that are not about one frame, e.g. the wakeup of
+ * a reader with several queued frames. The decoder adds them to the
+ * timelines of the frames queued to the file at that time.
+ */
+#define DMX512_TRACE_NO_PORT (0xffff)
+
+#define DMX512_TRACE_MAGIC   (0x52545844) /* "DXTR" */
+#define DMX512_TRACE_VERSION (1)
+
+/* default number of records per cpu, if DMX512_TRACE_RECORDS is not set. */
+#define DMX512_TRACE_DEFAULT_RECORDS (65536)
+
+struct dmx512_trace_record
+{
+    uint32_t sequence; /* index of the record in its ring + 1, 0 while it is written. */
+    uint16_t port;
+    uint8_t  event;    /* DMX512_TRACE_... */
+    uint8_t  cpu;
+    int64_t  ns;       /* CLOCK_MONOTONIC */
+    uint32_t frame_id; /* see dmx512_trace_frame_id */
+    uint32_t arg;
+};
+
+/* every ring starts on a cache line of its own. */
+struct dmx512_trace_ring
+{
+    uint32_t head;
+    uint32_t reserved[15];
+    /* struct dmx512_trace_record records[records]; */
+};
+
+struct dmx512_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cpus;
+    uint32_t records; /* per cpu, a power of 2. */
+    uint32_t reserved[12];
+    /* struct dmx512_trace_ring rings[cpus]; */
+};
+
+#define DMX512_TRACE_RING_SIZE(records) \
+    (sizeof(struct dmx512_trace_ring) + (records) * sizeof(struct dmx512_trace_record))
+
+#define DMX512_TRACE_FILE_SIZE(cpus, records) \
+    (sizeof(struct dmx512_trace_header) + (cpus) * DMX512_TRACE_RING_SIZE(records))
+
+static inline struct dmx512_trace_ring * dmx512_trace_ring(struct dmx512_trace_header * h, const unsigned int cpu)
+{
+    return (struct dmx512_trace_ring *)((char *)(h + 1) + cpu * DMX512_TRACE_RING_SIZE(h->records));
+}
+
+static inline struct dmx512_trace_record * dmx512_trace_records(struct dmx512_trace_ring * r)
+{
+    return (struct dmx512_trace_record *)(r + 1);
+}
+
+/* the mapped trace file, 0 if tracing is disabled. */
+extern struct dmx512_trace_header * dmx512_trace;
+
+/*
+ * Map the trace file named by DMX512_TRACE, if it is set.
+ * Returns 0 if tracing is enabled or not requested, -1 on an error.
+ */
+int  dmx512_trace_open_env(void);
+int  dmx512_trace_open(const char * path, const unsigned int records);
+void dmx512_trace_close(void);
+
+void dmx512_trace_record(const int event, const unsigned int port,
+                         const uint32_t frame_id, const uint32_t arg);
+
+static inline void dmx512_trace_event(const int event, const unsigned int port,
+                                      const uint32_t frame_id, const uint32_t arg)
+{
+    if (__builtin_expect(dmx512_trace != 0, 0))
+        dmx512_trace_record(event, port, frame_id, arg);
+}
+
+/*
+ * Userspace frames are not taken from a pool, so the id is made from
+ * the front timestamp, taken at the break, or the back timestamp if a
+ * frame has none. Frames written without a timestamp have the id 0,
+ * the decoder ties their events together by their order on the port.
+ */
+uint32_t dmx512_trace_frame_id(const struct dmx512frame * frame);
+
+#endif
@@ -41,6 +41,9 @@ extern void dmx512_delete_port(struct dmx512_port * port);
 extern void dmx512_port_set_sendframe(struct dmx512_port *port,
                                       int (*callback_fn) (struct dmx512_port *,
                                                           struct dmx512_framequeue_entry *));
+extern void dmx512_port_set_rx_timestamp(struct dmx512_port *port,
+                                         void (*callback_fn) (struct dmx512_port *,
+                                                              struct dmx512_framequeue_entry *));
 
 
 extern int dmx512_add_port(struct dmx512_device * dev, struct dmx512_port *port);
@@ -55,7 +58,25 @@ extern const char * dmx512_port_name(struct dmx512_port * port);
 
 extern int dmx512_received_frame(struct dmx512_port *port, struct dmx512_framequeue_entry * frame);
 
+/*
+ * Called by a driver with transmitter_has_space, when the transmitter
+ * has space again, to hand it the frames queued meanwhile.
+ */
+extern void dmx512_port_transmitter_ready(struct dmx512_port *port);
+
+/* a driver lost a received frame, e.g. on a fifo overrun. */
+extern void dmx512_port_rx_overrun(struct dmx512_port *port);
+
 extern void dmx512_put_frame(struct dmx512_port *port, struct dmx512_framequeue_entry * frame);
 extern struct dmx512_framequeue_entry * dmx512_get_frame(struct dmx512_port *port);
 
+/*
+ * Software timestamps of received frames in CLOCK_MONOTONIC.
+ * Drivers take the front timestamp when they detect the break.
+ * The back timestamp is taken by dmx512_received_frame, if the driver
+ * has not taken it after the last slot.
+ */
+extern void dmx512_frame_timestamp_front(struct dmx512_framequeue_entry * frame);
+extern void dmx512_frame_timestamp_back(struct dmx512_framequeue_entry * frame);
+
 #endif
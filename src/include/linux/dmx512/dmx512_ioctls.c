@@ -3,31 +3,39 @@
  * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
  */
 #include "dmx512_ioctls.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 
 /*
  * The caller needs to free 'matchcode' if 0 is returned.
+ * 'size' is the size of matchcode in octets.
  */
 static int dmx512_get_matchcode(int fd,
 				int index,
 				unsigned int * size,
-				char ** matchcode)
+				struct dmx512_matchcode_term ** matchcode)
 {
 	int ret;
 	struct dmx512_rxfilter_info info;
+	struct dmx512_matchcode_term * code;
 	memset(&info, 0, sizeof(info));
 	info.matchcodes_index = index;
-	ret = ioctl(fd, DMX512_IOCTL_GET_PORT_FILTER, &info);
+	ret = ioctl(fd, DMX512_IOCTL_GET_RX_MATCH_FILTER, &info);
 	if (ret)
 		return ret;
-	info.matchcode = malloc(info.matchcodes_size);
-	ret = ioctl(fd, DMX512_IOCTL_GET_PORT_FILTER, &info);
+	code = malloc(info.matchcode_size);
+	if (!code)
+		return -1;
+	info.matchcode = (uintptr_t)code;
+	ret = ioctl(fd, DMX512_IOCTL_GET_RX_MATCH_FILTER, &info);
 	if (ret) {
-		free(info.matchcode);
+		free(code);
 		return ret;
 	}
 	*size = info.matchcode_size;
-	*matchcode = info.matchcode;
+	*matchcode = code;
 	return 0;
 }
 
@@ -37,12 +45,23 @@ static int dmx512_get_matchcode(int fd,
 static int dmx512_set_matchcode(int fd,
 				int index,
 				unsigned int size,
-				char * matchcode)
+				struct dmx512_matchcode_term * matchcode)
 {
-	int ret;
 	struct dmx512_rxfilter_info info;
+	memset(&info, 0, sizeof(info));
 	info.matchcodes_index = index;
 	info.matchcode_size = size;
-	info.matchcode = matchcode;
-	return ioctl(fd, DMX512_IOCTL_GET_PORT_FILTER, &info);
+	info.matchcode = (uintptr_t)matchcode;
+	return ioctl(fd, DMX512_IOCTL_SET_RX_MATCH_FILTER, &info);
+}
+
+/*
+ * Set index to -1 to remove all matchcodes.
+ */
+static int dmx512_remove_matchcode(int fd, int index)
+{
+	struct dmx512_rxfilter_info info;
+	memset(&info, 0, sizeof(info));
+	info.matchcodes_index = index;
+	return ioctl(fd, DMX512_IOCTL_REM_RX_MATCH_FILTER, &info);
 }
@@ -7,8 +7,12 @@
 
 #ifndef __KERNEL__
 #include <sys/ioctl.h>
+#else
+#include <linux/ioctl.h>
 #endif
 
+#include <linux/dmx512/dmx512frame.h>
+
 #define DMX4LINUX2_VERSION_MAJOR  3
 #define DMX4LINUX2_VERSION_MINOR  0
 #define DMX4LINUX2_VERSION_PATCH  0
@@ -66,6 +70,335 @@ struct dmx4linux2_port_info {
 };
 
 
+/*
+ * Buffer management, modeled after the v4l2 buffer queue.
+ *
+ * DMX512_IOCTL_ALLOCATE_DMX_BUFFERS allocates <count> buffers of
+ * sizeof(struct dmx512frame) each, that are then mapped into the
+ * application with mmap(0, mmap_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0).
+ * Buffer <i> starts at offset i*sizeof(struct dmx512frame) of that mapping.
+ * A count of 0 frees the buffers, which is only possible while they are not mapped.
+ *
+ * Transmit buffers are filled by the application and then enqueued with
+ * DMX512_IOCTL_ENQUEUE_DMX_BUFFER. Receive buffers are enqueued empty.
+ * DMX512_IOCTL_DEQUEUE_DMX_BUFFER returns the next buffer the driver is done
+ * with, either a transmitted buffer or a receive buffer that now holds a frame.
+ * It blocks unless the device has been opened with O_NONBLOCK.
+ */
+enum dmx512_buffer_type {
+    DMX512_BUFFER_TYPE_RX = 0,
+    DMX512_BUFFER_TYPE_TX = 1,
+};
+
+enum {
+    DMX512_BUFFER_FLAG_ERROR = (1<<0), /* The frame could not be transmitted. */
+};
+
+struct dmx512_buffer_request {
+    unsigned int count;     /* in: number of buffers to allocate, out: number of buffers allocated. */
+    unsigned int size;      /* out: size of one buffer. */
+    unsigned int mmap_size; /* out: size of the area to mmap. */
+    unsigned int reserved;
+};
+
+struct dmx512_buffer {
+    unsigned int index; /* index of the buffer in the mapped area. */
+    unsigned int type;  /* DMX512_BUFFER_TYPE_... */
+    unsigned int flags; /* out: DMX512_BUFFER_FLAG_... */
+    unsigned int reserved;
+};
+
+/*
+ * Usage of the frame pool of a device, read with DMX512_IOCTL_GET_FRAMEPOOL_INFO.
+ * The pool keeps at least low_watermark unused frames and frees unused
+ * frames above high_watermark. It never holds more than max_frames.
+ */
+#define DMX512_FRAMEPOOL_PORTS (64) /* ports with per port accounting */
+
+struct dmx512_framepool_info {
+    unsigned int allocated;      /* frames allocated, used or unused. */
+    unsigned int in_use;         /* frames handed out. */
+    unsigned int peak_in_use;    /* highest in_use seen. */
+    unsigned int low_watermark;
+    unsigned int high_watermark;
+    unsigned int max_frames;
+    unsigned int grown;          /* number of frames allocated on demand. */
+    unsigned int shrunk;         /* number of frames freed above the high watermark. */
+    unsigned int exhausted;      /* number of requests that could not be served. */
+    unsigned int reserved;
+    unsigned int port_in_use[DMX512_FRAMEPOOL_PORTS]; /* frames charged to each port. */
+};
+
+/*
+ * Statistics of a port, read with DMX512_IOCTL_GET_PORT_STATS, and of
+ * an open file, read with DMX512_IOCTL_GET_STATS. The counters start
+ * when the port is added or the file is opened. A read returns a
+ * snapshot, but the counters are not read atomically together.
+ *
+ * Latencies are log2 histograms in us. Bucket 0 counts the latencies
+ * below 1us, bucket i those from 2^(i-1) to below 2^i us. The last
+ * bucket also counts everything longer.
+ */
+#define DMX512_STATS_HISTOGRAM_BUCKETS (24)
+
+struct dmx512_port_stats {
+    unsigned int port;                 /* in: index of the port. */
+    unsigned int txqueue_high_water;   /* most frames waiting for the transmitter. */
+    unsigned long long rx_frames;
+    unsigned long long rx_bytes;       /* slots including the start code. */
+    unsigned long long rx_no_frame;    /* frames lost, the pool had no frame for the driver. */
+    unsigned long long rx_overruns;    /* frames lost in the driver, e.g. on a fifo overrun. */
+    unsigned long long tx_frames;      /* frames handed to the transmitter. */
+    unsigned long long tx_bytes;
+    unsigned long long tx_queue_full;  /* frames dropped, the txqueue was full. */
+    unsigned long long tx_coalesced;   /* frames replaced in the txqueue by a later one. */
+    unsigned long long tx_late;        /* timed frames send late. */
+    unsigned long long rdm_timeouts;   /* requests without a response. */
+    unsigned long long rdm_collisions; /* discovery responses with an invalid checksum. */
+    unsigned int tx_latency[DMX512_STATS_HISTOGRAM_BUCKETS]; /* queued to handed to the transmitter. */
+};
+
+struct dmx512_stats {
+    unsigned int rxqueue_high_water;  /* most frames waiting to be read. */
+    unsigned int reserved;
+    unsigned long long rx_frames;     /* frames read or filled into buffers. */
+    unsigned long long rx_bytes;
+    unsigned long long rx_queue_full; /* frames dropped, as the receive queue was full. */
+    unsigned long long tx_frames;     /* frames written and accepted. */
+    unsigned long long tx_bytes;
+    unsigned long long tx_refused;    /* frames written, but refused, e.g. with EAGAIN or ENOSPC. */
+    unsigned long long rdm_timeouts;  /* requests of the file without a response. */
+    unsigned int rx_latency[DMX512_STATS_HISTOGRAM_BUCKETS]; /* received to read. */
+};
+
+/*
+ * The universe state table of a device holds the latest frame with
+ * the NULL start code received on each port, and with
+ * DMX512_STATE_FLAG_TX the latest one handed to each transmitter.
+ * It is mapped read only with
+ *   mmap(0, info.mmap_size, PROT_READ, MAP_SHARED, fd, DMX512_STATE_MMAP_OFFSET)
+ * and sampled without a syscall. The sequence of an entry is odd while
+ * the core writes it, a reader copies the frame and retries if the
+ * sequence was odd or changed meanwhile:
+ *   do {
+ *       seq = __atomic_load_n(&e->sequence, __ATOMIC_ACQUIRE);
+ *       memcpy(&frame, &e->frame, sizeof(frame));
+ *       __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *   } while ((seq & 1) || (seq != __atomic_load_n(&e->sequence, __ATOMIC_RELAXED)));
+ * A sequence of 0 means no frame yet. The back_timestamp of an entry
+ * is the CLOCK_MONOTONIC time of its update. Ports with an index of
+ * DMX512_STATE_MAX_PORTS or above are not in the table.
+ */
+#define DMX512_STATE_MAX_PORTS   (32)
+#define DMX512_STATE_MMAP_OFFSET (0x40000000UL)
+
+enum {
+    DMX512_STATE_FLAG_TX = (1<<0), /* also keep the frames transmitted. */
+};
+
+struct dmx512_port_state {
+    unsigned int sequence;
+    unsigned int reserved;
+    struct dmx512frame frame;
+};
+
+struct dmx512_state_table {
+    struct dmx512_port_state rx[DMX512_STATE_MAX_PORTS];
+    struct dmx512_port_state tx[DMX512_STATE_MAX_PORTS];
+};
+
+/* Only flags is set with DMX512_IOCTL_SET_STATE_INFO, for the whole device. */
+struct dmx512_state_info {
+    unsigned int flags;      /* DMX512_STATE_FLAG_... */
+    unsigned int mmap_size;  /* out: size of the area to mmap. */
+    unsigned int port_count; /* out: DMX512_STATE_MAX_PORTS. */
+    unsigned int reserved;
+};
+
+/*
+ * Frame routing of a device. Frames with the NULL start code received
+ * on source_port are send out on dest_port of the device named
+ * dest_device, or of this device if dest_device is empty. The frame is
+ * forwarded by the core as it is received, without a copy to userspace.
+ * A route with a slot_count of 0 forwards the whole frame. Otherwise
+ * slot_count slots from source_slot on are send as the slots from
+ * dest_slot on, the slots before dest_slot are 0. Slots are numbered
+ * 1..512. A source port may have any number of routes. A frame send by
+ * a route is not routed again, when it is received back on a loopback.
+ * A route to another device needs CAP_SYS_ADMIN.
+ *
+ * DMX512_IOCTL_SET_ROUTE replaces the route at route_index or appends it
+ * if the index is -1. DMX512_IOCTL_REM_ROUTE removes the route at
+ * route_index, or all if the index is -1. DMX512_IOCTL_GET_ROUTE fills
+ * in the route at route_index and returns the number of routes in
+ * routes_size. With an index of -1 only the number of routes is returned.
+ * Routes are kept until they are removed or one of the devices goes away.
+ */
+#define DMX512_ROUTES_MAX           (64) /* per device */
+#define DMX512_ROUTE_DEVICE_NAME_LEN (32)
+
+struct dmx512_route_info {
+    int            route_index;
+    unsigned int   routes_size; /* out: number of routes of the device */
+    unsigned int   source_port;
+    unsigned int   dest_port;
+    unsigned short source_slot;
+    unsigned short dest_slot;
+    unsigned short slot_count;
+    unsigned short priority;    /* if dest_port merges, 0 for DMX512_MERGE_DEFAULT_PRIORITY */
+    char           dest_device[DMX512_ROUTE_DEVICE_NAME_LEN];
+};
+
+/*
+ * Merge of a port, set with DMX512_IOCTL_SET_PORT_MERGE.
+ * Frames with the NULL start code written to a merging port by open
+ * files, and forwarded to it by routes, are not send as they are. Every
+ * writer and every route source is a source of the merge, the port sends
+ * the merged slots instead. The merged frame is send, whenever the
+ * output changes, and for every frame written if the port has no refresh.
+ * The refresh repeats the merged frame otherwise.
+ * Timestamps of frames written to a merging port are ignored.
+ * A source that has not send a frame for source_timeout_ms is dropped,
+ * a source_timeout_ms of 0 keeps the sources until their file is closed.
+ * The priority of a writer is set with DMX512_IOCTL_SET_MERGE_PRIORITY.
+ */
+#define DMX512_MERGE_MAX_SOURCES      (16) /* per port */
+#define DMX512_MERGE_DEFAULT_PRIORITY (100)
+#define DMX512_MERGE_MAX_PRIORITY     (200)
+
+enum dmx512_merge_mode {
+    DMX512_MERGE_OFF      = 0,
+    DMX512_MERGE_HTP      = 1, /* per slot the highest value of all sources */
+    DMX512_MERGE_LTP      = 2, /* per slot the value a source changed last */
+    DMX512_MERGE_PRIORITY = 3, /* HTP of the sources with the highest priority */
+};
+
+struct dmx512_port_merge_info {
+    unsigned int port;              /* in: index of the port. */
+    int          mode;              /* DMX512_MERGE_... */
+    unsigned int source_timeout_ms;
+    unsigned int sources;           /* out: number of sources sending. */
+};
+
+/*
+ * The frames of a port waiting for its transmitter. A write blocks
+ * while the queue of the port is full, or fails with EAGAIN with
+ * O_NONBLOCK, and poll reports POLLOUT once there is room again.
+ * With coalesce set, a frame with the NULL start code replaces the
+ * one still queued, so a slow port always sends the latest slots.
+ * Only coalesce is set with DMX512_IOCTL_SET_PORT_TXQUEUE.
+ */
+struct dmx512_port_txqueue_info {
+    unsigned int port;      /* in: index of the port. */
+    int          coalesce;
+    unsigned int size;      /* out: frames the queue holds. */
+    unsigned int queued;    /* out: frames waiting. */
+    unsigned int dropped;   /* out: frames dropped, because the queue was full. */
+    unsigned int coalesced; /* out: frames replaced by a later one. */
+};
+
+/*
+ * Refresh of a port, set with DMX512_IOCTL_SET_PORT_REFRESH.
+ * The core keeps the last frame with the NULL start code written to
+ * the port and sends it again, if no frame has been written for period_us.
+ * An application then only needs to write a universe if it changes.
+ * Frames written less than min_gap_us after the previous frame are held
+ * back until the gap has passed, a newer frame replaces a held back one.
+ * A period_us of 0 disables the refresh.
+ */
+struct dmx512_port_refresh_info {
+    unsigned int port;       /* in: index of the port. */
+    unsigned int period_us;  /* 0 or at least 1000. */
+    unsigned int min_gap_us; /* must not be larger than period_us. */
+    unsigned int reserved;
+};
+
+/*
+ * Timed transmission, read with DMX512_IOCTL_GET_PORT_TXSCHEDULE_INFO.
+ * A frame written with a timestamp other than {0,0} is held back until
+ * CLOCK_MONOTONIC reaches the timestamp. Frames send more than 100us late
+ * are counted and flagged with DMX512_FLAG_TX_LATE on loopback.
+ */
+struct dmx512_port_txschedule_info {
+    unsigned int port;    /* in: index of the port. */
+    unsigned int queued;  /* frames waiting for their time. */
+    unsigned int late;    /* frames send late. */
+    unsigned int dropped; /* frames dropped at their time, because the transmitter was full. */
+};
+
+/*
+ * Receive match filter of an open file.
+ *
+ * A match code is an array of terms, a frame matches the code if all
+ * terms match. A frame is queued to the file if it matches any of the
+ * match codes of the file. Without match codes all frames are queued.
+ * The port masks apply as well.
+ *
+ * Examples, with offsets into dmx512frame.data:
+ *   RDM frames:          { 0, 0xff, 0xCC }
+ *   RDM to one UID:      { 0, 0xff, 0xCC }, { 3, 0xff, uid[0] }, ... { 8, 0xff, uid[5] }
+ *   Text packets:        { 0, 0xff, 0x17 }
+ */
+#define DMX512_RXFILTER_MAX_MATCHCODES (16) /* per open file */
+#define DMX512_RXFILTER_MAX_TERMS      (64) /* per match code */
+
+struct dmx512_matchcode_term {
+    unsigned short offset; /* octet in dmx512frame.data, 0 is the start code. */
+    unsigned char  mask;   /* bits of the octet compared. */
+    unsigned char  value;  /* the octet and'ed with mask must be value. */
+};
+
+/*
+ * DMX512_IOCTL_SET_RX_MATCH_FILTER replaces the match code at
+ * matchcodes_index, or appends it if the index is -1.
+ * DMX512_IOCTL_REM_RX_MATCH_FILTER removes the match code at
+ * matchcodes_index, or all if the index is -1.
+ * DMX512_IOCTL_GET_RX_MATCH_FILTER returns the number of match codes
+ * in matchcodes_size and the size of the code at matchcodes_index in
+ * matchcode_size. The code is copied to matchcode, if it is not 0 and
+ * matchcode_size was large enough. With an index of -1 only the number
+ * of match codes is returned.
+ * The address is a 64 bit field, so 32 bit programs use the same
+ * layout and ioctl number on a 64 bit kernel.
+ */
+struct dmx512_rxfilter_info {
+    int            matchcodes_index;
+    unsigned int   matchcodes_size; /* out: number of match codes */
+    unsigned int   matchcode_size;  /* size of matchcode in octets, a multiple of sizeof(struct dmx512_matchcode_term) */
+    unsigned int   reserved;
+    unsigned long long matchcode;   /* address of the struct dmx512_matchcode_term array */
+};
+
+/*
+ * Port filter of an open file for any number of ports.
+ * Port n is selected by bit (n % 64) of bitmap[n / 64].
+ *
+ * DMX512_IOCTL_SET_PORT_BITMAP replaces the ports of the file with the
+ * port_count ports of the bitmap. A port_count of 0 deselects all ports.
+ * Ports the device does not have when the bitmap is set are ignored.
+ * DMX512_IOCTL_GET_PORT_BITMAP fills the first port_count ports of the
+ * bitmap, if it is not 0, and returns the number of ports needed to hold
+ * all selected ports in port_count.
+ *
+ * bitmap holds the address as a 64 bit value, see struct dmx512_rxfilter_info.
+ *
+ * DMX512_IOCTL_SET_PORT_FILTER and DMX512_IOCTL_SET_PORT_TXFILTER set
+ * the ports 0..63 and deselect all others.
+ */
+#define DMX512_PORT_BITMAP_MAX_PORTS (65536)
+
+enum dmx512_port_bitmap_direction {
+    DMX512_PORT_BITMAP_RX = 0, /* the received frames of the ports. */
+    DMX512_PORT_BITMAP_TX = 1, /* the frames transmitted on the ports, looped back. */
+};
+
+struct dmx512_port_bitmap {
+    int                  direction;  /* DMX512_PORT_BITMAP_RX or _TX */
+    unsigned int         port_count; /* number of ports in bitmap */
+    unsigned long long   bitmap;     /* address of (port_count + 63) / 64 words */
+};
+
+
 #define DMX512_IOCTL_BASE 'D'
 
 
@@ -92,10 +425,45 @@ enum {
     DMX512_GET_PORT_TXFILTER,
     DMX512_SET_PORT_TXFILTER,
 
+    DMX512_SET_TIMESTAMP_CLOCK,
+    DMX512_GET_TIMESTAMP_CLOCK,
+
+    DMX512_SET_RX_MODE,
+    DMX512_GET_RX_MODE,
+
     /* Buffer Management */
     DMX512_ALLOCATE_DMX_BUFFERS = 30,
     DMX512_ENQUEUE_DMX_BUFFER,
     DMX512_DEQUEUE_DMX_BUFFER,
+
+    /* Device */
+    DMX512_GET_FRAMEPOOL_INFO = 40,
+    DMX512_SET_ROUTE,
+    DMX512_REM_ROUTE,
+    DMX512_GET_ROUTE,
+    DMX512_SET_STATE_INFO,
+    DMX512_GET_STATE_INFO,
+
+    /* Port */
+    DMX512_SET_PORT_REFRESH = 50,
+    DMX512_GET_PORT_REFRESH,
+    DMX512_GET_PORT_TXSCHEDULE_INFO,
+    DMX512_SET_PORT_MERGE,
+    DMX512_GET_PORT_MERGE,
+    DMX512_SET_PORT_TXQUEUE,
+    DMX512_GET_PORT_TXQUEUE,
+    DMX512_GET_PORT_STATS,
+
+    /* Open File, continued */
+    DMX512_SET_PORT_BITMAP = 60,
+    DMX512_GET_PORT_BITMAP,
+    DMX512_SET_FRAME_FORMAT,
+    DMX512_GET_FRAME_FORMAT,
+    DMX512_SET_MERGE_PRIORITY,
+    DMX512_GET_MERGE_PRIORITY,
+    DMX512_SET_RX_MODERATION,
+    DMX512_GET_RX_MODERATION,
+    DMX512_GET_STATS,
 };
 
 
@@ -111,18 +479,109 @@ enum {
 #define DMX512_IOCTL_GET_PORT_TXFILTER   _IOR(DMX512_IOCTL_BASE, DMX512_GET_PORT_TXFILTER, unsigned long long)
 #define DMX512_IOCTL_SET_PORT_TXFILTER   _IOW(DMX512_IOCTL_BASE, DMX512_SET_PORT_TXFILTER, unsigned long long)
 
-#define DMX512_IOCTL_SET_RX_MATCH_FILTER   _IOW(DMX512_IOCTL_BASE, DMX512_SET_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
-#define DMX512_IOCTL_REM_RX_MATCH_FILTER   _IOW(DMX512_IOCTL_BASE, DMX512_REM_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
-#define DMX512_IOCTL_GET_RX_MATCH_FILTER   _IOW(DMX512_IOCTL_BASE, DMX512_GET_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
+#define DMX512_IOCTL_SET_PORT_BITMAP   _IOW(DMX512_IOCTL_BASE, DMX512_SET_PORT_BITMAP, struct dmx512_port_bitmap)
+#define DMX512_IOCTL_GET_PORT_BITMAP   _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_BITMAP, struct dmx512_port_bitmap)
 
 /*
- * RDM replies are routed to the file handles the requests came from.
+ * The clock of the timestamps of an open file, CLOCK_MONOTONIC (default) or CLOCK_TAI.
+ * It applies to the timestamps of received frames as well as to the
+ * timestamps of frames written for timed transmission.
+ */
+#define DMX512_IOCTL_SET_TIMESTAMP_CLOCK   _IOW(DMX512_IOCTL_BASE, DMX512_SET_TIMESTAMP_CLOCK, int)
+#define DMX512_IOCTL_GET_TIMESTAMP_CLOCK   _IOR(DMX512_IOCTL_BASE, DMX512_GET_TIMESTAMP_CLOCK, int)
+
+/*
+ * Receive mode of an open file, set with DMX512_IOCTL_SET_RX_MODE.
+ * In DMX512_RX_MODE_CHANGES a frame with the NULL start code is only
+ * delivered, if it differs from the last one delivered for that port.
+ * Other frames are always delivered.
+ * Setting the mode delivers the next frame of every port.
+ */
+enum dmx512_rx_mode {
+    DMX512_RX_MODE_ALL     = 0,
+    DMX512_RX_MODE_CHANGES = 1,
+};
+
+#define DMX512_IOCTL_SET_RX_MODE   _IOW(DMX512_IOCTL_BASE, DMX512_SET_RX_MODE, int)
+#define DMX512_IOCTL_GET_RX_MODE   _IOR(DMX512_IOCTL_BASE, DMX512_GET_RX_MODE, int)
+
+/*
+ * Format of the frames read and written by an open file, set with
+ * DMX512_IOCTL_SET_FRAME_FORMAT. In DMX512_FRAME_FORMAT_COMPACT a read
+ * returns as many struct dmx512frame_compact records as fit into the
+ * buffer, which must hold at least DMX512_FRAME_COMPACT_MAX_SIZE octets.
+ * A write consumes whole records. Frames in mmap'ed buffers are always
+ * struct dmx512frame.
+ */
+enum dmx512_frame_format {
+    DMX512_FRAME_FORMAT_FULL    = 0, /* struct dmx512frame */
+    DMX512_FRAME_FORMAT_COMPACT = 1, /* struct dmx512frame_compact */
+};
+
+#define DMX512_IOCTL_SET_FRAME_FORMAT   _IOW(DMX512_IOCTL_BASE, DMX512_SET_FRAME_FORMAT, int)
+#define DMX512_IOCTL_GET_FRAME_FORMAT   _IOR(DMX512_IOCTL_BASE, DMX512_GET_FRAME_FORMAT, int)
+
+/*
+ * Priority of the frames an open file writes to merging ports in
+ * DMX512_MERGE_PRIORITY, 0..DMX512_MERGE_MAX_PRIORITY.
+ * Defaults to DMX512_MERGE_DEFAULT_PRIORITY.
  */
+#define DMX512_IOCTL_SET_MERGE_PRIORITY   _IOW(DMX512_IOCTL_BASE, DMX512_SET_MERGE_PRIORITY, int)
+#define DMX512_IOCTL_GET_MERGE_PRIORITY   _IOR(DMX512_IOCTL_BASE, DMX512_GET_MERGE_PRIORITY, int)
 
 /*
- * future dmabuf interface can be inspired by v4l2.
- * enqueue dmx-receive-buffer, dmx-transmit-buffer, rdm-request-reply,
- * incomming-rdm-request
+ * Wakeup moderation of an open file, set with DMX512_IOCTL_SET_RX_MODERATION.
+ * A reader waiting in read, poll or DMX512_IOCTL_DEQUEUE_DMX_BUFFER is
+ * woken up once max_frames frames are queued or max_delay_us have passed
+ * since the first of them was queued, whatever comes first. RDM frames
+ * wake up the reader right away. A non blocking read returns the frames
+ * queued so far. A max_frames of 0 or 1 wakes up for every frame, which
+ * is the default. max_frames is limited to the frames an open file can
+ * queue, DMX512_IOCTL_GET_RX_MODERATION returns the limited value.
+ */
+#define DMX512_RX_MODERATION_MAX_DELAY_US (1000000)
+
+struct dmx512_rx_moderation {
+    unsigned int max_frames;
+    unsigned int max_delay_us; /* 1..DMX512_RX_MODERATION_MAX_DELAY_US if max_frames > 1 */
+};
+
+#define DMX512_IOCTL_SET_RX_MODERATION   _IOW(DMX512_IOCTL_BASE, DMX512_SET_RX_MODERATION, struct dmx512_rx_moderation)
+#define DMX512_IOCTL_GET_RX_MODERATION   _IOR(DMX512_IOCTL_BASE, DMX512_GET_RX_MODERATION, struct dmx512_rx_moderation)
+#define DMX512_IOCTL_GET_STATS           _IOR(DMX512_IOCTL_BASE, DMX512_GET_STATS, struct dmx512_stats)
+
+#define DMX512_IOCTL_SET_RX_MATCH_FILTER   _IOW(DMX512_IOCTL_BASE, DMX512_SET_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
+#define DMX512_IOCTL_REM_RX_MATCH_FILTER   _IOW(DMX512_IOCTL_BASE, DMX512_REM_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
+#define DMX512_IOCTL_GET_RX_MATCH_FILTER   _IOWR(DMX512_IOCTL_BASE, DMX512_GET_RX_MATCH_FILTER, struct dmx512_rxfilter_info)
+
+#define DMX512_IOCTL_ALLOCATE_DMX_BUFFERS _IOWR(DMX512_IOCTL_BASE, DMX512_ALLOCATE_DMX_BUFFERS, struct dmx512_buffer_request)
+#define DMX512_IOCTL_ENQUEUE_DMX_BUFFER   _IOW(DMX512_IOCTL_BASE, DMX512_ENQUEUE_DMX_BUFFER, struct dmx512_buffer)
+#define DMX512_IOCTL_DEQUEUE_DMX_BUFFER   _IOR(DMX512_IOCTL_BASE, DMX512_DEQUEUE_DMX_BUFFER, struct dmx512_buffer)
+
+#define DMX512_IOCTL_GET_FRAMEPOOL_INFO   _IOR(DMX512_IOCTL_BASE, DMX512_GET_FRAMEPOOL_INFO, struct dmx512_framepool_info)
+#define DMX512_IOCTL_SET_ROUTE            _IOW(DMX512_IOCTL_BASE, DMX512_SET_ROUTE, struct dmx512_route_info)
+#define DMX512_IOCTL_REM_ROUTE            _IOW(DMX512_IOCTL_BASE, DMX512_REM_ROUTE, struct dmx512_route_info)
+#define DMX512_IOCTL_GET_ROUTE            _IOWR(DMX512_IOCTL_BASE, DMX512_GET_ROUTE, struct dmx512_route_info)
+#define DMX512_IOCTL_SET_STATE_INFO       _IOW(DMX512_IOCTL_BASE, DMX512_SET_STATE_INFO, struct dmx512_state_info)
+#define DMX512_IOCTL_GET_STATE_INFO       _IOR(DMX512_IOCTL_BASE, DMX512_GET_STATE_INFO, struct dmx512_state_info)
+
+#define DMX512_IOCTL_SET_PORT_REFRESH     _IOW(DMX512_IOCTL_BASE, DMX512_SET_PORT_REFRESH, struct dmx512_port_refresh_info)
+#define DMX512_IOCTL_GET_PORT_REFRESH     _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_REFRESH, struct dmx512_port_refresh_info)
+#define DMX512_IOCTL_GET_PORT_TXSCHEDULE_INFO _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_TXSCHEDULE_INFO, struct dmx512_port_txschedule_info)
+#define DMX512_IOCTL_SET_PORT_MERGE       _IOW(DMX512_IOCTL_BASE, DMX512_SET_PORT_MERGE, struct dmx512_port_merge_info)
+#define DMX512_IOCTL_GET_PORT_MERGE       _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_MERGE, struct dmx512_port_merge_info)
+#define DMX512_IOCTL_SET_PORT_TXQUEUE     _IOW(DMX512_IOCTL_BASE, DMX512_SET_PORT_TXQUEUE, struct dmx512_port_txqueue_info)
+#define DMX512_IOCTL_GET_PORT_TXQUEUE     _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_TXQUEUE, struct dmx512_port_txqueue_info)
+#define DMX512_IOCTL_GET_PORT_STATS       _IOWR(DMX512_IOCTL_BASE, DMX512_GET_PORT_STATS, struct dmx512_port_stats)
+
+/*
+ * RDM replies are routed to the file handles the requests came from.
+ * A request is matched by its port, transaction number and source UID,
+ * a discovery response by the port of the oldest DISC_UNIQUE_BRANCH.
+ * Responses are delivered regardless of the selected ports and match
+ * codes, and not to any other file handle. If no response arrives in
+ * time, a frame with DMX512_FLAG_RDM_TIMEOUT and the header of the
+ * request is delivered instead.
  */
 
 #endif // DEFINED_DMX512_IOCTLS
@@ -5,10 +5,59 @@
 #ifndef DRIVER_DMX512_PRIV_H
 #define DRIVER_DMX512_PRIV_H
 
+#include <linux/mutex.h>
+#include <linux/xarray.h>
+#include <linux/rcupdate.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/dmx512/dmx512.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+#include <linux/dmx512/dmx512framepool.h>
+#include <linux/dmx512/dmx512txschedule.h>
+#include <linux/dmx512/dmx512txqueue.h>
+#include <linux/dmx512/dmx512rxfilter.h>
+#include <linux/dmx512/dmx512rdmroute.h>
+#include <linux/dmx512/dmx512merge.h>
+#include <linux/dmx512/dmx512state.h>
+#include <linux/dmx512/dmx512stats.h>
 
-extern struct dmx512_framequeue free_framequeue;
 
+/*
+ * A frame route of a device (see struct dmx512_route_info).
+ */
+struct dmx512_route {
+	struct dmx512_device * dest_device;
+	unsigned int   source_port;
+	unsigned int   dest_port;
+	unsigned short source_slot;
+	unsigned short dest_slot;
+	unsigned short slot_count;
+	unsigned short priority; /* of the frames in the merge of the destination port */
+};
+
+/*
+ * The routes of a device are never changed in place, a changed table
+ * replaces the old one under the dmx512_lock. Received frames are
+ * forwarded under rcu_read_lock without a lock.
+ */
+struct dmx512_routes {
+	struct rcu_head rcu;
+	unsigned int    count;
+	struct dmx512_route routes[DMX512_ROUTES_MAX];
+};
+
+/*
+ * The universe state table of a device (see struct dmx512_state_table).
+ * It outlives the device while it is still mapped, the last unmap frees it.
+ */
+struct dmx512_device_state {
+	spinlock_t     lock;     /* serializes the writers, mapped and removed */
+	unsigned int   flags;    /* DMX512_STATE_FLAG_... */
+	unsigned int   mapped;   /* number of vmas mapping the table */
+	int            removed;  /* the device has been unregistered */
+	unsigned long  size;     /* page aligned size of table */
+	struct dmx512_state_table * table; /* vmalloc_user'ed */
+};
 
 struct dmx512_device {
 	struct list_head devicelist_item;
@@ -17,9 +66,203 @@ struct dmx512_device {
 	struct module * owner;
 	void          * data; /* filled by the register function with it's data parameter */
 	struct list_head ports;
+	struct xarray    ports_xa; /* ports by index, for lock free lookup */
+	struct xarray    subscribers_xa; /* dmx512_port_subscribers by port index */
 	struct miscdevice miscdev;
-        struct dmx512_framequeue rxframequeue;
-        wait_queue_head_t rxwait_queue;
+        spinlock_t       clients_lock;
+        struct list_head clients; /* the open files of this device */
+	struct dmx512_framepool * framepool; /* outlives the device while frames of it are in use */
+	struct dmx512_rdmroute rdmroute; /* RDM requests waiting for a response, under clients_lock */
+	struct hrtimer   rdmroute_timer;   /* reports requests without a response */
+	int              rdmroute_stopped;
+	struct dmx512_routes __rcu * routes; /* 0 if the device has no routes */
+	wait_queue_head_t txwait_queue; /* writers waiting for room in the txqueue of a port */
+	struct dmx512_device_state __rcu * state; /* 0 once the device is unregistered */
+	struct dentry * debugfs;  /* the statistics file of the device */
+};
+
+/*
+ * The clients that get the frames of one port. Created when the first
+ * client selects the port and kept until the device is unregistered,
+ * so it can be looked up in subscribers_xa without a lock.
+ * The lists are protected by the clients_lock of the device.
+ */
+struct dmx512_port_subscribers {
+	struct list_head rx;
+	struct list_head tx;
+	struct rcu_head rcu; /* looked up without a lock, so freed with kfree_rcu */
+};
+
+/* a port selected by a client with its port filter. */
+struct dmx512_subscription {
+	struct list_head port_item;   /* in dmx512_port_subscribers rx or tx */
+	struct list_head client_item; /* in dmx512_client subscriptions */
+	struct dmx512_client * client;
+	unsigned int port;
+	int direction;                /* DMX512_PORT_BITMAP_RX or _TX */
+	unsigned int rx_generation;   /* of the last frame delivered, for DMX512_RX_MODE_CHANGES */
+};
+
+/* number of frames a client can queue before the oldest one is dropped. */
+#define DMX512_CLIENT_RXQUEUE_SIZE (64)
+
+/* maximum number of buffers a client can allocate for mmap. */
+#define DMX512_CLIENT_MAX_BUFFERS (1024)
+
+/*
+ * The frame buffers a client shares with userspace via mmap.
+ * The rx and done fifos hold at most <count> entries, as every buffer
+ * is in only one of them at a time.
+ */
+struct dmx512_client_buffers {
+	struct mutex          lock;
+	struct dmx512frame  * frames;    /* vmalloc_user'ed, mapped into userspace */
+	unsigned long         size;      /* page aligned size of frames */
+	unsigned int          count;
+	atomic_t              mapped;    /* number of vmas mapping the buffers */
+	unsigned char       * state;     /* DMX512_BUFFER_STATE_... per buffer */
+	unsigned int        * rx;        /* fifo of enqueued receive buffers */
+	unsigned int          rx_head, rx_tail;
+	struct dmx512_buffer * done;     /* fifo of buffers ready to be dequeued */
+	unsigned int          done_head, done_tail;
+};
+
+/*
+ * Wakeup moderation of a client (see struct dmx512_rx_moderation),
+ * protected by the clients_lock of the device.
+ */
+struct dmx512_client_moderation {
+	unsigned int   frames;  /* wake up once this many frames are queued, 0 or 1 for every frame */
+	ktime_t        delay;   /* or this long after the first of them was queued */
+	struct hrtimer timer;   /* started by the first frame queued to an empty queue */
+	int            expired; /* the delay has passed or an RDM frame was queued */
+};
+
+/*
+ * Statistics of an open file (see struct dmx512_stats), updated
+ * without a lock.
+ */
+struct dmx512_client_counters {
+	atomic64_t rx_frames;
+	atomic64_t rx_bytes;
+	atomic64_t rx_queue_full;
+	atomic64_t tx_frames;
+	atomic64_t tx_bytes;
+	atomic64_t tx_refused;
+	atomic64_t rdm_timeouts;
+	atomic_t   rxqueue_high_water;
+	struct dmx512_histogram rx_latency;
+};
+
+/*
+ * The context of one open file on a dmx512 device.
+ */
+struct dmx512_client {
+	struct list_head deviceclient_item; /* client in dmx512-device */
+	struct dmx512_device *device;
+
+	/* the selected ports, protected by the clients_lock of the device. */
+	struct list_head subscriptions;
+
+	/* CLOCK_MONOTONIC or CLOCK_TAI, the clock of the timestamps the client sees. */
+	int clock;
+
+	/* DMX512_RX_MODE_... */
+	int rx_mode;
+
+	/* DMX512_FRAME_FORMAT_..., of the frames read and written. */
+	int frame_format;
+
+	/* 0..DMX512_MERGE_MAX_PRIORITY, of the frames written to merging ports. */
+	unsigned int merge_priority;
+
+	/* match codes, protected by the clients_lock of the device. */
+	struct dmx512_rxfilter rxfilter;
+
+	struct dmx512_framerefqueue rxframequeue;
+	wait_queue_head_t           rxwait_queue;
+	struct dmx512_client_moderation moderation;
+
+	/* port the last write could not queue a frame on, -1 if none. */
+	int tx_blocked_port;
+
+	struct dmx512_client_buffers buffers;
+
+	struct dmx512_client_counters stats;
+};
+
+/* shortest refresh period that can be configured. */
+#define DMX512_REFRESH_MIN_PERIOD_US (1000)
+
+/*
+ * Retransmission of the last frame written to a port (see dmx512refresh.c).
+ */
+struct dmx512_port_refresh {
+	spinlock_t         lock;
+	struct hrtimer     timer;
+	ktime_t            period;  /* 0 if the refresh is disabled */
+	ktime_t            min_gap;
+	ktime_t            last_tx; /* when the last frame has been send */
+	int                valid;   /* frame holds the last frame written */
+	int                pending; /* frame is held back until min_gap has passed */
+	int                stopped; /* the port is being removed */
+	struct dmx512frame frame;
+};
+
+/* number of timed frames a port can hold. */
+#define DMX512_PORT_TXSCHEDULE_SIZE (256)
+
+/*
+ * Frames written with a timestamp wait here until the timer
+ * releases them to the port at that time.
+ */
+struct dmx512_port_txschedule {
+	spinlock_t               lock;
+	struct hrtimer           timer;
+	int                      stopped; /* the port is being removed */
+	struct dmx512_txschedule frames;
+};
+
+/* number of frames a port can hold for its transmitter. */
+#define DMX512_PORT_TXQUEUE_SIZE (16)
+
+/*
+ * Frames waiting for the transmitter of a port (see struct
+ * dmx512_port_txqueue_info). Only one context hands frames to
+ * send_frame at a time, the one that finds the queue not busy.
+ */
+struct dmx512_port_txqueue {
+	spinlock_t             lock;
+	struct dmx512_txqueue  frames;
+	int                    busy;    /* frames are being handed to send_frame */
+	int                    stopped; /* the port is being removed */
+	atomic_t               dropped;
+	atomic_t               coalesced;
+};
+
+/*
+ * Statistics of a port (see struct dmx512_port_stats), updated
+ * without a lock. The txqueue and txschedule count their own drops.
+ */
+struct dmx512_port_counters {
+	atomic64_t rx_frames;
+	atomic64_t rx_bytes;
+	atomic64_t rx_no_frame;
+	atomic64_t rx_overruns;
+	atomic64_t tx_frames;
+	atomic64_t tx_bytes;
+	atomic64_t rdm_timeouts;
+	atomic64_t rdm_collisions;
+	atomic_t   txqueue_high_water;
+	struct dmx512_histogram tx_latency;
+};
+
+/*
+ * Merge of the frames written to a port (see dmx512merge.h).
+ */
+struct dmx512_port_merge {
+	spinlock_t            lock;
+	struct dmx512_merge * merge; /* 0 if the port does not merge */
 };
 
 struct dmx512_port {
@@ -27,14 +270,46 @@ struct dmx512_port {
         struct list_head portlist_item; /* port in the global ports list */
 
 	struct dmx512_device *device;
+	int      index; /* index of the port in the device, -1 if not added */
+	struct rcu_head rcu;
 	char     name[MAX_DMXPORT_NAME];
 	uint64_t capabilities;
 
+	/* called in an rcu read side critical section, must not sleep. */
 	int (*send_frame) (struct dmx512_port * port, struct dmx512_framequeue_entry * frame);
 	int (*transmitter_has_space) (struct dmx512_port * port);
+	/*
+	 * optional, fills the timestamps of a received frame from the hardware
+	 * and sets DMX512_FLAG_TIMESTAMP and DMX512_FLAG_BACK_TIMESTAMP for the
+	 * ones filled. Called from dmx512_received_frame.
+	 */
+	void (*rx_timestamp) (struct dmx512_port * port, struct dmx512_framequeue_entry * frame);
     // struct dmx512_framequeue rxframequeue;
-    // struct dmx512_framequeue txframequeue;
         void * userptr;
+
+	struct dmx512_port_refresh refresh;
+	struct dmx512_port_txschedule txschedule;
+	struct dmx512_port_txqueue txqueue;
+	struct dmx512_port_merge merge;
+	struct dmx512_port_counters stats;
+
+	/*
+	 * The last frame with the NULL start code received that differed
+	 * from the one before and its generation, for clients that only
+	 * want changes. Only used by dmx512_received_frame.
+	 */
+	struct dmx512_framequeue_entry * rx_last;
+	unsigned int rx_generation;
 };
 
+void dmx512_port_refresh_init(struct dmx512_port * port);
+void dmx512_port_refresh_cleanup(struct dmx512_port * port);
+void dmx512_port_refresh_stop(struct dmx512_port * port);
+int  dmx512_port_refresh_configure(struct dmx512_port * port, const u32 period_us, const u32 min_gap_us);
+void dmx512_port_refresh_get(struct dmx512_port * port, u32 * period_us, u32 * min_gap_us);
+int  dmx512_port_refresh_transmit(struct dmx512_port * port, struct dmx512_framequeue_entry * e);
+
+/* queue the frame for the transmitter of the port, consumes the reference. */
+int  dmx512_port_txqueue_transmit(struct dmx512_port * port, struct dmx512_framequeue_entry * e);
+
 #endif
@@ -61,4 +61,6 @@ struct ioctl_dmx512_port_filter
 
 /*
   Can we somehow model mergers and splitters within this api?
+  Splitters are routes (DMX512_IOCTL_SET_ROUTE) from one port to several,
+  mergers are merging ports (DMX512_IOCTL_SET_PORT_MERGE), see dmx512_ioctls.h.
 */
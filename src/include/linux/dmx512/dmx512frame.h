@@ -24,12 +24,16 @@ enum
     DMX512_FLAG_RDMCRC_VALID   = (2<<1), /* */
     DMX512_FLAG_RDMCRC_INVALID = (3<<1), /* */
 
-    DMX512_FLAG_TIMESTAMP      = (1<<3), /* have front timestamp */
-    DMX512_FLAG_BACK_TIMESTAMP = (1<<4), /* have back timestamp - on rx only. */
+    DMX512_FLAG_TIMESTAMP      = (1<<3), /* have front timestamp, taken at the break. */
+    DMX512_FLAG_BACK_TIMESTAMP = (1<<4), /* have back timestamp, taken after the last slot - on rx only. */
 
     DMX512_FLAG_IS_RDM      = (1<<6),/* RDM frame. This is also set if DMX512_FLAG_IS_RDM_DISC is set */
     DMX512_FLAG_IS_RDM_DISC = (1<<7), /* RDM Discover request or reply */
 
+    DMX512_FLAG_TX_LATE = (1<<8), /* a timed frame was send later than its timestamp, seen on loopback. */
+
+    DMX512_FLAG_RDM_TIMEOUT = (1<<9), /* no response to an RDM request of this file, the frame holds the header of the request. */
+
     DMX512_FLAGS_IS_TRANSMIT_FRAME = (1<<15) /* used when promiscuous mode is enabled to differentiate outgoing from incomming frames. */
   };
 
@@ -58,12 +62,41 @@ struct dmx512frame
     /* @timestamp:
        for incoming frames this is closest to the beginning of the frame possible.
        If this is {0,0} it means the hardware is not able to create a timestamp and the option for software timestamping must be enabled.
+       Timestamps of incoming frames are in the clock selected with DMX512_IOCTL_SET_TIMESTAMP_CLOCK,
+       CLOCK_MONOTONIC by default.
 
-       for outgoing frames this is the place in time it shall be send out.
-       If this is {0,0} it means as soon as possible.
+       for outgoing frames this is the place in time it shall be send out,
+       taken from CLOCK_MONOTONIC. If this is {0,0} it means as soon as possible.
     */
     struct timespec timestamp; // timestamp near the start of the break.
     struct timespec back_timestamp; // timestamp near the end of the frame (after last octet).
 } __attribute__((packed));
 
+/*
+ * Compact frame record, read and written instead of struct dmx512frame
+ * by open files that selected DMX512_FRAME_FORMAT_COMPACT.
+ * The header is followed by the start code and payload_size octets of
+ * payload, padded with 0 to a multiple of 8 octets. Records are packed
+ * back to back, so the next record starts DMX512_FRAME_COMPACT_SIZE(payload_size)
+ * octets after this one.
+ */
+struct dmx512frame_compact
+{
+    uint16_t port;
+    uint16_t flags;
+    uint8_t  breaksize;
+    uint8_t  unused;
+    uint16_t payload_size;
+
+    int64_t  timestamp;      /* in ns, same meaning and clock as dmx512frame.timestamp */
+    int64_t  back_timestamp; /* in ns, same meaning and clock as dmx512frame.back_timestamp */
+
+    uint8_t  data[];         /* startcode and payload */
+} __attribute__((packed));
+
+#define DMX512_FRAME_COMPACT_DATA_SIZE(payload_size) (((payload_size) < 512) ? (payload_size) + 1 : 513)
+#define DMX512_FRAME_COMPACT_SIZE(payload_size) \
+    ((sizeof(struct dmx512frame_compact) + DMX512_FRAME_COMPACT_DATA_SIZE(payload_size) + 7) & ~7UL)
+#define DMX512_FRAME_COMPACT_MAX_SIZE DMX512_FRAME_COMPACT_SIZE(512)
+
 #endif // DMX512_FRAME_H
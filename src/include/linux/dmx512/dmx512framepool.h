@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_FRAMEPOOL
+#define DEFINED_DMX512_FRAMEPOOL
+
+#include <linux/atomic.h>
+#include <linux/slab.h>
+
+#include <linux/dmx512/dmx512framequeue.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+/*
+ * A pool of frames for one device.
+ *
+ * Unused frames are kept in a lock free queue. If it runs empty, new
+ * frames are allocated from the kmem_cache up to max_frames. Frames
+ * returned while more than high_watermark frames are unused are given
+ * back to the cache. At least low_watermark frames are allocated on init.
+ *
+ * Every frame in use is charged to a port, so a port that holds on to
+ * many frames can be spotted with dmx512_framepool_info.
+ *
+ * The owner and every frame in use hold a reference to the pool. It is
+ * gone once the owner called dmx512_framepool_cleanup and the last
+ * frame was put, e.g. by a file still open after its device went away.
+ */
+struct dmx512_framepool
+{
+    struct dmx512_framequeue free;
+    struct kmem_cache * cache;
+
+    unsigned int low_watermark;
+    unsigned int high_watermark;
+    unsigned int max_frames;
+
+    atomic_t allocated;
+    atomic_t in_use;
+    atomic_t peak_in_use;
+    atomic_t grown;
+    atomic_t shrunk;
+    atomic_t exhausted;
+    atomic_t next_id;
+    atomic_t port_in_use[DMX512_FRAMEPOOL_PORTS];
+
+    atomic_t users;  /* the owner and the frames in use */
+    int      dynamic; /* from dmx512_framepool_create, freed with the last reference */
+};
+
+int  dmx512_framepool_init(struct dmx512_framepool *, struct kmem_cache * cache,
+                           const unsigned int low_watermark,
+                           const unsigned int high_watermark,
+                           const unsigned int max_frames);
+
+/* a pool that is freed with its last reference, 0 if out of memory. */
+struct dmx512_framepool * dmx512_framepool_create(struct kmem_cache * cache,
+                                                  const unsigned int low_watermark,
+                                                  const unsigned int high_watermark,
+                                                  const unsigned int max_frames);
+
+/* drop the reference of the owner and free the unused frames. */
+void dmx512_framepool_cleanup(struct dmx512_framepool *);
+
+/* get a frame charged to port (-1 for none), the caller holds the only reference. */
+struct dmx512_framequeue_entry * dmx512_framepool_get(struct dmx512_framepool *, const int port, gfp_t gfp);
+
+/* drop a reference to the frame, the last one returns it to its pool. */
+void dmx512_framepool_put(struct dmx512_framequeue_entry *);
+
+/* move the charge of the frame to another port. */
+void dmx512_framepool_charge(struct dmx512_framequeue_entry *, const int port);
+
+void dmx512_framepool_get_info(struct dmx512_framepool *, struct dmx512_framepool_info *);
+
+/* the cache all pools allocate their frames from. */
+struct kmem_cache * dmx512_framepool_create_cache(void);
+
+#endif
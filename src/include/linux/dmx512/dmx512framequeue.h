@@ -5,34 +5,126 @@
 #ifndef DEFINED_DMX512_FRAMEQUEUE
 #define DEFINED_DMX512_FRAMEQUEUE
 
-#include <linux/list.h>
-#include <linux/spinlock.h>
+#include <linux/atomic.h>
 
 #include <linux/dmx512/dmx512frame.h>
 
 /*
  * Local types
  */
+struct dmx512_framepool;
+
 typedef struct dmx512_framequeue_entry
 {
-    struct list_head    head;
+    atomic_t            refcount; /* number of users, 0 while in the free queue */
+    struct dmx512_framepool * pool; /* the pool the frame is returned to */
+    int                 charged_port; /* port the frame is accounted to, -1 for none */
+    long long           queued_ns; /* CLOCK_MONOTONIC when queued for the transmitter */
+    unsigned int        id; /* set by the pool when the frame is taken, tells frames apart in a trace */
+    unsigned int        routed; /* send by a route, it is not routed again when it loops back */
     struct dmx512frame  frame;
 } dmx512_framequeue_entry_t;
 
+/*
+ * One slot of the free queue. The sequence tells producers and
+ * consumers whether the slot is free or holds an entry for them.
+ */
+struct dmx512_framequeue_cell
+{
+    atomic_t                         sequence;
+    struct dmx512_framequeue_entry * entry;
+};
+
+/*
+ * A bounded lock free multi producer / multi consumer queue of frames.
+ * It is used as the pool of unused frames, which is fed back from
+ * every reader and taken from by every receiver, also in irq context.
+ */
 typedef struct dmx512_framequeue
 {
-    spinlock_t       queue_lock;
-    struct list_head head;
+    unsigned int     mask; /* size - 1, the size is a power of two */
+    atomic_t         enqueue_pos;
+    atomic_t         dequeue_pos;
+    struct dmx512_framequeue_cell * cells;
 } dmx512_framequeue_t;
 
-void dmx512_framequeue_init(struct dmx512_framequeue *);
+/*
+ * A bounded lock free ring of frame references. Used to queue one frame
+ * to many readers without copying it. There is one producer at a time,
+ * the device delivering frames, and consumers claim frames with a
+ * cmpxchg on the tail, so the producer can drop the oldest frame if
+ * the ring is full.
+ *
+ * Overflow policy:
+ * A DMX frame never takes one of the last rdm_reserve slots. If it does
+ * not fit, the oldest frame is dropped, unless that one is an RDM frame,
+ * then the new DMX frame is dropped instead. An RDM frame can use all
+ * slots and is only dropped if the ring is full of RDM frames.
+ */
+typedef struct dmx512_framerefqueue
+{
+    unsigned int     mask;        /* size - 1, the size is a power of two */
+    unsigned int     rdm_reserve; /* slots only RDM frames can use */
+    atomic_t         head;        /* next slot to write, written by the producer only */
+    atomic_t         tail;        /* next slot to read */
+    atomic_t         dropped;     /* number of frames dropped due to overflow */
+    struct dmx512_framequeue_entry ** ring;
+} dmx512_framerefqueue_t;
+
+int  dmx512_framequeue_init(struct dmx512_framequeue *, const unsigned int size);
 void dmx512_framequeue_cleanup(struct dmx512_framequeue *);
 int  dmx512_framequeue_isempty(struct dmx512_framequeue *);
 struct dmx512_framequeue_entry * dmx512_framequeue_get (struct dmx512_framequeue *);
-struct dmx512_framequeue_entry * dmx512_framequeue_front (struct dmx512_framequeue *);
 int  dmx512_framequeue_put(struct dmx512_framequeue *, struct dmx512_framequeue_entry *);
 
+int  dmx512_framerefqueue_init(struct dmx512_framerefqueue *, const unsigned int size);
+void dmx512_framerefqueue_cleanup(struct dmx512_framerefqueue *);
+int  dmx512_framerefqueue_isempty(struct dmx512_framerefqueue *);
+/* number of frames queued, a snapshot if there are concurrent consumers. */
+unsigned int dmx512_framerefqueue_count(struct dmx512_framerefqueue *);
+/* the most frames a DMX frame finds queued, when it is put. */
+unsigned int dmx512_framerefqueue_capacity(struct dmx512_framerefqueue *);
+struct dmx512_framequeue_entry * dmx512_framerefqueue_get (struct dmx512_framerefqueue *);
+struct dmx512_framequeue_entry * dmx512_framerefqueue_put(struct dmx512_framerefqueue *, struct dmx512_framequeue_entry *);
+
 struct dmx512_framequeue_entry * dmx512_framequeue_entry_alloc(void);
 void dmx512_framequeue_entry_free(struct dmx512_framequeue_entry *);
 
+/* RDM frames are never dropped in favour of DMX frames. */
+static inline int dmx512_frame_is_rdm(const struct dmx512_framequeue_entry * e)
+{
+    return (e->frame.flags & DMX512_FLAG_IS_RDM) || (e->frame.startcode == 0xCC);
+}
+
+/* 1 if both frames have the same size, start code and slots. */
+int dmx512_frame_data_equal(const struct dmx512frame * a, const struct dmx512frame * b);
+
+/*
+ * Fill the header of the compact record of a frame. Timestamps the frame
+ * has are moved by offset ns. Returns the number of data octets that follow.
+ */
+unsigned int dmx512_frame_to_compact(const struct dmx512frame * frame,
+                                     struct dmx512frame_compact * h,
+                                     const long long offset);
+
+/*
+ * Fill the frame from the header of a compact record, the data is copied
+ * by the caller. Returns the number of data octets that follow the header.
+ */
+unsigned int dmx512_frame_from_compact(struct dmx512frame * frame,
+                                       const struct dmx512frame_compact * h);
+
+/* take an additional reference to the frame. */
+static inline struct dmx512_framequeue_entry * dmx512_frame_ref(struct dmx512_framequeue_entry * e)
+{
+    atomic_inc(&e->refcount);
+    return e;
+}
+
+/* drop a reference, returns 1 if it was the last one and the frame can be reused. */
+static inline int dmx512_frame_unref(struct dmx512_framequeue_entry * e)
+{
+    return atomic_dec_and_test(&e->refcount);
+}
+
 #endif
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_MERGE
+#define DEFINED_DMX512_MERGE
+
+#include <linux/dmx512/dmx512frame.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+/*
+ * The merge of the frames several sources send to one port
+ * (see struct dmx512_port_merge_info).
+ *
+ * Slots are combined 8 at a time in 64 bit words, the per slot
+ * maximum and select are done with carry free byte arithmetic.
+ * A source is a writer, identified by an owner key, that is
+ * forgotten if it has not send a frame for the source timeout.
+ * The caller serializes access to a merge.
+ */
+struct dmx512_merge_source
+{
+    unsigned long owner;        /* 0 if the source is unused */
+    long long     updated;      /* CLOCK_MONOTONIC in ns of the last frame */
+    unsigned int  priority;
+    unsigned int  payload_size;
+    uint64_t      slots[512 / 8];
+};
+
+struct dmx512_merge
+{
+    int          mode;          /* DMX512_MERGE_... */
+    long long    source_timeout; /* ns, 0 if sources never time out */
+    unsigned int payload_size;
+    uint64_t     output[512 / 8];
+    struct dmx512_merge_source sources[DMX512_MERGE_MAX_SOURCES];
+
+    /*
+     * scratch of dmx512_merge_put and dmx512_merge_forget, kept here as
+     * they run in the rx interrupt of a driver with its small stack.
+     */
+    uint64_t     previous[512 / 8]; /* the output before the frame */
+    uint64_t     slots[512 / 8];    /* the slots of the frame */
+};
+
+void dmx512_merge_init(struct dmx512_merge *, const int mode, const long long source_timeout);
+
+/*
+ * Merge the slots of a frame with the NULL start code, send by owner.
+ * Returns 1 if the output changed, 0 if not and -1 if there are already
+ * DMX512_MERGE_MAX_SOURCES sources.
+ */
+int dmx512_merge_put(struct dmx512_merge *, const unsigned long owner, const unsigned int priority,
+                     const struct dmx512frame *, const long long now);
+
+/* remove the source of owner, returns 1 if the output changed. */
+int dmx512_merge_forget(struct dmx512_merge *, const unsigned long owner, const long long now);
+
+/* number of sources that have not timed out at now. */
+unsigned int dmx512_merge_sources(const struct dmx512_merge *, const long long now);
+
+/* copy the output into the start code and slots of frame. */
+void dmx512_merge_output(const struct dmx512_merge *, struct dmx512frame *);
+
+#endif
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_RDMROUTE
+#define DEFINED_DMX512_RDMROUTE
+
+#include <linux/dmx512/dmx512frame.h>
+
+/* number of RDM requests a device can wait for at the same time. */
+#define DMX512_RDMROUTE_SIZE (64)
+
+/* time to wait for the response to an RDM request, before a timeout is reported. */
+#define DMX512_RDMROUTE_TIMEOUT_NS (10000000LL)
+
+/* octets of an RDM message up to the parameter data length. */
+#define DMX512_RDM_HEADER_SIZE (24)
+
+/*
+ * The RDM requests sent by the open files of a device, that wait for a
+ * response. A response is routed to the owner of the request with the
+ * same port, transaction number and source UID. Discovery responses
+ * are routed to the owner of the oldest DISC_UNIQUE_BRANCH on the port,
+ * as they carry no header.
+ * The caller serializes access to a table.
+ */
+struct dmx512_rdmroute_entry
+{
+    void *    owner;   /* 0 if the entry is unused */
+    long long expires; /* CLOCK_MONOTONIC in ns */
+    uint16_t  port;
+    uint8_t   disc;    /* the request is a DISC_UNIQUE_BRANCH */
+    uint8_t   header[DMX512_RDM_HEADER_SIZE]; /* of the request, starting with the start code */
+};
+
+struct dmx512_rdmroute
+{
+    unsigned int count;
+    struct dmx512_rdmroute_entry entries[DMX512_RDMROUTE_SIZE];
+};
+
+void dmx512_rdmroute_init(struct dmx512_rdmroute *);
+
+/* 1 if the frame is an RDM request that expects a response. */
+int  dmx512_rdmroute_is_request(const struct dmx512frame *);
+
+/* 1 if the frame may be the response to a request, RDM or a discovery response. */
+int  dmx512_rdmroute_is_response(const struct dmx512frame *);
+
+/*
+ * Record the request of owner. Returns 1 if the request was recorded,
+ * 0 if it is no request or the table is full.
+ */
+int  dmx512_rdmroute_request(struct dmx512_rdmroute *, const struct dmx512frame *,
+                             void * owner, const long long expires);
+
+/*
+ * The request in frame has been handed to the transmitter, it does not
+ * expire before expires then. A request recorded when it was written
+ * may have waited in a txqueue. Returns 1 if the request was found.
+ */
+int  dmx512_rdmroute_sent(struct dmx512_rdmroute *, const struct dmx512frame *, const long long expires);
+
+/*
+ * The owner of the request the frame responds to, the request is removed.
+ * Returns 0 if the frame is no response to a recorded request.
+ */
+void * dmx512_rdmroute_response(struct dmx512_rdmroute *, const struct dmx512frame *);
+
+/*
+ * Remove a request that expired at now and return its owner, 0 if none expired.
+ * If timeout is not 0, it is filled with the header of the request and
+ * DMX512_FLAG_RDM_TIMEOUT.
+ */
+void * dmx512_rdmroute_expire(struct dmx512_rdmroute *, const long long now, struct dmx512frame * timeout);
+
+/*
+ * Make room for a request if the table is full. The request that
+ * expires first is removed and its owner returned, timeout is filled as
+ * by dmx512_rdmroute_expire. Returns 0 if the table is not full.
+ */
+void * dmx512_rdmroute_evict(struct dmx512_rdmroute *, struct dmx512frame * timeout);
+
+/* the time the first request expires or -1 if there is none. */
+long long dmx512_rdmroute_next(const struct dmx512_rdmroute *);
+
+/* remove all requests of owner, e.g. when the file is closed. */
+void dmx512_rdmroute_forget(struct dmx512_rdmroute *, void * owner);
+
+#endif
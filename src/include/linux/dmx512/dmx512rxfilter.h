@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_RXFILTER
+#define DEFINED_DMX512_RXFILTER
+
+#include <linux/dmx512/dmx512frame.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+/*
+ * The match filter of an open file (see struct dmx512_rxfilter_info).
+ *
+ * The terms of a match code are compiled into words of 8 octets, so
+ * a frame is checked with a few masked compares of unaligned loads.
+ * Match codes are immutable once compiled. Changing the filter only
+ * swaps the pointers, so it can be done under a spinlock, while
+ * compiling and freeing is done outside.
+ */
+struct dmx512_rxfilter_word
+{
+    uint64_t     mask;
+    uint64_t     value;
+    unsigned int offset; /* first octet of the word in dmx512frame.data */
+};
+
+struct dmx512_rxfilter_code
+{
+    unsigned int min_payload_size; /* the highest offset of a term */
+    unsigned int word_count;
+    unsigned int term_count;
+    struct dmx512_rxfilter_word  words[DMX512_RXFILTER_MAX_TERMS];
+    struct dmx512_matchcode_term terms[DMX512_RXFILTER_MAX_TERMS]; /* as set, for DMX512_IOCTL_GET_RX_MATCH_FILTER */
+};
+
+struct dmx512_rxfilter
+{
+    unsigned int count;
+    struct dmx512_rxfilter_code * codes[DMX512_RXFILTER_MAX_MATCHCODES];
+};
+
+/* returns 0 if a term is invalid or contradicts another one. */
+struct dmx512_rxfilter_code * dmx512_rxfilter_compile(const struct dmx512_matchcode_term * terms,
+                                                      const unsigned int count);
+void dmx512_rxfilter_free(struct dmx512_rxfilter_code *);
+
+/*
+ * Replace the match code at index or append it if index is -1.
+ * The replaced code is returned in old, the caller frees it.
+ * Returns -1 if the index is invalid or the filter is full.
+ */
+int dmx512_rxfilter_set(struct dmx512_rxfilter *, const int index,
+                        struct dmx512_rxfilter_code * code,
+                        struct dmx512_rxfilter_code ** old);
+
+/* remove the match code at index, the caller frees it. Returns -1 if the index is invalid. */
+int dmx512_rxfilter_remove(struct dmx512_rxfilter *, const int index,
+                           struct dmx512_rxfilter_code ** old);
+
+/* 1 if the frame matches any code, or the filter has no codes. */
+int dmx512_rxfilter_match(const struct dmx512_rxfilter *, const struct dmx512frame *);
+
+#endif
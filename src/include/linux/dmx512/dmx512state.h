@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_STATE
+#define DEFINED_DMX512_STATE
+
+#include <linux/dmx512/dmx512frame.h>
+#include <linux/dmx512/dmx512_ioctls.h>
+
+/*
+ * An entry of the universe state table (see struct dmx512_state_table).
+ * The writers of an entry are serialized by the caller, readers never
+ * block them and retry if the entry changed while it was copied.
+ */
+
+/* updated is stored as the back_timestamp of the entry. */
+void dmx512_port_state_write(struct dmx512_port_state *, const struct dmx512frame * frame,
+                             const struct timespec * updated);
+
+/*
+ * Copy a consistent snapshot of the entry into frame.
+ * Returns its sequence, 0 if the entry has never been written.
+ */
+unsigned int dmx512_port_state_read(const struct dmx512_port_state *, struct dmx512frame * frame);
+
+#endif
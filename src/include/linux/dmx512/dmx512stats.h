@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_STATS
+#define DEFINED_DMX512_STATS
+
+#include <linux/atomic.h>
+
+#include <linux/dmx512/dmx512_ioctls.h>
+
+/*
+ * A log2 latency histogram (see DMX512_STATS_HISTOGRAM_BUCKETS).
+ * Values are added without a lock, from any context.
+ */
+struct dmx512_histogram
+{
+    atomic_t buckets[DMX512_STATS_HISTOGRAM_BUCKETS];
+};
+
+void dmx512_histogram_init(struct dmx512_histogram *);
+
+/* the bucket of a latency in ns, negative latencies count as 0. */
+unsigned int dmx512_histogram_bucket(const long long ns);
+
+void dmx512_histogram_add(struct dmx512_histogram *, const long long ns);
+void dmx512_histogram_get(const struct dmx512_histogram *, unsigned int * buckets);
+
+/* raise the high water mark to value, if it is lower. */
+void dmx512_stats_high_water(atomic_t * mark, const int value);
+
+#endif
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_TXQUEUE
+#define DEFINED_DMX512_TXQUEUE
+
+#include <linux/dmx512/dmx512framequeue.h>
+
+/*
+ * The frames of a port waiting for its transmitter, in the order they
+ * were put. With coalescing, a frame with the NULL start code replaces
+ * the one with the NULL start code that is queued and not yet send, in
+ * its place in the queue, so a slow port sends the latest slots only.
+ * The caller serializes access to a queue.
+ */
+struct dmx512_txqueue
+{
+    unsigned int size;
+    unsigned int head;     /* next frame to get */
+    unsigned int count;
+    int          coalesce;
+    int          latest;   /* slot of the queued frame with the NULL start code, -1 if none */
+    struct dmx512_framequeue_entry ** frames;
+};
+
+int  dmx512_txqueue_init(struct dmx512_txqueue *, const unsigned int size);
+
+/* the queue must be drained with dmx512_txqueue_get before. */
+void dmx512_txqueue_cleanup(struct dmx512_txqueue *);
+
+/* only frames put while coalescing is enabled are replaced later. */
+void dmx512_txqueue_set_coalesce(struct dmx512_txqueue *, const int coalesce);
+
+/* 1 if the frame would be queued, it replaces a queued frame or there is room. */
+int  dmx512_txqueue_accepts(const struct dmx512_txqueue *, const struct dmx512frame *);
+
+/*
+ * Queue the frame, the queue takes over the callers reference.
+ * A frame it replaced is returned in replaced, the caller drops it.
+ * Returns -1 if the queue is full.
+ */
+int  dmx512_txqueue_put(struct dmx512_txqueue *, struct dmx512_framequeue_entry *,
+                        struct dmx512_framequeue_entry ** replaced);
+
+/* remove the oldest frame, 0 if the queue is empty. */
+struct dmx512_framequeue_entry * dmx512_txqueue_get(struct dmx512_txqueue *);
+
+#endif
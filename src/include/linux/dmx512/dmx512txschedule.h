@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Copyright (C) 2021 Michael Stickel <michael@cubic.org>
+ */
+#ifndef DEFINED_DMX512_TXSCHEDULE
+#define DEFINED_DMX512_TXSCHEDULE
+
+#include <linux/atomic.h>
+
+#include <linux/dmx512/dmx512framequeue.h>
+
+/*
+ * Frames released later than this after their timestamp are flagged
+ * with DMX512_FLAG_TX_LATE and counted as late.
+ */
+#define DMX512_TXSCHEDULE_LATE_NS (100000LL)
+
+/*
+ * A time ordered queue of frames to transmit, kept as a binary min heap.
+ * Frames with the same due time are released in the order they were put.
+ * The caller serializes access to a schedule.
+ */
+struct dmx512_txschedule_slot
+{
+    long long due; /* CLOCK_MONOTONIC in ns */
+    unsigned int seq;
+    struct dmx512_framequeue_entry * entry;
+};
+
+struct dmx512_txschedule
+{
+    unsigned int size;
+    unsigned int count;
+    unsigned int seq;
+    struct dmx512_txschedule_slot * heap;
+
+    atomic_t late;    /* frames released more than DMX512_TXSCHEDULE_LATE_NS after their due time. */
+    atomic_t dropped; /* frames released, but not send, e.g. because the transmitter was full. */
+};
+
+int  dmx512_txschedule_init(struct dmx512_txschedule *, const unsigned int size);
+
+/* the schedule must be drained with dmx512_txschedule_get before. */
+void dmx512_txschedule_cleanup(struct dmx512_txschedule *);
+
+/*
+ * Queue the frame for the time due. The schedule takes over the callers reference.
+ * Returns 1 if the frame is now the first one, 0 if not and -1 if the schedule is full.
+ */
+int  dmx512_txschedule_put(struct dmx512_txschedule *, struct dmx512_framequeue_entry *, const long long due);
+
+/* remove the first frame, if it is due at now. Late frames are flagged. */
+struct dmx512_framequeue_entry * dmx512_txschedule_get_due(struct dmx512_txschedule *, const long long now);
+
+/* remove the first frame, regardless of its due time. */
+struct dmx512_framequeue_entry * dmx512_txschedule_get(struct dmx512_txschedule *);
+
+/* the due time of the first frame or -1 if the schedule is empty. */
+long long dmx512_txschedule_next(struct dmx512_txschedule *);
+
+/* the timestamp of a frame in ns, 0 means send as soon as possible. */
+long long dmx512_frame_timestamp_ns(const struct dmx512frame *);
+
+#endif
@@ -0,0 +1,638 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/dmx512/dmx512framequeue.h>
+#include <linux/dmx512/dmx512framepool.h>
+#include <linux/dmx512/dmx512txschedule.h>
+#include <linux/dmx512/dmx512rxfilter.h>
+#include <linux/dmx512/dmx512rdmroute.h>
+#include <linux/dmx512/dmx512merge.h>
+#include <linux/dmx512/dmx512txqueue.h>
+#include <linux/dmx512/dmx512state.h>
+#include <linux/dmx512/dmx512stats.h>
+
+#define POOLSIZE (256)
+#define RINGSIZE (16)
+
+static const int producers_count = 4;
+static const int rounds = 1000000;
+
+static struct dmx512_framequeue pool;
+
+static int check(const int cond, const char * what)
+{
+  printf ("%s: %s\n", cond ? "ok" : "FAILED", what);
+  return cond ? 0 : 1;
+}
+
+static struct dmx512_framequeue_entry * frame(struct dmx512_framequeue_entry * e, const int startcode, const int n)
+{
+  atomic_set(&e->refcount, 0); /* the queue holds the only reference */
+  e->frame.startcode = startcode;
+  e->frame.flags = (startcode == 0xCC) ? DMX512_FLAG_IS_RDM : 0;
+  e->frame.payload[0] = n;
+  return e;
+}
+
+/* drop the callers reference, returns the remaining references. */
+static int unref(struct dmx512_framequeue_entry * e)
+{
+  if (e)
+    dmx512_frame_unref(e);
+  return e ? atomic_read(&e->refcount) : -1;
+}
+
+static int test_refqueue()
+{
+  struct dmx512_framerefqueue q;
+  struct dmx512_framequeue_entry e[RINGSIZE+4];
+  struct dmx512_framequeue_entry * d;
+  int errors = 0;
+  int i;
+
+  memset(e, 0, sizeof(e));
+  errors += check(dmx512_framerefqueue_init(&q, 12) != 0, "size must be a power of two");
+  errors += check(dmx512_framerefqueue_init(&q, RINGSIZE) == 0, "init");
+  errors += check(dmx512_framerefqueue_isempty(&q), "empty after init");
+
+  /* DMX frames can use all but the rdm reserve. */
+  for (i = 0; i < RINGSIZE - RINGSIZE/8; ++i)
+    errors += (dmx512_framerefqueue_put(&q, frame(&e[i], 0, i)) != 0);
+  errors += check(dmx512_framerefqueue_count(&q) == dmx512_framerefqueue_capacity(&q), "count of a full ring");
+  d = dmx512_framerefqueue_put(&q, frame(&e[i], 0, i));
+  errors += check(d == &e[0], "dmx drops the oldest frame");
+  errors += check(dmx512_framerefqueue_count(&q) == dmx512_framerefqueue_capacity(&q), "count after a drop");
+  errors += check(unref(d) == 0, "dropped frame has no reference left");
+
+  /* RDM frames use the reserve. */
+  for (i = RINGSIZE; i < RINGSIZE + RINGSIZE/8; ++i)
+    errors += (dmx512_framerefqueue_put(&q, frame(&e[i], 0xCC, i)) != 0);
+  d = dmx512_framerefqueue_put(&q, frame(&e[RINGSIZE+2], 0xCC, 99));
+  errors += check(d == &e[1], "rdm drops the oldest dmx frame if full");
+  unref(d);
+
+  /* drain the dmx frames, the ring is left with rdm only */
+  while ((d = dmx512_framerefqueue_get(&q)) != 0 && !dmx512_frame_is_rdm(d))
+    unref(d);
+  errors += check(d == &e[RINGSIZE], "rdm frames are kept in order");
+  unref(d);
+
+  dmx512_framerefqueue_put(&q, frame(&e[2], 0, 2));
+  while ((d = dmx512_framerefqueue_get(&q)) != 0)
+    unref(d);
+  errors += check(dmx512_framerefqueue_isempty(&q), "empty after drain");
+  errors += check(dmx512_framerefqueue_count(&q) == 0, "count after drain");
+  errors += check(atomic_read(&q.dropped) == 2, "dropped count");
+  dmx512_framerefqueue_cleanup(&q);
+  return errors;
+}
+
+static atomic_t pool_dups = ATOMIC_INIT(0);
+
+/*
+ * Returns the number of frames freed, because the put found the pool full.
+ * This happens if another thread is preempted between claiming and
+ * releasing a cell.
+ */
+static void *pool_user(void *arg)
+{
+  long freed = 0;
+  int i;
+  (void)arg;
+  for (i = 0; i < rounds; ++i)
+    {
+      struct dmx512_framequeue_entry * e = dmx512_framequeue_get(&pool);
+      if (!e)
+        continue;
+      if (atomic_inc_return(&e->refcount) != 1)
+        atomic_inc(&pool_dups); /* the same frame was handed out twice */
+      atomic_dec(&e->refcount);
+      if (dmx512_framequeue_put(&pool, e))
+        {
+          dmx512_framequeue_entry_free(e);
+          ++freed;
+        }
+    }
+  return (void*)freed;
+}
+
+static int test_pool()
+{
+  pthread_t threads[producers_count];
+  struct dmx512_framequeue_entry * e;
+  int errors = 0;
+  long count = 0;
+  int i;
+
+  errors += check(dmx512_framequeue_init(&pool, POOLSIZE) == 0, "pool init");
+  for (i = 0; i < POOLSIZE/2; ++i)
+    dmx512_framequeue_put(&pool, dmx512_framequeue_entry_alloc());
+
+  for (i = 0; i < producers_count; ++i)
+    pthread_create(&threads[i], 0, pool_user, 0);
+  for (i = 0; i < producers_count; ++i)
+    {
+      void * freed;
+      pthread_join(threads[i], &freed);
+      count += (long)freed;
+    }
+
+  while ((e = dmx512_framequeue_get(&pool)) != 0)
+    {
+      dmx512_framequeue_entry_free(e);
+      ++count;
+    }
+  errors += check(atomic_read(&pool_dups) == 0, "no frame handed out twice");
+  errors += check(count == POOLSIZE/2, "no frame lost in the pool");
+  dmx512_framequeue_cleanup(&pool);
+  return errors;
+}
+
+static int test_framepool()
+{
+  struct kmem_cache * cache = dmx512_framepool_create_cache();
+  struct dmx512_framepool p;
+  struct dmx512_framequeue_entry * e[40];
+  struct dmx512_framepool_info info;
+  int errors = 0;
+  int i;
+
+  errors += check(dmx512_framepool_init(&p, cache, 8, 16, 32) == 0, "framepool init");
+  dmx512_framepool_get_info(&p, &info);
+  errors += check(info.allocated == 8, "low watermark preallocated");
+
+  for (i = 0; i < 40; ++i)
+    e[i] = dmx512_framepool_get(&p, i % 2, GFP_KERNEL);
+  dmx512_framepool_get_info(&p, &info);
+  errors += check(e[31] && !e[32], "pool grows up to max_frames");
+  errors += check(info.grown == 24 && info.exhausted == 8, "grown and exhausted counted");
+  errors += check(info.port_in_use[0] == 16 && info.port_in_use[1] == 16, "frames charged per port");
+
+  dmx512_framepool_charge(e[0], 5);
+  dmx512_framepool_get_info(&p, &info);
+  errors += check(info.port_in_use[0] == 15 && info.port_in_use[5] == 1, "charge moves to another port");
+
+  for (i = 0; i < 32; ++i)
+    dmx512_framepool_put(e[i]);
+  dmx512_framepool_get_info(&p, &info);
+  errors += check(info.in_use == 0 && info.peak_in_use == 32, "all frames returned");
+  errors += check(info.allocated == 16 && info.shrunk == 16, "pool shrinks to high watermark");
+  errors += check(info.port_in_use[0] == 0 && info.port_in_use[5] == 0, "ports uncharged");
+
+  dmx512_framepool_cleanup(&p);
+
+  /* a frame still queued to an open file when the device goes away. */
+  {
+    struct dmx512_framepool * dp = dmx512_framepool_create(cache, 8, 16, 32);
+    struct dmx512_framequeue_entry * late = dmx512_framepool_get(dp, 0, GFP_KERNEL);
+    errors += check(dp && late, "created pool hands out frames");
+    dmx512_framepool_cleanup(dp);
+    errors += check(atomic_read(&dp->users) == 1 && atomic_read(&dp->allocated) == 1,
+                    "pool kept for the frame in use");
+    dmx512_framepool_put(late);
+  }
+
+  kmem_cache_destroy(cache);
+  return errors;
+}
+
+/*
+ * The cards of the userspace drivers run in threads of their own and
+ * their pools share one kmem_cache. Every put frees the frame to the
+ * cache, so the threads allocate and free from it all the time.
+ */
+static struct dmx512_framepool shared_pools[2];
+static atomic_t shared_corrupt = ATOMIC_INIT(0);
+
+static void *shared_pool_user(void *arg)
+{
+  const long id = (long)arg;
+  struct dmx512_framequeue_entry * e[4];
+  int i, j;
+  for (i = 0; i < rounds / 10; ++i)
+    {
+      for (j = 0; j < 4; ++j)
+        {
+          e[j] = dmx512_framepool_get(&shared_pools[(i + j) % 2], j, GFP_KERNEL);
+          if (e[j])
+            memset(e[j]->frame.data, id, 64);
+        }
+      for (j = 0; j < 4; ++j)
+        if (e[j])
+          {
+            int k;
+            for (k = 0; k < 64; ++k)
+              if (e[j]->frame.data[k] != id)
+                break;
+            if (k < 64)
+              atomic_inc(&shared_corrupt); /* another thread has the same frame */
+            dmx512_framepool_put(e[j]);
+          }
+    }
+  return 0;
+}
+
+static int test_shared_cache()
+{
+  struct kmem_cache * cache = dmx512_framepool_create_cache();
+  pthread_t threads[producers_count];
+  struct dmx512_framepool_info info[2];
+  int errors = 0;
+  long i;
+
+  errors += check(dmx512_framepool_init(&shared_pools[0], cache, 0, 1, 64) == 0, "shared pool 0 init");
+  errors += check(dmx512_framepool_init(&shared_pools[1], cache, 0, 1, 64) == 0, "shared pool 1 init");
+  for (i = 0; i < producers_count; ++i)
+    pthread_create(&threads[i], 0, shared_pool_user, (void*)(i + 1));
+  for (i = 0; i < producers_count; ++i)
+    pthread_join(threads[i], 0);
+
+  dmx512_framepool_get_info(&shared_pools[0], &info[0]);
+  dmx512_framepool_get_info(&shared_pools[1], &info[1]);
+  errors += check(atomic_read(&shared_corrupt) == 0, "no frame of the shared cache handed out twice");
+  errors += check(info[0].in_use == 0 && info[1].in_use == 0, "all frames of the shared cache returned");
+  errors += check(info[0].allocated <= 1 && info[1].allocated <= 1, "frames freed to the shared cache");
+  dmx512_framepool_cleanup(&shared_pools[0]);
+  dmx512_framepool_cleanup(&shared_pools[1]);
+  kmem_cache_destroy(cache);
+  return errors;
+}
+
+static int test_txschedule()
+{
+  struct dmx512_txschedule s;
+  struct dmx512_framequeue_entry e[8];
+  static const long long due[8] = { 500, 100, 300, 100, 700, 200, 100, 600 };
+  struct dmx512_framequeue_entry * d;
+  long long last = 0;
+  int in_order = 1;
+  int errors = 0;
+  int i;
+
+  memset(e, 0, sizeof(e));
+  errors += check(dmx512_txschedule_init(&s, 7) == 0, "txschedule init");
+  for (i = 0; i < 7; ++i)
+    {
+      e[i].frame.payload[0] = i;
+      errors += (dmx512_txschedule_put(&s, &e[i], due[i]) < 0);
+    }
+  errors += check(dmx512_txschedule_put(&s, &e[7], due[7]) < 0, "txschedule full");
+  errors += check(dmx512_txschedule_next(&s) == 100, "next due");
+  errors += check(dmx512_txschedule_get_due(&s, 99) == 0, "nothing due early");
+
+  /* frames due at the same time keep their order. */
+  d = dmx512_txschedule_get_due(&s, 100);
+  errors += check(d == &e[1] && !(d->frame.flags & DMX512_FLAG_TX_LATE), "first due frame");
+  d = dmx512_txschedule_get_due(&s, 100);
+  errors += check(d == &e[3], "same due time in order");
+  d = dmx512_txschedule_get_due(&s, 100);
+  errors += check(d == &e[6], "same due time in order");
+
+  while ((d = dmx512_txschedule_get_due(&s, 300 + DMX512_TXSCHEDULE_LATE_NS + 1)) != 0)
+    {
+      in_order &= (due[d->frame.payload[0]] >= last);
+      last = due[d->frame.payload[0]];
+    }
+  errors += check(in_order && (last == 700), "released in time order");
+  errors += check((e[5].frame.flags & DMX512_FLAG_TX_LATE) && (e[2].frame.flags & DMX512_FLAG_TX_LATE) &&
+                  !(e[4].frame.flags & DMX512_FLAG_TX_LATE), "late frames flagged");
+  errors += check(atomic_read(&s.late) == 2, "late frames counted");
+  errors += check(dmx512_txschedule_next(&s) == -1, "empty after release");
+  dmx512_txschedule_cleanup(&s);
+  return errors;
+}
+
+static int test_frame_equal()
+{
+  static struct dmx512frame a, b;
+  int errors = 0;
+  int differ = 0;
+  int i;
+
+  a.payload_size = b.payload_size = 512;
+  for (i = 0; i < 513; ++i)
+    a.data[i] = b.data[i] = i * 7;
+  errors += check(dmx512_frame_data_equal(&a, &b), "equal frames");
+  for (i = 0; i < 513; ++i)
+    {
+      b.data[i] ^= 0x10;
+      differ += dmx512_frame_data_equal(&a, &b) ? 0 : 1;
+      b.data[i] ^= 0x10;
+    }
+  errors += check(differ == 513, "every changed slot is found");
+  b.payload_size = 24;
+  errors += check(!dmx512_frame_data_equal(&a, &b), "size differs");
+  a.payload_size = 24;
+  a.data[100] = ~b.data[100];
+  errors += check(dmx512_frame_data_equal(&a, &b), "slots behind the payload are ignored");
+  return errors;
+}
+
+static int test_rxfilter()
+{
+  static struct dmx512frame f;
+  static const struct dmx512_matchcode_term rdm[] = { { 0, 0xff, 0xcc }, { 1, 0xff, 0x01 } };
+  static const struct dmx512_matchcode_term tail[] = { { 512, 0xf0, 0x50 }, { 3, 0x0f, 0x02 }, { 512, 0x0f, 0x0a } };
+  static const struct dmx512_matchcode_term contradiction[] = { { 7, 0x0f, 0x01 }, { 7, 0x03, 0x02 } };
+  struct dmx512_rxfilter filter;
+  struct dmx512_rxfilter_code * old;
+  int errors = 0;
+
+  memset(&filter, 0, sizeof(filter));
+  f.payload_size = 512;
+  f.data[3] = 0x72;
+  f.data[512] = 0x5a;
+  errors += check(dmx512_rxfilter_match(&filter, &f), "empty filter passes all frames");
+  errors += check(dmx512_rxfilter_compile(contradiction, 2) == 0, "contradicting terms are rejected");
+  errors += check(dmx512_rxfilter_set(&filter, -1, dmx512_rxfilter_compile(rdm, 2), &old) == 0, "append match code");
+  errors += check(!dmx512_rxfilter_match(&filter, &f), "frame does not match");
+  errors += check(dmx512_rxfilter_set(&filter, -1, dmx512_rxfilter_compile(tail, 3), &old) == 0, "append match code");
+  errors += check(dmx512_rxfilter_match(&filter, &f), "merged terms on the last slot match");
+  f.payload_size = 511;
+  errors += check(!dmx512_rxfilter_match(&filter, &f), "terms behind the payload do not match");
+  f.payload_size = 512;
+  f.data[0] = 0xcc;
+  f.data[1] = 0x01;
+  errors += check(dmx512_rxfilter_remove(&filter, 1, &old) == 0 && old, "remove match code");
+  dmx512_rxfilter_free(old);
+  errors += check(dmx512_rxfilter_match(&filter, &f), "frame matches the remaining code");
+  errors += check(dmx512_rxfilter_remove(&filter, 1, &old) == -1, "invalid index");
+  dmx512_rxfilter_remove(&filter, 0, &old);
+  dmx512_rxfilter_free(old);
+  errors += check(filter.count == 0, "filter empty");
+  return errors;
+}
+
+static int test_compact()
+{
+  static struct dmx512frame f, g;
+  struct dmx512frame_compact h;
+  unsigned int n;
+  int errors = 0;
+
+  errors += check(sizeof(struct dmx512frame_compact) == 24, "compact header size");
+  errors += check(DMX512_FRAME_COMPACT_SIZE(25) == 56, "rdm record size");
+  errors += check(DMX512_FRAME_COMPACT_MAX_SIZE == 544, "full record size");
+  errors += check(DMX512_FRAME_COMPACT_SIZE(513) == DMX512_FRAME_COMPACT_MAX_SIZE, "start code counted in payload_size");
+
+  f.port = 300;
+  f.flags = DMX512_FLAG_TIMESTAMP;
+  f.payload_size = 24;
+  f.timestamp.tv_sec = 12;
+  f.timestamp.tv_nsec = 999999999;
+  n = dmx512_frame_to_compact(&f, &h, 2);
+  errors += check(n == 25 && h.port == 300 && h.payload_size == 24, "compact header");
+  errors += check(h.timestamp == 13000000001LL && h.back_timestamp == 0, "timestamps moved by the offset");
+
+  h.timestamp = -1;
+  n = dmx512_frame_from_compact(&g, &h);
+  errors += check(n == 25 && g.port == 300 && g.payload_size == 24, "frame from compact header");
+  errors += check(g.timestamp.tv_sec == -1 && g.timestamp.tv_nsec == 999999999, "negative timestamp");
+  return errors;
+}
+
+static void rdm_message(struct dmx512frame * f, const int port, const uint8_t cc, const uint8_t tn,
+                        const uint8_t dest, const uint8_t source)
+{
+  memset(f, 0, sizeof(*f));
+  f->port = port;
+  f->payload_size = 25;
+  f->data[0] = 0xcc;
+  f->data[1] = 0x01;
+  f->data[2] = 24;
+  f->data[8] = dest;
+  f->data[14] = source;
+  f->data[15] = tn;
+  f->data[20] = cc;
+  f->data[22] = 0x60; /* DEVICE_INFO */
+}
+
+static int test_rdmroute()
+{
+  static struct dmx512_rdmroute r;
+  static struct dmx512frame f, timeout;
+  int a, b;
+  int i;
+  int errors = 0;
+
+  dmx512_rdmroute_init(&r);
+  rdm_message(&f, 3, 0x20, 7, 0x11, 0x01);
+  errors += check(dmx512_rdmroute_request(&r, &f, &a, 1000), "get request recorded");
+  rdm_message(&f, 3, 0x20, 7, 0x12, 0x02);
+  errors += check(dmx512_rdmroute_request(&r, &f, &b, 2000), "same tn from another file");
+  memset(&f.data[3], 0xff, 6);
+  errors += check(!dmx512_rdmroute_is_request(&f), "broadcasts get no response");
+  errors += check(dmx512_rdmroute_next(&r) == 1000, "first request times out first");
+  rdm_message(&f, 3, 0x20, 7, 0x11, 0x01);
+  errors += check(dmx512_rdmroute_sent(&r, &f, 1500) && dmx512_rdmroute_next(&r) == 1500, "sent request waits from then on");
+  errors += check(dmx512_rdmroute_sent(&r, &f, 900) && dmx512_rdmroute_next(&r) == 1500, "expiry is not moved back");
+  rdm_message(&f, 4, 0x20, 7, 0x11, 0x01);
+  errors += check(!dmx512_rdmroute_sent(&r, &f, 1500), "sent request on another port");
+
+  rdm_message(&f, 3, 0x21, 7, 0x02, 0x12);
+  errors += check(dmx512_rdmroute_response(&r, &f) == &b, "response goes to the requester");
+  errors += check(dmx512_rdmroute_response(&r, &f) == 0, "response is routed once");
+  rdm_message(&f, 4, 0x21, 7, 0x01, 0x11);
+  errors += check(dmx512_rdmroute_response(&r, &f) == 0, "response on another port");
+
+  errors += check(dmx512_rdmroute_expire(&r, 1499, &timeout) == 0, "not yet expired");
+  errors += check(dmx512_rdmroute_expire(&r, 1500, &timeout) == &a, "request expired");
+  errors += check((timeout.flags & DMX512_FLAG_RDM_TIMEOUT) && timeout.port == 3 && timeout.data[15] == 7,
+                  "timeout holds the request");
+  errors += check(dmx512_rdmroute_next(&r) == -1, "table empty");
+
+  rdm_message(&f, 5, 0x10, 1, 0xff, 0x01);
+  memset(&f.data[3], 0xff, 6);
+  f.data[22] = 0x01; /* DISC_UNIQUE_BRANCH */
+  errors += check(dmx512_rdmroute_request(&r, &f, &a, 10), "discovery is broadcast");
+  dmx512_rdmroute_forget(&r, &a);
+  errors += check(dmx512_rdmroute_next(&r) == -1, "requests of a closed file are forgotten");
+  dmx512_rdmroute_request(&r, &f, &b, 10);
+  memset(&f, 0, sizeof(f));
+  f.port = 5;
+  f.startcode = 0xfe;
+  f.payload_size = 23;
+  errors += check(dmx512_rdmroute_response(&r, &f) == &b, "discovery response goes to the requester");
+
+  errors += check(dmx512_rdmroute_evict(&r, &timeout) == 0, "no eviction with room left");
+  for (i = 0; i < DMX512_RDMROUTE_SIZE; ++i)
+  {
+    rdm_message(&f, 3, 0x20, i, 0x11, 0x01);
+    dmx512_rdmroute_request(&r, &f, (i == 7) ? &a : &b, 100 + ((i == 7) ? 0 : i + 1));
+  }
+  rdm_message(&f, 3, 0x20, 200, 0x11, 0x01);
+  errors += check(!dmx512_rdmroute_request(&r, &f, &b, 500), "full table refuses a request");
+  errors += check(dmx512_rdmroute_evict(&r, &timeout) == &a, "evicts the request that expires first");
+  errors += check((timeout.flags & DMX512_FLAG_RDM_TIMEOUT) && timeout.data[15] == 7, "eviction reports the timeout");
+  errors += check(dmx512_rdmroute_request(&r, &f, &b, 500), "request recorded after the eviction");
+  return errors;
+}
+
+static int test_merge()
+{
+  static struct dmx512_merge m;
+  static struct dmx512frame a, b, out;
+  int i, htp = 1;
+  int errors = 0;
+
+  dmx512_merge_init(&m, DMX512_MERGE_HTP, 1000);
+  a.payload_size = 512;
+  b.payload_size = 3;
+  for (i = 1; i <= 512; ++i)
+    a.data[i] = i;
+  for (i = 1; i <= 3; ++i)
+    b.data[i] = 0xff - i;
+  b.data[2] = 0;
+  errors += check(dmx512_merge_put(&m, 1, 100, &a, 0) == 1, "first source changes the output");
+  errors += check(dmx512_merge_put(&m, 1, 100, &a, 10) == 0, "same frame again");
+  errors += check(dmx512_merge_put(&m, 2, 100, &b, 20) == 1, "second source");
+  dmx512_merge_output(&m, &out);
+  for (i = 1; i <= 512; ++i)
+    if (out.data[i] != ((a.data[i] > b.data[i]) ? a.data[i] : b.data[i]))
+      htp = 0;
+  errors += check(htp && out.payload_size == 512, "highest value per slot");
+  errors += check(dmx512_merge_sources(&m, 1015) == 1, "first source timed out");
+  errors += check(dmx512_merge_forget(&m, 2, 30) == 1, "forget a source");
+  dmx512_merge_output(&m, &out);
+  errors += check(out.data[1] == 1 && out.data[3] == 3, "values of the remaining source");
+
+  dmx512_merge_init(&m, DMX512_MERGE_PRIORITY, 0);
+  dmx512_merge_put(&m, 1, 100, &a, 0);
+  dmx512_merge_put(&m, 2, 120, &b, 0);
+  dmx512_merge_output(&m, &out);
+  errors += check(out.payload_size == 3 && out.data[1] == 0xfe && out.data[2] == 0, "highest priority wins");
+
+  dmx512_merge_init(&m, DMX512_MERGE_LTP, 0);
+  dmx512_merge_put(&m, 1, 100, &a, 0);
+  dmx512_merge_put(&m, 2, 100, &b, 0);
+  a.data[2] = 0x80;
+  dmx512_merge_put(&m, 1, 100, &a, 0);
+  dmx512_merge_output(&m, &out);
+  errors += check(out.data[1] == 0xfe && out.data[2] == 0x80 && out.data[3] == 0xfc && out.data[4] == 4,
+                  "latest change per slot");
+  for (i = 0; i < DMX512_MERGE_MAX_SOURCES; ++i)
+    dmx512_merge_put(&m, 10 + i, 100, &a, 0);
+  errors += check(dmx512_merge_put(&m, 100, 100, &a, 0) == -1, "no free source");
+  return errors;
+}
+
+static int test_txqueue()
+{
+  struct dmx512_txqueue q;
+  struct dmx512_framequeue_entry e[6];
+  struct dmx512_framequeue_entry * replaced;
+  int errors = 0;
+
+  memset(e, 0, sizeof(e));
+  e[1].frame.startcode = 0xCC;
+  errors += check(dmx512_txqueue_init(&q, 3) == 0, "txqueue init");
+  errors += (dmx512_txqueue_put(&q, &e[0], &replaced) != 0) || (replaced != 0);
+  errors += (dmx512_txqueue_put(&q, &e[1], &replaced) != 0);
+  errors += (dmx512_txqueue_put(&q, &e[2], &replaced) != 0);
+  errors += check(!dmx512_txqueue_accepts(&q, &e[3].frame), "txqueue full");
+  errors += check(dmx512_txqueue_put(&q, &e[3], &replaced) < 0, "no coalescing by default");
+
+  /* the latest frame with the NULL start code replaces the queued one in its place. */
+  dmx512_txqueue_set_coalesce(&q, 1);
+  errors += check(dmx512_txqueue_get(&q) == &e[0], "txqueue in order");
+  errors += (dmx512_txqueue_put(&q, &e[3], &replaced) != 0);
+  errors += check(dmx512_txqueue_accepts(&q, &e[4].frame) && !dmx512_txqueue_accepts(&q, &e[1].frame),
+                  "a full queue accepts coalescing frames only");
+  errors += check((dmx512_txqueue_put(&q, &e[4], &replaced) == 0) && (replaced == &e[3]), "latest wins");
+  errors += check(dmx512_txqueue_get(&q) == &e[1], "rdm frame kept");
+  errors += check(dmx512_txqueue_get(&q) == &e[2], "older frame kept");
+  errors += check(dmx512_txqueue_get(&q) == &e[4], "latest frame in place");
+  errors += check(dmx512_txqueue_get(&q) == 0, "txqueue empty");
+  errors += check((dmx512_txqueue_put(&q, &e[5], &replaced) == 0) && (replaced == 0), "no replace once send");
+  dmx512_txqueue_get(&q);
+  dmx512_txqueue_cleanup(&q);
+  return errors;
+}
+
+static struct dmx512_port_state port_state;
+
+/* every frame written has all slots set to the same value. */
+static void * state_writer(void * arg)
+{
+  struct dmx512frame f;
+  struct timespec now = { 0, 0 };
+  int i;
+  (void)arg;
+  memset(&f, 0, sizeof(f));
+  f.payload_size = 512;
+  for (i = 1; i <= rounds; ++i)
+    {
+      memset(f.payload, i & 0xff, sizeof(f.payload));
+      now.tv_nsec = i;
+      dmx512_port_state_write(&port_state, &f, &now);
+    }
+  return 0;
+}
+
+static int test_state()
+{
+  pthread_t writer;
+  struct dmx512frame f;
+  unsigned int sequence, last = 0;
+  int torn = 0, backwards = 0;
+  int errors = 0;
+  int i;
+
+  memset(&port_state, 0, sizeof(port_state));
+  errors += check(dmx512_port_state_read(&port_state, &f) == 0, "state not written yet");
+
+  pthread_create(&writer, 0, state_writer, 0);
+  for (i = 0; i < rounds / 10; ++i)
+    {
+      sequence = dmx512_port_state_read(&port_state, &f);
+      if (sequence & 1)
+        ++torn;
+      if (sequence < last)
+        ++backwards;
+      last = sequence;
+      if (sequence && ((f.payload[0] != f.payload[511]) ||
+                       ((unsigned int)f.back_timestamp.tv_nsec != sequence / 2) ||
+                       ((f.back_timestamp.tv_nsec & 0xff) != f.payload[0])))
+        ++torn;
+    }
+  pthread_join(writer, 0);
+  errors += check(torn == 0, "no torn state read");
+  errors += check(backwards == 0, "state sequence never goes back");
+  errors += check(dmx512_port_state_read(&port_state, &f) == 2u * rounds, "sequence counts the updates");
+  return errors;
+}
+
+static int test_stats()
+{
+  struct dmx512_histogram h;
+  unsigned int buckets[DMX512_STATS_HISTOGRAM_BUCKETS];
+  atomic_t mark = ATOMIC_INIT(0);
+  int errors = 0;
+
+  errors += check((dmx512_histogram_bucket(-5) == 0) && (dmx512_histogram_bucket(999) == 0), "below 1us in bucket 0");
+  errors += check((dmx512_histogram_bucket(1000) == 1) && (dmx512_histogram_bucket(1999) == 1), "1us in bucket 1");
+  errors += check((dmx512_histogram_bucket(2000) == 2) && (dmx512_histogram_bucket(3999) == 2), "2us to 4us in bucket 2");
+  errors += check(dmx512_histogram_bucket(1024000) == 11, "1024us in bucket 11");
+  errors += check(dmx512_histogram_bucket(3600LL * 1000000000LL) == DMX512_STATS_HISTOGRAM_BUCKETS - 1,
+                  "long latencies in the last bucket");
+
+  dmx512_histogram_init(&h);
+  dmx512_histogram_add(&h, 500);
+  dmx512_histogram_add(&h, 1500);
+  dmx512_histogram_add(&h, 1600);
+  dmx512_histogram_get(&h, buckets);
+  errors += check((buckets[0] == 1) && (buckets[1] == 2) && (buckets[2] == 0), "histogram counts");
+
+  dmx512_stats_high_water(&mark, 3);
+  dmx512_stats_high_water(&mark, 2);
+  errors += check(atomic_read(&mark) == 3, "high water mark only rises");
+  return errors;
+}
+
+int main ()
+{
+  const int errors = test_refqueue() + test_pool() + test_framepool() + test_shared_cache() + test_txschedule() + test_frame_equal() + test_rxfilter() + test_compact() + test_rdmroute() + test_merge() + test_txqueue() + test_state() + test_stats();
+  printf ("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
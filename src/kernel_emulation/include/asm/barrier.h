@@ -0,0 +1,7 @@
+#ifndef DEFINED_BARRIER
+#define DEFINED_BARRIER
+
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DEFINED_ATOMIC
+#define DEFINED_ATOMIC
+
+typedef struct { int counter; } atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+static inline int atomic_read(const atomic_t * v) { return __atomic_load_n(&v->counter, __ATOMIC_RELAXED); }
+static inline void atomic_set(atomic_t * v, int i) { __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED); }
+static inline void atomic_add(int i, atomic_t * v) { __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST); }
+static inline void atomic_sub(int i, atomic_t * v) { __atomic_sub_fetch(&v->counter, i, __ATOMIC_SEQ_CST); }
+static inline void atomic_inc(atomic_t * v) { __atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline void atomic_dec(atomic_t * v) { __atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline int atomic_inc_return(atomic_t * v) { return __atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline int atomic_dec_return(atomic_t * v) { return __atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline int atomic_dec_and_test(atomic_t * v) { return atomic_dec_return(v) == 0; }
+
+static inline int atomic_read_acquire(const atomic_t * v) { return __atomic_load_n(&v->counter, __ATOMIC_ACQUIRE); }
+static inline void atomic_set_release(atomic_t * v, int i) { __atomic_store_n(&v->counter, i, __ATOMIC_RELEASE); }
+
+/* returns the old value, the exchange took place if it equals old. */
+static inline int atomic_cmpxchg(atomic_t * v, int old, int new)
+{
+    __atomic_compare_exchange_n(&v->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return old;
+}
+
+#endif
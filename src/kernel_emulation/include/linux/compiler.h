@@ -0,0 +1,7 @@
+#ifndef DEFINED_COMPILER
+#define DEFINED_COMPILER
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+#endif
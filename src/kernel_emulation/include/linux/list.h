@@ -117,6 +117,17 @@ _INLINE_ void list_del_init(struct list_head *entry)
 	INIT_LIST_HEAD(entry);
 }
 
+/**
+ * list_move_tail - delete from one list and add as another's tail
+ * @entry:	the entry to move
+ * @head:	the head that will follow our entry
+ */
+_INLINE_ void list_move_tail(struct list_head *entry, struct list_head *head)
+{
+	__list_del(entry->prev, entry->next);
+	list_add_tail(entry, head);
+}
+
 /**
  * list_empty - tests whether a list is empty
  * @head:	the list to test.
@@ -0,0 +1,15 @@
+#ifndef DEFINED_MATH64
+#define DEFINED_MATH64
+
+#include <stdint.h>
+
+typedef int32_t s32;
+typedef int64_t s64;
+
+static inline s64 div_s64_rem(s64 dividend, s32 divisor, s32 *remainder)
+{
+  *remainder = dividend % divisor;
+  return dividend / divisor;
+}
+
+#endif
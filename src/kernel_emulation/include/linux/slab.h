@@ -2,6 +2,11 @@
 #define DEFINED_SLAB
 
 #include <stdlib.h>
+#include <string.h>
+
+#include <linux/spinlock.h>
+
+typedef unsigned int gfp_t;
 
 #define GFP_ATOMIC (1)
 #define GFP_KERNEL (2)
@@ -17,15 +22,112 @@
 #define GFP_TRANSHUGE_LIGHT (12)
 #define GFP_TRANSHUGE (13)
 
-void * kzalloc(const size_t size, const unsigned long flags)
+static inline void * kzalloc(const size_t size, const unsigned long flags)
 {
   (void)flags;
-  return malloc(size);
+  return calloc(1, size);
 }
 
-void kfree(void * p)
+static inline void kfree(void * p)
 {
   free(p);
 }
-  
+
+/*
+ * kmem_cache backed by arenas. Objects are carved out of arenas of
+ * KMEM_CACHE_ARENA_OBJECTS objects and freed objects are kept on a free
+ * list, that is linked through the objects. Memory is only given back to
+ * the system by kmem_cache_destroy.
+ */
+#define SLAB_HWCACHE_ALIGN (1)
+
+#define KMEM_CACHE_ARENA_OBJECTS (64)
+#define KMEM_CACHE_LINE_SIZE (64)
+
+struct kmem_cache
+{
+  const char * name;
+  size_t       size;   /* object size, including alignment */
+  void       * free;   /* free objects */
+  void       * arenas; /* the arenas, linked through their first word */
+  spinlock_t   lock;
+};
+
+static inline struct kmem_cache * kmem_cache_create(const char * name, unsigned int size, unsigned int align,
+                                                    unsigned long flags, void (*ctor)(void *))
+{
+  struct kmem_cache * c = (struct kmem_cache *)calloc(1, sizeof(*c));
+  (void)ctor;
+  if (!c)
+    return 0;
+  if (flags & SLAB_HWCACHE_ALIGN)
+    align = KMEM_CACHE_LINE_SIZE;
+  if (align < sizeof(void*))
+    align = sizeof(void*);
+  c->name = name;
+  c->size = (size + align - 1) / align * align;
+  spin_lock_init(&c->lock);
+  return c;
+}
+
+static inline void * kmem_cache_alloc(struct kmem_cache * c, gfp_t flags)
+{
+  void * p;
+  (void)flags;
+  spin_lock(&c->lock);
+  if (!c->free)
+    {
+      /* the first object of the arena holds the arena link. */
+      char * arena = (char *)aligned_alloc(KMEM_CACHE_LINE_SIZE, (KMEM_CACHE_ARENA_OBJECTS + 1) * c->size);
+      int i;
+      if (!arena)
+        {
+          spin_unlock(&c->lock);
+          return 0;
+        }
+      *(void **)arena = c->arenas;
+      c->arenas = arena;
+      for (i = KMEM_CACHE_ARENA_OBJECTS; i > 0; --i)
+        {
+          *(void **)(arena + i * c->size) = c->free;
+          c->free = arena + i * c->size;
+        }
+    }
+  p = c->free;
+  c->free = *(void **)p;
+  spin_unlock(&c->lock);
+  return p;
+}
+
+static inline void * kmem_cache_zalloc(struct kmem_cache * c, gfp_t flags)
+{
+  void * p = kmem_cache_alloc(c, flags);
+  if (p)
+    memset(p, 0, c->size);
+  return p;
+}
+
+static inline void kmem_cache_free(struct kmem_cache * c, void * p)
+{
+  if (!p)
+    return;
+  spin_lock(&c->lock);
+  *(void **)p = c->free;
+  c->free = p;
+  spin_unlock(&c->lock);
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache * c)
+{
+  if (!c)
+    return;
+  while (c->arenas)
+    {
+      void * next = *(void **)c->arenas;
+      free(c->arenas);
+      c->arenas = next;
+    }
+  free(c);
+}
+
 #endif
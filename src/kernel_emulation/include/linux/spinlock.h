@@ -1,10 +1,69 @@
 #ifndef DEFINED_SPINLOCK
 #define DEFINED_SPINLOCK
 
-typedef unsigned long spinlock_t;
+#include <pthread.h>
 
-static void spin_lock_init(spinlock_t * sl) { (void)sl;  }
-static void spin_lock(spinlock_t * sl) { (void)sl;  }
-static void spin_unlock(spinlock_t * sl) { (void)sl; }
+/*
+ * A test and test-and-set spinlock. The userspace drivers run the cards
+ * in threads of their own, which share e.g. the kmem_cache of the frames.
+ * There are no interrupts in userspace, so the _irq and _irqsave
+ * variants only take the lock.
+ */
+typedef struct { int locked; } spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name) { 0 }
+#define DEFINE_SPINLOCK(name) spinlock_t name = __SPIN_LOCK_UNLOCKED(name)
+
+static inline void spin_lock_init(spinlock_t * sl)
+{
+    __atomic_store_n(&sl->locked, 0, __ATOMIC_RELAXED);
+}
+
+static inline int spin_trylock(spinlock_t * sl)
+{
+    return !__atomic_exchange_n(&sl->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_lock(spinlock_t * sl)
+{
+    while (!spin_trylock(sl))
+    {
+        /* wait on the cache line without writing it. */
+        while (__atomic_load_n(&sl->locked, __ATOMIC_RELAXED))
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            __asm__ __volatile__("yield");
+#endif
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock_t * sl)
+{
+    __atomic_store_n(&sl->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define spin_lock_irq(sl)   spin_lock(sl)
+#define spin_unlock_irq(sl) spin_unlock(sl)
+#define spin_lock_irqsave(sl, flags)      do { (void)(flags); spin_lock(sl); } while (0)
+#define spin_unlock_irqrestore(sl, flags) do { (void)(flags); spin_unlock(sl); } while (0)
+
+/*
+ * A sleeping lock for the longer critical sections.
+ */
+struct mutex
+{
+    pthread_mutex_t m;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+
+static inline void mutex_init(struct mutex * m)    { pthread_mutex_init(&m->m, 0); }
+static inline void mutex_destroy(struct mutex * m) { pthread_mutex_destroy(&m->m); }
+static inline void mutex_lock(struct mutex * m)    { pthread_mutex_lock(&m->m); }
+static inline int  mutex_trylock(struct mutex * m) { return pthread_mutex_trylock(&m->m) == 0; }
+static inline void mutex_unlock(struct mutex * m)  { pthread_mutex_unlock(&m->m); }
 
 #endif
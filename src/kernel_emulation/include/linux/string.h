@@ -0,0 +1,6 @@
+#ifndef DEFINED_STRING
+#define DEFINED_STRING
+
+#include <string.h>
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef DEFINED_TIME
+#define DEFINED_TIME
+
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+#endif
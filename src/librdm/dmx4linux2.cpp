@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <limits.h>
 #include <poll.h>
@@ -67,6 +68,50 @@ bool Dmx4Linux2Device::read(dmx512frame & dmxframe)
   return n == sizeof(dmxframe);
 }
 
+int Dmx4Linux2Device::write(dmx512frame * dmxframes, int count)
+{
+  const ssize_t ret = ::write(m_dmxfd, dmxframes, count * sizeof(dmx512frame));
+  if (ret < 0)
+    {
+      perror("Dmx4Linux2Device::write");
+      return -1;
+    }
+  return ret / sizeof(dmx512frame);
+}
+
+int Dmx4Linux2Device::read(dmx512frame * dmxframes, int count)
+{
+  const ssize_t n = ::read(m_dmxfd, dmxframes, count * sizeof(dmx512frame));
+  if (n < 0)
+    {
+      perror("Dmx4Linux2Device::read");
+      return -1;
+    }
+  return n / sizeof(dmx512frame);
+}
+
+int Dmx4Linux2Device::writev(const struct iovec * iov, int iovcnt)
+{
+  const ssize_t ret = ::writev(m_dmxfd, iov, iovcnt);
+  if (ret < 0)
+    {
+      perror("Dmx4Linux2Device::writev");
+      return -1;
+    }
+  return ret / sizeof(dmx512frame);
+}
+
+int Dmx4Linux2Device::readv(const struct iovec * iov, int iovcnt)
+{
+  const ssize_t n = ::readv(m_dmxfd, iov, iovcnt);
+  if (n < 0)
+    {
+      perror("Dmx4Linux2Device::readv");
+      return -1;
+    }
+  return n / sizeof(dmx512frame);
+}
+
 // adds the file handle to a pollfd entry.
 void Dmx4Linux2Device::addToPoll(struct pollfd & fds)
 {
@@ -5,6 +5,7 @@
 #pragma once
 struct dmx512frame;
 struct pollfd;
+struct iovec;
 
 /*
  * This abstracts most of the operating system away.
@@ -36,6 +37,18 @@ public:
   // read a frame and block, if no one is available.
   bool read(dmx512frame & dmxframe);
 
+  // write up to count frames with one call, returns the number of frames written or -1.
+  int write(dmx512frame * dmxframes, int count);
+
+  // read up to count frames with one call, returns the number of frames read or -1.
+  int read(dmx512frame * dmxframes, int count);
+
+  // write the frames of all iov entries with one call, returns the number of frames written or -1.
+  int writev(const struct iovec * iov, int iovcnt);
+
+  // read frames into all iov entries with one call, returns the number of frames read or -1.
+  int readv(const struct iovec * iov, int iovcnt);
+
   // adds the file handle to a pollfd entry.
   void addToPoll(struct pollfd &);
 
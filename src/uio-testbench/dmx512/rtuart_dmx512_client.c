@@ -14,6 +14,7 @@
 
 #include <linux/dmx512/dmx512frame.h>
 #include "dmx512_port.h"
+#include <dmx512trace.h>
 
 extern void dump_dmx512_frame(struct dmx512_framequeue_entry * frame, const char * prompt);
 
@@ -467,6 +468,7 @@ static struct dmx512_framequeue_entry* dmx512rtuart_checkout_tx_frame(struct dmx
 {
 	struct dmx512_framequeue_entry * f = port->tx.frame;
 	if (f) {
+		dmx512_trace_event(DMX512_TRACE_TX_COMPLETE, f->frame.port, dmx512_trace_frame_id(&f->frame), 0);
 		port->tx.ptr = 0;
 		port->tx.remain = 0;
 		port->tx.frame = 0;
@@ -474,11 +476,24 @@ static struct dmx512_framequeue_entry* dmx512rtuart_checkout_tx_frame(struct dmx
 	return f;
 }
 
+/*
+ * The core queues the frames while a frame is on the line, see
+ * dmx512_rtuart_client_transmitter_has_space. Called at the end of
+ * the notifications, if the frame send before was handed back.
+ */
+static void dmx512rtuart_tx_done(struct dmx512_uart_port * port, const struct dmx512_framequeue_entry * sent)
+{
+	if (sent && !port->tx.frame)
+		dmx512_port_transmitter_ready(&port->dmx);
+}
+
 static struct dmx512_framequeue_entry* dmx512rtuart_checkout_rx_frame(struct dmx512_uart_port * port)
 {
 	struct dmx512_framequeue_entry * f = port->rx.frame;
 	if (f) {
+		dmx512_frame_timestamp_back(f);
 		f->frame.payload_size = port->rx.count - 1;
+		dmx512_trace_event(DMX512_TRACE_RX_COMPLETE, f->frame.port, dmx512_trace_frame_id(&f->frame), 0);
 
                 printf ("dmx512rtuart_checkout_rx_frame: startcode=%02X size=%d\n",
                         f->frame.startcode,
@@ -598,7 +613,8 @@ static void dmx512rtuart_handle_rdm_timeout(struct dmx512_uart_port * port)
 	/*
 	 * We only handle timeouts for replies for which we have a request.
 	 */
-	if (!port->tx.frame)
+	const struct dmx512_framequeue_entry * sent = port->tx.frame;
+	if (!sent)
 		return;
 
 	switch(port->state)
@@ -647,6 +663,7 @@ static void dmx512rtuart_handle_rdm_timeout(struct dmx512_uart_port * port)
 		// TODO: should not happen, write a note and delete timer.
 		break;
 	}
+	dmx512rtuart_tx_done(port, sent);
 }
 
 static int dmx512rtuart_transmitter_empty(struct rtuart *uart)
@@ -873,7 +890,10 @@ static int dmx512rtuart_receiver_data_available(struct rtuart * uart, const int
 					uart_enable_notification(uart, UART_NOTIFY_RXAVAILABLE);
 			}
 			if (count > toread)
+			{
 				rtuart_flush_fifo (uart, 0, 1); // uart_flush_rxfifo(uart);
+				dmx512_port_rx_overrun(&port->dmx);
+			}
 		}
 		break;
 
@@ -1022,6 +1042,10 @@ static int dmx512rtuart_line_status_event(struct rtuart * uart, const unsigned l
 			port->rx.frame = dmx512_get_frame(&port->dmx);
 			if (port->rx.frame)
 			{
+				port->rx.frame->frame.flags = 0;
+				dmx512_frame_timestamp_front(port->rx.frame);
+				dmx512_trace_event(DMX512_TRACE_RX_BREAK, port->rx.frame->frame.port,
+						   dmx512_trace_frame_id(&port->rx.frame->frame), 0);
 				port->rx.data = port->rx.frame->frame.data;
 				port->rx.count = 0;
 				memset(port->rx.frame->frame.data, 0xCE, sizeof(port->rx.frame->frame.data));
@@ -1070,17 +1094,54 @@ static int dmx512rtuart_line_status_event(struct rtuart * uart, const unsigned l
 	uart_enable_notification(uart, UART_NOTIFY_LINEEVENT);
 }
 
+/*
+ * The notifications that may hand back the frame send, e.g. the
+ * TX-empty interrupt at the end of a DMX frame.
+ */
+static int dmx512rtuart_notify_transmitter_has_space(struct rtuart *uart, const int space_available)
+{
+	struct dmx512_uart_port * port = rtuart_to_dmx512_uart_port(uart);
+	const struct dmx512_framequeue_entry * sent = port->tx.frame;
+	const int ret = dmx512rtuart_transmitter_has_space(uart, space_available);
+	dmx512rtuart_tx_done(port, sent);
+	return ret;
+}
+
+static int dmx512rtuart_notify_transmitter_empty(struct rtuart *uart)
+{
+	struct dmx512_uart_port * port = rtuart_to_dmx512_uart_port(uart);
+	const struct dmx512_framequeue_entry * sent = port->tx.frame;
+	const int ret = dmx512rtuart_transmitter_empty(uart);
+	dmx512rtuart_tx_done(port, sent);
+	return ret;
+}
+
+static int dmx512rtuart_notify_receiver_data_available(struct rtuart * uart, const int count)
+{
+	struct dmx512_uart_port * port = rtuart_to_dmx512_uart_port(uart);
+	const struct dmx512_framequeue_entry * sent = port->tx.frame;
+	const int ret = dmx512rtuart_receiver_data_available(uart, count);
+	dmx512rtuart_tx_done(port, sent);
+	return ret;
+}
+
 static const struct rtuart_client_callbacks dmx512rtuart_callbacks =
 {
-  .transmitter_has_space = dmx512rtuart_transmitter_has_space,
-  .transmitter_empty = dmx512rtuart_transmitter_empty,
-  .receiver_data_available = dmx512rtuart_receiver_data_available,
+  .transmitter_has_space = dmx512rtuart_notify_transmitter_has_space,
+  .transmitter_empty = dmx512rtuart_notify_transmitter_empty,
+  .receiver_data_available = dmx512rtuart_notify_receiver_data_available,
   .modem_input_changed = dmx512rtuart_modem_input_changed,
   .line_status_event = dmx512rtuart_line_status_event
 };
 
 
 
+/* one frame is on the line at a time, the core queues the others. */
+static int dmx512_rtuart_client_transmitter_has_space(struct dmx512_port * dmxport)
+{
+	return dmx512port_to_dmx512_uart_port(dmxport)->tx.frame == 0;
+}
+
 static int dmx512_rtuart_client_send_frame (struct dmx512_port * dmxport, struct dmx512_framequeue_entry * frame)
 {
 	// printk (KERN_DEBUG"dmx512_rtuart_client_send_frame\n");
@@ -1089,6 +1150,8 @@ static int dmx512_rtuart_client_send_frame (struct dmx512_port * dmxport, struct
 
 	struct dmx512_uart_port * port = dmx512port_to_dmx512_uart_port(dmxport);
 
+	dmx512_trace_event(DMX512_TRACE_TX_SEND, frame->frame.port, dmx512_trace_frame_id(&frame->frame), 0);
+
 	/* if we plan to transmit data, we need to kill a reception
 	 * maybe we can check how old the last dmx-slot of the frame is.
 	 * If it is very young (<132us) or we have an rx-lock, then we
@@ -1264,6 +1327,7 @@ struct dmx512_port * dmx512_rtuart_client_create(struct rtuart * uart)
 	strcpy(port->dmx.name, "uio-dmx");
 	port->dmx.capabilities = 0; // DMX512_CAP_RDM
 	port->dmx.send_frame = dmx512_rtuart_client_send_frame;
+	port->dmx.transmitter_has_space = dmx512_rtuart_client_transmitter_has_space;
 
 	// dmx512_add_port(dmx_device, &port->dmx);
 	
@@ -10,6 +10,7 @@
 #include "kernel.h"
 
 #include <stdint.h>
+#include <time.h>
 
 //---- kernel dmx512 header substution --------
 typedef struct dmx512_framequeue_entry
@@ -24,6 +25,8 @@ struct dmx512_port {
 	char     name[MAX_DMXPORT_NAME];
 	uint64_t capabilities;
 	int (*send_frame) (struct dmx512_port * port, struct dmx512_framequeue_entry * frame);
+	int (*transmitter_has_space) (struct dmx512_port * port);
+	unsigned long rx_overruns; /* frames lost in the driver, see DMX512_IOCTL_GET_PORT_STATS */
     // struct dmx512_framequeue rxframequeue;
     // struct dmx512_framequeue txframequeue;
 };
@@ -33,5 +36,36 @@ void dmx512_put_frame(struct dmx512_port *port, struct dmx512_framequeue_entry *
 int  dmx512_received_frame(struct dmx512_port *port, struct dmx512_framequeue_entry * frame);
 int dmx512_send_frame (struct dmx512_port * port, struct dmx512_framequeue_entry * frame);
 
+/*
+ * Called by a driver with transmitter_has_space, when the transmitter
+ * has space again, to hand it the frames queued meanwhile.
+ */
+void dmx512_port_transmitter_ready(struct dmx512_port * port);
+
+/*
+ * software timestamps in CLOCK_MONOTONIC, taken at the break and after the last slot.
+ * The frame is packed, so the time is taken into a copy.
+ */
+static inline void dmx512_frame_timestamp_front(struct dmx512_framequeue_entry * frame)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    frame->frame.timestamp = ts;
+    frame->frame.flags |= DMX512_FLAG_TIMESTAMP;
+}
+
+static inline void dmx512_frame_timestamp_back(struct dmx512_framequeue_entry * frame)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    frame->frame.back_timestamp = ts;
+    frame->frame.flags |= DMX512_FLAG_BACK_TIMESTAMP;
+}
+
+static inline void dmx512_port_rx_overrun(struct dmx512_port * port)
+{
+    port->rx_overruns++;
+}
+
 //---- kernel dmx512 header substution END --------
 #endif
@@ -21,6 +21,7 @@
 #include "rtuart_dmx512_client.h"
 
 #include "dmx512_port.h"
+#include <dmx512trace.h>
 
 #include <unistd.h>
 
@@ -71,6 +72,12 @@ int dmx512_send_frame (struct dmx512_port * port, struct dmx512_framequeue_entry
 	return -1;
 }
 
+/* frames are only send from the loop below, which asks the port if it is busy. */
+void dmx512_port_transmitter_ready(struct dmx512_port * port)
+{
+	(void)port;
+}
+
 
 struct dmx512_framequeue_entry * received_frames = 0;
 static int received_dmx_signal = -1;
@@ -119,6 +126,8 @@ void dmx512_rtuart_periodical(struct rtuart * uart);
 
 int main (int argc, char **argv)
 {
+  if (dmx512_trace_open_env())
+	  return 1;
   const char * dmx_cardname = "/dev/dmx-card1";
   int dmxfd = open(dmx_cardname, O_RDWR | O_NONBLOCK);
   if (dmxfd < 0)
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include "dmx512trace.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+struct dmx512_trace_header * dmx512_trace = 0;
+static size_t dmx512_trace_size = 0;
+
+int dmx512_trace_open_env(void)
+{
+    const char * path = getenv("DMX512_TRACE");
+    const char * records = getenv("DMX512_TRACE_RECORDS");
+    if (!path || !*path)
+        return 0;
+    return dmx512_trace_open(path, records ? strtoul(records, 0, 0) : DMX512_TRACE_DEFAULT_RECORDS);
+}
+
+int dmx512_trace_open(const char * path, const unsigned int records)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned int size = 1;
+    struct dmx512_trace_header * h;
+    size_t filesize;
+    int fd;
+
+    if (dmx512_trace || !records)
+        return -1;
+    if (cpus < 1)
+        cpus = 1;
+    if (cpus > 256) /* the cpu of a record is 8 bits. */
+        cpus = 256;
+    while (size < records)
+        size <<= 1;
+    filesize = DMX512_TRACE_FILE_SIZE(cpus, size);
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    if (ftruncate(fd, filesize) < 0)
+    {
+        perror("dmx512_trace_open: ftruncate");
+        close(fd);
+        return -1;
+    }
+    h = mmap(0, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+    {
+        perror("dmx512_trace_open: mmap");
+        return -1;
+    }
+    /* the new file is all 0, so every ring is empty. */
+    h->version = DMX512_TRACE_VERSION;
+    h->cpus = cpus;
+    h->records = size;
+    __atomic_store_n(&h->magic, DMX512_TRACE_MAGIC, __ATOMIC_RELEASE);
+    dmx512_trace_size = filesize;
+    dmx512_trace = h;
+    printf ("tracing to %s, %ld cpus with %u records\n", path, cpus, size);
+    return 0;
+}
+
+void dmx512_trace_close(void)
+{
+    struct dmx512_trace_header * h = dmx512_trace;
+    if (!h)
+        return;
+    dmx512_trace = 0;
+    munmap(h, dmx512_trace_size);
+}
+
+void dmx512_trace_record(const int event, const unsigned int port,
+                         const uint32_t frame_id, const uint32_t arg)
+{
+    struct dmx512_trace_header * h = dmx512_trace;
+    struct dmx512_trace_ring * ring;
+    struct dmx512_trace_record * r;
+    struct timespec ts;
+    int cpu = sched_getcpu();
+    uint32_t index;
+
+    if (!h)
+        return;
+    if ((cpu < 0) || ((unsigned int)cpu >= h->cpus))
+        cpu = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    /*
+     * The thread may move to another cpu, so the record is claimed
+     * with an atomic add and published by its sequence, written last.
+     */
+    ring = dmx512_trace_ring(h, cpu);
+    index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    r = &dmx512_trace_records(ring)[index & (h->records - 1)];
+    __atomic_store_n(&r->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->port = port;
+    r->event = event;
+    r->cpu = cpu;
+    r->ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    r->frame_id = frame_id;
+    r->arg = arg;
+    __atomic_store_n(&r->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t dmx512_trace_frame_id(const struct dmx512frame * frame)
+{
+    const struct timespec front = frame->timestamp;
+    const struct timespec back = frame->back_timestamp;
+    uint64_t ns = (uint64_t)front.tv_sec * 1000000000ULL + front.tv_nsec;
+    if (!ns && (frame->flags & DMX512_FLAG_BACK_TIMESTAMP))
+        ns = (uint64_t)back.tv_sec * 1000000000ULL + back.tv_nsec;
+    return (uint32_t)(ns ^ (ns >> 32));
+}
@@ -0,0 +1,334 @@
+/*
+ * Decode a trace file written by the userspace drivers (see dmx512trace.h)
+ * into a timeline per frame, followed by the time spent between the
+ * steps of the frame path.
+ *
+ * usage: dmx512trace_decode [-r] <tracefile>
+ *   -r  list the records in the order of time instead.
+ */
+#include "dmx512trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct trace_item
+{
+    struct dmx512_trace_record r;
+    uint32_t generation; /* tells frames with the id 0 apart. */
+    uint32_t group;      /* index of the frame in the order of its first event. */
+};
+
+static const char * event_name(const unsigned int event)
+{
+    static const char * names[DMX512_TRACE_EVENT_COUNT] = {
+        "?", "rx_break", "rx_complete", "rx_enqueue", "rx_wakeup",
+        "rx_read", "tx_write", "tx_send", "tx_complete"
+    };
+    return (event < DMX512_TRACE_EVENT_COUNT) ? names[event] : "?";
+}
+
+static int compare_time(const void * a, const void * b)
+{
+    const struct trace_item * x = (const struct trace_item *)a;
+    const struct trace_item * y = (const struct trace_item *)b;
+    if (x->r.ns != y->r.ns)
+        return (x->r.ns < y->r.ns) ? -1 : 1;
+    if (x->r.cpu != y->r.cpu)
+        return (x->r.cpu < y->r.cpu) ? -1 : 1;
+    return (x->r.sequence < y->r.sequence) ? -1 : (x->r.sequence > y->r.sequence);
+}
+
+static int compare_frame(const void * a, const void * b)
+{
+    const struct trace_item * x = (const struct trace_item *)a;
+    const struct trace_item * y = (const struct trace_item *)b;
+    if (x->group != y->group)
+        return (x->group < y->group) ? -1 : 1;
+    return compare_time(a, b);
+}
+
+/* copy the records that are completely written. */
+static size_t collect(struct dmx512_trace_header * h, struct trace_item * items)
+{
+    size_t n = 0;
+    unsigned int cpu, i;
+    for (cpu = 0; cpu < h->cpus; ++cpu)
+    {
+        struct dmx512_trace_record * records = dmx512_trace_records(dmx512_trace_ring(h, cpu));
+        for (i = 0; i < h->records; ++i)
+        {
+            const uint32_t sequence = __atomic_load_n(&records[i].sequence, __ATOMIC_ACQUIRE);
+            if (!sequence)
+                continue;
+            items[n].r = records[i];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&records[i].sequence, __ATOMIC_RELAXED) != sequence)
+                continue;
+            items[n].r.sequence = sequence;
+            ++n;
+        }
+    }
+    return n;
+}
+
+/*
+ * Number the frames in the order of their first event. Frames written
+ * without a timestamp share the id 0, a write starts the next one.
+ */
+static void group(struct trace_item * items, const size_t n)
+{
+    static uint32_t generation[65536];
+    struct key { uint16_t port; uint32_t id; uint32_t generation; uint32_t group; int used; } * keys;
+    size_t size = 1;
+    uint32_t count = 0;
+    size_t i;
+
+    /* an open addressing hash of the frames, at most half full. */
+    while (size < 2 * n)
+        size <<= 1;
+    keys = calloc(size, sizeof(*keys));
+    if (!keys)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    for (i = 0; i < n; ++i)
+    {
+        struct trace_item * it = &items[i];
+        size_t k;
+        if (it->r.port == DMX512_TRACE_NO_PORT)
+            continue;
+        if (!it->r.frame_id && (it->r.event == DMX512_TRACE_TX_WRITE))
+            generation[it->r.port]++;
+        it->generation = it->r.frame_id ? 0 : generation[it->r.port];
+
+        k = ((size_t)it->r.frame_id * 2654435761u ^ it->r.port ^ ((size_t)it->generation << 16)) & (size - 1);
+        while (keys[k].used &&
+               ((keys[k].port != it->r.port) || (keys[k].id != it->r.frame_id) ||
+                (keys[k].generation != it->generation)))
+            k = (k + 1) & (size - 1);
+        if (!keys[k].used)
+        {
+            keys[k].used = 1;
+            keys[k].port = it->r.port;
+            keys[k].id = it->r.frame_id;
+            keys[k].generation = it->generation;
+            keys[k].group = count++;
+        }
+        it->group = keys[k].group;
+    }
+    free(keys);
+}
+
+static void append(struct trace_item ** items, size_t * count, size_t * size, const struct trace_item * it)
+{
+    if (*count == *size)
+    {
+        *size = *size ? 2 * *size : 1024;
+        *items = realloc(*items, *size * sizeof(**items));
+        if (!*items)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    (*items)[(*count)++] = *it;
+}
+
+/*
+ * A wakeup of a reader with several queued frames is not about one
+ * frame, it is added to the timeline of every frame queued to the
+ * file and not yet read at that time.
+ */
+static struct trace_item * expand_wakeups(struct trace_item * items, size_t * n)
+{
+    struct pending { uint32_t * groups; size_t count; size_t size; } files[256];
+    struct trace_item * out = 0;
+    size_t count = 0, size = 0;
+    size_t i, j;
+
+    memset(files, 0, sizeof(files));
+    for (i = 0; i < *n; ++i)
+    {
+        const struct trace_item * it = &items[i];
+        struct pending * f = &files[it->r.arg & 255];
+        if (it->r.port == DMX512_TRACE_NO_PORT)
+        {
+            for (j = 0; j < f->count; ++j)
+            {
+                struct trace_item copy = *it;
+                copy.group = f->groups[j];
+                append(&out, &count, &size, &copy);
+            }
+            continue;
+        }
+        append(&out, &count, &size, it);
+        if (it->r.event == DMX512_TRACE_RX_ENQUEUE)
+        {
+            if (f->count == f->size)
+            {
+                f->size = f->size ? 2 * f->size : 256;
+                f->groups = realloc(f->groups, f->size * sizeof(*f->groups));
+                if (!f->groups)
+                {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            f->groups[f->count++] = it->group;
+        }
+        else if (it->r.event == DMX512_TRACE_RX_READ)
+        {
+            for (j = 0; j < f->count; ++j)
+                if (f->groups[j] == it->group)
+                {
+                    f->groups[j] = f->groups[--f->count];
+                    break;
+                }
+        }
+    }
+    for (j = 0; j < 256; ++j)
+        free(files[j].groups);
+    free(items);
+    *n = count;
+    return out;
+}
+
+static void print_records(const struct trace_item * items, const size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; ++i)
+    {
+        const struct dmx512_trace_record * r = &items[i].r;
+        printf("%lld.%09lld cpu %3u port %5u frame %08x %-12s arg %u\n",
+               (long long)(r->ns / 1000000000LL), (long long)(r->ns % 1000000000LL),
+               r->cpu, r->port, r->frame_id, event_name(r->event), r->arg);
+    }
+}
+
+struct step
+{
+    unsigned long count;
+    long long sum;
+    long long max;
+};
+
+static void print_timelines(const struct trace_item * items, const size_t n)
+{
+    static struct step steps[DMX512_TRACE_EVENT_COUNT][DMX512_TRACE_EVENT_COUNT];
+    long long first = 0;
+    size_t i;
+    int a, b;
+    for (i = 0; i < n; ++i)
+    {
+        const struct dmx512_trace_record * r = &items[i].r;
+        if (!i || (items[i].group != items[i-1].group))
+        {
+            first = r->ns;
+            printf("\nport %u frame %08x\n", r->port, r->frame_id);
+            printf("  %12.3f us  %12s  %-12s cpu %3u arg %u\n", 0.0, "", event_name(r->event), r->cpu, r->arg);
+        }
+        else
+        {
+            const struct dmx512_trace_record * p = &items[i-1].r;
+            const long long delta = r->ns - p->ns;
+            struct step * s = &steps[p->event % DMX512_TRACE_EVENT_COUNT][r->event % DMX512_TRACE_EVENT_COUNT];
+            s->count++;
+            s->sum += delta;
+            if (delta > s->max)
+                s->max = delta;
+            printf("  %12.3f us  %+12.3f  %-12s cpu %3u arg %u\n",
+                   (r->ns - first) / 1000.0, delta / 1000.0,
+                   event_name(r->event), r->cpu, r->arg);
+        }
+    }
+
+    printf("\nsteps                         count      avg us      max us\n");
+    for (a = 0; a < DMX512_TRACE_EVENT_COUNT; ++a)
+        for (b = 0; b < DMX512_TRACE_EVENT_COUNT; ++b)
+        {
+            const struct step * s = &steps[a][b];
+            if (s->count)
+                printf("%-12s -> %-12s %8lu %11.3f %11.3f\n",
+                       event_name(a), event_name(b), s->count,
+                       (double)s->sum / s->count / 1000.0, s->max / 1000.0);
+        }
+}
+
+int main(int argc, char ** argv)
+{
+    struct dmx512_trace_header * h;
+    struct trace_item * items;
+    struct stat st;
+    int raw = 0;
+    size_t n;
+    int fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r")) != -1)
+    {
+        if (opt == 'r')
+            raw = 1;
+        else
+        {
+            fprintf(stderr, "usage: %s [-r] <tracefile>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-r] <tracefile>\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) < 0))
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(*h))
+    {
+        fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+        return 1;
+    }
+    h = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    if ((h->magic != DMX512_TRACE_MAGIC) || (h->version != DMX512_TRACE_VERSION) ||
+        !h->cpus || !h->records || ((size_t)st.st_size < DMX512_TRACE_FILE_SIZE(h->cpus, h->records)))
+    {
+        fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+        return 1;
+    }
+
+    items = malloc((size_t)h->cpus * h->records * sizeof(*items));
+    if (!items)
+    {
+        perror("malloc");
+        return 1;
+    }
+    n = collect(h, items);
+    qsort(items, n, sizeof(*items), compare_time);
+    if (raw)
+        print_records(items, n);
+    else
+    {
+        group(items, n);
+        items = expand_wakeups(items, &n);
+        qsort(items, n, sizeof(*items), compare_frame);
+        print_timelines(items, n);
+    }
+    free(items);
+    munmap(h, st.st_size);
+    return 0;
+}